@@ -0,0 +1,50 @@
+#!/bin/bash
+# Contention benchmark of block allocation: worker threads creating and
+# removing files in separate directories, each create and rm claiming or
+# freeing a block of the shared bitmap.
+#
+# usage: bench/alloc.sh [max-jobs] [rounds]
+#   HEARTYFS       the binary to run, bin/heartyfs by default
+#   HEARTYFS_OPTS  extra options, --sync=none by default so that flushing the
+#                  disk does not hide the allocator
+set -e
+MAX_JOBS=${1:-8}
+ROUNDS=${2:-20}
+HEARTYFS=${HEARTYFS:-bin/heartyfs}
+HEARTYFS_OPTS=${HEARTYFS_OPTS:---sync=none}
+DIRS=12
+FILES=12
+
+batch=$(mktemp)
+trap 'rm -f "$batch"' EXIT
+for ((r = 0; r < ROUNDS; r++)); do
+    # Files are interleaved across directories so that workers running side by
+    # side only share the bitmap.
+    for ((f = 0; f < FILES; f++)); do
+        for ((d = 0; d < DIRS; d++)); do
+            echo "create d$d/f$f"
+        done
+    done
+    echo
+    for ((f = 0; f < FILES; f++)); do
+        for ((d = 0; d < DIRS; d++)); do
+            echo "rm d$d/f$f"
+        done
+    done
+    echo
+done > "$batch"
+ops=$((ROUNDS * DIRS * FILES * 2))
+
+echo "cpus: $(nproc)  ops per run: $ops"
+printf "%6s %10s %12s\n" jobs "time (ms)" "ops/s"
+for ((jobs = 1; jobs <= MAX_JOBS; jobs *= 2)); do
+    $HEARTYFS --reset ls > /dev/null
+    for ((d = 0; d < DIRS; d++)); do
+        echo "mkdir d$d"
+    done | $HEARTYFS --batch
+    start=$(date +%s%N)
+    $HEARTYFS $HEARTYFS_OPTS --jobs=$jobs --batch < "$batch"
+    end=$(date +%s%N)
+    ms=$(((end - start) / 1000000))
+    printf "%6d %10d %12d\n" "$jobs" "$ms" $((ops * 1000 / (ms > 0 ? ms : 1)))
+done
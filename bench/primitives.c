@@ -0,0 +1,423 @@
+/**
+ * @file primitives.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  Micro-benchmarks of heartyfs's core primitives, built and run by
+ *  `make bench`.
+ *
+ *  Every primitive is timed on synthetic images held in memory, at several
+ *  fill levels and with the used blocks either packed at the front or
+ *  scattered, so the disk file is never touched. Each benchmark is first run
+ *  with a doubling number of operations until a trial takes long enough,
+ *  which also warms it up, and then timed over several trials, of which the
+ *  median and the fastest are reported.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "heartyfs.h"
+#include "heartyfs_bitmap.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_math.h"
+
+#define TRIAL_COUNT 7
+#define TRIAL_MIN_NS 20000000L // 20 ms
+#define START_COUNT 64         // Random start blocks, cycled through
+#define TREE_DEPTH 4
+#define TREE_FILLER_COUNT 11   // Entries before the next directory
+#define READ_FILE_BLOCKS 64
+#define WRITE_SIZE (16 * BLOCK_MAX_DATA)
+#define DENSE_BLOCKS 16
+#define BITMAP_RUN 8
+
+// A synthetic image and what the benchmarks use in it.
+struct BenchImage {
+    char name[NAME_MAX_LEN];
+    union Block *mem;
+    char path[TREE_DEPTH * (NAME_MAX_LEN + 1) + 1]; // Deepest directory
+    int read_id;                                    // File to read
+    int write_id;                                   // Empty file to write
+    int starts[START_COUNT];                        // Random block IDs
+    uint8_t buf[READ_FILE_BLOCKS * BLOCK_MAX_DATA];
+};
+
+// A primitive to time.
+struct Bench {
+    char name[NAME_MAX_LEN];
+    long (*run)(struct BenchImage *image, long op_count);
+    int op_size; // Bytes handled by one operation, 0 if it is no transfer
+};
+
+static long _benchNextFree(struct BenchImage *image, long op_count);
+static long _benchDensest(struct BenchImage *image, long op_count);
+static long _benchSetBitmap(struct BenchImage *image, long op_count);
+static long _benchNodeID(struct BenchImage *image, long op_count);
+static long _benchReadFile(struct BenchImage *image, long op_count);
+static long _benchWriteBlock(struct BenchImage *image, long op_count);
+static long _benchWriteFile(struct BenchImage *image, long op_count);
+static bool _makeImage(struct BenchImage *image, int fill_pct,
+                       bool is_scattered);
+static int _makeNode(union Block *mem, char *name, int parent_id, int type);
+static void _fillImage(struct BenchImage *image, int fill_pct,
+                       bool is_scattered);
+static unsigned int _nextRandom(unsigned int *seed);
+static void _runBench(struct BenchImage *image, const struct Bench *bench);
+static long _timeRun(struct BenchImage *image, const struct Bench *bench,
+                     long op_count);
+static int _compareLong(const void *a, const void *b);
+
+const struct Bench BENCH_LIST[] = {
+    {.name = "findNextFreeBlock", .run = _benchNextFree},
+    {.name = "findFreeDensestBlocks", .run = _benchDensest},
+    {.name = "setBitmapUsed/Free", .run = _benchSetBitmap},
+    {.name = "getNodeID", .run = _benchNodeID},
+    {.name = "readFileID",
+     .run = _benchReadFile,
+     .op_size = READ_FILE_BLOCKS * BLOCK_MAX_DATA},
+    {.name = "writeDataBlock", .run = _benchWriteBlock, .op_size = BLOCK_MAX_DATA},
+    {.name = "writeFileID", .run = _benchWriteFile, .op_size = WRITE_SIZE}};
+#define BENCH_LIST_LEN (int)(sizeof(BENCH_LIST) / sizeof(BENCH_LIST[0]))
+
+const struct {
+    int fill_pct;
+    bool is_scattered;
+} IMAGE_LIST[] = {{0, false}, {50, false}, {50, true}, {90, false}, {90, true}};
+#define IMAGE_LIST_LEN (int)(sizeof(IMAGE_LIST) / sizeof(IMAGE_LIST[0]))
+
+// Keeps the results of the benchmarks from being optimised away.
+static volatile long sink;
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [benchmark-name-part]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    char *filter = (argc == 2) ? argv[1] : NULL;
+
+    // Blocks are only changed in memory, and frees apply right away.
+    setDiskLocking(DISK_LOCK_WHOLE);
+    setSyncMode(SYNC_NONE);
+    printf("%-12s %-22s %12s %12s %10s\n", "image", "benchmark",
+           "median ns/op", "min ns/op", "MB/s");
+    for (int i = 0; i < IMAGE_LIST_LEN; i++) {
+        struct BenchImage *image = malloc(sizeof(struct BenchImage));
+        if (image == NULL || !_makeImage(image, IMAGE_LIST[i].fill_pct,
+                                         IMAGE_LIST[i].is_scattered)) {
+            perror("bench");
+            free(image);
+            return EXIT_FAILURE;
+        }
+        for (int j = 0; j < BENCH_LIST_LEN; j++)
+            if (filter == NULL || strstr(BENCH_LIST[j].name, filter) != NULL)
+                _runBench(image, &BENCH_LIST[j]);
+        free(image->mem);
+        free(image);
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief
+ *  Finds the next free block from random blocks.
+ */
+static long _benchNextFree(struct BenchImage *image, long op_count)
+{
+    long sum = 0;
+    for (long i = 0; i < op_count; i++)
+        sum += findNextFreeBlock(image->mem[BITMAP_ID].bitmap,
+                                 image->starts[i % START_COUNT]);
+    return sum;
+}
+
+/**
+ * @brief
+ *  Finds the densest run of free blocks for a small file.
+ */
+static long _benchDensest(struct BenchImage *image, long op_count)
+{
+    struct Interval no_bounds = intArrInterval(NULL, 0);
+    struct Interval bounds = {0};
+    long sum = 0;
+    for (long i = 0; i < op_count; i++) {
+        findFreeDensestBlocks(image->mem[BITMAP_ID].bitmap, DENSE_BLOCKS,
+                              &no_bounds, &bounds);
+        sum += bounds.start;
+    }
+    return sum;
+}
+
+/**
+ * @brief
+ *  Marks a run of blocks at a random block used and then free again, on a
+ *  copy of the bitmap.
+ */
+static long _benchSetBitmap(struct BenchImage *image, long op_count)
+{
+    uint8_t map[BITMAP_LEN];
+    memcpy(map, image->mem[BITMAP_ID].bitmap, BITMAP_LEN);
+    for (long i = 0; i < op_count; i++) {
+        int start = image->starts[i % START_COUNT];
+        struct Interval bounds = {start, minInt(start + BITMAP_RUN, BLOCK_COUNT)};
+        setBitmapUsed(map, &bounds);
+        setBitmapFree(map, &bounds);
+    }
+    return map[0];
+}
+
+/**
+ * @brief
+ *  Looks up the deepest directory of the tree from the root.
+ */
+static long _benchNodeID(struct BenchImage *image, long op_count)
+{
+    long sum = 0;
+    for (long i = 0; i < op_count; i++)
+        sum += getNodeID(image->mem, image->path, ROOT_ID);
+    return sum;
+}
+
+/**
+ * @brief
+ *  Reads a whole file of `READ_FILE_BLOCKS` blocks.
+ */
+static long _benchReadFile(struct BenchImage *image, long op_count)
+{
+    long sum = 0;
+    for (long i = 0; i < op_count; i++) {
+        int offset = 0;
+        sum += readFileID(image->mem, image->read_id, image->buf,
+                          sizeof(image->buf), &offset);
+    }
+    return sum;
+}
+
+/**
+ * @brief
+ *  Fills a data block.
+ */
+static long _benchWriteBlock(struct BenchImage *image, long op_count)
+{
+    union Block block;
+    long sum = 0;
+    for (long i = 0; i < op_count; i++)
+        sum += writeDataBlock(&block.data, 0, image->buf, BLOCK_MAX_DATA);
+    return sum;
+}
+
+/**
+ * @brief
+ *  Writes `WRITE_SIZE` bytes to an empty file, allocating its blocks, and
+ *  empties it again.
+ */
+static long _benchWriteFile(struct BenchImage *image, long op_count)
+{
+    long sum = 0;
+    for (long i = 0; i < op_count; i++) {
+        sum += writeFileID(image->mem, image->write_id, image->buf, WRITE_SIZE);
+        deleteFileData(image->mem, image->write_id);
+    }
+    return sum;
+}
+
+/**
+ * @brief
+ *  Builds a synthetic image, with a tree of directories, a file to read and
+ *  one to write, and then used blocks up to a fill level.
+ *
+ * @param[out] image         The image.
+ * @param[in]  fill_pct      Percentage of the blocks after the reserved ones
+ *                           to mark used.
+ * @param[in]  is_scattered  Whether used blocks are scattered at random
+ *                           rather than packed at the front.
+ *
+ * @return
+ *   true if the image was built, false if it could not be allocated.
+ */
+static bool _makeImage(struct BenchImage *image, int fill_pct,
+                       bool is_scattered)
+{
+    union Block *mem = calloc(BLOCK_COUNT, sizeof(union Block));
+    if (mem == NULL)
+        return false;
+    image->mem = mem;
+    snprintf(image->name, NAME_MAX_LEN, "%d%%%s", fill_pct,
+             (fill_pct == 0) ? "" : (is_scattered ? "/scatter" : "/packed"));
+
+    strncpy(mem[ROOT_ID].dir.name, "/", NAME_MAX_LEN);
+    mem[ROOT_ID].dir.type = TYPE_DIR;
+    initDirEntry(mem, ".", ROOT_ID, ROOT_ID);
+    initDirEntry(mem, "..", ROOT_ID, ROOT_ID);
+    memset(mem[BITMAP_ID].bitmap, 0xFF, BITMAP_LEN);
+    setBitmapUsed(mem[BITMAP_ID].bitmap,
+                  &(struct Interval){0, RESERVED_BLOCK_COUNT});
+
+    // Each lookup scans the filler entries of a directory before its child.
+    int dir_id = ROOT_ID;
+    char *path_end = image->path;
+    for (int depth = 0; depth < TREE_DEPTH; depth++) {
+        char name[NAME_MAX_LEN];
+        for (int i = 0; i < TREE_FILLER_COUNT; i++) {
+            snprintf(name, NAME_MAX_LEN, "filler%d", i);
+            _makeNode(mem, name, dir_id, TYPE_FILE);
+        }
+        snprintf(name, NAME_MAX_LEN, "dir%d", depth);
+        dir_id = _makeNode(mem, name, dir_id, TYPE_DIR);
+        path_end += sprintf(path_end, "/%s", name);
+    }
+    for (size_t i = 0; i < sizeof(image->buf); i++)
+        image->buf[i] = i * 31;
+    image->read_id = _makeNode(mem, "read", dir_id, TYPE_FILE);
+    writeFileID(mem, image->read_id, image->buf, sizeof(image->buf));
+    image->write_id = _makeNode(mem, "write", dir_id, TYPE_FILE);
+
+    _fillImage(image, fill_pct, is_scattered);
+    return true;
+}
+
+/**
+ * @brief
+ *  Creates an empty file or directory in a directory of an image.
+ *
+ * @param[in, out] mem        The image.
+ * @param[in]      name       The name of the node.
+ * @param[in]      parent_id  The ID of the directory.
+ * @param[in]      type       `TYPE_FILE` or `TYPE_DIR`.
+ *
+ * @return
+ *   The ID of the node.
+ */
+static int _makeNode(union Block *mem, char *name, int parent_id, int type)
+{
+    int id = allocBlock(mem, RESERVED_BLOCK_COUNT);
+    initDirEntry(mem, name, id, parent_id);
+    memset(&mem[id], 0, BLOCK_SIZE);
+    strncpy(mem[id].file.name, name, NAME_MAX_LEN);
+    mem[id].file.type = type;
+    if (type == TYPE_DIR) {
+        initDirEntry(mem, ".", id, id);
+        initDirEntry(mem, "..", parent_id, id);
+    }
+    return id;
+}
+
+/**
+ * @brief
+ *  Marks blocks of an image used up to a fill level, and picks the random
+ *  blocks the benchmarks start from.
+ *
+ * @param[in, out] image         The image.
+ * @param[in]      fill_pct      Percentage of the blocks after the reserved
+ *                               ones to mark used.
+ * @param[in]      is_scattered  Whether used blocks are scattered at random.
+ */
+static void _fillImage(struct BenchImage *image, int fill_pct,
+                       bool is_scattered)
+{
+    uint8_t *map = image->mem[BITMAP_ID].bitmap;
+    int free_count = BLOCK_COUNT - RESERVED_BLOCK_COUNT;
+    int used_count = 0;
+    for (int id = RESERVED_BLOCK_COUNT; id < BLOCK_COUNT; id++)
+        if (findNextFreeBlock(map, id) != id)
+            used_count++;
+    int target = free_count * fill_pct / 100;
+
+    // The same seed gives every run the same images.
+    unsigned int seed = 1;
+    int id = RESERVED_BLOCK_COUNT;
+    while (used_count < target) {
+        if (is_scattered)
+            id = RESERVED_BLOCK_COUNT +
+                 _nextRandom(&seed) % (BLOCK_COUNT - RESERVED_BLOCK_COUNT);
+        if (findNextFreeBlock(map, id) == id) {
+            setBitmapUsed(map, &(struct Interval){id, id + 1});
+            used_count++;
+        }
+        if (!is_scattered)
+            id++;
+    }
+    for (int i = 0; i < START_COUNT; i++)
+        image->starts[i] = _nextRandom(&seed) % BLOCK_COUNT;
+}
+
+/**
+ * @brief
+ *  Steps a linear congruential generator.
+ *
+ * @param[in, out] seed  The state of the generator.
+ *
+ * @return
+ *   The next pseudo-random number.
+ */
+static unsigned int _nextRandom(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/**
+ * @brief
+ *  Times a benchmark on an image and prints the results on one line.
+ *
+ * @param[in, out] image  The image.
+ * @param[in]      bench  The benchmark.
+ */
+static void _runBench(struct BenchImage *image, const struct Bench *bench)
+{
+    // Doubling the operations until a trial is long enough warms up too.
+    long op_count = 1;
+    while (_timeRun(image, bench, op_count) < TRIAL_MIN_NS)
+        op_count *= 2;
+
+    long trial_ns[TRIAL_COUNT];
+    for (int i = 0; i < TRIAL_COUNT; i++)
+        trial_ns[i] = _timeRun(image, bench, op_count);
+    qsort(trial_ns, TRIAL_COUNT, sizeof(long), _compareLong);
+    double median_ns = (double)trial_ns[TRIAL_COUNT / 2] / op_count;
+    double min_ns = (double)trial_ns[0] / op_count;
+
+    printf("%-12s %-22s %12.1f %12.1f ", image->name, bench->name, median_ns,
+           min_ns);
+    if (bench->op_size > 0)
+        printf("%10.1f\n", bench->op_size / median_ns * 1e9 / (1 << 20));
+    else
+        printf("%10s\n", "-");
+}
+
+/**
+ * @brief
+ *  Runs a benchmark a number of times.
+ *
+ * @param[in, out] image     The image.
+ * @param[in]      bench     The benchmark.
+ * @param[in]      op_count  Number of operations to run.
+ *
+ * @return
+ *   The time taken in nanoseconds.
+ */
+static long _timeRun(struct BenchImage *image, const struct Bench *bench,
+                     long op_count)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sink = bench->run(image, op_count);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) * 1000000000L +
+           (end.tv_nsec - start.tv_nsec);
+}
+
+/**
+ * @brief
+ *  Compares two longs for `qsort()`.
+ */
+static int _compareLong(const void *a, const void *b)
+{
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Speedup of the build profiles: the allocation and writer benchmarks run on
+# one job with the heartyfs of every profile built, the best of 3 runs
+# compared to debug.
+#
+# usage: bench/profiles.sh [rounds]
+#   Build the profiles first with make, make release and make pgo. Profiles
+#   not built are skipped.
+set -e
+ROUNDS=${1:-100}
+REPEAT=3
+PROFILES="debug release pgo"
+
+bin_of() {
+    if [ "$1" = debug ]; then
+        echo bin/heartyfs
+    else
+        echo "bin/$1/heartyfs"
+    fi
+}
+
+# Best ops per second of a benchmark script over a few runs, since a run
+# also times starting the process.
+ops_of() {
+    for ((i = 0; i < REPEAT; i++)); do
+        HEARTYFS=$1 "bench/$2.sh" 1 "$ROUNDS" | tail -n 1 | awk '{ print $3 }'
+    done | sort -n | tail -n 1
+}
+
+printf "%-8s %12s %8s %12s %8s\n" profile "alloc ops/s" speedup \
+    "write ops/s" speedup
+base_alloc=
+base_write=
+for profile in $PROFILES; do
+    bin=$(bin_of "$profile")
+    [ -x "$bin" ] || continue
+    alloc=$(ops_of "$bin" alloc)
+    write=$(ops_of "$bin" write)
+    base_alloc=${base_alloc:-$alloc}
+    base_write=${base_write:-$write}
+    awk -v p="$profile" -v a="$alloc" -v w="$write" -v ba="$base_alloc" \
+        -v bw="$base_write" \
+        'BEGIN { printf "%-8s %12d %7.2fx %12d %7.2fx\n", p, a, a / ba, w, w / bw }'
+done
@@ -0,0 +1,32 @@
+#!/bin/bash
+# Training run of the pgo build profile: the instrumented workload benchmark
+# on a fresh disk, so that every object leaves a profile next to it. The disk
+# in use is put back afterwards.
+#
+# usage: bench/train.sh <bin-dir> [workload options]
+set -e
+BIN=$1
+shift
+DISK=/tmp/heartyfs
+CWD=.heartyfs_cwd
+
+saved=$(mktemp -d)
+restore() {
+    if [ -e "$saved/disk" ]; then
+        mv "$saved/disk" "$DISK"
+    else
+        rm -f "$DISK"
+    fi
+    if [ -e "$saved/cwd" ]; then
+        mv "$saved/cwd" "$CWD"
+    else
+        rm -f "$CWD"
+    fi
+    rm -rf "$saved"
+}
+[ ! -e "$DISK" ] || cp "$DISK" "$saved/disk"
+[ ! -e "$CWD" ] || cp "$CWD" "$saved/cwd"
+trap restore EXIT
+
+"$BIN/heartyfs" --reset ls > /dev/null
+"$BIN/workload" "$@" > /dev/null
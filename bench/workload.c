@@ -0,0 +1,784 @@
+/**
+ * @file workload.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  An end-to-end workload driver running mixes of heartyfs commands and
+ *  reporting their throughput and latency.
+ *
+ *  A workload is a set of streams, each a sequence of commands in a directory
+ *  of its own under `/wl`, run side by side on a pool of workers the way a
+ *  parallel batch runs them: every command is its own operation of the open
+ *  transaction. Each stream follows one shape, a metadata storm, many small
+ *  files, a large sequential file or an append-heavy log, and the mixed
+ *  workload gives the streams the shapes in turn. The latency of every
+ *  command is counted in a log-linear histogram, as HDR histograms do, which
+ *  keeps every percentile within about 3% at any scale in a fixed size.
+ *
+ *  A generated workload can be recorded as a trace of commands and replayed
+ *  later, so a load shape seen elsewhere is reproduced exactly.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "heartyfs.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_pool.h"
+#include "heartyfs_string.h"
+
+#define WL_ROOT "/wl"
+#define PAYLOAD_DIR WL_ROOT "/p"
+#define PATH_LEN 64
+#define STREAM_DIR_LEN 16
+#define META_DIR_LEN 32
+#define LINE_LEN 128
+#define STREAM_MAX (DIR_MAX_ENTRIES - 3) // Beside ".", ".." and the payloads
+#define OPS_DEFAULT 2000
+#define META_FILES 8
+#define SMALL_FILES 10
+#define LARGE_SIZE (64 * BLOCK_MAX_DATA)
+#define APPEND_SIZE 200
+#define APPEND_MAX_SIZE (32 * BLOCK_MAX_DATA)
+#define APPEND_READ_EVERY 16
+#define PAYLOAD_MAX (DIR_MAX_ENTRIES - 2)
+
+// Latencies are kept in buckets of 2^HIST_SUB_BITS per power of two up to
+// 2^HIST_MAX_BITS nanoseconds.
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40
+#define HIST_LEN ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+enum OpTypes { OP_MKDIR, OP_CREATE, OP_WRITE, OP_READ, OP_LS, OP_RM, OP_RMDIR };
+
+const struct {
+    char name[8];
+    bool (*call)(union Block *, char *, char **, int);
+} OP_LIST[] = {[OP_MKDIR] = {"mkdir", mkdirCmd}, [OP_CREATE] = {"create", createCmd},
+               [OP_WRITE] = {"write", writeCmd}, [OP_READ] = {"read", readCmd},
+               [OP_LS] = {"ls", lsCmd},          [OP_RM] = {"rm", rmCmd},
+               [OP_RMDIR] = {"rmdir", rmdirCmd}};
+#define OP_LIST_LEN (int)(sizeof(OP_LIST) / sizeof(OP_LIST[0]))
+
+enum Shapes { SHAPE_META, SHAPE_SMALL, SHAPE_LARGE, SHAPE_APPEND, SHAPE_MIXED };
+const char SHAPE_LIST[][8] = {[SHAPE_META] = "meta", [SHAPE_SMALL] = "small",
+                              [SHAPE_LARGE] = "large", [SHAPE_APPEND] = "append",
+                              [SHAPE_MIXED] = "mixed"};
+#define SHAPE_LIST_LEN (int)(sizeof(SHAPE_LIST) / sizeof(SHAPE_LIST[0]))
+
+const int SMALL_SIZES[] = {64, 256, 1024, 4096};
+#define SMALL_SIZES_LEN (int)(sizeof(SMALL_SIZES) / sizeof(SMALL_SIZES[0]))
+
+// A command of a stream. Writes copy `size` bytes from a payload file.
+struct WlOp {
+    int type;
+    bool is_append;
+    int size;
+    char path[PATH_LEN];
+};
+
+// The latencies of a type of command, in nanoseconds.
+struct LatencyHist {
+    long counts[HIST_LEN];
+    long count;
+    long max;
+};
+
+// A stream of commands run in order by one worker.
+struct Stream {
+    union Block *mem;
+    char dir[STREAM_DIR_LEN];
+    struct WlOp *ops;
+    int op_count;
+    int op_cap;
+    int op_limit; // Commands a generator stops at
+    int fail_count;
+    struct LatencyHist hists[OP_LIST_LEN];
+};
+
+// The settings of a run.
+struct WlConfig {
+    int jobs;
+    int op_count;
+    unsigned int seed;
+    int shape;
+    char *record_path;
+    char *replay_path;
+    bool is_kept;
+};
+
+static bool _parseArgs(int argc, char *argv[], struct WlConfig *config);
+static void _genStream(struct Stream *stream, int shape, unsigned int seed);
+static void _addOp(struct Stream *stream, int type, char *path, int size,
+                   bool is_append);
+static bool _recordTrace(char *path, struct Stream *streams, int count);
+static int _replayTrace(char *path, struct Stream *streams);
+static bool _setUp(union Block *mem, struct Stream *streams, int count);
+static bool _makePayload(union Block *mem, int size);
+static bool _runStream(void *arg);
+static bool _runOp(union Block *mem, struct WlOp *op);
+static bool _callCmd(union Block *mem, int type, char *path, char *arg);
+static void _addLatency(struct LatencyHist *hist, long ns);
+static long _findPercentile(struct LatencyHist *hist, double fraction);
+static void _printHist(const char *name, struct LatencyHist *hist);
+static unsigned int _nextRandom(unsigned int *seed);
+static long _getTimeNs();
+
+static char APPEND_FLAG[] = "-a";
+static char RECURSIVE_FLAG[] = "-r";
+static char EXE_NAME[] = "workload";
+
+int main(int argc, char *argv[])
+{
+    struct WlConfig config = {.jobs = 4,
+                              .op_count = OPS_DEFAULT,
+                              .seed = 1,
+                              .shape = SHAPE_MIXED};
+    if (!_parseArgs(argc, argv, &config)) {
+        fprintf(stderr,
+                "usage: %s [--jobs=N] [--ops=N] [--seed=N] [--sync=MODE] "
+                "[--record=FILE | --replay=FILE] [--keep] "
+                "[meta|small|large|append|mixed]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (access(DISK_FILE_PATH, F_OK) != 0) {
+        fprintf(stderr, "%s: Run 'heartyfs --reset ls' first\n",
+                DISK_FILE_PATH);
+        return EXIT_FAILURE;
+    }
+
+    struct Stream *streams = calloc(STREAM_MAX, sizeof(struct Stream));
+    if (streams == NULL) {
+        perror("workload");
+        return EXIT_FAILURE;
+    }
+    int stream_count = config.jobs;
+    if (config.replay_path != NULL) {
+        stream_count = _replayTrace(config.replay_path, streams);
+    } else {
+        for (int i = 0; i < stream_count; i++) {
+            snprintf(streams[i].dir, STREAM_DIR_LEN, WL_ROOT "/s%d", i);
+            streams[i].op_limit = config.op_count;
+            int shape = (config.shape == SHAPE_MIXED) ? i % SHAPE_MIXED
+                                                      : config.shape;
+            _genStream(&streams[i], shape, config.seed + i);
+        }
+    }
+    int status = EXIT_SUCCESS;
+    if (stream_count == -1 ||
+        (config.record_path != NULL &&
+         !_recordTrace(config.record_path, streams, stream_count))) {
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+
+    // Commands of different streams run as commands of a parallel batch do.
+    setDiskLocking(DISK_LOCK_WHOLE);
+    setJobCount(1);
+    union Block *mem = mountDisk();
+    if (mem == NULL) {
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+    if (!_setUp(mem, streams, stream_count) || !commitDisk(mem)) {
+        unmountDisk(mem);
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+
+    // What the commands print is left out of the report.
+    fflush(stdout);
+    int stdout_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (stdout_fd != -1 && null_fd != -1)
+        dup2(null_fd, STDOUT_FILENO);
+    long start_ns = _getTimeNs();
+    struct Pool *pool = (stream_count > 1) ? startPool(stream_count) : NULL;
+    for (int i = 0; i < stream_count; i++) {
+        streams[i].mem = mem;
+        if (pool == NULL || !submitTask(pool, _runStream, &streams[i]))
+            _runStream(&streams[i]);
+    }
+    if (pool != NULL)
+        stopPool(pool);
+    bool is_committed = commitDisk(mem);
+    long elapsed_ns = _getTimeNs() - start_ns;
+    fflush(stdout);
+    if (stdout_fd != -1 && null_fd != -1)
+        dup2(stdout_fd, STDOUT_FILENO);
+    if (stdout_fd != -1)
+        close(stdout_fd);
+    if (null_fd != -1)
+        close(null_fd);
+
+    if (!config.is_kept && beginDiskOp(mem)) {
+        char root_dir[] = WL_ROOT;
+        _callCmd(mem, OP_RM, RECURSIVE_FLAG, root_dir);
+        endDiskOp(mem);
+    }
+    if (!unmountDisk(mem) || !is_committed)
+        status = EXIT_FAILURE;
+
+    struct LatencyHist *totals = calloc(OP_LIST_LEN + 1, sizeof(struct LatencyHist));
+    if (totals == NULL) {
+        perror("workload");
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+    struct LatencyHist *all = &totals[OP_LIST_LEN];
+    int fail_count = 0;
+    for (int i = 0; i < stream_count; i++) {
+        fail_count += streams[i].fail_count;
+        for (int type = 0; type < OP_LIST_LEN; type++) {
+            struct LatencyHist *hist = &streams[i].hists[type];
+            for (int j = 0; j < HIST_LEN; j++) {
+                totals[type].counts[j] += hist->counts[j];
+                all->counts[j] += hist->counts[j];
+            }
+            totals[type].count += hist->count;
+            all->count += hist->count;
+            totals[type].max = (hist->max > totals[type].max) ? hist->max
+                                                              : totals[type].max;
+            all->max = (hist->max > all->max) ? hist->max : all->max;
+        }
+    }
+    printf("%d streams, %ld commands in %.3f s, %.0f commands/s, %d failed\n",
+           stream_count, all->count, elapsed_ns / 1e9,
+           all->count / (elapsed_ns / 1e9), fail_count);
+    printf("%-8s %10s %10s %10s %10s %10s\n", "command", "count", "p50 us",
+           "p99 us", "p99.9 us", "max us");
+    for (int type = 0; type < OP_LIST_LEN; type++)
+        _printHist(OP_LIST[type].name, &totals[type]);
+    _printHist("all", all);
+    free(totals);
+
+cleanup:
+    for (int i = 0; i < STREAM_MAX; i++)
+        free(streams[i].ops);
+    free(streams);
+    return status;
+}
+
+/**
+ * @brief
+ *  Parses the options and the shape of a run.
+ *
+ * @param[in]  argc    Number of command-line arguments.
+ * @param[in]  argv    Array of command-line arguments.
+ * @param[out] config  The settings, holding the defaults beforehand.
+ *
+ * @return
+ *   true if every argument is valid, false otherwise.
+ */
+static bool _parseArgs(int argc, char *argv[], struct WlConfig *config)
+{
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        char *value = strchr(arg, '=');
+        if (value != NULL)
+            value++;
+        int number = 0;
+        bool is_number = value != NULL && parseSize(value, &number);
+        if (strncmp(arg, "--jobs=", 7) == 0 && is_number && number > 0 &&
+            number <= STREAM_MAX) {
+            config->jobs = number;
+        } else if (strncmp(arg, "--ops=", 6) == 0 && is_number && number > 0) {
+            config->op_count = number;
+        } else if (strncmp(arg, "--seed=", 7) == 0 && is_number) {
+            config->seed = number;
+        } else if (strncmp(arg, "--sync=", 7) == 0 && value != NULL) {
+            enum SyncModes mode;
+            if (!parseSyncMode(value, &mode))
+                return false;
+            setSyncMode(mode);
+        } else if (strncmp(arg, "--record=", 9) == 0 && value[0] != '\0') {
+            config->record_path = value;
+        } else if (strncmp(arg, "--replay=", 9) == 0 && value[0] != '\0') {
+            config->replay_path = value;
+        } else if (strcmp(arg, "--keep") == 0) {
+            config->is_kept = true;
+        } else if (arg[0] != '-') {
+            int shape = 0;
+            while (shape < SHAPE_LIST_LEN && strcmp(arg, SHAPE_LIST[shape]) != 0)
+                shape++;
+            if (shape == SHAPE_LIST_LEN)
+                return false;
+            config->shape = shape;
+        } else {
+            return false;
+        }
+    }
+    return config->record_path == NULL || config->replay_path == NULL;
+}
+
+/**
+ * @brief
+ *  Generates the commands of a stream following a shape.
+ *
+ * @param[in, out] stream  The stream, with its directory and limit set.
+ * @param[in]      shape   The shape, other than `SHAPE_MIXED`.
+ * @param[in]      seed    The seed of the sizes picked at random.
+ */
+static void _genStream(struct Stream *stream, int shape, unsigned int seed)
+{
+    char path[PATH_LEN];
+    switch (shape) {
+    case SHAPE_META:
+        // Directories filled, listed and emptied again.
+        for (int i = 0; stream->op_count < stream->op_limit; i++) {
+            char dir[META_DIR_LEN];
+            snprintf(dir, META_DIR_LEN, "%s/d%d", stream->dir, i);
+            _addOp(stream, OP_MKDIR, dir, 0, false);
+            for (int j = 0; j < META_FILES; j++) {
+                snprintf(path, PATH_LEN, "%s/f%d", dir, j);
+                _addOp(stream, OP_CREATE, path, 0, false);
+            }
+            _addOp(stream, OP_LS, dir, 0, false);
+            for (int j = 0; j < META_FILES; j++) {
+                snprintf(path, PATH_LEN, "%s/f%d", dir, j);
+                _addOp(stream, OP_RM, path, 0, false);
+            }
+            _addOp(stream, OP_RMDIR, dir, 0, false);
+        }
+        break;
+    case SHAPE_SMALL:
+        // Small files written once and read back, the oldest replaced.
+        for (int i = 0; stream->op_count < stream->op_limit; i++) {
+            snprintf(path, PATH_LEN, "%s/f%d", stream->dir, i % SMALL_FILES);
+            if (i >= SMALL_FILES)
+                _addOp(stream, OP_RM, path, 0, false);
+            _addOp(stream, OP_CREATE, path, 0, false);
+            int size = SMALL_SIZES[_nextRandom(&seed) % SMALL_SIZES_LEN];
+            _addOp(stream, OP_WRITE, path, size, false);
+            _addOp(stream, OP_READ, path, 0, false);
+        }
+        break;
+    case SHAPE_LARGE:
+        // A large file written and read through, and written again.
+        snprintf(path, PATH_LEN, "%s/big", stream->dir);
+        _addOp(stream, OP_CREATE, path, 0, false);
+        while (stream->op_count < stream->op_limit) {
+            _addOp(stream, OP_WRITE, path, LARGE_SIZE, false);
+            _addOp(stream, OP_READ, path, 0, false);
+            _addOp(stream, OP_READ, path, 0, false);
+        }
+        break;
+    case SHAPE_APPEND: {
+        // A log appended to, read now and then, and rotated once full.
+        snprintf(path, PATH_LEN, "%s/log", stream->dir);
+        _addOp(stream, OP_CREATE, path, 0, false);
+        int size = 0;
+        for (int i = 1; stream->op_count < stream->op_limit; i++) {
+            if (size + APPEND_SIZE > APPEND_MAX_SIZE) {
+                _addOp(stream, OP_RM, path, 0, false);
+                _addOp(stream, OP_CREATE, path, 0, false);
+                size = 0;
+            }
+            _addOp(stream, OP_WRITE, path, APPEND_SIZE, true);
+            size += APPEND_SIZE;
+            if (i % APPEND_READ_EVERY == 0)
+                _addOp(stream, OP_READ, path, 0, false);
+        }
+        break;
+    }
+    }
+}
+
+/**
+ * @brief
+ *  Adds a command to the end of a stream, unless the stream reached its
+ *  limit.
+ *
+ * @param[in, out] stream     The stream.
+ * @param[in]      type       The type of the command.
+ * @param[in]      path       The path the command works on.
+ * @param[in]      size       The bytes written by a write, 0 otherwise.
+ * @param[in]      is_append  Whether a write appends.
+ */
+static void _addOp(struct Stream *stream, int type, char *path, int size,
+                   bool is_append)
+{
+    if (stream->op_count >= stream->op_limit)
+        return;
+    if (stream->op_count == stream->op_cap) {
+        int cap = (stream->op_cap == 0) ? 64 : stream->op_cap * 2;
+        struct WlOp *ops = realloc(stream->ops, cap * sizeof(struct WlOp));
+        if (ops == NULL) {
+            perror("workload");
+            stream->op_limit = stream->op_count;
+            return;
+        }
+        stream->ops = ops;
+        stream->op_cap = cap;
+    }
+    struct WlOp *op = &stream->ops[stream->op_count++];
+    *op = (struct WlOp){.type = type, .is_append = is_append, .size = size};
+    snprintf(op->path, PATH_LEN, "%s", path);
+}
+
+/**
+ * @brief
+ *  Writes the commands of every stream to a trace file, one per line as
+ *  `<stream> <command> [-a] <path> [size]`.
+ *
+ * @param[in] path     The path of the trace file on the host.
+ * @param[in] streams  The streams.
+ * @param[in] count    The number of streams.
+ *
+ * @return
+ *   true if the trace was written, false otherwise.
+ */
+static bool _recordTrace(char *path, struct Stream *streams, int count)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < streams[i].op_count; j++) {
+            struct WlOp *op = &streams[i].ops[j];
+            fprintf(file, "%d %s%s %s", i, OP_LIST[op->type].name,
+                    op->is_append ? " -a" : "", op->path);
+            if (op->type == OP_WRITE)
+                fprintf(file, " %d", op->size);
+            fputc('\n', file);
+        }
+    }
+    if (fclose(file) != 0) {
+        perror(path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief
+ *  Reads the commands of every stream from a trace file.
+ *
+ * @param[in]  path     The path of the trace file on the host.
+ * @param[out] streams  The streams, `STREAM_MAX` of them, all empty.
+ *
+ * @return
+ *   The number of streams, or -1 if the trace cannot be read.
+ */
+static int _replayTrace(char *path, struct Stream *streams)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    int stream_count = 0;
+    char line[LINE_LEN];
+    for (int line_no = 1; fgets(line, LINE_LEN, file) != NULL; line_no++) {
+        char *save;
+        char *tokens[5];
+        int token_count = 0;
+        for (char *token = strtok_r(line, " \n", &save);
+             token != NULL && token_count < 5;
+             token = strtok_r(NULL, " \n", &save))
+            tokens[token_count++] = token;
+        if (token_count == 0)
+            continue;
+
+        int id = -1;
+        int type = -1;
+        int size = 0;
+        bool is_append = token_count > 2 && strcmp(tokens[2], "-a") == 0;
+        int path_idx = is_append ? 3 : 2;
+        if (parseSize(tokens[0], &id) && id < STREAM_MAX && token_count > 1)
+            for (type = OP_LIST_LEN - 1; type >= 0; type--)
+                if (strcmp(tokens[1], OP_LIST[type].name) == 0)
+                    break;
+        int arg_count = (type == OP_WRITE) ? path_idx + 2 : path_idx + 1;
+        if (type == -1 || token_count != arg_count ||
+            strncmp(tokens[path_idx], WL_ROOT "/", strlen(WL_ROOT) + 1) != 0 ||
+            (is_append && type != OP_WRITE) ||
+            (type == OP_WRITE &&
+             (!parseSize(tokens[path_idx + 1], &size) || size > FILE_MAX_SIZE))) {
+            fprintf(stderr, "%s:%d: Invalid command\n", path, line_no);
+            fclose(file);
+            return -1;
+        }
+
+        struct Stream *stream = &streams[id];
+        if (stream->dir[0] == '\0') {
+            snprintf(stream->dir, STREAM_DIR_LEN, WL_ROOT "/s%d", id);
+            stream->op_limit = __INT_MAX__;
+        }
+        stream_count = (id + 1 > stream_count) ? id + 1 : stream_count;
+        _addOp(stream, type, tokens[path_idx], size, is_append);
+    }
+    fclose(file);
+    return stream_count;
+}
+
+/**
+ * @brief
+ *  Creates the directories of the streams and the payload files the writes
+ *  copy from, after removing what a previous run left.
+ *
+ * @param[in, out] mem      Pointer to the mapped memory.
+ * @param[in]      streams  The streams.
+ * @param[in]      count    The number of streams.
+ *
+ * @return
+ *   true if everything was created, false otherwise.
+ */
+static bool _setUp(union Block *mem, struct Stream *streams, int count)
+{
+    char root_dir[] = WL_ROOT;
+    char payload_dir[] = PAYLOAD_DIR;
+    struct DirNode *root = &mem[ROOT_ID].dir;
+    if (findStr(root_dir + 1, root->entries, root->len, sizeof(struct DirEntry),
+                isDirEntryMatch) != -1 &&
+        !_callCmd(mem, OP_RM, RECURSIVE_FLAG, root_dir))
+        return false;
+    if (!_callCmd(mem, OP_MKDIR, root_dir, NULL) ||
+        !_callCmd(mem, OP_MKDIR, payload_dir, NULL))
+        return false;
+
+    int sizes[PAYLOAD_MAX];
+    int size_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (streams[i].dir[0] != '\0' &&
+            !_callCmd(mem, OP_MKDIR, streams[i].dir, NULL))
+            return false;
+        for (int j = 0; j < streams[i].op_count; j++) {
+            struct WlOp *op = &streams[i].ops[j];
+            if (op->type != OP_WRITE)
+                continue;
+            int k = 0;
+            while (k < size_count && sizes[k] != op->size)
+                k++;
+            if (k < size_count)
+                continue;
+            if (size_count == PAYLOAD_MAX) {
+                fprintf(stderr, "workload: More than %d write sizes\n",
+                        PAYLOAD_MAX);
+                return false;
+            }
+            sizes[size_count++] = op->size;
+            if (!_makePayload(mem, op->size))
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief
+ *  Creates the payload file writes of a size copy from.
+ *
+ * @param[in, out] mem   Pointer to the mapped memory.
+ * @param[in]      size  The size of the file.
+ *
+ * @return
+ *   true if the file was created, false otherwise.
+ */
+static bool _makePayload(union Block *mem, int size)
+{
+    char path[PATH_LEN];
+    snprintf(path, PATH_LEN, PAYLOAD_DIR "/%d", size);
+    if (!_callCmd(mem, OP_CREATE, path, NULL))
+        return false;
+    char *data = malloc(size + 1);
+    if (data == NULL) {
+        perror("workload");
+        return false;
+    }
+    for (int i = 0; i < size; i++)
+        data[i] = 'a' + i % 26;
+    int id = lockNodeID(mem, path, true);
+    bool is_ok = id != -1 && writeFileID(mem, id, data, size);
+    if (id != -1)
+        unlockInode(id);
+    free(data);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Runs the commands of a stream in order, timing each one.
+ *
+ * @param[in] arg  The `struct Stream` to run.
+ *
+ * @return
+ *   true if every command succeeded, false otherwise.
+ */
+static bool _runStream(void *arg)
+{
+    struct Stream *stream = arg;
+    for (int i = 0; i < stream->op_count; i++) {
+        struct WlOp *op = &stream->ops[i];
+        long start_ns = _getTimeNs();
+        bool is_ok = beginDiskOp(stream->mem);
+        if (is_ok) {
+            is_ok = _runOp(stream->mem, op);
+            if (!endDiskOp(stream->mem))
+                is_ok = false;
+        }
+        _addLatency(&stream->hists[op->type], _getTimeNs() - start_ns);
+        if (!is_ok)
+            stream->fail_count++;
+    }
+    return stream->fail_count == 0;
+}
+
+/**
+ * @brief
+ *  Runs a command of a stream through the command layer.
+ *
+ * @param[in, out] mem  Pointer to the mapped memory.
+ * @param[in]      op   The command.
+ *
+ * @return
+ *   true if the command succeeded, false otherwise.
+ */
+static bool _runOp(union Block *mem, struct WlOp *op)
+{
+    if (op->type != OP_WRITE)
+        return _callCmd(mem, op->type, op->path, NULL);
+
+    char payload_path[PATH_LEN];
+    snprintf(payload_path, PATH_LEN, PAYLOAD_DIR "/%d", op->size);
+    char name[8];
+    strcpy(name, OP_LIST[OP_WRITE].name);
+    char *cmd[4];
+    int cmd_len = 0;
+    cmd[cmd_len++] = name;
+    if (op->is_append)
+        cmd[cmd_len++] = APPEND_FLAG;
+    cmd[cmd_len++] = op->path;
+    cmd[cmd_len++] = payload_path;
+    return writeCmd(mem, EXE_NAME, cmd, cmd_len);
+}
+
+/**
+ * @brief
+ *  Runs a command with one or two operands.
+ *
+ * @param[in, out] mem   Pointer to the mapped memory.
+ * @param[in]      type  The type of the command.
+ * @param[in]      path  The first operand.
+ * @param[in]      arg   The second operand, or NULL.
+ *
+ * @return
+ *   true if the command succeeded, false otherwise.
+ */
+static bool _callCmd(union Block *mem, int type, char *path, char *arg)
+{
+    char name[8];
+    strcpy(name, OP_LIST[type].name);
+    char *cmd[] = {name, path, arg};
+    return OP_LIST[type].call(mem, EXE_NAME, cmd, (arg == NULL) ? 2 : 3);
+}
+
+/**
+ * @brief
+ *  Counts a latency in a histogram.
+ *
+ * @note
+ *  Latencies below `2 * HIST_SUB_COUNT` have a bucket each, and every power
+ *  of two above is split into `HIST_SUB_COUNT` buckets of equal width.
+ *
+ * @param[in, out] hist  The histogram.
+ * @param[in]      ns    The latency in nanoseconds.
+ */
+static void _addLatency(struct LatencyHist *hist, long ns)
+{
+    hist->count++;
+    hist->max = (ns > hist->max) ? ns : hist->max;
+    long value = (ns < 0) ? 0 : ns;
+    if (value >= 1L << HIST_MAX_BITS)
+        value = (1L << HIST_MAX_BITS) - 1;
+    int idx = value;
+    if (value >= 2 * HIST_SUB_COUNT) {
+        int shift = 63 - __builtin_clzl(value) - HIST_SUB_BITS;
+        idx = shift * HIST_SUB_COUNT + (value >> shift);
+    }
+    hist->counts[idx]++;
+}
+
+/**
+ * @brief
+ *  Finds the latency under which a fraction of a histogram falls.
+ *
+ * @param[in] hist      The histogram.
+ * @param[in] fraction  The fraction, from 0 to 1.
+ *
+ * @return
+ *   The highest latency of the bucket holding the percentile, in nanoseconds.
+ */
+static long _findPercentile(struct LatencyHist *hist, double fraction)
+{
+    long target = (long)(fraction * hist->count + 0.5);
+    target = (target < 1) ? 1 : target;
+    long seen = 0;
+    for (int idx = 0; idx < HIST_LEN; idx++) {
+        seen += hist->counts[idx];
+        if (seen < target)
+            continue;
+        if (idx < 2 * HIST_SUB_COUNT)
+            return idx;
+        int shift = idx / HIST_SUB_COUNT - 1;
+        long high = ((long)(idx - shift * HIST_SUB_COUNT + 1) << shift) - 1;
+        return (high < hist->max) ? high : hist->max;
+    }
+    return hist->max;
+}
+
+/**
+ * @brief
+ *  Prints the count and percentiles of a histogram on one line.
+ *
+ * @param[in] name  What the histogram counts.
+ * @param[in] hist  The histogram.
+ */
+static void _printHist(const char *name, struct LatencyHist *hist)
+{
+    if (hist->count == 0)
+        return;
+    printf("%-8s %10ld %10.1f %10.1f %10.1f %10.1f\n", name, hist->count,
+           _findPercentile(hist, 0.5) / 1e3, _findPercentile(hist, 0.99) / 1e3,
+           _findPercentile(hist, 0.999) / 1e3, hist->max / 1e3);
+}
+
+/**
+ * @brief
+ *  Steps a linear congruential generator.
+ *
+ * @param[in, out] seed  The state of the generator.
+ *
+ * @return
+ *   The next pseudo-random number.
+ */
+static unsigned int _nextRandom(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/**
+ * @brief
+ *  Reads the monotonic clock.
+ *
+ * @return
+ *   The time in nanoseconds.
+ */
+static long _getTimeNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
@@ -0,0 +1,61 @@
+#!/bin/bash
+# Contention benchmark of parallel writers: worker threads writing files of
+# several blocks in separate directories, so that every write allocates its
+# blocks from the shared bitmap.
+#
+# usage: bench/write.sh [max-jobs] [rounds]
+#   HEARTYFS       the binary to run, bin/heartyfs by default
+#   HEARTYFS_OPTS  extra options, --sync=none by default so that flushing the
+#                  disk does not hide the allocator
+set -e
+MAX_JOBS=${1:-16}
+ROUNDS=${2:-10}
+HEARTYFS=${HEARTYFS:-bin/heartyfs}
+HEARTYFS_OPTS=${HEARTYFS_OPTS:---sync=none}
+DIRS=11
+FILES=8
+SRC_SIZE=4000
+
+batch=$(mktemp)
+trap 'rm -f "$batch"' EXIT
+for ((f = 0; f < FILES; f++)); do
+    for ((d = 0; d < DIRS; d++)); do
+        echo "create d$d/f$f"
+    done
+done > "$batch"
+echo >> "$batch"
+for ((r = 0; r < ROUNDS; r++)); do
+    # Truncating to 0 frees the blocks of the last round, so every write
+    # allocates them again.
+    for ((f = 0; f < FILES; f++)); do
+        for ((d = 0; d < DIRS; d++)); do
+            echo "write d$d/f$f src"
+        done
+    done
+    echo
+    for ((f = 0; f < FILES; f++)); do
+        for ((d = 0; d < DIRS; d++)); do
+            echo "truncate d$d/f$f 0"
+        done
+    done
+    echo
+done >> "$batch"
+ops=$((ROUNDS * DIRS * FILES * 2))
+
+echo "cpus: $(nproc)  ops per run: $ops"
+printf "%6s %10s %12s\n" jobs "time (ms)" "ops/s"
+for ((jobs = 1; jobs <= MAX_JOBS; jobs *= 2)); do
+    $HEARTYFS --reset ls > /dev/null
+    {
+        echo "create src"
+        for ((d = 0; d < DIRS; d++)); do
+            echo "mkdir d$d"
+        done
+    } | $HEARTYFS --batch
+    head -c $SRC_SIZE /dev/urandom | $HEARTYFS write src
+    start=$(date +%s%N)
+    $HEARTYFS $HEARTYFS_OPTS --jobs=$jobs --batch < "$batch"
+    end=$(date +%s%N)
+    ms=$(((end - start) / 1000000))
+    printf "%6d %10d %12d\n" "$jobs" "$ms" $((ops * 1000 / (ms > 0 ? ms : 1)))
+done
@@ -35,7 +35,9 @@ struct DataBlock {
     uint8_t data[BLOCK_MAX_DATA];
 };
 
-enum InodeTypes { TYPE_FILE = 0, TYPE_DIR = 1 };
+// `TYPE_DELETED` marks an inode removed by `rm -r` in memory, for the threads
+// still waiting to lock it.
+enum InodeTypes { TYPE_FILE = 0, TYPE_DIR = 1, TYPE_DELETED = 2 };
 
 #define NAME_MAX_LEN 28
 
@@ -58,9 +60,15 @@ struct DirNode {
 #define FILE_MAX_BLOCKS 119
 #define FILE_MAX_SIZE (FILE_MAX_BLOCKS * BLOCK_MAX_DATA)
 
+// Flags of a file. A compressed file holds its data in the chunks of
+// `heartyfs_chunk.h` rather than as is.
+#define FILE_COMPRESSED 0x1
+
 struct FileNode {
     char name[NAME_MAX_LEN];
     uint8_t type;
+    uint8_t prealloc; // Reserved blocks kept after `blocks[len - 1]`
+    uint8_t flags;
     int len;
     int blocks[FILE_MAX_BLOCKS];
 };
@@ -68,16 +76,64 @@ struct FileNode {
 #define BITMAP_LEN (BLOCK_COUNT / CHAR_BIT)
 #define ROOT_ID 0
 #define BITMAP_ID 1
+#define JOURNAL_ID 2
+#define JOURNAL_LEN 64
+#define RESERVED_BLOCK_COUNT (JOURNAL_ID + JOURNAL_LEN)
+
+// Blocks holding the reference counts of shared data blocks, one byte per
+// block of the disk, each counting the files sharing it past the first.
+#define REF_BLOCK_COUNT (BLOCK_COUNT / BLOCK_SIZE)
+#define REF_MAX UINT8_MAX
+
+/*
+ * The bitmap block. The IDs of the blocks holding the reference counts follow
+ * the map, 0 until a block in their range is first shared, so a disk that
+ * never shared a block has none.
+ */
+struct BitmapBlock {
+    _Alignas(uint64_t) uint8_t map[BITMAP_LEN];
+    int ref_ids[REF_BLOCK_COUNT];
+};
+
+#define JOURNAL_MAGIC 0x4846534A
+#define JOURNAL_MAX_RECORDS (JOURNAL_LEN - 1)
+
+enum JournalStates { JOURNAL_CLEAN = 0, JOURNAL_COMMITTED = 1 };
+
+/*
+ * Header of the journal region. The after-images of the `count` blocks listed
+ * in `targets` are stored in the blocks following the header.
+ */
+struct JournalHeader {
+    uint32_t magic;
+    uint32_t state;
+    uint32_t seq;
+    uint32_t checksum;
+    int count;
+    int targets[JOURNAL_MAX_RECORDS];
+};
 
 union Block {
     struct FileNode file;
     struct DirNode dir;
     struct DataBlock data;
-    uint8_t bitmap[BITMAP_LEN];
+    struct JournalHeader journal;
+    _Alignas(uint64_t) uint8_t bitmap[BITMAP_LEN];
+    struct BitmapBlock bitmap_block;
+    uint8_t refs[BLOCK_SIZE];
 };
 
 enum AccessModes { WRONLY, APPEND };
 
+// A position in a file, kept across sequential reads so that each one
+// continues from the block the last one stopped in.
+struct FilePos {
+    int offset;
+    int block_idx;    // Index in `blocks` of the block holding `offset`, or
+                      // -1 until it is looked up
+    int block_offset; // Offset of `offset` in that block
+};
+
 /* Command Functions */
 
 /**
@@ -219,13 +275,16 @@ bool createCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
 
 /**
  * @brief 
- *  Removes a file from the file system.
+ *  Removes a file from the file system, or a whole directory with `-r`.
  * 
  * @note 
  *  This function checks if the correct number of command arguments is provided.
  *  It retrieves the parent directory of the file and verifies if the specified
  *  path corresponds to a valid file. If it is a valid file, it deletes the file
- *  by calling the helper function `_deleteFile`.
+ *  by calling the helper function `_deleteFile`. With `-r`, a directory is
+ *  deleted with everything under it, unless it holds the current directory.
+ *  Its subdirectories are walked by a pool of `getJobCount()` workers, and its
+ *  blocks are freed in one pass once it was walked.
  * 
  * @param[in]  mem      Pointer to the memory block containing file system data.
  * @param[in]  exe_path The executable path for displaying the usage message.
@@ -239,6 +298,29 @@ bool createCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
  */
 bool rmCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
 
+/**
+ * @brief 
+ *  Copies a file, or a whole directory with `-r`.
+ * 
+ * @note 
+ *  If the destination is an existing directory, the copy is made inside it
+ *  with the name of the source. Otherwise the copy is made at the destination,
+ *  which must not exist yet. The source is read into memory first and the copy
+ *  is then built from it, both by a pool of `getJobCount()` workers, one
+ *  directory per task.
+ * 
+ * @param[in]  mem      Pointer to the memory block containing file system data.
+ * @param[in]  exe_path The executable path for displaying the usage message.
+ * @param[in]  cmd      Array of command arguments.
+ * @param[in]  cmd_len  The length of the command argument array.
+ * 
+ * @return 
+ *   true  : Successfully copied. @n
+ *   false : Failed to copy (e.g., invalid path, directory without `-r`,
+ *           existing destination, not enough free blocks, etc.).
+ */
+bool cpCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
+
 /**
  * @brief 
  *  Reads the contents of a file and prints them to standard output.
@@ -288,6 +370,255 @@ bool readCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
  */
 bool writeCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
 
+/**
+ * @brief
+ *  Shrinks or extends a file to the given size.
+ *
+ * @note
+ *  When shrinking, only the data blocks past the new size are freed (along with
+ *  any blocks reserved by `fallocate`) and the last kept block is cut to size.
+ *  When extending, the file is padded with zeroed data, consuming reserved
+ *  blocks first before allocating new ones. A size larger than
+ *  `FILE_MAX_SIZE` sets `ENOMEM`.
+ *
+ * @param[in]  mem      Pointer to the memory block containing file system data.
+ * @param[in]  exe_path The executable path for displaying the usage message.
+ * @param[in]  cmd      Array of command arguments.
+ * @param[in]  cmd_len  The length of the command argument array.
+ *
+ * @return
+ *   true  : The file was successfully resized. @n
+ *   false : Failed to resize the file (e.g., invalid path or size, not enough
+ *           free blocks, etc.).
+ */
+bool truncateCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
+
+/**
+ * @brief
+ *  Reserves data blocks for a file up front without changing its size.
+ *
+ * @note
+ *  The blocks needed to hold `size` bytes are reserved as one dense run found
+ *  by `findFreeDensestBlocks()`, so that later appends fill them in order
+ *  instead of scattering new blocks across the disk. Reserved blocks are
+ *  released by `truncate`, `rm` or an overwriting `write`. Nothing is done if
+ *  the file already owns enough blocks.
+ *
+ * @param[in]  mem      Pointer to the memory block containing file system data.
+ * @param[in]  exe_path The executable path for displaying the usage message.
+ * @param[in]  cmd      Array of command arguments.
+ * @param[in]  cmd_len  The length of the command argument array.
+ *
+ * @return
+ *   true  : The blocks were successfully reserved. @n
+ *   false : Failed to reserve the blocks (e.g., invalid path or size, not
+ *           enough free blocks, etc.).
+ */
+bool fallocateCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
+
+/**
+ * @brief
+ *  Prints the paths under a directory that pass every given test.
+ *
+ * @note
+ *  `-name` matches the name against a glob, `-type` keeps files (`f`) or
+ *  directories (`d`), and `-size` compares the size in bytes, with a leading
+ *  `+` for larger and `-` for smaller. The tree is walked by a pool of
+ *  `getJobCount()` workers, one directory per task, and paths are printed as
+ *  they are found, in no particular order with more than one job.
+ *
+ * @param[in]  mem      Pointer to the memory block containing file system data.
+ * @param[in]  exe_path The executable path for displaying the usage message.
+ * @param[in]  cmd      Array of command arguments.
+ * @param[in]  cmd_len  The length of the command argument array.
+ *
+ * @return
+ *   true  : The whole tree was walked. @n
+ *   false : Failed to walk the tree (e.g., invalid path or test, etc.).
+ */
+bool findCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
+
+/**
+ * @brief
+ *  Copies the files and directories of a host directory into a directory.
+ *
+ * @note
+ *  The host files are read by a pool of `getJobCount()` workers, a window of
+ *  files ahead of a single writer, which lays out each file with its inode in
+ *  one dense run of blocks. Entries are imported in name order, and entries
+ *  that already exist or do not fit are reported and skipped.
+ *
+ * @param[in]  mem      Pointer to the memory block containing file system data.
+ * @param[in]  exe_path The executable path for displaying the usage message.
+ * @param[in]  cmd      Array of command arguments.
+ * @param[in]  cmd_len  The length of the command argument array.
+ *
+ * @return
+ *   true  : Every entry was imported. @n
+ *   false : Some entries could not be imported (e.g., invalid path, existing
+ *           entry, file too large, not enough free blocks, etc.).
+ */
+bool importCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
+
+/**
+ * @brief
+ *  Writes a directory and everything under it to standard output as a POSIX
+ *  (ustar) tar archive.
+ *
+ * @note
+ *  The tree is streamed in one pass, with the data of each file written with
+ *  `writev()` straight from its data blocks. Entries are named after the
+ *  directory, or `.` for the root, and paths too long for a header are
+ *  reported and left out.
+ *
+ * @param[in]  mem      Pointer to the memory block containing file system data.
+ * @param[in]  exe_path The executable path for displaying the usage message.
+ * @param[in]  cmd      Array of command arguments.
+ * @param[in]  cmd_len  The length of the command argument array.
+ *
+ * @return
+ *   true  : The whole tree was written. @n
+ *   false : Failed to write the tree (e.g., invalid path, closed output,
+ *           etc.).
+ */
+bool exportCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
+
+/**
+ * @brief
+ *  Checks the consistency of the whole disk, and repairs it with `-r`.
+ *
+ * @note
+ *  Every directory and file reachable from the root is checked, and the
+ *  bitmap is rebuilt from the blocks they use and compared with the one on
+ *  the disk. Bad directory entries, cross-linked inodes and blocks, bad
+ *  lengths, reference counts above the files sharing a block, leaked blocks
+ *  and orphaned inodes are reported. A repair removes bad entries, cuts files
+ *  short at their first bad block, lowers bad reference counts and writes the
+ *  rebuilt bitmap, which frees leaked blocks. The whole disk is locked during
+ *  the check, which is spread over a pool of `getJobCount()` workers.
+ *
+ * @param[in]  mem      Pointer to the memory block containing file system data.
+ * @param[in]  exe_path The executable path for displaying the usage message.
+ * @param[in]  cmd      Array of command arguments.
+ * @param[in]  cmd_len  The length of the command argument array.
+ *
+ * @return
+ *   true  : The disk is consistent, or was repaired. @n
+ *   false : Problems were found and left as they are.
+ */
+bool fsckCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
+
+/**
+ * @brief
+ *  Moves the files under a path into contiguous runs of blocks toward the
+ *  front of the disk, root by default.
+ *
+ * @note
+ *  A file is moved, inode and blocks together, into the first run of free
+ *  blocks that holds it, if that makes it contiguous or moves it forward.
+ *  Directories stay in place. The blocks a file leaves are only free once the
+ *  transaction is committed, so running it again may pack the disk further.
+ *  The layout before and after is printed.
+ *
+ * @param[in]  mem      Pointer to the memory block containing file system data.
+ * @param[in]  exe_path The executable path for displaying the usage message.
+ * @param[in]  cmd      Array of command arguments.
+ * @param[in]  cmd_len  The length of the command argument array.
+ *
+ * @return
+ *   true  : The files were compacted. @n
+ *   false : The path is not found.
+ */
+bool defragCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
+
+/**
+ * @brief
+ *  Reports how the blocks of the disk are used and how fragmented the files
+ *  and the free space are.
+ *
+ * @note
+ *  One walk over the tree and one scan of the bitmap count the metadata and
+ *  data blocks, the extents of every file and the runs of free blocks, whose
+ *  counts are printed as power-of-two histograms. Each inode is only locked
+ *  while it is counted, so the report is not a snapshot of a disk in use.
+ *
+ * @param[in]  mem      Pointer to the memory block containing file system data.
+ * @param[in]  exe_path The executable path for displaying the usage message.
+ * @param[in]  cmd      Array of command arguments.
+ * @param[in]  cmd_len  The length of the command argument array.
+ *
+ * @return
+ *   true  : The report was printed. @n
+ *   false : The arguments are invalid.
+ */
+bool statfsCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
+
+/**
+ * @brief
+ *  Shows the rates, latencies and latest commands of a running heartyfs
+ *  process started with `--live`, refreshed once a second.
+ *
+ * @note
+ *  The shared memory segment of the process is mapped read-only, so watching
+ *  a process costs it nothing. The disk is not used, so the command does not
+ *  wait for a batch holding it.
+ *
+ * @param[in]  mem      Unused, NULL.
+ * @param[in]  exe_path The executable path for displaying the usage message.
+ * @param[in]  cmd      Array of command arguments.
+ * @param[in]  cmd_len  The length of the command argument array.
+ *
+ * @return
+ *   true  : The process was watched until it exited or for `-n` samples. @n
+ *   false : The arguments are invalid or no live process was found.
+ */
+bool topCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
+
+/**
+ * @brief
+ *  Compresses a file, or decompresses it with `-d`.
+ *
+ * @note
+ *  A compressed file keeps its data in chunks of up to `CHUNK_MAX_SIZE` bytes,
+ *  one per block, and stays compressed as it is written to, truncated or
+ *  copied. Reading it decodes one chunk at a time. Compressing a file that is
+ *  already compressed, or the other way around, does nothing.
+ *
+ * @param[in]  mem      Pointer to the memory block containing file system data.
+ * @param[in]  exe_path The executable path for displaying the usage message.
+ * @param[in]  cmd      Array of command arguments.
+ * @param[in]  cmd_len  The length of the command argument array.
+ *
+ * @return
+ *   true  : The file was compressed or decompressed. @n
+ *   false : The arguments are invalid, the path is not a file or the disk is
+ *           full.
+ */
+bool compressCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
+
+/**
+ * @brief
+ *  Stores the data blocks with the same content under a path once, shared by
+ *  the files holding them.
+ *
+ * @note
+ *  Blocks are found through a hash of their content and compared byte for
+ *  byte before they are shared. A shared block counts its references, is
+ *  only freed with the last one and is copied before a file changes it, see
+ *  `heartyfs_refs.h`. Every inode under the path is locked for writing while
+ *  the command runs.
+ *
+ * @param[in]  mem      Pointer to the memory block containing file system data.
+ * @param[in]  exe_path The executable path for displaying the usage message.
+ * @param[in]  cmd      Array of command arguments.
+ * @param[in]  cmd_len  The length of the command argument array.
+ *
+ * @return
+ *   true  : The files were deduplicated. @n
+ *   false : The arguments are invalid or the path does not exist.
+ */
+bool dedupCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len);
+
 #define GETNODEID_USE_CWD -2
 
 /**
@@ -307,15 +638,38 @@ int getNodeID(union Block *mem, char path[], int start_id);
 
 /**
  * @brief 
- *  Retrieves the ID of the parent directory of a given path.
+ *  Retrieves the ID of the parent directory of a given path and locks it.
  * 
- * @param[in] mem   Memory block representing the file system.
- * @param[in] path  Path to the directory.
+ * @note 
+ *  The path is walked like in `lockNodeID()`. Must be released with
+ *  `unlockInode()`.
+ * 
+ * @param[in] mem       Memory block representing the file system.
+ * @param[in] path      Path to the node in the directory.
+ * @param[in] is_write  Whether to lock the directory for writing.
  * 
  * @return 
  *   Parent directory ID if successful, -1 otherwise.
  */
-int getParentID(union Block *mem, char path[]);
+int lockParentID(union Block *mem, char path[], bool is_write);
+
+/**
+ * @brief 
+ *  Retrieves the ID of a node from its path and locks it.
+ * 
+ * @note 
+ *  Every directory on the path stays locked until the next node on it is, so
+ *  that no node can be removed and its block reused in between. Must be
+ *  released with `unlockInode()`.
+ * 
+ * @param[in] mem       Memory block representing the file system.
+ * @param[in] path      Path to the node.
+ * @param[in] is_write  Whether to lock the node for writing.
+ * 
+ * @return 
+ *   Node ID if successful, -1 if the node does not exist.
+ */
+int lockNodeID(union Block *mem, char path[], bool is_write);
 
 /**
  * @brief 
@@ -371,7 +725,8 @@ void deleteParentDirEntry(struct DirNode *parent_dir, int id);
 
 /**
  * @brief 
- *  Calculates the total file size based on its data blocks.
+ *  Calculates the total file size based on its data blocks, or the sizes of
+ *  its chunks if it is compressed.
  * 
  * @param[in] mem  Memory block representing the file system.
  * @param[in] id   ID of the file.
@@ -382,21 +737,143 @@ void deleteParentDirEntry(struct DirNode *parent_dir, int id);
 int calcFileSize(union Block *mem, int id);
 
 /**
- * @brief 
+ * @brief
+ *  Counts the runs of consecutive blocks a file's data and reserved blocks
+ *  are split into.
+ *
+ * @param[in] mem   Memory block representing the file system.
+ * @param[in] id    ID of the file.
+ *
+ * @return
+ *   Number of extents, 0 for a file without blocks.
+ */
+int countFileExtents(union Block *mem, int id);
+
+/**
+ * @brief
  *  Deletes all data blocks associated with a file, marking them free in the bitmap.
- * 
+ *
+ * @note
+ *  Blocks reserved by `fallocate` are freed as well.
+ *
  * @param[in, out] mem  Memory block representing the file system.
  * @param[in]      id   ID of the file to delete.
  */
 void deleteFileData(union Block *mem, int id);
 
+/**
+ * @brief
+ *  Marks a list of blocks free in the bitmap, coalescing consecutive IDs into
+ *  runs.
+ *
+ * @note
+ *  A block shared by other files only loses a reference, see
+ *  `heartyfs_refs.h`.
+ *
+ * @param[in, out] mem    Memory block representing the file system.
+ * @param[in]      ids    IDs of the blocks to free.
+ * @param[in]      count  Number of IDs in `ids`.
+ */
+void freeBlockIDs(union Block *mem, const int *ids, int count);
+
+/**
+ * @brief
+ *  Gives a file blocks of its own in place of the shared blocks in a range of
+ *  its data blocks, with the same content, before they are changed in place.
+ *
+ * @param[in, out] mem    Memory block representing the file system.
+ * @param[in]      id     ID of the file, write-locked.
+ * @param[in]      start  Index of the first data block in the range.
+ * @param[in]      end    Index past the last data block in the range.
+ *
+ * @return
+ *   true if successful, false if there is not enough free space (sets errno).
+ *   The blocks copied so far stay the file's own on failure.
+ */
+bool unshareFileBlocks(union Block *mem, int id, int start, int end);
+
+/**
+ * @brief
+ *  Reserves free blocks for a file, appending them after its data blocks and
+ *  any blocks already reserved.
+ *
+ * @note
+ *  The blocks are taken from the densest interval spanning the file's current
+ *  blocks, so that the file stays as contiguous as possible.
+ *
+ * @param[in, out] mem    Memory block representing the file system.
+ * @param[in]      id     ID of the file.
+ * @param[in]      count  Number of blocks to reserve.
+ *
+ * @return
+ *   true if successful, false if there is not enough free space (sets errno).
+ */
+bool reserveFileBlocks(union Block *mem, int id, int count);
+
+/**
+ * @brief
+ *  Appends data to the end of a file, using its reserved blocks first and
+ *  allocating new blocks if needed.
+ *
+ * @param[in, out] mem   Memory block representing the file system.
+ * @param[in]      id    ID of the file to write to.
+ * @param[in]      data  Data to append, or NULL to append zeroes.
+ * @param[in]      size  Size of the data to append.
+ *
+ * @return
+ *   true if successful, false if there is not enough free space (sets errno).
+ */
+bool writeFileID(union Block *mem, int id, void *data, int size);
+
+/**
+ * @brief
+ *  Replaces the data of a compressed file from one of its chunks on.
+ *
+ * @note
+ *  The data is encoded before any block is touched, so the file is left as it
+ *  was if it does not fit. Shared blocks replaced are copied first, and blocks
+ *  left over are kept as reserved blocks.
+ *
+ * @param[in, out] mem        Memory block representing the file system.
+ * @param[in]      id         ID of the file.
+ * @param[in]      chunk_idx  Index of the first chunk to replace, up to the
+ *                            number of chunks.
+ * @param[in]      data       Data from the start of that chunk on, or NULL
+ *                            for zeroes.
+ * @param[in]      size       Size of the data.
+ *
+ * @return
+ *   true if successful, false if there is not enough free space (sets errno).
+ */
+bool writeFileChunks(union Block *mem, int id, int chunk_idx, const void *data,
+                     int size);
+
+/**
+ * @brief
+ *  Compresses or decompresses the data of a file and sets whether it is
+ *  compressed.
+ *
+ * @note
+ *  The data is written to new blocks before the old ones are freed, so the
+ *  file is left as it was if the disk is full.
+ *
+ * @param[in, out] mem            Memory block representing the file system.
+ * @param[in]      id             ID of the file, write-locked.
+ * @param[in]      is_compressed  Whether to compress the file.
+ *
+ * @return
+ *   true if successful, false otherwise (sets errno).
+ */
+bool setFileCompressed(union Block *mem, int id, bool is_compressed);
+
 /**
  * @brief 
  *  Writes data to a data block with size constraints.
  * 
  * @param[in, out] d_block     Pointer to the data block.
  * @param[in]      size_used   Amount of space already used in the block.
- * @param[in]      data        Data to write to the block.
+ * @param[in]      data        Data to write to the block, or NULL to write
+ *                             zeroes.
  * @param[in]      size        Size of the data to write.
  * 
  * @return 
@@ -420,6 +897,44 @@ int writeDataBlock(struct DataBlock *d_block, int size_used, void *data,
  */
 int readFileID(union Block *mem, int id, void *buf, int size, int *offset);
 
+/**
+ * @brief
+ *  Moves a file position to an offset, leaving its block to be looked up by
+ *  the next read.
+ *
+ * @param[out] pos     The position.
+ * @param[in]  offset  Offset in the file.
+ */
+void setFilePos(struct FilePos *pos, int offset);
+
+/**
+ * @brief
+ *  Looks up the block holding a file position, which only takes adding up
+ *  the sizes of the chunks before it in a compressed file.
+ *
+ * @param[in]      mem  Memory block representing the file system.
+ * @param[in]      id   ID of the file.
+ * @param[in, out] pos  The position, with its block looked up.
+ */
+void seekFilePos(union Block *mem, int id, struct FilePos *pos);
+
+/**
+ * @brief
+ *  Reads data from a file by ID into a buffer, continuing from a position.
+ *
+ * @param[in]      mem   Memory block representing the file system.
+ * @param[in]      id    ID of the file to read.
+ * @param[out]     buf   Buffer to store the read data.
+ * @param[in]      size  Size of the buffer.
+ * @param[in, out] pos   Position to start reading from, moved past the data
+ *                       read.
+ *
+ * @return
+ *   Number of bytes read.
+ */
+int readFilePos(union Block *mem, int id, void *buf, int size,
+                struct FilePos *pos);
+
 /**
  * @brief 
  *  Reads data from a file specified by its path.
@@ -441,4 +956,61 @@ bool readFilePath(union Block *mem, char *path, char **buf, int *size);
  * @param[in] bitmap  Pointer to the bitmap to print.
  */
 void printBitmap(uint8_t *bitmap);
+
+/**
+ * @brief
+ *  Creates an empty file in a directory.
+ *
+ * @param[in] mem        Memory block representing the file system.
+ * @param[in] name       The name of the file.
+ * @param[in] parent_id  The ID of the directory, write-locked, with room for
+ *                       one more entry.
+ * @param[in] start_id   The ID to look for a free block from, `ROOT_ID` for
+ *                       the first free block.
+ *
+ * @return
+ *   The ID of the file, or -1 if no block is free (sets errno).
+ */
+int initFileNode(union Block *mem, char *name, int parent_id, int start_id);
+
+/**
+ * @brief
+ *  Creates an empty directory, holding only its `.` and `..` entries, in a
+ *  directory.
+ *
+ * @param[in] mem        Memory block representing the file system.
+ * @param[in] name       The name of the directory.
+ * @param[in] parent_id  The ID of the parent directory, write-locked, with
+ *                       room for one more entry.
+ *
+ * @return
+ *   The ID of the directory, or -1 if no block is free (sets errno).
+ */
+int initDirNode(union Block *mem, char *name, int parent_id);
+
+/**
+ * @brief
+ *  Deletes a file, removing its entry from its directory and freeing its
+ *  inode and blocks.
+ *
+ * @param[in] mem        Memory block representing the file system.
+ * @param[in] id         The ID of the file, write-locked.
+ * @param[in] parent_id  The ID of the directory holding it, write-locked.
+ */
+void deleteFileNode(union Block *mem, int id, int parent_id);
+
+/**
+ * @brief
+ *  Prints an error like `perror()`, unless errors are muted, keeping errno.
+ *
+ * @param[in] what  What failed, printed before the error.
+ */
+void reportError(const char *what);
+
+/**
+ * @brief
+ *  Mutes the errors printed by the file system, for callers that take the
+ *  errno of a failed call instead, like the library.
+ */
+void muteErrors();
 #endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+/**
+ * @file heartyfs_backend.h
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  A header for the storage backends reading and writing blocks of the disk
+ *  file.
+ *
+ *  - `BACKEND_MMAP` maps the disk file directly and writes blocks back with
+ *    `pwrite()`. This is the default.
+ *  - `BACKEND_PREAD` serves the disk from a block cache filled with `pread()`
+ *    and writes blocks back with `pwrite()`.
+ *  - `BACKEND_URING` serves the disk from a block cache like `BACKEND_PREAD`,
+ *    but submits every read or write of a batch to an io_uring at once and
+ *    waits for them together.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#ifndef _HEARTYFS_BACKEND_UTILS_H
+#define _HEARTYFS_BACKEND_UTILS_H
+
+#include <stdbool.h>
+
+enum BackendTypes { BACKEND_MMAP, BACKEND_PREAD, BACKEND_URING };
+
+struct BlockIO {
+    int id;    // ID of the first block
+    int count; // Number of consecutive blocks
+    void *buf; // Memory holding the blocks
+};
+
+/**
+ * @brief
+ *  Parses the name of a backend, e.g. "uring" for `BACKEND_URING`.
+ *
+ * @param[in]  name  The name to parse.
+ * @param[out] type  The parsed backend.
+ *
+ * @return
+ *  `true` if the name is a valid backend, `false` otherwise (sets errno).
+ */
+bool parseBackend(const char *name, enum BackendTypes *type);
+
+/**
+ * @brief
+ *  Opens a backend on the disk file.
+ *
+ * @param[in] type  The backend to open.
+ * @param[in] fd    File descriptor of the disk file.
+ *
+ * @return
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+bool openBackend(enum BackendTypes type, int fd);
+
+/**
+ * @brief
+ *  Closes the open backend.
+ */
+void closeBackend();
+
+/**
+ * @brief
+ *  Reads runs of blocks from the disk file, as one batch.
+ *
+ * @param[in] ios    The runs of blocks to read into their buffers.
+ * @param[in] count  Number of runs in `ios`.
+ *
+ * @return
+ *  `true` if every run was read, `false` otherwise (sets errno).
+ */
+bool readBlocks(const struct BlockIO *ios, int count);
+
+/**
+ * @brief
+ *  Writes runs of blocks to the disk file, as one batch.
+ *
+ * @note
+ *  The buffers must not be backed by pages the block cache could still have
+ *  to fault in, since the block cache reads through the same backend.
+ *
+ * @param[in] ios    The runs of blocks to write from their buffers.
+ * @param[in] count  Number of runs in `ios`.
+ * @param[in] sync   Whether to make the disk file durable after the writes.
+ *
+ * @return
+ *  `true` if every run was written, `false` otherwise (sets errno).
+ */
+bool writeBlocks(const struct BlockIO *ios, int count, bool sync);
+#endif
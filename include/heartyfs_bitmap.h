@@ -4,6 +4,9 @@
  * @brief 
  *  A header for operations on the bitmap for heartyfs, used to track memory
  *  usage.
+ *
+ *  The bitmap is updated atomically a 64-bit word at a time, so every map
+ *  passed in must be declared `_Alignas(uint64_t)`.
  * 
  * @version 0.1
  * @date 2024-11-11
@@ -16,11 +19,25 @@
 
 #include "heartyfs_helper_structs.h"
 
+// Buckets of a histogram of run lengths, one per power of two up to
+// `BLOCK_COUNT`.
+#define RUN_HIST_LEN 12
+
+// The runs of free blocks of a bitmap.
+struct FreeRuns {
+    int free_count; // Free blocks
+    int run_count;
+    int max_len; // Blocks in the longest run
+    // Runs of `2^k` to `2^(k+1) - 1` blocks, the last also holding longer ones
+    int len_hist[RUN_HIST_LEN];
+};
+
 /**
  * @brief 
  *  Sets a range of bits in the bitmap to free.
  *
- *  Marks the specified range in the bitmap as free, indicated by `bounds`.
+ *  Marks the specified range in the bitmap as free, indicated by `bounds`,
+ *  atomically per word of the bitmap.
  *
  * @param[out]  bitmap The bitmap to modify.
  * @param[in]   bounds Interval specifying the range to free.
@@ -31,7 +48,8 @@ void setBitmapFree(uint8_t *bitmap, struct Interval *bounds);
  * @brief 
  *  Sets a range of bits in the bitmap as used.
  *
- *  Marks the specified range in the bitmap as used, indicated by `bounds`.
+ *  Marks the specified range in the bitmap as used, indicated by `bounds`,
+ *  atomically per word of the bitmap.
  *
  * @param[out]  bitmap The bitmap to modify.
  * @param[in]   bounds Interval specifying the range to mark as used.
@@ -69,7 +87,49 @@ bool findFreeDensestBlocks(uint8_t *map, int block_count,
  * @param[in] start_id  Index to start searching from.
  * 
  * @return 
- *  Index of the next free block.
+ *  Index of the next free block, or `BLOCK_COUNT` if there is none.
  */
 int findNextFreeBlock(uint8_t *map, int start_id);
+
+/**
+ * @brief 
+ *  Finds the next used block in the bitmap starting from a given position,
+ *  i.e. the end of the run of free blocks starting there.
+ *
+ * @param[in] map       Bitmap to search.
+ * @param[in] start_id  Index to start searching from.
+ * 
+ * @return 
+ *  Index of the next used block, or `BLOCK_COUNT` if there is none.
+ */
+int findNextUsedBlock(uint8_t *map, int start_id);
+
+/**
+ * @brief 
+ *  Atomically marks up to a given number of free blocks as used, taking them
+ *  from the first word of the bitmap with a free bit from a given position.
+ *
+ *  Free bits are claimed with a compare-and-swap on the word holding them, so
+ *  concurrent callers never claim the same block, and a caller losing a race
+ *  retries with the bits left. A batch thus costs the shared bitmap no more
+ *  than a single block does.
+ *
+ * @param[in, out] map        Bitmap to claim the blocks from.
+ * @param[in]      start_id   Index to start searching from.
+ * @param[out]     ids        Indices of the claimed blocks, in ascending order.
+ * @param[in]      max_count  Maximum number of blocks to claim, at least 1.
+ * 
+ * @return 
+ *  Number of blocks claimed, 0 if there is no free block.
+ */
+int claimFreeBlocks(uint8_t *map, int start_id, int *ids, int max_count);
+
+/**
+ * @brief 
+ *  Adds the runs of free blocks in the bitmap to a count of them.
+ *
+ * @param[in]      map   Bitmap to scan.
+ * @param[in, out] runs  The count of runs, zeroed to start a new one.
+ */
+void countFreeRuns(uint8_t *map, struct FreeRuns *runs);
 #endif
\ No newline at end of file
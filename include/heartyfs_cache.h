@@ -0,0 +1,68 @@
+/**
+ * @file heartyfs_cache.h
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  A header for the block cache serving the disk to the backends without a
+ *  mapping of the disk file.
+ *
+ *  The cache hands out memory that can be indexed like a mapping of the whole
+ *  disk, but only keeps a bounded number of pages of it. Pages are read
+ *  through the backend when they are first touched, a few pages ahead at a
+ *  time, and the least recently faulted clean pages are dropped once the cache
+ *  is full. Pages written since the last `cleanCache()` are never dropped, so
+ *  the cache can grow past its size while a transaction is open.
+ *
+ *  Where userfaultfd is not permitted, the cache reads the whole disk when it
+ *  is set up and keeps it, ignoring its size.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#ifndef _HEARTYFS_CACHE_UTILS_H
+#define _HEARTYFS_CACHE_UTILS_H
+
+#include "heartyfs.h"
+#include "heartyfs_helper_structs.h"
+
+/**
+ * @brief
+ *  Sets up the cache in front of the open backend.
+ *
+ * @param[in] capacity  Number of blocks the cache keeps.
+ *
+ * @return
+ *  Pointer to the memory of the disk on success, `NULL` otherwise (sets
+ *  errno).
+ */
+union Block *mapCache(int capacity);
+
+/**
+ * @brief
+ *  Drops every page of the cache and tears it down.
+ *
+ * @param[in] mem   Pointer to the memory of the disk.
+ */
+void unmapCache(union Block *mem);
+
+/**
+ * @brief
+ *  Reads ranges of blocks into the cache ahead of their use, as one batch.
+ *
+ * @note
+ *  Stops once the cache is full, so it never drops pages to read ahead.
+ *
+ * @param[in] mem     Pointer to the memory of the disk.
+ * @param[in] ranges  Intervals of the blocks to read.
+ * @param[in] count   Number of intervals in `ranges`.
+ */
+void prefetchCache(union Block *mem, const struct Interval *ranges, int count);
+
+/**
+ * @brief
+ *  Marks every page of the cache clean, once the changes in it were written
+ *  back, so that they can be dropped again.
+ *
+ * @param[in] mem   Pointer to the memory of the disk.
+ */
+void cleanCache(union Block *mem);
+#endif
@@ -0,0 +1,112 @@
+/**
+ * @file heartyfs_chunk.h
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  A header for the chunks of compressed files and their codec.
+ *
+ *  The data of a compressed file is split into chunks of up to
+ *  `CHUNK_MAX_SIZE` bytes, each stored in a data block of its own behind a
+ *  header holding its size. A chunk is compressed with an LZ77 codec in the
+ *  block format of LZ4, so it is decoded without looking at any other block,
+ *  or stored as is when compressing would fit fewer bytes in the block.
+ *
+ *  Every block but the last one of a file is filled with as many bytes as
+ *  fit, so chunks vary in size and a file is only sought through by adding up
+ *  the sizes of its chunks.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#ifndef _HEARTYFS_CHUNK_UTILS_H
+#define _HEARTYFS_CHUNK_UTILS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "heartyfs.h"
+
+// Bytes of a file held by a chunk at most, decoded at once to read it.
+#define CHUNK_MAX_SIZE 4096
+#define CHUNK_HEADER_SIZE (int)sizeof(uint16_t)
+// Bytes of a block left for the encoded chunk.
+#define CHUNK_MAX_DATA (BLOCK_MAX_DATA - CHUNK_HEADER_SIZE)
+
+/**
+ * @brief
+ *  Compresses as much of a buffer as fits in another one.
+ *
+ * @param[in]  src       The data to compress.
+ * @param[in]  src_len   Size of the data, below 32 KiB.
+ * @param[out] dst       The compressed data.
+ * @param[in]  dst_cap   Size of `dst`.
+ * @param[out] src_used  Bytes of `src` compressed, a prefix of it.
+ *
+ * @return
+ *   Size of the compressed data.
+ */
+int compressLZ(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap,
+               int *src_used);
+
+/**
+ * @brief
+ *  Decompresses data compressed by `compressLZ()`, stopping once a buffer is
+ *  full.
+ *
+ * @param[in]  src      The compressed data.
+ * @param[in]  src_len  Size of the compressed data.
+ * @param[out] dst      The decompressed data.
+ * @param[in]  dst_cap  Bytes to decompress at most.
+ *
+ * @return
+ *   Size of the decompressed data, or -1 if the compressed data is corrupt.
+ */
+int decompressLZ(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap);
+
+/**
+ * @brief
+ *  Encodes the start of some data into a data block, as one chunk.
+ *
+ * @param[out] d_block  The data block.
+ * @param[in]  data     The data, or NULL for zeroes.
+ * @param[in]  size     Size of the data.
+ *
+ * @return
+ *   Bytes of the data held by the chunk.
+ */
+int encodeChunk(struct DataBlock *d_block, const void *data, int size);
+
+/**
+ * @brief
+ *  Reads the size of the chunk in a data block.
+ *
+ * @param[in] d_block  The data block.
+ *
+ * @return
+ *   Bytes of the file held by the chunk.
+ */
+int getChunkSize(const struct DataBlock *d_block);
+
+/**
+ * @brief
+ *  Decodes the start of the chunk in a data block.
+ *
+ * @param[in]  d_block  The data block.
+ * @param[out] buf      Buffer to store the bytes decoded.
+ * @param[in]  size     Bytes to decode, up to the size of the chunk.
+ *
+ * @return
+ *   Number of bytes decoded, or -1 if the chunk is corrupt.
+ */
+int decodeChunk(const struct DataBlock *d_block, void *buf, int size);
+
+/**
+ * @brief
+ *  Checks that the chunk in a data block decodes to its size.
+ *
+ * @param[in] d_block  The data block.
+ *
+ * @return
+ *   true if the chunk is valid, false otherwise.
+ */
+bool isChunkValid(const struct DataBlock *d_block);
+#endif
@@ -0,0 +1,422 @@
+/**
+ * @file heartyfs_disk.h
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief 
+ *  A header for mounting the virtual disk of heartyfs and writing changes back
+ *  to it in crash-safe transactions.
+ * 
+ *  Every change must be recorded with `markBlockDirty()`, `markDataDirty()`,
+ *  `allocBlock()` or `freeBlocks()`, so that a commit only writes and flushes the blocks that
+ *  were touched. How changes reach the disk file depends on the sync mode:
+ * 
+ *  - `SYNC_ORDERED` and `SYNC_FULL` map the disk file privately, so changes
+ *    only reach the disk file through the journal when the open transaction is
+ *    committed. `SYNC_FULL` commits after every operation, while
+ *    `SYNC_ORDERED` groups the operations of a batch into as few commits as the
+ *    journal allows.
+ *  - `SYNC_ASYNC` and `SYNC_NONE` map the disk file shared and change it in
+ *    place without the journal, so they are not crash-safe. On commit,
+ *    `SYNC_ASYNC` starts writing back the pages that were touched without
+ *    waiting for them, while `SYNC_NONE` leaves it all to the kernel.
+ * 
+ *  With a backend serving the disk from the block cache instead of a mapping,
+ *  the cache plays the part of the private mapping in every mode, and the
+ *  modes without the journal write the changed blocks in place on commit.
+ * 
+ *  On a journaled commit, blocks allocated during the transaction are written in place
+ *  first, since they were free on the disk and nothing refers to them yet, and
+ *  so are the data blocks of files, as the journal only keeps the metadata
+ *  consistent. The other changed blocks go through the journal, as one journal
+ *  transaction, and are written to their home location once the journal is
+ *  durable. Blocks freed during the transaction stay used in the bitmap until
+ *  the commit, so they are never reused before the transaction freeing them
+ *  is durable.
+ * 
+ *  The journal only holds `JOURNAL_MAX_RECORDS` blocks, so a transaction is
+ *  committed before the next operation could overflow it. An operation
+ *  changing more than a few blocks runs alone with `isolateDiskOp()` and
+ *  commits in steps with `reserveDiskOp()`.
+ * 
+ *  Recording changes is thread-safe, see `heartyfs_lock.h` for the locks the
+ *  operations themselves take.
+ * 
+ *  Several processes may use the disk file at once. By default, the blocks an
+ *  operation reads are locked in the disk file while they are read, and the
+ *  blocks it changes, including the bitmap, stay locked until its transaction
+ *  is committed, so other processes never see half of a transaction. A block
+ *  is read again from the disk file whenever it is newly locked, in case
+ *  another process committed it in the meantime. Since a batch commits its
+ *  operations in groups, it locks the whole disk file instead.
+ * 
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#ifndef _HEARTYFS_DISK_UTILS_H
+#define _HEARTYFS_DISK_UTILS_H
+
+#include <stdbool.h>
+
+#include "heartyfs.h"
+#include "heartyfs_backend.h"
+#include "heartyfs_helper_structs.h"
+
+enum SyncModes { SYNC_NONE, SYNC_ASYNC, SYNC_ORDERED, SYNC_FULL };
+
+enum DiskLockModes { DISK_LOCK_BLOCKS, DISK_LOCK_WHOLE };
+
+#define ALLOC_CACHE_MAX_BLOCKS 64
+
+/**
+ * @brief 
+ *  Parses the name of a sync mode, e.g. "ordered" for `SYNC_ORDERED`.
+ * 
+ * @param[in]  name  The name to parse.
+ * @param[out] mode  The parsed sync mode.
+ * 
+ * @return 
+ *  `true` if the name is a valid sync mode, `false` otherwise.
+ */
+bool parseSyncMode(const char *name, enum SyncModes *mode);
+
+/**
+ * @brief 
+ *  Sets how changes are written back to the disk file, `SYNC_ORDERED` by
+ *  default.
+ * 
+ * @note 
+ *  Must be called before the disk is mounted.
+ * 
+ * @param[in] mode  The sync mode to use.
+ */
+void setSyncMode(enum SyncModes mode);
+
+enum MappingFlags {
+    MAPPING_POPULATE_META = 1 << 0, // Prefault the root and the bitmap
+    MAPPING_POPULATE = 1 << 1,      // Prefault the whole disk
+    MAPPING_HUGE = 1 << 2           // Ask for transparent huge pages
+};
+
+/**
+ * @brief 
+ *  Parses a comma separated list of mapping flags, e.g. "meta,huge" for
+ *  `MAPPING_POPULATE_META | MAPPING_HUGE`.
+ * 
+ * @param[in]  list   The list to parse.
+ * @param[out] flags  The parsed mapping flags.
+ * 
+ * @return 
+ *  `true` if every name in the list is a valid flag, `false` otherwise.
+ */
+bool parseMappingFlags(const char *list, int *flags);
+
+/**
+ * @brief 
+ *  Sets how the disk file is mapped, none of `MappingFlags` by default.
+ * 
+ * @note 
+ *  Must be called before the disk is mounted. Prefaulting pays for the page
+ *  faults of the disk up front in one call instead of one fault per page
+ *  touched, which only pays off when many pages are touched, e.g. in a batch.
+ * 
+ * @param[in] flags  A combination of `MappingFlags`.
+ */
+void setMappingFlags(int flags);
+
+/**
+ * @brief 
+ *  Sets the storage backend serving the disk, `BACKEND_MMAP` by default.
+ * 
+ * @note 
+ *  Must be called before the disk is mounted. The other backends serve the
+ *  disk from a block cache, so only the blocks in use take up memory.
+ * 
+ * @param[in] type  The backend to use.
+ */
+void setBackend(enum BackendTypes type);
+
+/**
+ * @brief 
+ *  Sets the number of blocks the block cache keeps, a quarter of the disk by
+ *  default.
+ * 
+ * @note 
+ *  Must be called before the disk is mounted. Only used by the backends
+ *  serving the disk from the block cache.
+ * 
+ * @param[in] size  Number of blocks.
+ */
+void setCacheSize(int size);
+
+/**
+ * @brief 
+ *  Sets how the disk file is locked against other processes,
+ *  `DISK_LOCK_BLOCKS` by default.
+ * 
+ * @note 
+ *  Must be called before the disk is mounted. `DISK_LOCK_WHOLE` locks the
+ *  whole disk file from mounting to unmounting, which suits processes running
+ *  many operations, or operations spanning many inodes, in one go.
+ * 
+ * @param[in] mode  The way of locking.
+ */
+void setDiskLocking(enum DiskLockModes mode);
+
+/**
+ * @brief 
+ *  Sets how many blocks each thread claims from the bitmap at once and keeps
+ *  for its next allocations, none by default.
+ * 
+ * @note 
+ *  With a cache, threads allocate without touching the shared bitmap until
+ *  their cache runs out, at the cost of files written on different threads
+ *  no longer sharing the densest free range. The blocks left in the caches are
+ *  freed again on every commit.
+ * 
+ * @param[in] size  Number of blocks, at most `ALLOC_CACHE_MAX_BLOCKS`.
+ */
+void setAllocCacheSize(int size);
+
+/**
+ * @brief 
+ *  Opens the disk file and maps it, or sets up the block cache in front of it,
+ *  replaying its journal first.
+ * 
+ * @note 
+ *  In the modes without the journal, the replayed journal is also cleared, so
+ *  that it is not replayed over later changes made in place.
+ * 
+ * @return 
+ *  Pointer to the mapped memory on success @n
+ *  NULL on failure (sets errno).
+ */
+union Block *mountDisk();
+
+/**
+ * @brief 
+ *  Commits the open transaction and unmaps the disk file.
+ * 
+ * @param[in] mem   Pointer to the mapped memory.
+ * 
+ * @return 
+ *  `true` if the last transaction was committed, `false` otherwise.
+ */
+bool unmountDisk(union Block *mem);
+
+/**
+ * @brief 
+ *  Writes the whole mapped disk back to the disk file and syncs it, bypassing
+ *  the journal.
+ * 
+ * @note 
+ *  Only meant for formatting a disk, where there is nothing to keep consistent.
+ * 
+ * @param[in] mem   Pointer to the mapped memory.
+ * 
+ * @return 
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+bool writeWholeDisk(union Block *mem);
+
+/**
+ * @brief 
+ *  Advises the kernel that the data blocks of a file are about to be read in
+ *  order, so that they are read ahead instead of faulted in one page at a
+ *  time.
+ * 
+ * @param[in] mem   Memory block representing the file system.
+ * @param[in] id    ID of the file.
+ */
+void prefetchFileData(union Block *mem, int id);
+
+/**
+ * @brief 
+ *  Advises the kernel that the data blocks of a file read after
+ *  `prefetchFileData()` are back to random access, so that later commands of
+ *  the same process are not read ahead.
+ * 
+ * @param[in] mem   Memory block representing the file system.
+ * @param[in] id    ID of the file, not changed since `prefetchFileData()`.
+ */
+void endFileRead(union Block *mem, int id);
+
+/**
+ * @brief 
+ *  Locks a block of the disk file against other processes, and reads it again
+ *  from the disk file if it was not locked yet. Does nothing with
+ *  `DISK_LOCK_WHOLE`.
+ * 
+ * @note 
+ *  A read lock is released by the matching `unlockDiskBlock()`, while a write
+ *  lock is kept until the transaction is committed. Blocks must be locked in
+ *  the order of `heartyfs_lock.h`, with the bitmap last. The threads of a
+ *  process share its locks, and are kept apart by the inode locks.
+ * 
+ * @param[in] id        ID of the block.
+ * @param[in] is_write  `true` to exclude every other process, `false` to only
+ *                      exclude writers.
+ * 
+ * Exits the program on failure.
+ */
+void lockDiskBlock(int id, bool is_write);
+
+/**
+ * @brief 
+ *  Write-locks every block of the disk file outside the journal until the
+ *  transaction is committed, for commands that must see and change the whole
+ *  disk at once. Does nothing with `DISK_LOCK_WHOLE`.
+ * 
+ * @note 
+ *  Must be called before any other block is locked, since it takes every
+ *  block at once regardless of the lock order.
+ * 
+ * Exits the program on failure.
+ */
+void lockWholeDisk();
+
+/**
+ * @brief 
+ *  Releases a read lock taken by `lockDiskBlock()`.
+ * 
+ * @param[in] id    ID of the block.
+ */
+void unlockDiskBlock(int id);
+
+/**
+ * @brief 
+ *  Records that a block was changed in the open transaction.
+ * 
+ * @param[in] id    ID of the changed block.
+ */
+void markBlockDirty(int id);
+
+/**
+ * @brief 
+ *  Records that a data block of a file was changed in the open transaction.
+ * 
+ * @note 
+ *  Data blocks are written in place before the journal, so they take no room
+ *  in it, and a crash may leave a data block changed by a transaction that
+ *  did not reach the disk file.
+ * 
+ * @param[in] id    ID of the changed data block.
+ */
+void markDataDirty(int id);
+
+/**
+ * @brief 
+ *  Claims the first free block at or after a given position, wrapping around
+ *  to the start of the disk, and records it as allocated in the open
+ *  transaction.
+ * 
+ * @note 
+ *  The block is claimed in the bitmap with a compare-and-swap, so threads
+ *  allocate without a lock and never get the same block. The content of the
+ *  block is not considered changed, `markBlockDirty()` must still be called
+ *  once it is written.
+ * 
+ * @param[in, out] mem       Memory block representing the file system.
+ * @param[in]      start_id  ID to start searching from.
+ * 
+ * @return 
+ *  ID of the block if successful, -1 if the disk is full (sets errno).
+ */
+int allocBlock(union Block *mem, int start_id);
+
+/**
+ * @brief 
+ *  Frees a range of blocks, once the open transaction is committed if it is
+ *  journaled.
+ * 
+ * @param[in, out] mem      Memory block representing the file system.
+ * @param[in]      bounds   Interval of the blocks to free.
+ */
+void freeBlocks(union Block *mem, struct Interval *bounds);
+
+/**
+ * @brief 
+ *  Marks the start of an operation, first committing the open transaction if
+ *  the journal could not hold the changes of another operation.
+ * 
+ * @note 
+ *  Operations may run on several threads at once, and a commit waits until
+ *  none is running, so that it only writes whole operations. Every
+ *  `beginDiskOp()` must be followed by an `endDiskOp()` on the same thread.
+ * 
+ * @param[in, out] mem  Pointer to the mapped memory.
+ * 
+ * @return 
+ *  `true` if successful, `false` if a commit failed.
+ */
+bool beginDiskOp(union Block *mem);
+
+/**
+ * @brief 
+ *  Makes the running operation the only one, waiting for the others to end,
+ *  and commits the open transaction.
+ * 
+ * @note 
+ *  Must be called before the operation locks anything, so that it starts
+ *  from a disk with nothing pending, and can then commit with
+ *  `reserveDiskOp()` while it holds its locks. Other operations wait until it
+ *  ends.
+ * 
+ * @param[in, out] mem  Pointer to the mapped memory.
+ * 
+ * @return 
+ *  `true` if successful, `false` if the commit failed.
+ */
+bool isolateDiskOp(union Block *mem);
+
+/**
+ * @brief 
+ *  Makes room in the open transaction for a step of the running operation,
+ *  committing it first if the step could overflow the journal.
+ * 
+ * @note 
+ *  Only for an operation running alone after `isolateDiskOp()`, between two
+ *  steps that each leave the disk consistent. The blocks it locked stay
+ *  locked in the disk file until it ends.
+ * 
+ * @param[in, out] mem    Pointer to the mapped memory.
+ * @param[in]      count  Most blocks the step changes, other than the ones it
+ *                        allocates and data blocks.
+ * 
+ * @return 
+ *  `true` if successful, `false` if the step can never fit in the journal
+ *  (`EFBIG`) or the commit failed.
+ */
+bool reserveDiskOp(union Block *mem, int count);
+
+/**
+ * @brief 
+ *  Marks the end of an operation, committing the open transaction in
+ *  `SYNC_FULL` mode.
+ * 
+ * @note 
+ *  Operations are otherwise grouped into a transaction, so that a batch of
+ *  operations pays for a single commit.
+ * 
+ * @param[in, out] mem  Pointer to the mapped memory.
+ * 
+ * @return 
+ *  `true` if successful, `false` if a commit failed.
+ */
+bool endDiskOp(union Block *mem);
+
+/**
+ * @brief 
+ *  Commits the open transaction to the disk file.
+ * 
+ * @note 
+ *  Waits until no operation is running. A transaction changing more existing
+ *  blocks than the journal holds is refused, and once a journaled commit
+ *  failed no later one is made, since the disk file no longer matches the
+ *  memory.
+ * 
+ * @param[in, out] mem  Pointer to the mapped memory.
+ * 
+ * @return 
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+bool commitDisk(union Block *mem);
+#endif
@@ -0,0 +1,71 @@
+/**
+ * @file heartyfs_journal.h
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief 
+ *  A header for the metadata journal of heartyfs, used to keep the disk
+ *  consistent across crashes.
+ * 
+ *  A transaction is written as the after-images of the blocks it changed into
+ *  the journal region, protected by a checksum. Once it is durable, the blocks
+ *  are written to their home location. A committed transaction is replayed on
+ *  the next mount, so a crash in between only ever loses whole transactions.
+ * 
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#ifndef _HEARTYFS_JOURNAL_UTILS_H
+#define _HEARTYFS_JOURNAL_UTILS_H
+
+#include <stdbool.h>
+
+#include "heartyfs.h"
+
+/**
+ * @brief 
+ *  Replays the last committed transaction of the journal onto the disk file.
+ *
+ *  Only the blocks whose home location differs from the journal are written.
+ *  A torn transaction, detected by its checksum, is discarded. The journal is
+ *  left committed, since replaying it again is harmless until it is replaced
+ *  by the next transaction.
+ *
+ * @param[in] fd    File descriptor of the disk file.
+ * 
+ * @return 
+ *  `true` if the journal was replayed or had nothing to replay, `false` on an
+ *  I/O error (sets errno).
+ */
+bool replayJournal(int fd);
+
+/**
+ * @brief 
+ *  Writes the given blocks to the journal as one committed transaction.
+ *
+ *  The header and the after-images are written with a single vectored write.
+ *  Nothing is flushed, the caller is responsible for syncing the disk file
+ *  before writing the blocks to their home location.
+ *
+ * @param[in] fd    File descriptor of the disk file.
+ * @param[in] mem   Memory block representing the file system.
+ * @param[in] ids   IDs of the blocks in the transaction.
+ * @param[in] count Number of IDs in `ids`, at most `JOURNAL_MAX_RECORDS`.
+ * 
+ * @return 
+ *  `true` if the transaction was written, `false` otherwise (sets errno).
+ */
+bool writeJournal(int fd, union Block *mem, const int *ids, int count);
+
+/**
+ * @brief 
+ *  Marks the journal clean and syncs it, if it holds a committed transaction.
+ *
+ *  Must be done before changing the disk file in place without the journal,
+ *  since replaying an older transaction would undo those changes.
+ *
+ * @param[in] fd    File descriptor of the disk file.
+ * 
+ * @return 
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+bool clearJournal(int fd);
+#endif
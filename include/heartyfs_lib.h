@@ -0,0 +1,185 @@
+/**
+ * @file heartyfs_lib.h
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The public header of libheartyfs, which embeds heartyfs in a process.
+ *
+ *  A process mounts the disk once and then opens, reads and writes files and
+ *  lists directories from any number of threads, each call running as one
+ *  operation of a batch would. Calls return a negative errno on failure and
+ *  print nothing.
+ *
+ *  The whole disk file stays locked while it is mounted, so other heartyfs
+ *  processes wait until it is unmounted. Changes are committed as the journal
+ *  fills up, by `hfs_sync()` and by `hfs_unmount()`, or after every call with
+ *  the `full` sync mode.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#ifndef _HEARTYFS_LIB_H
+#define _HEARTYFS_LIB_H
+
+#define HFS_API __attribute__((visibility("default")))
+
+// Longest name of a file or directory, without the terminating '\0'.
+#define HFS_NAME_MAX 28
+// Files open at once on a mount.
+#define HFS_MAX_FILES 64
+
+// Flags of `hfs_open()`, one access mode with any of the others.
+#define HFS_O_RDONLY 0x0
+#define HFS_O_WRONLY 0x1
+#define HFS_O_RDWR 0x2
+#define HFS_O_ACCMODE 0x3
+#define HFS_O_CREAT 0x4     // Create the file if it does not exist
+#define HFS_O_TRUNC 0x8     // Empty the file, with write access
+#define HFS_O_APPEND 0x10   // Write at the end of the file every time
+#define HFS_O_COMPRESS 0x20 // Create the file compressed, see `compress`
+
+enum hfs_types { HFS_TYPE_FILE = 0, HFS_TYPE_DIR = 1 };
+
+// A mounted disk.
+struct hfs;
+
+struct hfs_stat {
+    int id;     // Block of the inode, unique while the file exists
+    int type;   // `HFS_TYPE_FILE` or `HFS_TYPE_DIR`
+    int size;   // Bytes of a file, or entries of a directory as listed by
+                // `hfs_readdir()`
+    int blocks; // Blocks of data and reserved blocks of a file, 0 for a
+                // directory
+};
+
+struct hfs_dirent {
+    int id;
+    int type;
+    char name[HFS_NAME_MAX + 1];
+};
+
+/**
+ * @brief
+ *  Mounts the disk, replaying its journal. Only one disk is mounted in a
+ *  process at a time.
+ *
+ * @param[in]  sync_mode  `none`, `async`, `ordered` or `full` as for `--sync`,
+ *                        NULL for `ordered`.
+ * @param[out] fs         The mounted disk.
+ *
+ * @return
+ *   0 on success, or a negative errno: `-ENOENT` if the disk was never
+ *   created, `-EBUSY` if a disk is already mounted, `-EINVAL` for an unknown
+ *   sync mode.
+ */
+HFS_API int hfs_mount(const char *sync_mode, struct hfs **fs);
+
+/**
+ * @brief
+ *  Closes the files still open, commits the changes and unmounts the disk.
+ *
+ * @param[in] fs  The mounted disk, freed.
+ *
+ * @return
+ *   0 if the changes were committed, a negative errno otherwise.
+ */
+HFS_API int hfs_unmount(struct hfs *fs);
+
+/**
+ * @brief
+ *  Commits the changes made so far, waiting for the calls running.
+ *
+ * @param[in] fs  The mounted disk.
+ *
+ * @return
+ *   0 on success, a negative errno otherwise.
+ */
+HFS_API int hfs_sync(struct hfs *fs);
+
+/**
+ * @brief
+ *  Opens a file.
+ *
+ * @param[in] fs     The mounted disk.
+ * @param[in] path   Absolute path of the file.
+ * @param[in] flags  `HFS_O_*` flags.
+ *
+ * @return
+ *   A handle to the file, from 0, or a negative errno: `-ENOENT`, `-EISDIR`,
+ *   `-ENOTDIR`, `-ENAMETOOLONG`, `-ENOSPC` if the directory or disk is full,
+ *   `-EMFILE` if `HFS_MAX_FILES` are open, `-EINVAL` for a relative path or
+ *   bad flags.
+ */
+HFS_API int hfs_open(struct hfs *fs, const char *path, int flags);
+
+/**
+ * @brief
+ *  Closes a file.
+ *
+ * @param[in] fs  The mounted disk.
+ * @param[in] fd  Handle of the file.
+ *
+ * @return
+ *   0 on success, `-EBADF` if the handle is not open.
+ */
+HFS_API int hfs_close(struct hfs *fs, int fd);
+
+/**
+ * @brief
+ *  Reads from a file at its position, and moves the position past the bytes
+ *  read.
+ *
+ * @param[in]  fs    The mounted disk.
+ * @param[in]  fd    Handle of the file, open for reading.
+ * @param[out] buf   Buffer of `size` bytes.
+ * @param[in]  size  Bytes to read at most.
+ *
+ * @return
+ *   The bytes read, 0 at the end of the file, or a negative errno.
+ */
+HFS_API int hfs_read(struct hfs *fs, int fd, void *buf, int size);
+
+/**
+ * @brief
+ *  Writes to a file at its position, or at its end with `HFS_O_APPEND`,
+ *  and moves the position past the bytes written.
+ *
+ * @param[in] fs    The mounted disk.
+ * @param[in] fd    Handle of the file, open for writing.
+ * @param[in] buf   The bytes to write.
+ * @param[in] size  Number of bytes to write.
+ *
+ * @return
+ *   The bytes written, or a negative errno: `-EFBIG` past the largest file,
+ *   `-ENOSPC` if the disk is full.
+ */
+HFS_API int hfs_write(struct hfs *fs, int fd, const void *buf, int size);
+
+/**
+ * @brief
+ *  Lists a directory, without its `.` and `..` entries.
+ *
+ * @param[in]  fs       The mounted disk.
+ * @param[in]  path     Absolute path of the directory.
+ * @param[out] entries  Array of `max` entries.
+ * @param[in]  max      Entries to fill at most.
+ *
+ * @return
+ *   The number of entries of the directory, which may be more than `max`, or
+ *   a negative errno.
+ */
+HFS_API int hfs_readdir(struct hfs *fs, const char *path,
+                        struct hfs_dirent *entries, int max);
+
+/**
+ * @brief
+ *  Describes a file or directory.
+ *
+ * @param[in]  fs    The mounted disk.
+ * @param[in]  path  Absolute path of the file or directory.
+ * @param[out] st    The description.
+ *
+ * @return
+ *   0 on success, or a negative errno.
+ */
+HFS_API int hfs_stat(struct hfs *fs, const char *path, struct hfs_stat *st);
+#endif
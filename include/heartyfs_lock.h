@@ -0,0 +1,51 @@
+/**
+ * @file heartyfs_lock.h
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  A header for the locks letting operations run on several threads at once.
+ *
+ *  Every inode has a reader/writer lock. A directory is always locked before
+ *  the inodes it holds, i.e. an ancestor before its descendants, and inodes
+ *  that are not nested are never locked together, so that no two threads wait
+ *  on each other. The bitmap needs no lock, since blocks are claimed in it
+ *  atomically by `allocBlock()`.
+ *
+ *  A path is walked hand over hand, read-locking each directory until the next
+ *  inode on the path is locked, so that no inode on it can be removed and its
+ *  block reused in between. A `..` step cannot lock the parent after the
+ *  child, so it unlocks the child first and checks that the parent still
+ *  holds it.
+ *
+ *  The same order holds across processes, since the inode locks also lock the
+ *  inode in the disk file, see `lockDiskBlock()`.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#ifndef _HEARTYFS_LOCK_UTILS_H
+#define _HEARTYFS_LOCK_UTILS_H
+
+/**
+ * @brief
+ *  Locks an inode for reading, shared with other readers.
+ *
+ * @param[in] id    ID of the inode.
+ */
+void lockInodeRead(int id);
+
+/**
+ * @brief
+ *  Locks an inode for writing, excluding every other thread.
+ *
+ * @param[in] id    ID of the inode.
+ */
+void lockInodeWrite(int id);
+
+/**
+ * @brief
+ *  Unlocks an inode locked by `lockInodeRead()` or `lockInodeWrite()`.
+ *
+ * @param[in] id    ID of the inode.
+ */
+void unlockInode(int id);
+#endif
@@ -10,6 +10,12 @@
 #ifndef _HEARTYFS_MATH_UTILS_H
 #define _HEARTYFS_MATH_UTILS_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
 /**
  * @brief 
  *  Returns the maximum of two integers.
@@ -71,4 +77,28 @@ int absInt(int x);
  *  Number of digits in the integer.
  */
 int countDigits(int x);
+
+/**
+ * @brief 
+ *  Calculates the base-2 logarithm of a positive integer, rounded down.
+ *
+ * @param[in] x Input integer, at least 1.
+ * 
+ * @return 
+ *  The largest `k` such that `2^k <= x`.
+ */
+int log2Int(int x);
+
+/**
+ * @brief 
+ *  Folds a buffer into a running 32-bit FNV-1a hash.
+ * 
+ * @param[in] hash  The hash so far, `FNV_OFFSET_BASIS` to start a new one.
+ * @param[in] data  The buffer to hash.
+ * @param[in] size  The size of the buffer.
+ * 
+ * @return 
+ *   The updated hash.
+ */
+uint32_t hashBytes(uint32_t hash, const void *data, size_t size);
 #endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+/**
+ * @file heartyfs_pool.h
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  A header for the pool of worker threads running operations in parallel.
+ *
+ *  Tasks submitted from outside the pool are taken in the order they are
+ *  submitted by the first idle worker, so tasks may finish in any order. Tasks
+ *  may submit more tasks, which the worker runs itself unless an idle worker
+ *  steals them, so a task can split its work without waiting for it. A task is
+ *  a function returning whether it succeeded, and owns its argument.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#ifndef _HEARTYFS_POOL_UTILS_H
+#define _HEARTYFS_POOL_UTILS_H
+
+#include <stdbool.h>
+
+struct Pool;
+
+/**
+ * @brief
+ *  Sets the number of workers of the pools started by the commands, 1 by
+ *  default.
+ *
+ * @param[in] jobs  Number of workers, at least 1.
+ */
+void setJobCount(int jobs);
+
+/**
+ * @brief
+ *  Gets the number of workers of the pools started by the commands.
+ *
+ * @return
+ *  Number of workers set by `setJobCount()`.
+ */
+int getJobCount();
+
+/**
+ * @brief
+ *  Starts a pool of worker threads.
+ *
+ * @param[in] jobs  Number of workers, at least 1.
+ *
+ * @return
+ *  Pointer to the pool on success, `NULL` otherwise (sets errno).
+ */
+struct Pool *startPool(int jobs);
+
+/**
+ * @brief
+ *  Queues a task to be run by a worker.
+ *
+ * @param[in, out] pool  The pool.
+ * @param[in]      call  The task, returning whether it succeeded.
+ * @param[in]      arg   Argument passed to the task.
+ *
+ * @return
+ *  `true` if the task was queued, `false` otherwise (sets errno).
+ */
+bool submitTask(struct Pool *pool, bool (*call)(void *), void *arg);
+
+/**
+ * @brief
+ *  Waits until every task queued so far has finished, including the tasks
+ *  they submitted.
+ *
+ * @note
+ *  Must not be called by a task of the same pool.
+ *
+ * @param[in, out] pool  The pool.
+ *
+ * @return
+ *  `true` if every task since the last wait succeeded, `false` otherwise.
+ */
+bool waitPool(struct Pool *pool);
+
+/**
+ * @brief
+ *  Waits for the queued tasks, then stops the workers and frees the pool.
+ *
+ * @param[in, out] pool  The pool.
+ *
+ * @return
+ *  `true` if every task since the last wait succeeded, `false` otherwise.
+ */
+bool stopPool(struct Pool *pool);
+#endif
@@ -0,0 +1,77 @@
+/**
+ * @file heartyfs_refs.h
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  A header for the reference counts of data blocks shared by several files.
+ *
+ *  A data block holding the same bytes in several files is stored once by
+ *  `dedup`, and counts the files sharing it past the first. A shared block is
+ *  only freed once the last file lets go of it, and is never changed in
+ *  place, so a file copies it before writing to it.
+ *
+ *  The counts live in `REF_BLOCK_COUNT` blocks listed in the bitmap block,
+ *  each allocated when a block in its range is first shared. They are locked
+ *  after the bitmap, and changed atomically so that threads may drop the
+ *  references of different files to the same block at once.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#ifndef _HEARTYFS_REFS_UTILS_H
+#define _HEARTYFS_REFS_UTILS_H
+
+#include <stdbool.h>
+
+#include "heartyfs.h"
+
+/**
+ * @brief
+ *  Reads how many files share a block past the first.
+ *
+ * @param[in] mem  Memory block representing the file system.
+ * @param[in] id   ID of the block.
+ *
+ * @return
+ *   The extra references, 0 for a block with one owner.
+ */
+int getBlockRefs(union Block *mem, int id);
+
+/**
+ * @brief
+ *  Adds a reference to a block, allocating the block of its count if needed.
+ *
+ * @param[in, out] mem  Memory block representing the file system.
+ * @param[in]      id   ID of the block.
+ *
+ * @return
+ *   true if successful, false if the block has `REF_MAX` extra references or
+ *   the disk is full (sets errno).
+ */
+bool addBlockRef(union Block *mem, int id);
+
+/**
+ * @brief
+ *  Drops a reference to a block, unless it has only one owner left.
+ *
+ * @param[in, out] mem  Memory block representing the file system.
+ * @param[in]      id   ID of the block.
+ *
+ * @return
+ *   true if a reference was dropped and the block stays in use, false if the
+ *   caller is its only owner.
+ */
+bool dropBlockRef(union Block *mem, int id);
+
+/**
+ * @brief
+ *  Counts the blocks holding reference counts, and the references they hold.
+ *
+ * @param[in]  mem           Memory block representing the file system.
+ * @param[out] shared_count  Blocks shared by more than one file.
+ * @param[out] ref_count     Extra references to them, i.e. the blocks saved.
+ *
+ * @return
+ *   Number of blocks holding reference counts.
+ */
+int countBlockRefs(union Block *mem, int *shared_count, int *ref_count);
+#endif
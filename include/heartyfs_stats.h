@@ -0,0 +1,233 @@
+/**
+ * @file heartyfs_stats.h
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  A header for the counters and timers of the commands and of the internal
+ *  events of the file system, printed by `--stats` and published by `--live`.
+ *
+ *  Every thread counts into a block of its own, so counting never contends,
+ *  and the blocks are only added up by whoever reads them. While stats are
+ *  disabled, counting an event costs a single check of a flag.
+ *
+ *  A live process keeps the blocks in a shared memory segment instead, along
+ *  with a ring of trace records of its latest commands, so that `heartyfs top`
+ *  can map it read-only and watch the process without stopping it.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#ifndef _HEARTYFS_STATS_UTILS_H
+#define _HEARTYFS_STATS_UTILS_H
+
+#include <stdbool.h>
+
+#define STATS_MAX_CMDS 32
+#define STATS_NAME_LEN 32
+// Threads of a live process counting into its segment, past `JOBS_MAX`.
+#define LIVE_MAX_THREADS 80
+// Trace records kept by a live process, a power of two.
+#define TRACE_RING_LEN 1024
+#define TRACE_PATH_LEN 32
+
+enum StatCounters {
+    STAT_BITMAP_SCANS,    // Searches of the bitmap for a free block
+    STAT_BITMAP_BYTES,    // Bytes of the bitmap they visited
+    STAT_BLOCKS_ALLOCATED,
+    STAT_BLOCKS_FREED,
+    STAT_INODES_LOCKED,
+    STAT_PATH_LOOKUPS,
+    STAT_PATH_COMPONENTS, // Directory entries looked up for the paths
+    STAT_BYTES_READ,      // Bytes copied out of data blocks
+    STAT_BYTES_WRITTEN,   // Bytes copied into data blocks
+    STAT_COUNTER_COUNT
+};
+
+extern const char STAT_COUNTER_LIST[STAT_COUNTER_COUNT][24];
+
+// The runs of a command.
+struct CmdStats {
+    long count;
+    long fail_count;
+    long total_ns;
+    long max_ns;
+};
+
+// The counts of a thread, on a cache line of its own.
+struct ThreadStats {
+    long counters[STAT_COUNTER_COUNT];
+    struct CmdStats cmds[STATS_MAX_CMDS];
+    long cmd_blocks; // Blocks counted when the running command started
+    struct ThreadStats *next;
+} __attribute__((aligned(64)));
+
+// A command run by a live process.
+struct TraceRecord {
+    unsigned long seq; // `2 * (index + 1)` once written, odd while written
+    long end_ns;
+    long duration_ns;
+    int cmd_idx;
+    int block_count; // Inodes locked and blocks allocated or freed
+    bool is_ok;
+    char path[TRACE_PATH_LEN]; // First path argument, cut short
+};
+
+// The shared memory segment of a live process.
+struct LiveStats {
+    unsigned int magic; // Set once the segment is ready
+    int pid;
+    long start_ns;
+    int thread_count;
+    char cmd_names[STATS_MAX_CMDS][STATS_NAME_LEN];
+    struct ThreadStats threads[LIVE_MAX_THREADS];
+    unsigned long trace_head; // Records ever started
+    struct TraceRecord trace[TRACE_RING_LEN];
+};
+
+extern bool is_stats_enabled;
+
+/**
+ * @brief
+ *  Enables the counters and timers, disabled by default.
+ */
+void enableStats();
+
+/**
+ * @brief
+ *  Enables the counters and timers and publishes them in a shared memory
+ *  segment named after the process, removed when the process exits.
+ *
+ * @note
+ *  Must be called before any thread counts anything. A segment left by a
+ *  process that was killed is ignored once the process is gone.
+ *
+ * @return
+ *   true  : The segment was created. @n
+ *   false : The segment cannot be created (sets errno).
+ */
+bool publishStats();
+
+/**
+ * @brief
+ *  Adds to a counter of the calling thread.
+ *
+ * @note
+ *  Call `countStat()` instead, which skips the call while stats are disabled.
+ *
+ * @param[in] counter  The counter.
+ * @param[in] n        The amount to add.
+ */
+void addStat(enum StatCounters counter, long n);
+
+/**
+ * @brief
+ *  Adds to a counter of the calling thread if stats are enabled.
+ *
+ * @param[in] counter  The counter.
+ * @param[in] n        The amount to add.
+ */
+static inline void countStat(enum StatCounters counter, long n)
+{
+    if (__builtin_expect(is_stats_enabled, false))
+        addStat(counter, n);
+}
+
+/**
+ * @brief
+ *  Reads the clock the commands are timed with, shared by every process.
+ *
+ * @return
+ *   The time in nanoseconds.
+ */
+long getStatTime();
+
+/**
+ * @brief
+ *  Names a command in the stats, before it is first run.
+ *
+ * @param[in] idx   Index of the command, below `STATS_MAX_CMDS`.
+ * @param[in] name  Name of the command, which must outlive the stats.
+ */
+void nameCmdStat(int idx, const char *name);
+
+/**
+ * @brief
+ *  Starts timing a command on the calling thread.
+ *
+ * @return
+ *   The time the command started, for `addCmdStat()`.
+ */
+long startCmdStat();
+
+/**
+ * @brief
+ *  Counts a run of a command started on the calling thread, and traces it if
+ *  the stats are published.
+ *
+ * @param[in] idx       Index of the command, below `STATS_MAX_CMDS`.
+ * @param[in] path      Path the command ran on, or NULL.
+ * @param[in] start_ns  Time the command started, from `startCmdStat()`.
+ * @param[in] is_ok     Whether the command succeeded.
+ */
+void addCmdStat(int idx, const char *path, long start_ns, bool is_ok);
+
+/**
+ * @brief
+ *  Prints the commands run and every counter to standard error, once every
+ *  thread counting is done.
+ *
+ * @param[in] is_json  Whether to print a JSON object rather than a table.
+ */
+void printStats(bool is_json);
+
+/**
+ * @brief
+ *  Finds the live process that started last.
+ *
+ * @return
+ *   The ID of the process, or -1 if no live process is running.
+ */
+int findLiveProcess();
+
+/**
+ * @brief
+ *  Maps the shared memory segment of a live process read-only.
+ *
+ * @param[in] pid  The ID of the process.
+ *
+ * @return
+ *   The segment, or NULL if it cannot be mapped (sets errno).
+ */
+const struct LiveStats *attachStats(int pid);
+
+/**
+ * @brief
+ *  Unmaps the shared memory segment of a live process.
+ *
+ * @param[in] live  The segment, from `attachStats()`.
+ */
+void detachStats(const struct LiveStats *live);
+
+/**
+ * @brief
+ *  Adds up the counts of every thread of a live process.
+ *
+ * @param[in]  live   The segment of the process.
+ * @param[out] total  The counts of the whole process.
+ */
+void sumLiveStats(const struct LiveStats *live, struct ThreadStats *total);
+
+/**
+ * @brief
+ *  Copies a trace record of a live process, unless it is being written or was
+ *  already overwritten.
+ *
+ * @param[in]  live  The segment of the process.
+ * @param[in]  idx   Index of the record, below `trace_head`.
+ * @param[out] rec   The record.
+ *
+ * @return
+ *   true if the record was copied whole, false otherwise.
+ */
+bool readTraceRecord(const struct LiveStats *live, unsigned long idx,
+                     struct TraceRecord *rec);
+#endif
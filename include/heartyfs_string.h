@@ -97,4 +97,19 @@ void parseDir(char path[], char *buf, int buf_len);
  *  The found option character, or '\0' if none is found.
  */
 char parseOpt(char **start_arg, int len, int *idx);
+
+/**
+ * @brief 
+ *  Parses a non-negative size in bytes from a string.
+ *
+ *  The whole string must be a decimal number that fits in an `int`, otherwise
+ *  `errno` is set to `EINVAL`.
+ *
+ * @param[in]   str     The string to parse.
+ * @param[out]  size    The parsed size.
+ *
+ * @return 
+ *  `true` if the string is a valid size, `false` otherwise.
+ */
+bool parseSize(const char *str, int *size);
 #endif
\ No newline at end of file
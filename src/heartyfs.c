@@ -14,33 +14,75 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <unistd.h>
 
 #include "heartyfs.h"
+#include "heartyfs_backend.h"
 #include "heartyfs_bitmap.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_pool.h"
+#include "heartyfs_stats.h"
 #include "heartyfs_string.h"
 
 /* Private Functions */
 
-static union Block *_mapDisk();
-static int _unmapDisk(union Block *);
 static void _createVirtualDisk();
 static void _initSys(union Block *);
 static void _helpCmd(char *exe);
-static bool _getOpts(int argc, char *argv[], bool *opts, int *resume_idx);
+static bool _getOpts(int argc, char *argv[], bool *opts, char **vals,
+                     int *resume_idx);
 static bool _isCmdMatch(char *name, const void *cmd);
+static bool _isDisklessCmd(char *name);
+static char *_findPathArg(char **cmd, int cmd_len);
+static bool _runCmd(union Block *mem, char *exe, char **cmd, int cmd_len);
+static bool _runBatch(union Block *mem, char *exe, int jobs);
+static bool _runBatchCmd(void *arg);
 
 #define ARG_STR_LEN 32
 #define CMD_START_DEFAULT 1
+#define BATCH_MAX_ARGS 16
+#define JOBS_MAX 64
+#define ALLOC_CACHE_DEFAULT 16
 
-enum Options { OPT_HELP, OPT_RESET, OPT_PRINT_BITMAP };
-const char OPT_LIST[][ARG_STR_LEN] = {"help", "reset", "print-bitmap"};
+enum Options {
+    OPT_HELP,
+    OPT_RESET,
+    OPT_PRINT_BITMAP,
+    OPT_BATCH,
+    OPT_SYNC,
+    OPT_MAP,
+    OPT_BACKEND,
+    OPT_CACHE,
+    OPT_JOBS,
+    OPT_ALLOC_CACHE,
+    OPT_STATS,
+    OPT_LIVE
+};
+const char OPT_LIST[][ARG_STR_LEN] = {"help",  "reset", "print-bitmap",
+                                      "batch", "sync",  "map",
+                                      "backend", "cache", "jobs",
+                                      "alloc-cache", "stats", "live"};
 #define OPT_LIST_LEN (int)(sizeof(OPT_LIST) / sizeof(OPT_LIST[0]))
+// Values accepted by each option after a '=', empty for options without one
+// and in brackets for options where it may be left out.
+const char OPT_VALUE_LIST[OPT_LIST_LEN][ARG_STR_LEN] = {
+    [OPT_SYNC] = "none|async|ordered|full", [OPT_MAP] = "meta,populate,huge",
+    [OPT_BACKEND] = "mmap|pread|uring", [OPT_CACHE] = "blocks",
+    [OPT_JOBS] = "N", [OPT_ALLOC_CACHE] = "blocks", [OPT_STATS] = "[json]"};
 
 struct Cmd {
     char name[ARG_STR_LEN];
     bool (*call)(union Block *, char *, char **, int);
+    bool is_diskless; // Run without the disk, which is then NULL
+};
+
+// A command of a batch handed to a worker, owning the line it was read from.
+struct BatchCmd {
+    union Block *mem;
+    char *exe;
+    char *line;
+    char *cmd[BATCH_MAX_ARGS];
+    int cmd_len;
 };
 
 const struct Cmd CMD_LIST[] = {
@@ -48,27 +90,117 @@ const struct Cmd CMD_LIST[] = {
     {.name = "pwd", .call = pwdCmd},     {.name = "mkdir", .call = mkdirCmd},
     {.name = "rmdir", .call = rmdirCmd}, {.name = "create", .call = createCmd},
     {.name = "rm", .call = rmCmd},       {.name = "read", .call = readCmd},
-    {.name = "write", .call = writeCmd}};
+    {.name = "write", .call = writeCmd},
+    {.name = "truncate", .call = truncateCmd},
+    {.name = "fallocate", .call = fallocateCmd},
+    {.name = "cp", .call = cpCmd},       {.name = "find", .call = findCmd},
+    {.name = "import", .call = importCmd},
+    {.name = "export", .call = exportCmd},
+    {.name = "fsck", .call = fsckCmd},
+    {.name = "defrag", .call = defragCmd},
+    {.name = "statfs", .call = statfsCmd},
+    {.name = "compress", .call = compressCmd},
+    {.name = "dedup", .call = dedupCmd},
+    {.name = "top", .call = topCmd, .is_diskless = true}};
 #define CMD_LIST_LEN (int)(sizeof(CMD_LIST) / sizeof(struct Cmd))
 
 int main(int argc, char *argv[])
 {
     bool opts[OPT_LIST_LEN] = {0};
+    char *opt_vals[OPT_LIST_LEN] = {0};
     int cmd_start;
-    if (!_getOpts(argc, argv, opts, &cmd_start)) {
+    if (!_getOpts(argc, argv, opts, opt_vals, &cmd_start)) {
+        fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (opts[OPT_SYNC]) {
+        enum SyncModes mode;
+        if (!parseSyncMode(opt_vals[OPT_SYNC], &mode)) {
+            fprintf(stderr, "%s: Invalid sync mode\n", opt_vals[OPT_SYNC]);
+            fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        setSyncMode(mode);
+    }
+    if (opts[OPT_MAP]) {
+        int flags;
+        if (!parseMappingFlags(opt_vals[OPT_MAP], &flags)) {
+            fprintf(stderr, "%s: Invalid mapping flags\n", opt_vals[OPT_MAP]);
+            fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        setMappingFlags(flags);
+    }
+    if (opts[OPT_BACKEND]) {
+        enum BackendTypes type;
+        if (!parseBackend(opt_vals[OPT_BACKEND], &type)) {
+            fprintf(stderr, "%s: Invalid backend\n", opt_vals[OPT_BACKEND]);
+            fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        setBackend(type);
+    }
+    if (opts[OPT_CACHE]) {
+        int size;
+        if (!parseSize(opt_vals[OPT_CACHE], &size) || size == 0) {
+            fprintf(stderr, "%s: Invalid cache size\n", opt_vals[OPT_CACHE]);
+            fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        setCacheSize(size);
+    }
+    int jobs = 1;
+    if (opts[OPT_JOBS] &&
+        (!parseSize(opt_vals[OPT_JOBS], &jobs) || jobs == 0 || jobs > JOBS_MAX)) {
+        fprintf(stderr, "%s: Invalid number of jobs\n", opt_vals[OPT_JOBS]);
         fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
         return EXIT_FAILURE;
     }
+    // A single thread has nothing to gain from claiming blocks ahead.
+    int alloc_cache = (jobs > 1) ? ALLOC_CACHE_DEFAULT : 0;
+    if (opts[OPT_ALLOC_CACHE] &&
+        (!parseSize(opt_vals[OPT_ALLOC_CACHE], &alloc_cache) ||
+         alloc_cache > ALLOC_CACHE_MAX_BLOCKS)) {
+        fprintf(stderr, "%s: Invalid allocation cache size\n",
+                opt_vals[OPT_ALLOC_CACHE]);
+        fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    setAllocCacheSize(alloc_cache);
+    if (opts[OPT_STATS]) {
+        if (opt_vals[OPT_STATS] != NULL &&
+            strcmp(opt_vals[OPT_STATS], "json") != 0) {
+            fprintf(stderr, "%s: Invalid stats format\n", opt_vals[OPT_STATS]);
+            fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        enableStats();
+    }
+    if (opts[OPT_LIVE] && !publishStats()) {
+        perror("Cannot publish the stats");
+        return EXIT_FAILURE;
+    }
+    if (is_stats_enabled)
+        for (int i = 0; i < CMD_LIST_LEN; i++)
+            nameCmdStat(i, CMD_LIST[i].name);
 
     if (opts[OPT_RESET] || access(DISK_FILE_PATH, F_OK) != 0) {
         _createVirtualDisk();
 
-        union Block *mem = _mapDisk();
+        setDiskLocking(DISK_LOCK_WHOLE);
+        union Block *mem = mountDisk();
+        if (mem == NULL)
+            return EXIT_FAILURE;
         _initSys(mem);
-        _unmapDisk(mem);
-        if (setCWD(ROOT_ID) == false)
+        bool is_written = writeWholeDisk(mem);
+        unmountDisk(mem);
+        if (!is_written || setCWD(ROOT_ID) == false)
             return EXIT_FAILURE;
     }
+    // A batch keeps changes of finished commands uncommitted, so it could not
+    // release their locks in order.
+    setDiskLocking(opts[OPT_BATCH] ? DISK_LOCK_WHOLE : DISK_LOCK_BLOCKS);
+    setJobCount(jobs);
     if (access(CWD_STORE_PATH, F_OK) != 0 && setCWD(ROOT_ID) == false) {
         return EXIT_FAILURE;
     }
@@ -80,34 +212,192 @@ int main(int argc, char *argv[])
 
     int status = EXIT_SUCCESS;
     char **cmd = argv + cmd_start;
-    union Block *mem = _mapDisk();
+    // Such a command need not wait for a batch holding the disk.
+    if (!opts[OPT_BATCH] && cmd_start < argc && _isDisklessCmd(cmd[0])) {
+        if (!_runCmd(NULL, argv[0], cmd, argc - cmd_start))
+            status = EXIT_FAILURE;
+        if (opts[OPT_STATS])
+            printStats(opt_vals[OPT_STATS] != NULL);
+        return status;
+    }
+    union Block *mem = mountDisk();
+    if (mem == NULL)
+        return EXIT_FAILURE;
 
-    if (cmd_start < argc) {
-        int idx = findStr(cmd[0], CMD_LIST, CMD_LIST_LEN, sizeof(struct Cmd),
-                          _isCmdMatch);
-        if (idx != -1) {
-            if (!CMD_LIST[idx].call(mem, argv[0], cmd, argc - cmd_start))
-                status = EXIT_FAILURE;
-        } else {
-            errno = EINVAL;
-            fprintf(stderr, "%s: Invalid command\n", cmd[0]);
-            fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+    if (opts[OPT_BATCH]) {
+        if (!_runBatch(mem, argv[0], jobs))
+            status = EXIT_FAILURE;
+    } else if (cmd_start < argc) {
+        // As an operation, the command may commit in steps when it is large.
+        if (!beginDiskOp(mem)) {
             status = EXIT_FAILURE;
+        } else {
+            if (!_runCmd(mem, argv[0], cmd, argc - cmd_start))
+                status = EXIT_FAILURE;
+            if (!endDiskOp(mem))
+                status = EXIT_FAILURE;
         }
     } else if (cmd_start == CMD_START_DEFAULT) {
         fprintf(stderr, "No command found.\n");
         fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
         status = EXIT_FAILURE;
     }
-    if (status == EXIT_FAILURE) {
+    if (!commitDisk(mem)) {
+        status = EXIT_FAILURE;
+    } else if (status == EXIT_FAILURE) {
     } else if (opts[OPT_PRINT_BITMAP]) {
         printf("\n---Bitmap---\n");
+        lockDiskBlock(BITMAP_ID, false);
         printBitmap(mem[BITMAP_ID].bitmap);
+        unlockDiskBlock(BITMAP_ID);
     }
-    _unmapDisk(mem);
+    unmountDisk(mem);
+    if (opts[OPT_STATS])
+        printStats(opt_vals[OPT_STATS] != NULL);
     return status;
 }
 
+/**
+ * @brief 
+ *  Looks up a command by name and runs it.
+ * 
+ * @param[in, out] mem      Pointer to the mapped memory.
+ * @param[in]      exe      Name of the executable.
+ * @param[in]      cmd      Array of command arguments, starting with the name.
+ * @param[in]      cmd_len  The length of the command argument array.
+ * 
+ * @return 
+ *   true if the command succeeded, false otherwise.
+ */
+static bool _runCmd(union Block *mem, char *exe, char **cmd, int cmd_len)
+{
+    int idx = findStr(cmd[0], CMD_LIST, CMD_LIST_LEN, sizeof(struct Cmd),
+                      _isCmdMatch);
+    if (idx == -1) {
+        errno = EINVAL;
+        fprintf(stderr, "%s: Invalid command\n", cmd[0]);
+        fprintf(stderr, "Try '%s --help' for more information.\n", exe);
+        return false;
+    }
+    if (!is_stats_enabled)
+        return CMD_LIST[idx].call(mem, exe, cmd, cmd_len);
+    long start_ns = startCmdStat();
+    bool is_ok = CMD_LIST[idx].call(mem, exe, cmd, cmd_len);
+    addCmdStat(idx, _findPathArg(cmd, cmd_len), start_ns, is_ok);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Finds the path a command runs on, its first argument that is not an option.
+ *
+ * @param[in] cmd      Array of command arguments, starting with the name.
+ * @param[in] cmd_len  The length of the command argument array.
+ *
+ * @return
+ *   The path, or NULL if the command has none.
+ */
+static char *_findPathArg(char **cmd, int cmd_len)
+{
+    for (int i = 1; i < cmd_len; i++)
+        if (cmd[i][0] != '-')
+            return cmd[i];
+    return NULL;
+}
+
+/**
+ * @brief 
+ *  Runs commands read from standard input, one per line with arguments
+ *  separated by spaces, on a pool of worker threads.
+ * 
+ * @note 
+ *  The changes of the commands are grouped into as few transactions as the
+ *  journal allows, so the whole batch pays for a single commit instead of one
+ *  per command. A failing command does not stop the batch. With more than one
+ *  job, commands run in any order, and an empty line waits for every command
+ *  before it to finish.
+ * 
+ * @param[in, out] mem   Pointer to the mapped memory.
+ * @param[in]      exe   Name of the executable.
+ * @param[in]      jobs  Number of worker threads.
+ * 
+ * @return 
+ *   true if every command succeeded, false otherwise.
+ */
+static bool _runBatch(union Block *mem, char *exe, int jobs)
+{
+    struct Pool *pool = startPool(jobs);
+    if (pool == NULL) {
+        perror("Batch");
+        return false;
+    }
+
+    bool is_ok = true;
+    char *line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, stdin) != -1) {
+        line[strcspn(line, "\n")] = '\0';
+
+        struct BatchCmd *batch_cmd = malloc(sizeof(struct BatchCmd));
+        if (batch_cmd == NULL) {
+            perror("Batch");
+            is_ok = false;
+            break;
+        }
+        *batch_cmd = (struct BatchCmd){.mem = mem, .exe = exe, .line = line};
+        char *ptr = line;
+        char *substr;
+        while (batch_cmd->cmd_len < BATCH_MAX_ARGS &&
+               splitStr(&substr, ' ', &ptr))
+            if (substr[0] != '\0')
+                batch_cmd->cmd[batch_cmd->cmd_len++] = substr;
+
+        if (batch_cmd->cmd_len == 0) {
+            free(batch_cmd);
+            if (!waitPool(pool))
+                is_ok = false;
+            continue;
+        }
+        if (!submitTask(pool, _runBatchCmd, batch_cmd)) {
+            perror("Batch");
+            free(batch_cmd);
+            is_ok = false;
+            break;
+        }
+        // The command owns the line now.
+        line = NULL;
+        line_size = 0;
+    }
+    free(line);
+    if (!stopPool(pool))
+        is_ok = false;
+    return is_ok;
+}
+
+/**
+ * @brief 
+ *  Runs a command of a batch as one operation on the disk, on a worker thread.
+ * 
+ * @param[in] arg   The `struct BatchCmd` to run, freed afterwards.
+ * 
+ * @return 
+ *   true if the command succeeded, false otherwise.
+ */
+static bool _runBatchCmd(void *arg)
+{
+    struct BatchCmd *batch_cmd = arg;
+    bool is_ok = beginDiskOp(batch_cmd->mem);
+    if (is_ok) {
+        is_ok = _runCmd(batch_cmd->mem, batch_cmd->exe, batch_cmd->cmd,
+                        batch_cmd->cmd_len);
+        if (!endDiskOp(batch_cmd->mem))
+            is_ok = false;
+    }
+    free(batch_cmd->line);
+    free(batch_cmd);
+    return is_ok;
+}
+
 /**
  * @brief 
  *  Checks if a command matches a given name.
@@ -124,29 +414,59 @@ static bool _isCmdMatch(char *name, const void *cmd)
     return (strcmp(name, cmd_name) == 0) ? true : false;
 }
 
+/**
+ * @brief
+ *  Checks if a command runs without the disk.
+ *
+ * @param[in] name  Name of the command.
+ *
+ * @return
+ *   true if the command exists and needs no disk, false otherwise.
+ */
+static bool _isDisklessCmd(char *name)
+{
+    int idx = findStr(name, CMD_LIST, CMD_LIST_LEN, sizeof(struct Cmd),
+                      _isCmdMatch);
+    return idx != -1 && CMD_LIST[idx].is_diskless;
+}
+
 /**
  * @brief
  *  Parses command-line options and sets corresponding flags.
  *
+ * @note
+ *  Options listed with values in `OPT_VALUE_LIST` must be given as
+ *  `--<option>=<value>`, unless the value is in brackets, and the others must
+ *  not have a value.
+ *
  * @param[in] argc	        Number of command-line arguments.
  * @param[in] argv	        Array of command-line arguments.
  * @param[out] opts	        Array to store the status of each option.
+ * @param[out] vals	        Array to store the value given to each option.
  * @param[out] resume_idx	Index of the first non-option argument in argv.
  *
  * @return
  *   true  : Options parsed successfully @n
  *   false : Invalid option encountered (sets errno).
  */
-static bool _getOpts(int argc, char *argv[], bool *opts, int *resume_idx)
+static bool _getOpts(int argc, char *argv[], bool *opts, char **vals,
+                     int *resume_idx)
 {
     int i = CMD_START_DEFAULT;
     char opt_prefix[] = "--";
     size_t preifx_len = strlen(opt_prefix);
     for (; i < argc && strncmp(argv[i], opt_prefix, preifx_len) == 0; i++) {
+        char *name = argv[i] + preifx_len;
+        char *val = strchr(name, '=');
+        size_t name_len = (val == NULL) ? strlen(name) : (size_t)(val - name);
         bool is_valid = false;
         for (int j = 0; j < OPT_LIST_LEN; j++)
-            if (strncmp(argv[i] + preifx_len, OPT_LIST[j], ARG_STR_LEN) == 0) {
+            if (strlen(OPT_LIST[j]) == name_len &&
+                strncmp(name, OPT_LIST[j], name_len) == 0 &&
+                ((val != NULL) == (OPT_VALUE_LIST[j][0] != '\0') ||
+                 (val == NULL && OPT_VALUE_LIST[j][0] == '['))) {
                 opts[j] = true;
+                vals[j] = (val == NULL) ? NULL : val + 1;
                 is_valid = true;
             }
         if (!is_valid) {
@@ -175,7 +495,13 @@ static void _helpCmd(char *exe)
 
     printf("\nOptions List:\n");
     for (int i = 0; i < OPT_LIST_LEN; i++)
-        printf("   --%s\n", OPT_LIST[i]);
+        if (OPT_VALUE_LIST[i][0] == '\0')
+            printf("   --%s\n", OPT_LIST[i]);
+        else if (OPT_VALUE_LIST[i][0] == '[')
+            printf("   --%s[=%.*s]\n", OPT_LIST[i],
+                   (int)strlen(OPT_VALUE_LIST[i]) - 2, OPT_VALUE_LIST[i] + 1);
+        else
+            printf("   --%s=%s\n", OPT_LIST[i], OPT_VALUE_LIST[i]);
 }
 
 /**
@@ -194,42 +520,8 @@ static void _createVirtualDisk()
 
 /**
  * @brief
- *  Maps the virtual disk file to memory.
- *
- * @return
- *   Pointer to the mapped memory on success @n
- *   Exits the program on failure.
- */
-static union Block *_mapDisk()
-{
-    int fd = open(DISK_FILE_PATH, O_RDWR);
-    if (fd < 0) {
-        perror("Cannot open the disk file\n");
-        exit(1);
-    }
-    void *buffer =
-        mmap(NULL, DISK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (buffer == MAP_FAILED) {
-        perror("Cannot map the disk file onto memory\n");
-        exit(1);
-    }
-    return buffer;
-}
-
-/**
- * @brief
- *  Unmaps the virtual disk from memory.
- *
- * @param[in] mem   Pointer to the mapped memory.
- *
- * @return
- *   Result of the munmap operation.
- */
-static int _unmapDisk(union Block *mem) { return munmap(mem, DISK_SIZE); }
-
-/**
- * @brief
- *  Initializes the root directory and bitmap of the virtual file system.
+ *  Initializes the root directory, bitmap and empty journal of the virtual
+ *  file system.
  *
  * @param[in, out] mem  Pointer to the mapped memory where the system is
  *                      initialized.
@@ -245,5 +537,6 @@ static void _initSys(union Block *mem)
 
     memset(mem[BITMAP_ID].bitmap, 0xFF, BITMAP_LEN);
 
-    setBitmapUsed(mem[BITMAP_ID].bitmap, &(struct Interval){0, 2});
+    setBitmapUsed(mem[BITMAP_ID].bitmap,
+                  &(struct Interval){0, RESERVED_BLOCK_COUNT});
 }
\ No newline at end of file
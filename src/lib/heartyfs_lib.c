@@ -0,0 +1,633 @@
+/**
+ * @file heartyfs_lib.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing libheartyfs on top of the file system utilities.
+ *
+ *  Every call runs as one operation between `beginDiskOp()` and
+ *  `endDiskOp()`, taking the same inode locks as the commands of a batch, so
+ *  calls from several threads interleave like the commands of `--jobs`. The
+ *  errors of the utilities are muted on mount and their errno is returned
+ *  instead.
+ *
+ *  A handle keeps its position in the file, along with the block holding it,
+ *  so that sequential reads continue where the last one stopped. The handles
+ *  open on a file share a node holding its inode and size, so neither the
+ *  path nor the size is looked up again until the file is closed. The node
+ *  is only changed under the write lock of its inode.
+ *
+ *  Writing to a compressed file encodes its chunks again from the one
+ *  written to, which moves the bytes of every later chunk. The node counts
+ *  these writes, and a handle whose position was found before the last one
+ *  looks it up again on its next read.
+ *
+ *  The mutex of a handle is held for a whole read or write, so calls on the
+ *  same handle run one at a time and `hfs_close()` waits for them, while
+ *  calls on different handles only contend on the inode locks.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heartyfs.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_lib.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_math.h"
+#include "heartyfs_stats.h"
+#include "heartyfs_string.h"
+
+#define HFS_O_ALL                                                              \
+    (HFS_O_ACCMODE | HFS_O_CREAT | HFS_O_TRUNC | HFS_O_APPEND |             \
+     HFS_O_COMPRESS)
+
+// A file open on at least one handle.
+struct HfsNode {
+    int id;
+    int size;       // Bytes of the file, guarded by the lock of the inode
+    int open_count; // Handles open on the file, guarded by `files_lock`
+    int gen;        // Writes moving chunks, guarded by the lock of the inode
+};
+
+struct HfsFile {
+    pthread_mutex_t lock; // Held by the calls on the handle
+    bool is_used;         // Taken by a handle, guarded by `files_lock`
+    bool is_open;         // Ready for calls, guarded by `lock`
+    struct HfsNode *node;
+    int flags;
+    struct FilePos pos;
+    int pos_gen; // `gen` of the node when the position was found
+};
+
+struct hfs {
+    union Block *mem;
+    pthread_mutex_t files_lock;
+    struct HfsFile files[HFS_MAX_FILES];
+    struct HfsNode nodes[HFS_MAX_FILES];
+};
+
+static pthread_mutex_t mount_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool is_mounted = false;
+
+static int _openFile(struct hfs *fs, int fd, char *path, int flags);
+static struct HfsNode *_takeNode(struct hfs *fs, int id);
+static int _takeHandle(struct hfs *fs);
+static void _releaseHandle(struct hfs *fs, int fd);
+static struct HfsFile *_lockHandle(struct hfs *fs, int fd);
+static int _endOp(union Block *mem, int ret);
+static int _writeFileAt(union Block *mem, struct HfsNode *node,
+                        const void *buf, int size, int offset);
+static int _writeChunksAt(union Block *mem, struct HfsNode *node,
+                          const void *buf, int size, int offset);
+static bool _isDirName(const char *name);
+
+int hfs_mount(const char *sync_mode, struct hfs **fs)
+{
+    enum SyncModes mode = SYNC_ORDERED;
+    if (sync_mode != NULL && !parseSyncMode(sync_mode, &mode))
+        return -EINVAL;
+
+    pthread_mutex_lock(&mount_lock);
+    if (is_mounted) {
+        pthread_mutex_unlock(&mount_lock);
+        return -EBUSY;
+    }
+    struct hfs *new_fs = malloc(sizeof(struct hfs));
+    if (new_fs == NULL) {
+        pthread_mutex_unlock(&mount_lock);
+        return -ENOMEM;
+    }
+
+    muteErrors();
+    setSyncMode(mode);
+    // Calls are grouped into transactions like the commands of a batch, which
+    // cannot be seen half-committed by other processes either.
+    setDiskLocking(DISK_LOCK_WHOLE);
+    new_fs->mem = mountDisk();
+    if (new_fs->mem == NULL) {
+        int err = errno;
+        free(new_fs);
+        pthread_mutex_unlock(&mount_lock);
+        return -err;
+    }
+    pthread_mutex_init(&new_fs->files_lock, NULL);
+    for (int fd = 0; fd < HFS_MAX_FILES; fd++) {
+        new_fs->files[fd] = (struct HfsFile){0};
+        pthread_mutex_init(&new_fs->files[fd].lock, NULL);
+        new_fs->nodes[fd] = (struct HfsNode){0};
+    }
+    is_mounted = true;
+    pthread_mutex_unlock(&mount_lock);
+    *fs = new_fs;
+    return 0;
+}
+
+int hfs_unmount(struct hfs *fs)
+{
+    for (int fd = 0; fd < HFS_MAX_FILES; fd++) {
+        pthread_mutex_destroy(&fs->files[fd].lock);
+    }
+    pthread_mutex_destroy(&fs->files_lock);
+
+    int ret = unmountDisk(fs->mem) ? 0 : -errno;
+    free(fs);
+    pthread_mutex_lock(&mount_lock);
+    is_mounted = false;
+    pthread_mutex_unlock(&mount_lock);
+    return ret;
+}
+
+int hfs_sync(struct hfs *fs) { return commitDisk(fs->mem) ? 0 : -errno; }
+
+int hfs_open(struct hfs *fs, const char *path, int flags)
+{
+    if (path[0] != '/' || (flags & ~HFS_O_ALL) != 0 ||
+        (flags & HFS_O_ACCMODE) == HFS_O_ACCMODE ||
+        ((flags & HFS_O_TRUNC) && (flags & HFS_O_ACCMODE) == HFS_O_RDONLY))
+        return -EINVAL;
+
+    int fd = _takeHandle(fs);
+    if (fd < 0)
+        return fd;
+    if (!beginDiskOp(fs->mem)) {
+        _releaseHandle(fs, fd);
+        return -errno;
+    }
+    int ret = _endOp(fs->mem, _openFile(fs, fd, (char *)path, flags));
+    if (ret < 0) {
+        _releaseHandle(fs, fd);
+        return ret;
+    }
+
+    struct HfsFile *file = &fs->files[fd];
+    pthread_mutex_lock(&file->lock);
+    file->flags = flags;
+    setFilePos(&file->pos, 0);
+    file->is_open = true;
+    pthread_mutex_unlock(&file->lock);
+    return fd;
+}
+
+int hfs_close(struct hfs *fs, int fd)
+{
+    struct HfsFile *file = _lockHandle(fs, fd);
+    if (file == NULL)
+        return -EBADF;
+    file->is_open = false;
+    pthread_mutex_unlock(&file->lock);
+    _releaseHandle(fs, fd);
+    return 0;
+}
+
+int hfs_read(struct hfs *fs, int fd, void *buf, int size)
+{
+    if (size < 0)
+        return -EINVAL;
+    struct HfsFile *file = _lockHandle(fs, fd);
+    if (file == NULL)
+        return -EBADF;
+    if ((file->flags & HFS_O_ACCMODE) == HFS_O_WRONLY) {
+        pthread_mutex_unlock(&file->lock);
+        return -EBADF;
+    }
+    if (!beginDiskOp(fs->mem)) {
+        pthread_mutex_unlock(&file->lock);
+        return -errno;
+    }
+
+    struct HfsNode *node = file->node;
+    lockInodeRead(node->id);
+    if (file->pos_gen != node->gen) {
+        setFilePos(&file->pos, file->pos.offset);
+        file->pos_gen = node->gen;
+    }
+    int ret = 0;
+    if (file->pos.offset < node->size)
+        ret = readFilePos(fs->mem, node->id, buf, size, &file->pos);
+    unlockInode(node->id);
+
+    ret = _endOp(fs->mem, ret);
+    pthread_mutex_unlock(&file->lock);
+    return ret;
+}
+
+int hfs_write(struct hfs *fs, int fd, const void *buf, int size)
+{
+    if (size < 0)
+        return -EINVAL;
+    struct HfsFile *file = _lockHandle(fs, fd);
+    if (file == NULL)
+        return -EBADF;
+    if ((file->flags & HFS_O_ACCMODE) == HFS_O_RDONLY) {
+        pthread_mutex_unlock(&file->lock);
+        return -EBADF;
+    }
+    if (!beginDiskOp(fs->mem)) {
+        pthread_mutex_unlock(&file->lock);
+        return -errno;
+    }
+
+    struct HfsNode *node = file->node;
+    lockInodeWrite(node->id);
+    if (file->flags & HFS_O_APPEND)
+        setFilePos(&file->pos, node->size);
+    int ret = (fs->mem[node->id].file.flags & FILE_COMPRESSED)
+                  ? _writeChunksAt(fs->mem, node, buf, size, file->pos.offset)
+                  : _writeFileAt(fs->mem, node, buf, size, file->pos.offset);
+    if (ret > 0)
+        setFilePos(&file->pos, file->pos.offset + ret);
+    file->pos_gen = node->gen;
+    unlockInode(node->id);
+
+    ret = _endOp(fs->mem, ret);
+    pthread_mutex_unlock(&file->lock);
+    return ret;
+}
+
+int hfs_readdir(struct hfs *fs, const char *path, struct hfs_dirent *entries,
+                int max)
+{
+    if (path[0] != '/')
+        return -EINVAL;
+    if (!beginDiskOp(fs->mem))
+        return -errno;
+
+    union Block *mem = fs->mem;
+    int id = lockNodeID(mem, (char *)path, false);
+    if (id == -1)
+        return _endOp(mem, -errno);
+    struct DirNode *dir = &mem[id].dir;
+    if (dir->type != TYPE_DIR) {
+        int err = (dir->type == TYPE_DELETED) ? ENOENT : ENOTDIR;
+        unlockInode(id);
+        return _endOp(mem, -err);
+    }
+
+    int count = 0;
+    for (int i = PARENT_DIR_ENTRY_IDX + 1; i < dir->len; i++, count++) {
+        if (count >= max)
+            continue;
+        struct DirEntry *entry = &dir->entries[i];
+        struct hfs_dirent *dirent = &entries[count];
+        dirent->id = entry->block_id;
+        memcpy(dirent->name, entry->name, NAME_MAX_LEN);
+        dirent->name[NAME_MAX_LEN] = '\0';
+        // Children are locked after their parent, so the lock order holds.
+        lockInodeRead(entry->block_id);
+        dirent->type = (mem[entry->block_id].dir.type == TYPE_DIR)
+                           ? HFS_TYPE_DIR
+                           : HFS_TYPE_FILE;
+        unlockInode(entry->block_id);
+    }
+    unlockInode(id);
+    return _endOp(mem, count);
+}
+
+int hfs_stat(struct hfs *fs, const char *path, struct hfs_stat *st)
+{
+    if (path[0] != '/')
+        return -EINVAL;
+    if (!beginDiskOp(fs->mem))
+        return -errno;
+
+    union Block *mem = fs->mem;
+    int id = lockNodeID(mem, (char *)path, false);
+    if (id == -1)
+        return _endOp(mem, -errno);
+    int ret = 0;
+    st->id = id;
+    if (mem[id].dir.type == TYPE_DIR) {
+        st->type = HFS_TYPE_DIR;
+        st->size = mem[id].dir.len - (PARENT_DIR_ENTRY_IDX + 1);
+        st->blocks = 0;
+    } else if (mem[id].file.type == TYPE_FILE) {
+        st->type = HFS_TYPE_FILE;
+        st->size = calcFileSize(mem, id);
+        st->blocks = mem[id].file.len + mem[id].file.prealloc;
+    } else {
+        ret = -ENOENT;
+    }
+    unlockInode(id);
+    return _endOp(mem, ret);
+}
+
+/**
+ * @brief
+ *  Looks up a file to open, creating or emptying it as the flags ask, and
+ *  gives its node to a handle.
+ *
+ * @param[in, out] fs     The mounted disk.
+ * @param[in]      fd     The handle, taken but not open yet.
+ * @param[in]      path   Absolute path of the file.
+ * @param[in]      flags  `HFS_O_*` flags of the handle.
+ *
+ * @return
+ *   0 on success, or a negative errno.
+ */
+static int _openFile(struct hfs *fs, int fd, char *path, int flags)
+{
+    union Block *mem = fs->mem;
+    const char *name = strrchr(path, '/') + 1;
+    if (_isDirName(name))
+        return -EISDIR;
+    if (strlen(name) > NAME_MAX_LEN)
+        return -ENAMETOOLONG;
+
+    bool is_creat = (flags & HFS_O_CREAT) != 0;
+    int parent_id = lockParentID(mem, path, is_creat);
+    if (parent_id == -1)
+        return -errno;
+
+    struct DirNode *parent = &mem[parent_id].dir;
+    int id = -ENOENT;
+    int idx = findStr((char *)name, parent->entries, parent->len,
+                      sizeof(struct DirEntry), isDirEntryMatch);
+    if (idx != -1) {
+        id = parent->entries[idx].block_id;
+    } else if (!is_creat) {
+    } else if (parent->len == DIR_MAX_ENTRIES) {
+        id = -ENOSPC;
+    } else {
+        id = initFileNode(mem, (char *)name, parent_id, ROOT_ID);
+        if (id == -1) {
+            id = -errno;
+        } else if (flags & HFS_O_COMPRESS) {
+            mem[id].file.flags |= FILE_COMPRESSED;
+            markBlockDirty(id);
+        }
+    }
+    if (id < 0) {
+        unlockInode(parent_id);
+        return id;
+    }
+
+    bool is_trunc = (flags & HFS_O_TRUNC) != 0;
+    if (is_trunc)
+        lockInodeWrite(id);
+    else
+        lockInodeRead(id);
+    int ret = 0;
+    if (mem[id].file.type == TYPE_DIR) {
+        ret = -EISDIR;
+    } else if (mem[id].file.type != TYPE_FILE) {
+        ret = -ENOENT;
+    } else {
+        if (is_trunc)
+            deleteFileData(mem, id);
+        // Taken under the lock of the inode, so that the size it caches
+        // cannot change before it is shared.
+        struct HfsNode *node = _takeNode(fs, id);
+        if (is_trunc) {
+            node->size = 0;
+            node->gen++;
+        }
+        fs->files[fd].node = node;
+        fs->files[fd].pos_gen = node->gen;
+    }
+    unlockInode(id);
+    unlockInode(parent_id);
+    return ret;
+}
+
+/**
+ * @brief
+ *  Takes the node of a file for a handle, setting up a free node if the file
+ *  is not open yet.
+ *
+ * @note
+ *  There is always a free node, since there are as many nodes as handles.
+ *
+ * @param[in, out] fs  The mounted disk.
+ * @param[in]      id  ID of the file, locked.
+ *
+ * @return
+ *   The node of the file.
+ */
+static struct HfsNode *_takeNode(struct hfs *fs, int id)
+{
+    pthread_mutex_lock(&fs->files_lock);
+    // Settles on the first free node unless the file is found open.
+    struct HfsNode *node = &fs->nodes[0];
+    for (int i = 0; i < HFS_MAX_FILES; i++) {
+        struct HfsNode *curr = &fs->nodes[i];
+        if (curr->open_count > 0 && curr->id == id) {
+            node = curr;
+            break;
+        } else if (curr->open_count == 0 && node->open_count > 0) {
+            node = curr;
+        }
+    }
+    if (node->open_count == 0) {
+        node->id = id;
+        node->size = calcFileSize(fs->mem, id);
+    }
+    node->open_count++;
+    pthread_mutex_unlock(&fs->files_lock);
+    return node;
+}
+
+/**
+ * @brief
+ *  Takes a free handle.
+ *
+ * @param[in, out] fs  The mounted disk.
+ *
+ * @return
+ *   The handle, or `-EMFILE` if every handle is taken.
+ */
+static int _takeHandle(struct hfs *fs)
+{
+    pthread_mutex_lock(&fs->files_lock);
+    int fd = 0;
+    while (fd < HFS_MAX_FILES && fs->files[fd].is_used)
+        fd++;
+    if (fd < HFS_MAX_FILES)
+        fs->files[fd].is_used = true;
+    pthread_mutex_unlock(&fs->files_lock);
+    return (fd < HFS_MAX_FILES) ? fd : -EMFILE;
+}
+
+/**
+ * @brief
+ *  Gives back a handle taken by `_takeHandle()`, along with its node.
+ *
+ * @param[in, out] fs  The mounted disk.
+ * @param[in]      fd  The handle, closed.
+ */
+static void _releaseHandle(struct hfs *fs, int fd)
+{
+    pthread_mutex_lock(&fs->files_lock);
+    struct HfsFile *file = &fs->files[fd];
+    if (file->node != NULL)
+        file->node->open_count--;
+    file->node = NULL;
+    file->is_used = false;
+    pthread_mutex_unlock(&fs->files_lock);
+}
+
+/**
+ * @brief
+ *  Locks an open handle for a call.
+ *
+ * @param[in, out] fs  The mounted disk.
+ * @param[in]      fd  The handle.
+ *
+ * @return
+ *   The file of the handle, locked, or NULL if the handle is not open.
+ */
+static struct HfsFile *_lockHandle(struct hfs *fs, int fd)
+{
+    if (fd < 0 || fd >= HFS_MAX_FILES)
+        return NULL;
+    struct HfsFile *file = &fs->files[fd];
+    pthread_mutex_lock(&file->lock);
+    if (!file->is_open) {
+        pthread_mutex_unlock(&file->lock);
+        return NULL;
+    }
+    return file;
+}
+
+/**
+ * @brief
+ *  Ends the operation of a call.
+ *
+ * @param[in, out] mem  Memory block representing the file system.
+ * @param[in]      ret  The result of the call.
+ *
+ * @return
+ *   The result of the call, or a negative errno if it succeeded but its
+ *   commit failed.
+ */
+static int _endOp(union Block *mem, int ret)
+{
+    if (!endDiskOp(mem) && ret >= 0)
+        return -errno;
+    return ret;
+}
+
+/**
+ * @brief
+ *  Writes data into a file at an offset, overwriting the bytes already there
+ *  and appending the rest, after zeroes filling any gap from the end of the
+ *  file.
+ *
+ * @note
+ *  Every block needed is reserved first, and the shared blocks overwritten
+ *  are copied, so the file is left untouched if the disk is full.
+ *
+ * @param[in, out] mem     Memory block representing the file system.
+ * @param[in, out] node    Node of the file, write-locked, with its size
+ *                         updated.
+ * @param[in]      buf     The data.
+ * @param[in]      size    Size of the data.
+ * @param[in]      offset  Offset to write the data at.
+ *
+ * @return
+ *   `size`, or a negative errno.
+ */
+static int _writeFileAt(union Block *mem, struct HfsNode *node,
+                        const void *buf, int size, int offset)
+{
+    if (offset + size > FILE_MAX_SIZE)
+        return -EFBIG;
+    int id = node->id;
+    struct FileNode *file = &mem[id].file;
+    int file_size = node->size;
+    int new_len = ceilDivInt(maxInt(file_size, offset + size), BLOCK_MAX_DATA);
+    int overwrite_end = ceilDivInt(minInt(offset + size, file_size),
+                                   BLOCK_MAX_DATA);
+    if (!unshareFileBlocks(mem, id, offset / BLOCK_MAX_DATA, overwrite_end) ||
+        !reserveFileBlocks(mem, id, new_len - file->len - file->prealloc))
+        return -ENOSPC;
+
+    if (offset > file_size) {
+        writeFileID(mem, id, NULL, offset - file_size);
+        file_size = offset;
+    }
+    int overwrite_size = minInt(size, file_size - offset);
+    writeFileID(mem, id, (uint8_t *)buf + overwrite_size,
+                size - overwrite_size);
+    node->size = maxInt(file_size, offset + size);
+
+    const uint8_t *buf_ptr = buf;
+    for (int i = offset / BLOCK_MAX_DATA; overwrite_size > 0; i++) {
+        int block_offset = offset % BLOCK_MAX_DATA;
+        int write_size = minInt(overwrite_size, BLOCK_MAX_DATA - block_offset);
+        memcpy(mem[file->blocks[i]].data.data + block_offset, buf_ptr,
+               write_size);
+        markDataDirty(file->blocks[i]);
+        countStat(STAT_BYTES_WRITTEN, write_size);
+
+        buf_ptr += write_size;
+        offset += write_size;
+        overwrite_size -= write_size;
+    }
+    return size;
+}
+
+/**
+ * @brief
+ *  Writes data into a compressed file at an offset, like `_writeFileAt()`.
+ *
+ * @note
+ *  The chunks from the one holding the offset to the end of the file are
+ *  encoded again with the data in place, and only replace the old ones once
+ *  they all fit, so the file is left untouched on failure.
+ *
+ * @param[in, out] mem     Memory block representing the file system.
+ * @param[in, out] node    Node of the compressed file, write-locked, with its
+ *                         size and generation updated.
+ * @param[in]      buf     The data.
+ * @param[in]      size    Size of the data.
+ * @param[in]      offset  Offset to write the data at.
+ *
+ * @return
+ *   `size`, or a negative errno.
+ */
+static int _writeChunksAt(union Block *mem, struct HfsNode *node,
+                          const void *buf, int size, int offset)
+{
+    int id = node->id;
+    struct FilePos pos;
+    setFilePos(&pos, minInt(offset, node->size));
+    seekFilePos(mem, id, &pos);
+    int start = pos.offset - pos.block_offset;
+    int old_size = node->size - start;
+    int new_size = maxInt(node->size, offset + size) - start;
+    uint8_t *tail = malloc(new_size);
+    if (tail == NULL && new_size > 0)
+        return -ENOMEM;
+
+    int chunk_idx = pos.block_idx;
+    pos.offset = start;
+    pos.block_offset = 0;
+    readFilePos(mem, id, tail, old_size, &pos);
+    memset(tail + old_size, 0, maxInt(offset - start - old_size, 0));
+    memcpy(tail + offset - start, buf, size);
+    bool is_ok = writeFileChunks(mem, id, chunk_idx, tail, new_size);
+    free(tail);
+    if (!is_ok)
+        return (errno == ENOMEM) ? -EFBIG : -errno;
+    node->size = start + new_size;
+    node->gen++;
+    return size;
+}
+
+/**
+ * @brief
+ *  Checks if a base name always names a directory.
+ *
+ * @param[in] name  The base name.
+ *
+ * @return
+ *   true for an empty name, `.` and `..`, false otherwise.
+ */
+static bool _isDirName(const char *name)
+{
+    return name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0;
+}
@@ -0,0 +1,40 @@
+/**
+ * @file heartyfs_compress.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing heartyfs's compress command on the command line.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "heartyfs.h"
+#include "heartyfs_lock.h"
+
+bool compressCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
+{
+    bool is_decompress = cmd_len == 3 && strcmp(cmd[1], "-d") == 0;
+    if (cmd_len != 2 && !is_decompress) {
+        printf("usage: %s %s [-d] <file-path>\n", exe_path, cmd[0]);
+        return false;
+    }
+
+    char *path = cmd[cmd_len - 1];
+    int id = lockNodeID(mem, path, true);
+    if (id == -1)
+        return false;
+    if (mem[id].file.type != TYPE_FILE) {
+        unlockInode(id);
+        errno = EISDIR;
+        perror(path);
+        return false;
+    }
+    bool is_ok = setFileCompressed(mem, id, !is_decompress);
+    if (!is_ok)
+        perror(path);
+    unlockInode(id);
+    return is_ok;
+}
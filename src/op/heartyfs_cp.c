@@ -0,0 +1,463 @@
+/**
+ * @file heartyfs_cp.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing heartyfs's cp command on the command line.
+ *
+ *  A copy runs in two passes over a pool of workers. The source tree is first
+ *  read into memory, only locking each inode while it is read, and the copy is
+ *  then built from that snapshot while only its destination directory is
+ *  locked. Since the source is never locked while blocks are allocated, the
+ *  bitmap stays the last lock taken, and copying a directory into itself
+ *  terminates. A copy that fails part way, e.g. once the disk is full, is
+ *  removed with everything built in it.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heartyfs.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_pool.h"
+#include "heartyfs_string.h"
+
+// A node of the source tree, as read in the first pass.
+struct CpNode {
+    char name[NAME_MAX_LEN];
+    uint8_t type;
+    uint8_t flags;                             // Flags of a file
+    int size;                                  // Size of a file
+    uint8_t *data;                             // Content of a file
+    int child_count;                           // Children of a directory
+    struct CpNode *children[DIR_MAX_ENTRIES];
+};
+
+// A copy being made, shared by the workers.
+struct CpTree {
+    union Block *mem;
+    struct Pool *pool;
+};
+
+// A directory left for a worker, either to read or to build.
+struct CpTask {
+    struct CpTree *tree;
+    struct CpNode *node;
+    int id;
+};
+
+static int _findDestDir(union Block *mem, char *path, char *name);
+static struct CpNode *_readTree(union Block *mem, char *path, int id,
+                                struct Pool *pool);
+static bool _readDirTask(void *arg);
+static bool _readDir(struct CpTree *tree, struct CpNode *node, int id);
+static bool _readFile(union Block *mem, struct CpNode *node, int id);
+static bool _buildDirTask(void *arg);
+static bool _buildDir(struct CpTree *tree, struct CpNode *node, int id);
+static int _buildNode(union Block *mem, struct CpNode *node, int parent_id);
+static bool _queueDir(struct CpTree *tree, bool (*call)(void *),
+                      struct CpNode *node, int id);
+static void _removeNode(union Block *mem, int id);
+static void _freeTree(struct CpNode *node);
+
+bool cpCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
+{
+    bool is_recursive = cmd_len == 4 && strcmp(cmd[1], "-r") == 0;
+    if (cmd_len != 3 && !is_recursive) {
+        printf("usage: %s %s [-r] <src-path> <dest-path>\n", exe_path, cmd[0]);
+        return false;
+    }
+    char *src_path = cmd[cmd_len - 2];
+    char *dest_path = cmd[cmd_len - 1];
+
+    // A trailing '/' still names the directory, not its parent.
+    for (int i = strlen(src_path) - 1; i > 0 && src_path[i] == '/'; i--)
+        src_path[i] = '\0';
+
+    // A destination naming a directory gets the source inside it. It is
+    // looked up before the source is locked, so that only one is locked at a
+    // time.
+    char name[NAME_MAX_LEN];
+    int parent_id = _findDestDir(mem, dest_path, name);
+    if (parent_id == -1)
+        return false;
+    if (name[0] == '\0')
+        parseBasename(src_path, name, NAME_MAX_LEN);
+    if (name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        errno = EINVAL;
+        perror(src_path);
+        return false;
+    }
+
+    int src_id = lockNodeID(mem, src_path, false);
+    if (src_id == -1)
+        return false;
+    if (mem[src_id].file.type == TYPE_DIR && !is_recursive) {
+        unlockInode(src_id);
+        errno = EISDIR;
+        perror(src_path);
+        return false;
+    }
+
+    struct Pool *pool = startPool(getJobCount());
+    if (pool == NULL) {
+        unlockInode(src_id);
+        perror(__func__);
+        return false;
+    }
+    struct CpNode *root = _readTree(mem, src_path, src_id, pool);
+    bool is_ok = root != NULL;
+    if (is_ok)
+        strncpy(root->name, name, NAME_MAX_LEN);
+
+    // The parent may have been removed or filled since it was looked up.
+    lockInodeWrite(parent_id);
+    struct DirNode *parent = &mem[parent_id].dir;
+    if (!is_ok) {
+    } else if (parent->type != TYPE_DIR) {
+        errno = ENOENT;
+        perror(dest_path);
+        is_ok = false;
+    } else if (parent->len == DIR_MAX_ENTRIES) {
+        errno = ENOMEM;
+        perror("Directory Full");
+        is_ok = false;
+    } else if (findStr(name, parent->entries, parent->len,
+                       sizeof(struct DirEntry), isDirEntryMatch) != -1) {
+        errno = EEXIST;
+        perror(dest_path);
+        is_ok = false;
+    } else {
+        struct CpTree tree = {.mem = mem, .pool = pool};
+        int id = _buildNode(mem, root, parent_id);
+        is_ok = id != -1 &&
+                (root->type != TYPE_DIR || _buildDir(&tree, root, id));
+        if (!waitPool(pool))
+            is_ok = false;
+        if (!is_ok && id != -1) {
+            _removeNode(mem, id);
+            deleteParentDirEntry(parent, id);
+            markBlockDirty(parent_id);
+        }
+    }
+    unlockInode(parent_id);
+    stopPool(pool);
+    _freeTree(root);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Finds the directory a copy goes in, and the name of the copy.
+ *
+ * @param[in]  mem   Pointer to the memory block containing file system data.
+ * @param[in]  path  The destination path.
+ * @param[out] name  The name of the copy, or an empty string if the copy keeps
+ *                   the name of the source, for a destination naming an
+ *                   existing directory.
+ *
+ * @return
+ *   The ID of the directory, or -1 if the destination is an existing file or
+ *   its directory does not exist.
+ */
+static int _findDestDir(union Block *mem, char *path, char *name)
+{
+    parseBasename(path, name, NAME_MAX_LEN);
+    if (name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        name[0] = '\0';
+        return getNodeID(mem, path, GETNODEID_USE_CWD);
+    }
+    int parent_id = lockParentID(mem, path, false);
+    if (parent_id == -1)
+        return -1;
+
+    struct DirNode *parent = &mem[parent_id].dir;
+    int idx = findStr(name, parent->entries, parent->len,
+                      sizeof(struct DirEntry), isDirEntryMatch);
+    int id = parent_id;
+    if (idx != -1) {
+        int child_id = parent->entries[idx].block_id;
+        lockInodeRead(child_id);
+        if (mem[child_id].dir.type == TYPE_DIR) {
+            id = child_id;
+            name[0] = '\0';
+        } else {
+            errno = EEXIST;
+            perror(path);
+            id = -1;
+        }
+        unlockInode(child_id);
+    }
+    unlockInode(parent_id);
+    return id;
+}
+
+/**
+ * @brief
+ *  Reads a tree into memory, reading its subdirectories in parallel.
+ *
+ * @param[in]  mem   Pointer to the memory block containing file system data.
+ * @param[in]  path  The path given for the tree.
+ * @param[in]  id    The ID of the top of the tree, locked for reading. It is
+ *                   unlocked before returning.
+ * @param[in]  pool  The pool of workers.
+ *
+ * @return
+ *   The top node of the snapshot, or NULL on failure.
+ */
+static struct CpNode *_readTree(union Block *mem, char *path, int id,
+                                struct Pool *pool)
+{
+    struct CpNode *root = calloc(1, sizeof(struct CpNode));
+    if (root == NULL) {
+        unlockInode(id);
+        perror(path);
+        return NULL;
+    }
+    struct CpTree tree = {.mem = mem, .pool = pool};
+    root->type = mem[id].file.type;
+    bool is_ok = (root->type == TYPE_DIR) ? _readDir(&tree, root, id)
+                                          : _readFile(mem, root, id);
+    unlockInode(id);
+    if (!waitPool(pool) || !is_ok) {
+        perror(path);
+        _freeTree(root);
+        return NULL;
+    }
+    return root;
+}
+
+/**
+ * @brief
+ *  Reads a directory of the source tree on a worker.
+ *
+ * @param[in] arg   The `struct CpTask` of the directory, freed afterwards.
+ *
+ * @return
+ *   true if the directory was read, false otherwise.
+ */
+static bool _readDirTask(void *arg)
+{
+    struct CpTask *task = arg;
+    lockInodeRead(task->id);
+    bool is_ok = true;
+    // Removed since its parent was read, so it is left out of the copy.
+    if (task->tree->mem[task->id].dir.type != TYPE_DIR)
+        task->node->type = TYPE_DELETED;
+    else
+        is_ok = _readDir(task->tree, task->node, task->id);
+    unlockInode(task->id);
+    free(task);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Reads the entries of a directory and the files it holds into a node, and
+ *  hands its subdirectories to the workers.
+ *
+ * @param[in, out] tree  The copy being made.
+ * @param[out]     node  The node of the directory.
+ * @param[in]      id    The ID of the directory, locked for reading.
+ *
+ * @return
+ *   true if the directory was read, false otherwise (sets errno).
+ */
+static bool _readDir(struct CpTree *tree, struct CpNode *node, int id)
+{
+    union Block *mem = tree->mem;
+    struct DirNode *dir = &mem[id].dir;
+    for (int i = PARENT_DIR_ENTRY_IDX + 1; i < dir->len; i++) {
+        int child_id = dir->entries[i].block_id;
+        struct CpNode *child = calloc(1, sizeof(struct CpNode));
+        if (child == NULL)
+            return false;
+        node->children[node->child_count++] = child;
+        strncpy(child->name, dir->entries[i].name, NAME_MAX_LEN);
+
+        lockInodeRead(child_id);
+        child->type = mem[child_id].file.type;
+        bool is_ok = child->type != TYPE_FILE || _readFile(mem, child, child_id);
+        unlockInode(child_id);
+        if (!is_ok)
+            return false;
+        if (child->type == TYPE_DIR &&
+            !_queueDir(tree, _readDirTask, child, child_id))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief
+ *  Reads the content of a file into a node.
+ *
+ * @param[in]  mem   Pointer to the memory block containing file system data.
+ * @param[out] node  The node of the file.
+ * @param[in]  id    The ID of the file, locked for reading.
+ *
+ * @return
+ *   true if the file was read, false otherwise (sets errno).
+ */
+static bool _readFile(union Block *mem, struct CpNode *node, int id)
+{
+    node->flags = mem[id].file.flags;
+    node->size = calcFileSize(mem, id);
+    node->data = malloc(node->size);
+    if (node->data == NULL && node->size > 0)
+        return false;
+    int offset = 0;
+    readFileID(mem, id, node->data, node->size, &offset);
+    return true;
+}
+
+/**
+ * @brief
+ *  Builds a directory of the copy on a worker.
+ *
+ * @param[in] arg   The `struct CpTask` of the directory, freed afterwards.
+ *
+ * @return
+ *   true if the directory was built, false otherwise.
+ */
+static bool _buildDirTask(void *arg)
+{
+    struct CpTask *task = arg;
+    bool is_ok = _buildDir(task->tree, task->node, task->id);
+    free(task);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Creates the children of a new directory of the copy, and hands its
+ *  subdirectories to the workers.
+ *
+ * @note
+ *  Nothing in the copy is locked, since it can only be reached through its
+ *  destination directory, which stays locked until the copy is built.
+ *
+ * @param[in, out] tree  The copy being made.
+ * @param[in]      node  The node of the source directory.
+ * @param[in]      id    The ID of the new directory.
+ *
+ * @return
+ *   true if the directory was built, false otherwise.
+ */
+static bool _buildDir(struct CpTree *tree, struct CpNode *node, int id)
+{
+    for (int i = 0; i < node->child_count; i++) {
+        struct CpNode *child = node->children[i];
+        if (child->type == TYPE_DELETED)
+            continue;
+        int child_id = _buildNode(tree->mem, child, id);
+        if (child_id == -1)
+            return false;
+        if (child->type == TYPE_DIR &&
+            !_queueDir(tree, _buildDirTask, child, child_id)) {
+            perror(child->name);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief
+ *  Creates a new file or an empty directory from a node of the source tree,
+ *  in a directory of the copy.
+ *
+ * @param[in, out] mem        Pointer to the memory block containing file
+ *                            system data.
+ * @param[in]      node       The node of the source.
+ * @param[in]      parent_id  The ID of the directory to create it in.
+ *
+ * @return
+ *   The ID of the new node, or -1 on failure, leaving nothing behind in the
+ *   directory.
+ */
+static int _buildNode(union Block *mem, struct CpNode *node, int parent_id)
+{
+    int id = (node->type == TYPE_DIR)
+                 ? initDirNode(mem, node->name, parent_id)
+                 : initFileNode(mem, node->name, parent_id, ROOT_ID);
+    if (id == -1 || node->type == TYPE_DIR)
+        return id;
+    mem[id].file.flags = node->flags;
+    if (!writeFileID(mem, id, node->data, node->size)) {
+        perror(node->name);
+        // Nothing else refers to it, so it goes with its entry.
+        deleteFileNode(mem, id, parent_id);
+        return -1;
+    }
+    return id;
+}
+
+/**
+ * @brief
+ *  Hands a directory to the workers, or handles it right away if it cannot be
+ *  queued.
+ *
+ * @param[in, out] tree  The copy being made.
+ * @param[in]      call  The task to run on the directory.
+ * @param[in]      node  The node of the directory.
+ * @param[in]      id    The ID of the directory.
+ *
+ * @return
+ *   false if the directory was handled right away and failed, true otherwise.
+ */
+static bool _queueDir(struct CpTree *tree, bool (*call)(void *),
+                      struct CpNode *node, int id)
+{
+    struct CpTask *task = malloc(sizeof(struct CpTask));
+    if (task == NULL)
+        return false;
+    *task = (struct CpTask){.tree = tree, .node = node, .id = id};
+    if (submitTask(tree->pool, call, task))
+        return true;
+    return call(task);
+}
+
+/**
+ * @brief
+ *  Removes a node of a copy that failed, with everything built under it.
+ *
+ * @note
+ *  Only runs once the workers are done, so nothing in the copy is in use.
+ *
+ * @param[in, out] mem  Pointer to the memory block containing file system
+ *                      data.
+ * @param[in]      id   The ID of the node.
+ */
+static void _removeNode(union Block *mem, int id)
+{
+    struct DirNode *dir = &mem[id].dir;
+    if (dir->type == TYPE_DIR) {
+        for (int i = PARENT_DIR_ENTRY_IDX + 1; i < dir->len; i++)
+            _removeNode(mem, dir->entries[i].block_id);
+    } else {
+        deleteFileData(mem, id);
+    }
+    freeBlocks(mem, &(struct Interval){id, id + 1});
+}
+
+/**
+ * @brief
+ *  Frees a snapshot of a tree.
+ *
+ * @param[in]  node  The top node of the snapshot, may be NULL.
+ */
+static void _freeTree(struct CpNode *node)
+{
+    if (node == NULL)
+        return;
+    for (int i = 0; i < node->child_count; i++)
+        _freeTree(node->children[i]);
+    free(node->data);
+    free(node);
+}
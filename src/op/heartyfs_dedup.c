@@ -0,0 +1,206 @@
+/**
+ * @file heartyfs_dedup.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing heartyfs's dedup command on the command line.
+ *
+ *  Every data block of the files under a path is hashed into an index of the
+ *  blocks seen so far. A block whose hash is found is compared with the
+ *  indexed block byte for byte, and if they match, the file refers to the
+ *  indexed block instead, which gains a reference, and lets go of its own.
+ *  The last block of a plain file is appended to in place, so it is only
+ *  shared once it is full.
+ *
+ *  Every inode under the path is locked for writing, so the files cannot
+ *  change under the index. Blocks shared with files elsewhere keep their
+ *  references, and only the files under the path are switched.
+ *
+ *  A deduplication runs alone, and switches the files in groups that fit in
+ *  the journal, committing a group before the next file could overflow it.
+ *  The inode of a file and the reference counts it changes are thus always
+ *  committed together.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heartyfs.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_math.h"
+#include "heartyfs_refs.h"
+
+// Slots of the index, a power of two above the number of blocks, so that it
+// is never full and stays sparse.
+#define DEDUP_INDEX_LEN (BLOCK_COUNT * 2)
+
+// A block in the index, or an empty slot with ID 0, which is never data.
+struct DedupSlot {
+    uint32_t hash;
+    int id;
+};
+
+// A deduplication in progress.
+struct Dedup {
+    union Block *mem;
+    int locked_ids[BLOCK_COUNT]; // Inodes locked for writing, in order
+    int locked_count;
+    int file_ids[BLOCK_COUNT];
+    int file_count;
+    struct DedupSlot index[DEDUP_INDEX_LEN];
+    int block_count;  // Data blocks looked at
+    int shared_count; // Data blocks switched to an indexed block
+    int freed_count;  // Blocks freed by the switch
+};
+
+static void _lockTree(struct Dedup *dedup, int dir_id);
+static void _dedupFile(struct Dedup *dedup, int id);
+static int _findBlock(struct Dedup *dedup, int id, uint32_t hash, int size);
+
+bool dedupCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
+{
+    char root_dir[] = "/";
+    if (cmd_len > 2) {
+        printf("usage: %s %s [path]\n", exe_path, cmd[0]);
+        return false;
+    }
+    char *path = (cmd_len == 2) ? cmd[1] : root_dir;
+
+    if (!isolateDiskOp(mem)) {
+        perror(__func__);
+        return false;
+    }
+    struct Dedup *dedup = calloc(1, sizeof(struct Dedup));
+    if (dedup == NULL) {
+        perror(__func__);
+        return false;
+    }
+    int id = lockNodeID(mem, path, true);
+    if (id == -1) {
+        free(dedup);
+        return false;
+    }
+    dedup->mem = mem;
+    dedup->locked_ids[dedup->locked_count++] = id;
+    if (mem[id].file.type == TYPE_DIR)
+        _lockTree(dedup, id);
+    else
+        dedup->file_ids[dedup->file_count++] = id;
+
+    bool is_ok = true;
+    for (int i = 0; is_ok && i < dedup->file_count; i++) {
+        // A file changes its inode, the bitmap, once its blocks are freed or a
+        // block of counts is added, and the blocks of counts.
+        is_ok = reserveDiskOp(mem, 2 + REF_BLOCK_COUNT);
+        if (is_ok)
+            _dedupFile(dedup, dedup->file_ids[i]);
+        else
+            perror(path);
+    }
+    for (int i = dedup->locked_count - 1; i >= 0; i--)
+        unlockInode(dedup->locked_ids[i]);
+
+    printf("%d files, %d of %d data blocks shared, %d blocks freed\n",
+           dedup->file_count, dedup->shared_count, dedup->block_count,
+           dedup->freed_count);
+    free(dedup);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Locks every inode under a directory for writing, in the order of the
+ *  tree, and records the files among them.
+ *
+ * @param[in, out] dedup   The deduplication in progress.
+ * @param[in]      dir_id  The ID of the directory, locked for writing.
+ */
+static void _lockTree(struct Dedup *dedup, int dir_id)
+{
+    union Block *mem = dedup->mem;
+    struct DirNode *dir = &mem[dir_id].dir;
+    for (int i = PARENT_DIR_ENTRY_IDX + 1; i < dir->len; i++) {
+        int id = dir->entries[i].block_id;
+        lockInodeWrite(id);
+        dedup->locked_ids[dedup->locked_count++] = id;
+        if (mem[id].file.type == TYPE_DIR)
+            _lockTree(dedup, id);
+        else
+            dedup->file_ids[dedup->file_count++] = id;
+    }
+}
+
+/**
+ * @brief
+ *  Switches the data blocks of a file matching a block in the index to the
+ *  indexed block, and adds the others to the index.
+ *
+ * @note
+ *  A block is left as it is if the indexed block has `REF_MAX` extra
+ *  references, or if the disk is too full to hold its counts.
+ *
+ * @param[in, out] dedup  The deduplication in progress.
+ * @param[in]      id     The ID of the file, locked for writing.
+ */
+static void _dedupFile(struct Dedup *dedup, int id)
+{
+    union Block *mem = dedup->mem;
+    struct FileNode *file = &mem[id].file;
+    bool is_compressed = file->flags & FILE_COMPRESSED;
+    for (int i = 0; i < minInt(file->len, FILE_MAX_BLOCKS); i++) {
+        int block_id = file->blocks[i];
+        struct DataBlock *d_block = &mem[block_id].data;
+        if (d_block->size < 0 || d_block->size > BLOCK_MAX_DATA ||
+            (!is_compressed && d_block->size != BLOCK_MAX_DATA))
+            continue;
+        dedup->block_count++;
+
+        // The size is compared along with the bytes it covers.
+        int size = sizeof(int) + d_block->size;
+        uint32_t hash = hashBytes(FNV_OFFSET_BASIS, d_block, size);
+        int slot = _findBlock(dedup, block_id, hash, size);
+        int match_id = dedup->index[slot].id;
+        if (match_id == 0) {
+            dedup->index[slot] = (struct DedupSlot){hash, block_id};
+            continue;
+        }
+        if (match_id == block_id || !addBlockRef(mem, match_id))
+            continue;
+        file->blocks[i] = match_id;
+        markBlockDirty(id);
+        dedup->shared_count++;
+        if (!dropBlockRef(mem, block_id)) {
+            freeBlockIDs(mem, &block_id, 1);
+            dedup->freed_count++;
+        }
+    }
+}
+
+/**
+ * @brief
+ *  Looks up a block in the index by its hash, checking that the bytes of a
+ *  match are the same.
+ *
+ * @param[in] dedup  The deduplication in progress.
+ * @param[in] id     ID of the block.
+ * @param[in] hash   Hash of the block.
+ * @param[in] size   Bytes of the block hashed.
+ *
+ * @return
+ *   The slot of the matching block, or the empty slot to index it in.
+ */
+static int _findBlock(struct Dedup *dedup, int id, uint32_t hash, int size)
+{
+    int slot = hash % DEDUP_INDEX_LEN;
+    while (dedup->index[slot].id != 0) {
+        struct DedupSlot *entry = &dedup->index[slot];
+        if (entry->hash == hash &&
+            memcmp(&dedup->mem[entry->id], &dedup->mem[id], size) == 0)
+            return slot;
+        slot = (slot + 1) % DEDUP_INDEX_LEN;
+    }
+    return slot;
+}
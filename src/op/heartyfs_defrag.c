@@ -0,0 +1,325 @@
+/**
+ * @file heartyfs_defrag.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing heartyfs's defrag command on the command line.
+ *
+ *  Every file under a path is moved, inode first and then its data and
+ *  reserved blocks in order, into the first run of free blocks large enough
+ *  to hold it, if that run lies before the file or the file is split. Files
+ *  thus end up contiguous and packed toward the front of the disk, leaving the
+ *  free space behind them in one piece. Blocks are copied within the mapping
+ *  and the file is switched to its new blocks in the same transaction, so a
+ *  crash leaves either the old or the new copy of every file.
+ *
+ *  A defragmentation runs alone, and commits between two files whenever the
+ *  journal could not hold the next one, a directory and the bitmap, so that a
+ *  whole tree is moved in as many transactions as it takes. The old blocks of
+ *  the files moved before a commit can then be reused.
+ *
+ *  Directories stay in place, since their IDs are kept by the current
+ *  directory of every process, and so do files sharing blocks with other
+ *  files, since moving them would copy the blocks they share.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heartyfs.h"
+#include "heartyfs_bitmap.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_math.h"
+#include "heartyfs_refs.h"
+#include "heartyfs_string.h"
+
+// The layout of the files under a path and of the free space.
+struct FragStats {
+    int file_count;
+    int split_count;  // Files in more than one extent
+    int extent_count;
+    struct FreeRuns free_runs;
+};
+
+// A file to move, by its entry in its directory.
+struct DefragFile {
+    int dir_id;
+    int idx;
+};
+
+// A defragmentation in progress.
+struct Defrag {
+    union Block *mem;
+    int locked_ids[BLOCK_COUNT]; // Inodes locked for writing, in order
+    int locked_count;
+    struct DefragFile files[BLOCK_COUNT];
+    int file_count;
+    // The bitmap once the frees are committed
+    _Alignas(uint64_t) uint8_t bitmap[BITMAP_LEN];
+    struct FragStats before;
+    struct FragStats after;
+    int moved_count;
+};
+
+static void _lockTree(struct Defrag *defrag, int dir_id, int idx);
+static void _defragFile(struct Defrag *defrag, struct DefragFile *file);
+static int _findFirstRun(uint8_t *map, int count, int end_id);
+static bool _isFileShared(union Block *mem, int id);
+static void _countFile(union Block *mem, int id, struct FragStats *stats);
+static void _printStats(char *label, struct FragStats *stats);
+
+bool defragCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
+{
+    char root_dir[] = "/";
+    char *path;
+    if (cmd_len > 2) {
+        printf("usage: %s %s [path]\n", exe_path, cmd[0]);
+        return false;
+    } else if (cmd_len == 2) {
+        path = cmd[1];
+    } else {
+        path = root_dir;
+    }
+
+    if (!isolateDiskOp(mem)) {
+        perror(__func__);
+        return false;
+    }
+    // A file is moved within its directory, so the directory holding the
+    // path is locked first, unless the path names a directory by itself.
+    char name[NAME_MAX_LEN];
+    parseBasename(path, name, NAME_MAX_LEN);
+    bool is_dir_path = name[0] == '\0' || strcmp(name, ".") == 0 ||
+                       strcmp(name, "..") == 0;
+    int dir_id = is_dir_path ? lockNodeID(mem, path, true)
+                             : lockParentID(mem, path, true);
+    if (dir_id == -1)
+        return false;
+    struct DirNode *dir = &mem[dir_id].dir;
+    int idx = -1;
+    if (!is_dir_path && dir->type == TYPE_DIR)
+        idx = findStr(name, dir->entries, dir->len, sizeof(struct DirEntry),
+                      isDirEntryMatch);
+    if (dir->type != TYPE_DIR || (!is_dir_path && idx == -1)) {
+        unlockInode(dir_id);
+        errno = ENOENT;
+        perror(path);
+        return false;
+    }
+
+    struct Defrag *defrag = malloc(sizeof(struct Defrag));
+    if (defrag == NULL) {
+        unlockInode(dir_id);
+        perror(__func__);
+        return false;
+    }
+    defrag->mem = mem;
+    defrag->locked_ids[0] = dir_id;
+    defrag->locked_count = 1;
+    defrag->file_count = 0;
+    defrag->before = defrag->after = (struct FragStats){0};
+    defrag->moved_count = 0;
+
+    // Every inode is locked before the bitmap is, which allocating locks
+    // until the commit.
+    _lockTree(defrag, dir_id, idx);
+    lockDiskBlock(BITMAP_ID, true);
+    memcpy(defrag->bitmap, mem[BITMAP_ID].bitmap, BITMAP_LEN);
+    countFreeRuns(defrag->bitmap, &defrag->before.free_runs);
+    bool is_ok = true;
+    for (int i = 0; is_ok && i < defrag->file_count; i++) {
+        // The new inode and blocks are allocated, so moving a file only
+        // changes its directory and the bitmap.
+        is_ok = reserveDiskOp(mem, 2);
+        if (is_ok)
+            _defragFile(defrag, &defrag->files[i]);
+        else
+            perror(path);
+    }
+    for (int i = defrag->locked_count - 1; i >= 0; i--)
+        unlockInode(defrag->locked_ids[i]);
+    countFreeRuns(defrag->bitmap, &defrag->after.free_runs);
+
+    printf("%d files moved\n", defrag->moved_count);
+    _printStats("before", &defrag->before);
+    _printStats("after", &defrag->after);
+    free(defrag);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Locks every inode under a directory for writing, in the order of the
+ *  tree, and records the files among them.
+ *
+ * @param[in, out] defrag  The defragmentation in progress.
+ * @param[in]      dir_id  The ID of the directory, locked for writing.
+ * @param[in]      idx     The index of the only entry to lock, or -1 for
+ *                         every entry.
+ */
+static void _lockTree(struct Defrag *defrag, int dir_id, int idx)
+{
+    union Block *mem = defrag->mem;
+    struct DirNode *dir = &mem[dir_id].dir;
+    int start = (idx == -1) ? PARENT_DIR_ENTRY_IDX + 1 : idx;
+    int end = (idx == -1) ? dir->len : idx + 1;
+    for (int i = start; i < end; i++) {
+        int id = dir->entries[i].block_id;
+        lockInodeWrite(id);
+        defrag->locked_ids[defrag->locked_count++] = id;
+        if (mem[id].file.type == TYPE_DIR)
+            _lockTree(defrag, id, -1);
+        else
+            defrag->files[defrag->file_count++] =
+                (struct DefragFile){.dir_id = dir_id, .idx = i};
+    }
+}
+
+/**
+ * @brief
+ *  Moves a file into the first run of free blocks large enough to hold it, if
+ *  that makes it contiguous or moves it toward the front of the disk.
+ *
+ * @note
+ *  The old blocks are freed, and only reused once the transaction moving the
+ *  file is committed.
+ *
+ * @param[in, out] defrag  The defragmentation in progress.
+ * @param[in]      file    The file, whose directory and inode are locked for
+ *                         writing.
+ */
+static void _defragFile(struct Defrag *defrag, struct DefragFile *file)
+{
+    union Block *mem = defrag->mem;
+    struct DirEntry *entry = &mem[file->dir_id].dir.entries[file->idx];
+    int id = entry->block_id;
+    struct FileNode *node = &mem[id].file;
+    int count = minInt(node->len + node->prealloc, FILE_MAX_BLOCKS);
+    _countFile(mem, id, &defrag->before);
+
+    bool is_placed = true;
+    for (int i = 0; i < count; i++)
+        if (node->blocks[i] != id + 1 + i)
+            is_placed = false;
+    int start_id = _isFileShared(mem, id)
+                       ? -1
+                       : _findFirstRun(mem[BITMAP_ID].bitmap, count + 1,
+                                       is_placed ? id : BLOCK_COUNT);
+    if (start_id == -1) {
+        _countFile(mem, id, &defrag->after);
+        return;
+    }
+
+    // The run was just seen free, but another thread may have taken a block.
+    int new_ids[FILE_MAX_BLOCKS + 1];
+    for (int i = 0; i <= count; i++) {
+        new_ids[i] = allocBlock(mem, start_id + i);
+        if (new_ids[i] != start_id + i) {
+            freeBlockIDs(mem, new_ids, (new_ids[i] == -1) ? i : i + 1);
+            _countFile(mem, id, &defrag->after);
+            return;
+        }
+    }
+
+    int old_ids[FILE_MAX_BLOCKS + 1];
+    old_ids[0] = id;
+    for (int i = 0; i < count; i++) {
+        old_ids[i + 1] = node->blocks[i];
+        memcpy(&mem[start_id + 1 + i], &mem[node->blocks[i]], BLOCK_SIZE);
+        markDataDirty(start_id + 1 + i);
+    }
+    memcpy(&mem[start_id], node, BLOCK_SIZE);
+    for (int i = 0; i < count; i++)
+        mem[start_id].file.blocks[i] = start_id + 1 + i;
+    markBlockDirty(start_id);
+    entry->block_id = start_id;
+    markBlockDirty(file->dir_id);
+
+    freeBlockIDs(mem, old_ids, count + 1);
+    for (int i = 0; i <= count; i++) {
+        setBitmapUsed(defrag->bitmap,
+                      &(struct Interval){new_ids[i], new_ids[i] + 1});
+        setBitmapFree(defrag->bitmap,
+                      &(struct Interval){old_ids[i], old_ids[i] + 1});
+    }
+    defrag->moved_count++;
+    _countFile(mem, start_id, &defrag->after);
+}
+
+/**
+ * @brief
+ *  Finds the first run of free blocks holding a given number of blocks.
+ *
+ * @param[in] map     Bitmap to search.
+ * @param[in] count   Number of blocks the run must hold.
+ * @param[in] end_id  ID the run must start before.
+ *
+ * @return
+ *   The ID of the first block of the run, or -1 if there is none.
+ */
+static int _findFirstRun(uint8_t *map, int count, int end_id)
+{
+    int start_id = findNextFreeBlock(map, RESERVED_BLOCK_COUNT);
+    while (start_id < end_id && start_id < BLOCK_COUNT) {
+        int run_end = findNextUsedBlock(map, start_id);
+        if (run_end - start_id >= count)
+            return start_id;
+        start_id = findNextFreeBlock(map, run_end);
+    }
+    return -1;
+}
+
+/**
+ * @brief
+ *  Checks if any data block of a file is shared with other files.
+ *
+ * @param[in] mem  Memory block representing the file system.
+ * @param[in] id   The ID of the file.
+ *
+ * @return
+ *   true if a data block is shared, false otherwise.
+ */
+static bool _isFileShared(union Block *mem, int id)
+{
+    struct FileNode *file = &mem[id].file;
+    for (int i = 0; i < minInt(file->len, FILE_MAX_BLOCKS); i++)
+        if (getBlockRefs(mem, file->blocks[i]) > 0)
+            return true;
+    return false;
+}
+
+/**
+ * @brief
+ *  Adds the extents of a file to the statistics of a layout.
+ *
+ * @param[in]      mem    Memory block representing the file system.
+ * @param[in]      id     The ID of the file.
+ * @param[in, out] stats  The statistics.
+ */
+static void _countFile(union Block *mem, int id, struct FragStats *stats)
+{
+    int extent_count = countFileExtents(mem, id);
+    stats->file_count++;
+    stats->extent_count += extent_count;
+    if (extent_count > 1)
+        stats->split_count++;
+}
+
+/**
+ * @brief
+ *  Prints the statistics of a layout on one line.
+ *
+ * @param[in] label  What the layout is.
+ * @param[in] stats  The statistics.
+ */
+static void _printStats(char *label, struct FragStats *stats)
+{
+    printf("%s: %d files, %d split, %d extents, %d free runs, "
+           "largest free run %d blocks\n",
+           label, stats->file_count, stats->split_count, stats->extent_count,
+           stats->free_runs.run_count, stats->free_runs.max_len);
+}
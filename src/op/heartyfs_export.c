@@ -0,0 +1,362 @@
+/**
+ * @file heartyfs_export.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing heartyfs's export command on the command line.
+ *
+ *  A subtree is written to standard output as a POSIX (ustar) tar stream in
+ *  one pass. Headers and file data are gathered into a vector of buffers that
+ *  point straight into the data blocks of the disk, and flushed with
+ *  `writev()` once it is full, so no large file is ever copied into a buffer of
+ *  its own. A large file stays locked until its buffers are flushed. Small
+ *  files are copied into a staging buffer instead and unlocked at once, so
+ *  that many of them share one `writev()`.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "heartyfs.h"
+#include "heartyfs_chunk.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_math.h"
+#include "heartyfs_string.h"
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_NAME_LEN 100
+#define TAR_PREFIX_LEN 155
+#define EXPORT_MAX_IOVS 64
+#define EXPORT_MAX_HEADERS 16
+// Largest file copied into the staging buffer, one chunk of a compressed file.
+#define EXPORT_SMALL_SIZE CHUNK_MAX_SIZE
+// Room for a small file behind every header.
+#define EXPORT_STAGE_SIZE (EXPORT_MAX_HEADERS * EXPORT_SMALL_SIZE)
+
+// The header of an entry of a ustar archive.
+struct TarHeader {
+    char name[TAR_NAME_LEN];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type;
+    char link_name[100];
+    char magic[6];
+    char version[2];
+    char user_name[32];
+    char group_name[32];
+    char dev_major[8];
+    char dev_minor[8];
+    char prefix[TAR_PREFIX_LEN];
+    char pad[12];
+};
+
+// An archive being written, with the buffers not flushed yet.
+struct TarStream {
+    union Block *mem;
+    long mtime;
+    struct iovec iovs[EXPORT_MAX_IOVS];
+    int iov_count;
+    struct TarHeader headers[EXPORT_MAX_HEADERS];
+    int header_count;
+    uint8_t stage[EXPORT_STAGE_SIZE]; // Small files not flushed yet
+    int stage_size;
+    bool is_ok;       // No write failed, so the stream goes on
+    bool is_complete; // No entry was left out
+};
+
+static const uint8_t ZERO_BLOCK[TAR_BLOCK_SIZE] = {0};
+
+static void _exportDir(struct TarStream *tar, int id, char *path);
+static void _exportNode(struct TarStream *tar, int id, char *path);
+static bool _addHeader(struct TarStream *tar, char *path, int type, int size);
+static void _addSmallFile(struct TarStream *tar, int id, int size);
+static void _addChunks(struct TarStream *tar, int id);
+static void _addBuf(struct TarStream *tar, const void *buf, int size);
+static void _flushStream(struct TarStream *tar);
+
+bool exportCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
+{
+    if (cmd_len != 2) {
+        printf("usage: %s %s <dir-path>\n", exe_path, cmd[0]);
+        return false;
+    }
+    int id = lockNodeID(mem, cmd[1], false);
+    if (id == -1)
+        return false;
+    if (mem[id].dir.type != TYPE_DIR) {
+        unlockInode(id);
+        errno = ENOTDIR;
+        perror(cmd[1]);
+        return false;
+    }
+
+    // Entries are named after the directory, or "." for the root.
+    char name[NAME_MAX_LEN];
+    parseBasename(cmd[1], name, NAME_MAX_LEN);
+    if (name[0] == '\0' || strcmp(name, "..") == 0 || id == ROOT_ID)
+        strcpy(name, ".");
+
+    struct TarStream *tar = malloc(sizeof(struct TarStream));
+    if (tar == NULL) {
+        unlockInode(id);
+        perror(__func__);
+        return false;
+    }
+    *tar = (struct TarStream){
+        .mem = mem, .mtime = time(NULL), .is_ok = true, .is_complete = true};
+    // Other output of a batch stays out of the archive.
+    flockfile(stdout);
+    fflush(stdout);
+    _exportNode(tar, id, name);
+    unlockInode(id);
+    _addBuf(tar, ZERO_BLOCK, TAR_BLOCK_SIZE);
+    _addBuf(tar, ZERO_BLOCK, TAR_BLOCK_SIZE);
+    _flushStream(tar);
+    funlockfile(stdout);
+    bool is_ok = tar->is_ok && tar->is_complete;
+    free(tar);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Adds a directory and everything under it to an archive.
+ *
+ * @param[in, out] tar   The archive being written.
+ * @param[in]      id    The ID of the directory, locked for reading.
+ * @param[in]      path  The path of the directory in the archive.
+ */
+static void _exportDir(struct TarStream *tar, int id, char *path)
+{
+    struct DirNode *dir = &tar->mem[id].dir;
+    int path_len = strlen(path);
+    for (int i = PARENT_DIR_ENTRY_IDX + 1; i < dir->len && tar->is_ok; i++) {
+        struct DirEntry *entry = &dir->entries[i];
+        char child_path[path_len + NAME_MAX_LEN + 2];
+        snprintf(child_path, sizeof(child_path), "%s/%.*s", path, NAME_MAX_LEN,
+                 entry->name);
+        lockInodeRead(entry->block_id);
+        _exportNode(tar, entry->block_id, child_path);
+        unlockInode(entry->block_id);
+    }
+}
+
+/**
+ * @brief
+ *  Adds a file, or a directory and everything under it, to an archive.
+ *
+ * @note
+ *  The data blocks of a large file are added as they are, so the file must
+ *  stay locked until they are flushed. Its buffers are flushed before it is
+ *  unlocked.
+ *
+ * @param[in, out] tar   The archive being written.
+ * @param[in]      id    The ID of the node, locked for reading.
+ * @param[in]      path  The path of the node in the archive.
+ */
+static void _exportNode(struct TarStream *tar, int id, char *path)
+{
+    union Block *mem = tar->mem;
+    if (mem[id].file.type == TYPE_DIR) {
+        if (_addHeader(tar, path, TYPE_DIR, 0))
+            _exportDir(tar, id, path);
+        return;
+    }
+    struct FileNode *file = &mem[id].file;
+    int size = calcFileSize(mem, id);
+    if (!_addHeader(tar, path, TYPE_FILE, size))
+        return;
+    if (size <= EXPORT_SMALL_SIZE) {
+        _addSmallFile(tar, id, size);
+    } else if (file->flags & FILE_COMPRESSED) {
+        _addChunks(tar, id);
+    } else {
+        for (int i = 0; i < file->len; i++) {
+            struct DataBlock *d_block = &mem[file->blocks[i]].data;
+            _addBuf(tar, d_block->data, d_block->size);
+        }
+    }
+    if (size % TAR_BLOCK_SIZE != 0)
+        _addBuf(tar, ZERO_BLOCK, TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE);
+    if (size > EXPORT_SMALL_SIZE)
+        _flushStream(tar);
+}
+
+/**
+ * @brief
+ *  Adds the header of an entry to an archive.
+ *
+ * @note
+ *  A path longer than a header holds is split into a prefix at a '/'. An
+ *  entry whose path still does not fit is reported and left out, and the
+ *  export fails once the rest is written.
+ *
+ * @param[in, out] tar   The archive being written.
+ * @param[in]      path  The path of the entry.
+ * @param[in]      type  The type of the node, `TYPE_FILE` or `TYPE_DIR`.
+ * @param[in]      size  The size of a file, 0 for a directory.
+ *
+ * @return
+ *   true if the header was added, false if the entry is left out.
+ */
+static bool _addHeader(struct TarStream *tar, char *path, int type, int size)
+{
+    char name[TAR_NAME_LEN + TAR_PREFIX_LEN + 2];
+    snprintf(name, sizeof(name), "%s%s", path, (type == TYPE_DIR) ? "/" : "");
+    int name_len = strlen(name);
+    int split = 0;
+    while (name_len - split > TAR_NAME_LEN) {
+        char *slash = strchr(name + split, '/');
+        if (slash == NULL || slash - name >= TAR_PREFIX_LEN ||
+            slash[1] == '\0') {
+            errno = ENAMETOOLONG;
+            perror(path);
+            tar->is_complete = false;
+            return false;
+        }
+        split = slash - name + 1;
+    }
+
+    // Leaves room for the header, a small file and its padding, whose buffers
+    // must not be flushed before they are added.
+    if (tar->header_count == EXPORT_MAX_HEADERS ||
+        tar->iov_count > EXPORT_MAX_IOVS - 3)
+        _flushStream(tar);
+    struct TarHeader *header = &tar->headers[tar->header_count++];
+    memset(header, 0, sizeof(struct TarHeader));
+    if (split > 0)
+        memcpy(header->prefix, name, split - 1);
+    memcpy(header->name, name + split, name_len - split);
+    sprintf(header->mode, "%07o", (type == TYPE_DIR) ? 0755 : 0644);
+    sprintf(header->uid, "%07o", 0);
+    sprintf(header->gid, "%07o", 0);
+    sprintf(header->size, "%011o", size);
+    sprintf(header->mtime, "%011lo", tar->mtime);
+    header->type = (type == TYPE_DIR) ? '5' : '0';
+    memcpy(header->magic, "ustar", 6);
+    memcpy(header->version, "00", 2);
+
+    // The checksum is taken with its own field filled with spaces.
+    memset(header->checksum, ' ', sizeof(header->checksum));
+    unsigned int checksum = 0;
+    for (size_t i = 0; i < sizeof(struct TarHeader); i++)
+        checksum += ((uint8_t *)header)[i];
+    sprintf(header->checksum, "%06o", checksum);
+    _addBuf(tar, header, sizeof(struct TarHeader));
+    return true;
+}
+
+/**
+ * @brief
+ *  Copies the data of a small file into the staging buffer and adds it to the
+ *  archive, so that the file can be unlocked before the buffer is flushed.
+ *
+ * @note
+ *  Bytes that cannot be read, e.g. of a chunk that cannot be decoded, are
+ *  zeroes, so the entry keeps the size of its header.
+ *
+ * @param[in, out] tar   The archive being written, with room for the file.
+ * @param[in]      id    The ID of the file, locked for reading.
+ * @param[in]      size  The size of the file, at most `EXPORT_SMALL_SIZE`.
+ */
+static void _addSmallFile(struct TarStream *tar, int id, int size)
+{
+    uint8_t *buf = tar->stage + tar->stage_size;
+    int offset = 0;
+    int size_read = maxInt(readFileID(tar->mem, id, buf, size, &offset), 0);
+    memset(buf + size_read, 0, size - size_read);
+    tar->stage_size += size;
+    _addBuf(tar, buf, size);
+}
+
+/**
+ * @brief
+ *  Adds the data of a compressed file to the archive, one decoded chunk at a
+ *  time.
+ *
+ * @note
+ *  A chunk that cannot be decoded is padded with zeroes, so the entry keeps
+ *  the size of its header.
+ *
+ * @param[in, out] tar  The archive being written.
+ * @param[in]      id   The ID of the file, locked for reading.
+ */
+static void _addChunks(struct TarStream *tar, int id)
+{
+    union Block *mem = tar->mem;
+    struct FileNode *file = &mem[id].file;
+    uint8_t chunk[CHUNK_MAX_SIZE];
+    for (int i = 0; i < file->len; i++) {
+        struct DataBlock *d_block = &mem[file->blocks[i]].data;
+        int size = getChunkSize(d_block);
+        int size_decoded = maxInt(decodeChunk(d_block, chunk, size), 0);
+        memset(chunk + size_decoded, 0, size - size_decoded);
+        // The buffer is reused by the next chunk, so it is written out now.
+        _addBuf(tar, chunk, size);
+        _flushStream(tar);
+    }
+}
+
+/**
+ * @brief
+ *  Adds a buffer to the archive, flushing the buffers first if the vector is
+ *  full.
+ *
+ * @param[in, out] tar   The archive being written.
+ * @param[in]      buf   The buffer, which must stay valid until flushed.
+ * @param[in]      size  The size of the buffer.
+ */
+static void _addBuf(struct TarStream *tar, const void *buf, int size)
+{
+    if (size == 0)
+        return;
+    if (tar->iov_count == EXPORT_MAX_IOVS)
+        _flushStream(tar);
+    tar->iovs[tar->iov_count++] =
+        (struct iovec){.iov_base = (void *)buf, .iov_len = size};
+}
+
+/**
+ * @brief
+ *  Writes every buffer added to the archive to standard output.
+ *
+ * @param[in, out] tar  The archive being written.
+ */
+static void _flushStream(struct TarStream *tar)
+{
+    struct iovec *iovs = tar->iovs;
+    int iov_count = tar->iov_count;
+    while (tar->is_ok && iov_count > 0) {
+        ssize_t size_wrote = writev(STDOUT_FILENO, iovs, iov_count);
+        if (size_wrote == -1 && errno == EINTR)
+            continue;
+        if (size_wrote == -1) {
+            perror("export");
+            tar->is_ok = false;
+            break;
+        }
+        // Skips what was written, which may end inside a buffer.
+        while (iov_count > 0 && (size_t)size_wrote >= iovs->iov_len) {
+            size_wrote -= iovs->iov_len;
+            iovs++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            iovs->iov_base = (uint8_t *)iovs->iov_base + size_wrote;
+            iovs->iov_len -= size_wrote;
+        }
+    }
+    tar->iov_count = 0;
+    tar->header_count = 0;
+    tar->stage_size = 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file heartyfs_fallocate.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief 
+ *  The module implementing heartyfs's fallocate command on the command line.
+ * 
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "heartyfs.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_math.h"
+#include "heartyfs_string.h"
+
+bool fallocateCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
+{
+    if (cmd_len != 3) {
+        printf("usage: %s %s <file-path> <size>\n", exe_path, cmd[0]);
+        return false;
+    }
+
+    int size;
+    if (!parseSize(cmd[2], &size)) {
+        perror(cmd[2]);
+        return false;
+    }
+    int id = lockNodeID(mem, cmd[1], true);
+    if (id == -1) {
+        return false;
+    } else if (mem[id].file.type != TYPE_FILE) {
+        unlockInode(id);
+        errno = EISDIR;
+        perror(cmd[1]);
+        return false;
+    } else if (size > FILE_MAX_SIZE) {
+        unlockInode(id);
+        errno = ENOMEM;
+        perror(cmd[1]);
+        return false;
+    }
+
+    struct FileNode *file = &mem[id].file;
+    int owned = file->len + file->prealloc;
+    int count = ceilDivInt(size, BLOCK_MAX_DATA) - owned;
+    bool is_ok = reserveFileBlocks(mem, id, count);
+    unlockInode(id);
+    return is_ok;
+}
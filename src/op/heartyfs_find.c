@@ -0,0 +1,256 @@
+/**
+ * @file heartyfs_find.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing heartyfs's find command on the command line.
+ *
+ *  The tree is walked one directory per task over a pool of workers, and every
+ *  matching path is printed as soon as it is found, so only the paths of the
+ *  directories still queued are ever kept in memory. With a single job the
+ *  tree is walked in place instead, which keeps the output in directory order.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heartyfs.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_pool.h"
+#include "heartyfs_string.h"
+
+#define TYPE_ANY -1
+
+// The tests every printed path passes.
+struct FindFilter {
+    char *name;    // Glob on the name, NULL for any
+    int type;      // Type of the inode, `TYPE_ANY` for any
+    char size_cmp; // '<', '>' or '=' to compare the size, '\0' for any
+    int size;      // Size in bytes, of a file or the entries of a directory
+};
+
+// A walk in progress, shared by the workers.
+struct FindWalk {
+    union Block *mem;
+    struct Pool *pool; // NULL to walk in place
+    struct FindFilter filter;
+};
+
+// A directory left for a worker.
+struct FindTask {
+    struct FindWalk *walk;
+    int id;
+    char path[]; // Path of the directory, as printed
+};
+
+static bool _parseFilter(char **args, int arg_count, struct FindFilter *filter);
+static bool _walkDirTask(void *arg);
+static bool _walkDir(struct FindWalk *walk, int id, char *path);
+static void _checkNode(struct FindWalk *walk, int id, char *name, char *path);
+static bool _queueDir(struct FindWalk *walk, int id, char *path);
+
+bool findCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
+{
+    char curr_dir[] = ".";
+    char *path = curr_dir;
+    int arg_start = 1;
+    if (cmd_len > 1 && cmd[1][0] != '-') {
+        path = cmd[1];
+        arg_start = 2;
+    }
+    struct FindWalk walk = {.mem = mem};
+    if (!_parseFilter(&cmd[arg_start], cmd_len - arg_start, &walk.filter)) {
+        printf("usage: %s %s [path] [-name <glob>] [-type f|d] "
+               "[-size [+|-]<bytes>]\n",
+               exe_path, cmd[0]);
+        return false;
+    }
+
+    int id = lockNodeID(mem, path, false);
+    if (id == -1)
+        return false;
+    if (getJobCount() > 1) {
+        walk.pool = startPool(getJobCount());
+        if (walk.pool == NULL) {
+            unlockInode(id);
+            perror(__func__);
+            return false;
+        }
+    }
+
+    char name[NAME_MAX_LEN];
+    parseBasename(path, name, NAME_MAX_LEN);
+    _checkNode(&walk, id, name, path);
+    bool is_ok = mem[id].dir.type != TYPE_DIR || _walkDir(&walk, id, path);
+    unlockInode(id);
+    if (walk.pool != NULL && !stopPool(walk.pool))
+        is_ok = false;
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Parses the tests of a find command.
+ *
+ * @param[in]  args       The arguments after the path.
+ * @param[in]  arg_count  The number of arguments.
+ * @param[out] filter     The parsed tests.
+ *
+ * @return
+ *   true if every argument is a valid test, false otherwise.
+ */
+static bool _parseFilter(char **args, int arg_count, struct FindFilter *filter)
+{
+    *filter = (struct FindFilter){.type = TYPE_ANY};
+    for (int i = 0; i < arg_count; i += 2) {
+        if (i + 1 == arg_count)
+            return false;
+        char *value = args[i + 1];
+        if (strcmp(args[i], "-name") == 0) {
+            filter->name = value;
+        } else if (strcmp(args[i], "-type") == 0) {
+            if (strcmp(value, "f") == 0)
+                filter->type = TYPE_FILE;
+            else if (strcmp(value, "d") == 0)
+                filter->type = TYPE_DIR;
+            else
+                return false;
+        } else if (strcmp(args[i], "-size") == 0) {
+            filter->size_cmp = '=';
+            if (value[0] == '+' || value[0] == '-') {
+                filter->size_cmp = (value[0] == '+') ? '>' : '<';
+                value++;
+            }
+            char *end;
+            errno = 0;
+            long size = strtol(value, &end, 10);
+            if (errno != 0 || end == value || *end != '\0' || size < 0 ||
+                size > BLOCK_COUNT * BLOCK_SIZE)
+                return false;
+            filter->size = size;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief
+ *  Walks a directory on a worker.
+ *
+ * @param[in] arg   The `struct FindTask` of the directory, freed afterwards.
+ *
+ * @return
+ *   true if the directory was walked, false otherwise.
+ */
+static bool _walkDirTask(void *arg)
+{
+    struct FindTask *task = arg;
+    lockInodeRead(task->id);
+    bool is_ok = true;
+    // Removed since its parent was walked, so there is nothing left to find.
+    if (task->walk->mem[task->id].dir.type == TYPE_DIR)
+        is_ok = _walkDir(task->walk, task->id, task->path);
+    unlockInode(task->id);
+    free(task);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Prints the matching entries of a directory, and walks its subdirectories
+ *  or hands them to the workers.
+ *
+ * @param[in, out] walk  The walk in progress.
+ * @param[in]      id    The ID of the directory, locked for reading.
+ * @param[in]      path  The path of the directory.
+ *
+ * @return
+ *   true if the directory was walked, false otherwise.
+ */
+static bool _walkDir(struct FindWalk *walk, int id, char *path)
+{
+    struct DirNode *dir = &walk->mem[id].dir;
+    int path_len = strlen(path);
+    bool has_slash = path_len > 0 && path[path_len - 1] == '/';
+    bool is_ok = true;
+    for (int i = PARENT_DIR_ENTRY_IDX + 1; i < dir->len; i++) {
+        struct DirEntry *entry = &dir->entries[i];
+        char child_path[path_len + NAME_MAX_LEN + 2];
+        snprintf(child_path, sizeof(child_path), "%s%s%.*s", path,
+                 has_slash ? "" : "/", NAME_MAX_LEN, entry->name);
+
+        lockInodeRead(entry->block_id);
+        _checkNode(walk, entry->block_id, entry->name, child_path);
+        bool is_dir = walk->mem[entry->block_id].dir.type == TYPE_DIR;
+        unlockInode(entry->block_id);
+        if (is_dir && !_queueDir(walk, entry->block_id, child_path))
+            is_ok = false;
+    }
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Prints the path of a node if it passes the tests of the walk.
+ *
+ * @param[in] walk  The walk in progress.
+ * @param[in] id    The ID of the node, locked for reading.
+ * @param[in] name  The name of the node.
+ * @param[in] path  The path of the node.
+ */
+static void _checkNode(struct FindWalk *walk, int id, char *name, char *path)
+{
+    struct FindFilter *filter = &walk->filter;
+    int type = walk->mem[id].file.type;
+    if (type != TYPE_FILE && type != TYPE_DIR)
+        return;
+    if (filter->type != TYPE_ANY && filter->type != type)
+        return;
+    if (filter->name != NULL && fnmatch(filter->name, name, 0) != 0)
+        return;
+    if (filter->size_cmp != '\0') {
+        int size = (type == TYPE_FILE)
+                       ? calcFileSize(walk->mem, id)
+                       : walk->mem[id].dir.len * (int)sizeof(struct DirEntry);
+        if ((filter->size_cmp == '=' && size != filter->size) ||
+            (filter->size_cmp == '<' && size >= filter->size) ||
+            (filter->size_cmp == '>' && size <= filter->size))
+            return;
+    }
+    flockfile(stdout);
+    printf("%s\n", path);
+    funlockfile(stdout);
+}
+
+/**
+ * @brief
+ *  Hands a directory to the workers, or walks it right away without a pool or
+ *  if it cannot be queued.
+ *
+ * @param[in, out] walk  The walk in progress.
+ * @param[in]      id    The ID of the directory.
+ * @param[in]      path  The path of the directory, copied.
+ *
+ * @return
+ *   false if the directory was walked right away and failed, true otherwise.
+ */
+static bool _queueDir(struct FindWalk *walk, int id, char *path)
+{
+    struct FindTask *task = malloc(sizeof(struct FindTask) + strlen(path) + 1);
+    if (task == NULL) {
+        perror(path);
+        return false;
+    }
+    task->walk = walk;
+    task->id = id;
+    strcpy(task->path, path);
+    if (walk->pool != NULL && submitTask(walk->pool, _walkDirTask, task))
+        return true;
+    return _walkDirTask(task);
+}
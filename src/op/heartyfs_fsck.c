@@ -0,0 +1,553 @@
+/**
+ * @file heartyfs_fsck.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing heartyfs's fsck command on the command line.
+ *
+ *  A check runs in two passes over a pool of workers. The tree is first walked
+ *  one directory per task, and every inode and data block reached is claimed
+ *  in a bitmap of its own with an atomic operation, so a block reached twice
+ *  is cross-linked no matter which worker got to it first. The rebuilt bitmap
+ *  is then compared with the one on the disk a word at a time, in chunks
+ *  handed to the workers, to find leaked blocks and blocks in use that are
+ *  marked free.
+ *
+ *  The check runs alone, after the open transaction is committed, so that
+ *  blocks freed or allocated by the commands before it are settled in the
+ *  bitmap. A repair walks the tree on a single thread and commits between
+ *  fixes when the journal fills up. Fixes to directories, files and reference
+ *  counts only ever leak blocks until the bitmap is rebuilt last, so a crash
+ *  in between leaves a disk that another repair fixes.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heartyfs.h"
+#include "heartyfs_bitmap.h"
+#include "heartyfs_chunk.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_pool.h"
+
+#define FSCK_CHUNK_WORDS 64
+#define WORD_BYTES 8
+#define WORD_BITS (WORD_BYTES * CHAR_BIT)
+
+// A check in progress, shared by the workers.
+struct Fsck {
+    union Block *mem;
+    struct Pool *pool;
+    bool is_repair;
+    // Rebuilt from the tree, 1 for free blocks
+    _Alignas(uint64_t) uint8_t bitmap[BITMAP_LEN];
+    int claims[BLOCK_COUNT];    // Claims of a data block past the first
+    int dir_count;
+    int file_count;
+    int error_count;
+    int leaked_count;
+    int missing_count;
+    int orphan_count;
+};
+
+// A directory, or a chunk of the bitmap, left for a worker.
+struct FsckTask {
+    struct Fsck *fsck;
+    int id;        // ID of the directory, or first word of the chunk
+    int parent_id; // ID of the parent directory
+    char path[];   // Path of the directory, empty for a chunk
+};
+
+static bool _queueTask(struct Fsck *fsck, bool (*call)(void *), int id,
+                       int parent_id, char *path);
+static bool _checkDirTask(void *arg);
+static void _checkDir(struct Fsck *fsck, int id, int parent_id, char *path);
+static bool _checkEntry(struct Fsck *fsck, int id, int dir_id, char *path);
+static void _checkFile(struct Fsck *fsck, int id, char *path);
+static bool _checkChunkTask(void *arg);
+static void _checkRefTable(struct Fsck *fsck);
+static void _checkRefCounts(struct Fsck *fsck);
+static bool _claimBlock(struct Fsck *fsck, int id);
+static bool _claimDataBlock(struct Fsck *fsck, int id);
+static void _markFixed(struct Fsck *fsck, int id);
+static void _report(struct Fsck *fsck, char *path, char *problem);
+
+bool fsckCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
+{
+    bool is_repair = cmd_len == 2 && strcmp(cmd[1], "-r") == 0;
+    if (cmd_len != 1 && !is_repair) {
+        printf("usage: %s %s [-r]\n", exe_path, cmd[0]);
+        return false;
+    }
+    // Frees and allocations of the commands before are settled in the bitmap.
+    if (!isolateDiskOp(mem)) {
+        perror(__func__);
+        return false;
+    }
+    struct Fsck *fsck = calloc(1, sizeof(struct Fsck));
+    if (fsck == NULL) {
+        perror(__func__);
+        return false;
+    }
+    fsck->mem = mem;
+    fsck->is_repair = is_repair;
+    fsck->pool = startPool(getJobCount());
+    if (fsck->pool == NULL) {
+        perror(__func__);
+        free(fsck);
+        return false;
+    }
+    memset(fsck->bitmap, 0xFF, BITMAP_LEN);
+    setBitmapUsed(fsck->bitmap, &(struct Interval){0, RESERVED_BLOCK_COUNT});
+
+    // Nothing may change under the check, in this process or any other.
+    lockWholeDisk();
+    _checkRefTable(fsck);
+    char root_path[] = "";
+    if (is_repair)
+        lockInodeWrite(ROOT_ID);
+    else
+        lockInodeRead(ROOT_ID);
+    _checkDir(fsck, ROOT_ID, ROOT_ID, root_path);
+    unlockInode(ROOT_ID);
+    waitPool(fsck->pool);
+    _checkRefCounts(fsck);
+
+    for (int i = 0; i < BITMAP_LEN / WORD_BYTES; i += FSCK_CHUNK_WORDS)
+        _queueTask(fsck, _checkChunkTask, i, 0, root_path);
+    stopPool(fsck->pool);
+
+    bool is_bad = fsck->leaked_count > 0 || fsck->missing_count > 0;
+    if (is_bad && is_repair) {
+        memcpy(mem[BITMAP_ID].bitmap, fsck->bitmap, BITMAP_LEN);
+        _markFixed(fsck, BITMAP_ID);
+    }
+    printf("%d directories, %d files, %d errors, %d leaked blocks "
+           "(%d orphaned inodes), %d used blocks marked free%s\n",
+           fsck->dir_count, fsck->file_count, fsck->error_count,
+           fsck->leaked_count, fsck->orphan_count, fsck->missing_count,
+           (is_repair && (is_bad || fsck->error_count > 0)) ? ", repaired"
+                                                            : "");
+    bool is_ok = is_repair || (!is_bad && fsck->error_count == 0);
+    free(fsck);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Hands a directory or a chunk of the bitmap to the workers, or checks it
+ *  right away if it cannot be queued.
+ *
+ * @param[in, out] fsck       The check in progress.
+ * @param[in]      call       The task to run.
+ * @param[in]      id         The ID of the directory, or first word of the
+ *                            chunk.
+ * @param[in]      parent_id  The ID of the parent directory.
+ * @param[in]      path       The path of the directory, copied.
+ *
+ * @return
+ *   true, since problems are counted in the check.
+ */
+static bool _queueTask(struct Fsck *fsck, bool (*call)(void *), int id,
+                       int parent_id, char *path)
+{
+    struct FsckTask *task = malloc(sizeof(struct FsckTask) + strlen(path) + 1);
+    if (task == NULL) {
+        perror(path);
+        __atomic_fetch_add(&fsck->error_count, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+    *task = (struct FsckTask){.fsck = fsck, .id = id, .parent_id = parent_id};
+    strcpy(task->path, path);
+    // A repair may commit between fixes, which only its own thread may do.
+    bool is_inline = fsck->is_repair && call == _checkDirTask;
+    if (is_inline || !submitTask(fsck->pool, call, task))
+        call(task);
+    return true;
+}
+
+/**
+ * @brief
+ *  Checks a directory on a worker.
+ *
+ * @param[in] arg   The `struct FsckTask` of the directory, freed afterwards.
+ *
+ * @return
+ *   true, since problems are counted in the check.
+ */
+static bool _checkDirTask(void *arg)
+{
+    struct FsckTask *task = arg;
+    if (task->fsck->is_repair)
+        lockInodeWrite(task->id);
+    else
+        lockInodeRead(task->id);
+    _checkDir(task->fsck, task->id, task->parent_id, task->path);
+    unlockInode(task->id);
+    free(task);
+    return true;
+}
+
+/**
+ * @brief
+ *  Checks the entries of a directory, checking its files right away and
+ *  handing its subdirectories to the workers.
+ *
+ * @note
+ *  A repair fixes the length and the `.` and `..` entries of the directory,
+ *  and removes the entries that do not lead to an inode, or to an inode
+ *  reached before.
+ *
+ * @param[in, out] fsck       The check in progress.
+ * @param[in]      id         The ID of the directory, locked, and claimed.
+ * @param[in]      parent_id  The ID of its parent directory.
+ * @param[in]      path       The path of the directory.
+ */
+static void _checkDir(struct Fsck *fsck, int id, int parent_id, char *path)
+{
+    struct DirNode *dir = &fsck->mem[id].dir;
+    __atomic_fetch_add(&fsck->dir_count, 1, __ATOMIC_RELAXED);
+    bool is_changed = false;
+    if (dir->len < PARENT_DIR_ENTRY_IDX + 1 || dir->len > DIR_MAX_ENTRIES) {
+        _report(fsck, path[0] == '\0' ? "/" : path, "bad directory length");
+        if (!fsck->is_repair)
+            return;
+        dir->len = (dir->len > DIR_MAX_ENTRIES) ? DIR_MAX_ENTRIES
+                                                : PARENT_DIR_ENTRY_IDX + 1;
+        is_changed = true;
+    }
+    if (dir->entries[0].block_id != id ||
+        dir->entries[PARENT_DIR_ENTRY_IDX].block_id != parent_id) {
+        _report(fsck, path[0] == '\0' ? "/" : path, "bad . or .. entry");
+        if (fsck->is_repair) {
+            dir->entries[0] = (struct DirEntry){.name = ".", .block_id = id};
+            dir->entries[PARENT_DIR_ENTRY_IDX] =
+                (struct DirEntry){.name = "..", .block_id = parent_id};
+            is_changed = true;
+        }
+    }
+
+    int path_len = strlen(path);
+    for (int i = PARENT_DIR_ENTRY_IDX + 1; i < dir->len; i++) {
+        struct DirEntry *entry = &dir->entries[i];
+        char child_path[path_len + NAME_MAX_LEN + 2];
+        snprintf(child_path, sizeof(child_path), "%s/%.*s", path,
+                 NAME_MAX_LEN - 1, entry->name);
+        if (_checkEntry(fsck, entry->block_id, id, child_path))
+            continue;
+        if (!fsck->is_repair)
+            continue;
+        // The entries after it move up, so the same index is checked again.
+        memmove(entry, entry + 1, (dir->len - i - 1) * sizeof(struct DirEntry));
+        dir->entries[--dir->len] = (struct DirEntry){0};
+        i--;
+        is_changed = true;
+    }
+    if (is_changed)
+        _markFixed(fsck, id);
+}
+
+/**
+ * @brief
+ *  Checks the inode an entry of a directory leads to, and claims it.
+ *
+ * @param[in, out] fsck    The check in progress.
+ * @param[in]      id      The ID the entry leads to.
+ * @param[in]      dir_id  The ID of the directory holding the entry.
+ * @param[in]      path    The path of the entry.
+ *
+ * @return
+ *   true if the entry leads to an inode not reached before, false if the
+ *   entry is bad.
+ */
+static bool _checkEntry(struct Fsck *fsck, int id, int dir_id, char *path)
+{
+    union Block *mem = fsck->mem;
+    if (id < RESERVED_BLOCK_COUNT || id >= BLOCK_COUNT ||
+        (mem[id].file.type != TYPE_FILE && mem[id].dir.type != TYPE_DIR)) {
+        _report(fsck, path, "entry does not lead to an inode");
+        return false;
+    }
+    if (!_claimBlock(fsck, id)) {
+        _report(fsck, path, "inode is cross-linked");
+        return false;
+    }
+    if (mem[id].file.type == TYPE_DIR) {
+        _queueTask(fsck, _checkDirTask, id, dir_id, path);
+        return true;
+    }
+    if (fsck->is_repair)
+        lockInodeWrite(id);
+    else
+        lockInodeRead(id);
+    _checkFile(fsck, id, path);
+    unlockInode(id);
+    return true;
+}
+
+/**
+ * @brief
+ *  Checks the blocks of a file and claims them.
+ *
+ * @note
+ *  A repair cuts the file short at its first bad or cross-linked block, and
+ *  drops its reserved blocks past that point.
+ *
+ * @param[in, out] fsck  The check in progress.
+ * @param[in]      id    The ID of the file, locked and claimed.
+ * @param[in]      path  The path of the file.
+ */
+static void _checkFile(struct Fsck *fsck, int id, char *path)
+{
+    union Block *mem = fsck->mem;
+    struct FileNode *file = &mem[id].file;
+    __atomic_fetch_add(&fsck->file_count, 1, __ATOMIC_RELAXED);
+    if (file->flags & ~FILE_COMPRESSED) {
+        _report(fsck, path, "bad file flags");
+        if (fsck->is_repair) {
+            file->flags &= FILE_COMPRESSED;
+            _markFixed(fsck, id);
+        }
+    }
+    bool is_compressed = file->flags & FILE_COMPRESSED;
+    int count = file->len + file->prealloc;
+    if (count > FILE_MAX_BLOCKS) {
+        _report(fsck, path, "bad file length");
+        count = FILE_MAX_BLOCKS;
+        if (fsck->is_repair) {
+            if (file->len > FILE_MAX_BLOCKS)
+                file->len = FILE_MAX_BLOCKS;
+            file->prealloc = FILE_MAX_BLOCKS - file->len;
+            _markFixed(fsck, id);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        int block_id = file->blocks[i];
+        char *problem = NULL;
+        // A block is only claimed once it is valid, so that a file cut short
+        // at a bad block leaves it free, and a block owned by another file is
+        // not blamed on it.
+        if (block_id < RESERVED_BLOCK_COUNT || block_id >= BLOCK_COUNT)
+            problem = "bad block number";
+        // Only the last data block may be partly filled.
+        else if (i < file->len && !is_compressed &&
+                 (mem[block_id].data.size < 0 ||
+                  mem[block_id].data.size > BLOCK_MAX_DATA ||
+                  (i < file->len - 1 &&
+                   mem[block_id].data.size != BLOCK_MAX_DATA)))
+            problem = "bad data block size";
+        else if (i < file->len && is_compressed &&
+                 !isChunkValid(&mem[block_id].data))
+            problem = "bad compressed chunk";
+        else if (!(i < file->len ? _claimDataBlock(fsck, block_id)
+                                 : _claimBlock(fsck, block_id)))
+            problem = "block is cross-linked";
+        if (problem == NULL)
+            continue;
+        _report(fsck, path, problem);
+        if (!fsck->is_repair)
+            continue;
+        if (i < file->len) {
+            file->len = i;
+            file->prealloc = 0;
+        } else {
+            file->prealloc = i - file->len;
+        }
+        _markFixed(fsck, id);
+        return;
+    }
+}
+
+/**
+ * @brief
+ *  Compares a chunk of the rebuilt bitmap with the one on the disk, a word at
+ *  a time, on a worker.
+ *
+ * @note
+ *  A leaked block that still holds something like an inode is counted as an
+ *  orphaned inode.
+ *
+ * @param[in] arg   The `struct FsckTask` of the chunk, freed afterwards.
+ *
+ * @return
+ *   true, since problems are counted in the check.
+ */
+static bool _checkChunkTask(void *arg)
+{
+    struct FsckTask *task = arg;
+    struct Fsck *fsck = task->fsck;
+    union Block *mem = fsck->mem;
+    int leaked_count = 0;
+    int missing_count = 0;
+    int orphan_count = 0;
+    for (int i = task->id;
+         i < task->id + FSCK_CHUNK_WORDS && i < BITMAP_LEN / WORD_BYTES; i++) {
+        uint64_t disk_word, fsck_word;
+        memcpy(&disk_word, &mem[BITMAP_ID].bitmap[i * WORD_BYTES], WORD_BYTES);
+        memcpy(&fsck_word, &fsck->bitmap[i * WORD_BYTES], WORD_BYTES);
+        if ((disk_word ^ fsck_word) == 0)
+            continue;
+        uint64_t leaked = fsck_word & ~disk_word;
+        leaked_count += __builtin_popcountll(leaked);
+        missing_count += __builtin_popcountll(disk_word & ~fsck_word);
+        for (int id = i * WORD_BITS; leaked != 0 && id < (i + 1) * WORD_BITS;
+             id++) {
+            uint8_t mask = 0x80 >> (id % CHAR_BIT);
+            if (!(fsck->bitmap[id / CHAR_BIT] & mask) ||
+                (mem[BITMAP_ID].bitmap[id / CHAR_BIT] & mask))
+                continue;
+            uint8_t type = mem[id].file.type;
+            if ((type == TYPE_FILE || type == TYPE_DIR) &&
+                memchr(mem[id].file.name, '\0', NAME_MAX_LEN) != NULL &&
+                mem[id].file.name[0] != '\0')
+                orphan_count++;
+        }
+    }
+    __atomic_fetch_add(&fsck->leaked_count, leaked_count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&fsck->missing_count, missing_count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&fsck->orphan_count, orphan_count, __ATOMIC_RELAXED);
+    free(task);
+    return true;
+}
+
+/**
+ * @brief
+ *  Checks and claims the blocks holding the reference counts.
+ *
+ * @note
+ *  A repair drops a bad block from the list, which leaves the counts in its
+ *  range at 0 and frees the block if it was leaked.
+ *
+ * @param[in, out] fsck  The check in progress.
+ */
+static void _checkRefTable(struct Fsck *fsck)
+{
+    union Block *mem = fsck->mem;
+    int *ref_ids = mem[BITMAP_ID].bitmap_block.ref_ids;
+    for (int i = 0; i < REF_BLOCK_COUNT; i++) {
+        if (ref_ids[i] == 0)
+            continue;
+        if (ref_ids[i] >= RESERVED_BLOCK_COUNT && ref_ids[i] < BLOCK_COUNT &&
+            _claimBlock(fsck, ref_ids[i]))
+            continue;
+        char label[STR_MAX_LEN];
+        snprintf(label, sizeof(label), "reference block %d", i);
+        _report(fsck, label, "bad block number");
+        if (fsck->is_repair) {
+            ref_ids[i] = 0;
+            _markFixed(fsck, BITMAP_ID);
+        }
+    }
+}
+
+/**
+ * @brief
+ *  Compares the reference count of every block with the files found sharing
+ *  it, once the whole tree was checked.
+ *
+ * @note
+ *  A count above the files sharing the block would keep it from ever being
+ *  freed, so a repair sets it to the files found. Files past the count were
+ *  reported as cross-linked and cut short by then.
+ *
+ * @param[in, out] fsck  The check in progress.
+ */
+static void _checkRefCounts(struct Fsck *fsck)
+{
+    union Block *mem = fsck->mem;
+    int *ref_ids = mem[BITMAP_ID].bitmap_block.ref_ids;
+    for (int i = 0; i < REF_BLOCK_COUNT; i++) {
+        if (ref_ids[i] == 0)
+            continue;
+        uint8_t *refs = mem[ref_ids[i]].refs;
+        for (int j = 0; j < BLOCK_SIZE; j++) {
+            int id = i * BLOCK_SIZE + j;
+            if (refs[j] <= fsck->claims[id])
+                continue;
+            char label[STR_MAX_LEN];
+            snprintf(label, sizeof(label), "block %d", id);
+            _report(fsck, label, "bad reference count");
+            if (fsck->is_repair) {
+                refs[j] = fsck->claims[id];
+                _markFixed(fsck, ref_ids[i]);
+            }
+        }
+    }
+}
+
+/**
+ * @brief
+ *  Atomically marks a block used in the rebuilt bitmap.
+ *
+ * @param[in, out] fsck  The check in progress.
+ * @param[in]      id    ID of the block.
+ *
+ * @return
+ *   true if the block was not reached before, false otherwise.
+ */
+static bool _claimBlock(struct Fsck *fsck, int id)
+{
+    uint8_t mask = 0x80 >> (id % CHAR_BIT);
+    return __atomic_fetch_and(&fsck->bitmap[id / CHAR_BIT], ~mask,
+                              __ATOMIC_RELAXED) &
+           mask;
+}
+
+/**
+ * @brief
+ *  Claims a data block, which as many files may claim again as it has extra
+ *  references.
+ *
+ * @param[in, out] fsck  The check in progress.
+ * @param[in]      id    ID of the block.
+ *
+ * @return
+ *   true if the claim is within the references of the block, false
+ *   otherwise.
+ */
+static bool _claimDataBlock(struct Fsck *fsck, int id)
+{
+    if (_claimBlock(fsck, id))
+        return true;
+    int ref_id = fsck->mem[BITMAP_ID].bitmap_block.ref_ids[id / BLOCK_SIZE];
+    int refs = (ref_id == 0) ? 0 : fsck->mem[ref_id].refs[id % BLOCK_SIZE];
+    return __atomic_fetch_add(&fsck->claims[id], 1, __ATOMIC_RELAXED) < refs;
+}
+
+/**
+ * @brief
+ *  Records a block changed by a repair, first committing the fixes before it
+ *  if the journal is full.
+ *
+ * @param[in, out] fsck  The check in progress.
+ * @param[in]      id    ID of the fixed block.
+ */
+static void _markFixed(struct Fsck *fsck, int id)
+{
+    if (!reserveDiskOp(fsck->mem, 1)) {
+        perror(__func__);
+        __atomic_fetch_add(&fsck->error_count, 1, __ATOMIC_RELAXED);
+    }
+    markBlockDirty(id);
+}
+
+/**
+ * @brief
+ *  Reports a problem found by the check.
+ *
+ * @param[in, out] fsck     The check in progress.
+ * @param[in]      path     The path of the node with the problem.
+ * @param[in]      problem  What is wrong with it.
+ */
+static void _report(struct Fsck *fsck, char *path, char *problem)
+{
+    __atomic_fetch_add(&fsck->error_count, 1, __ATOMIC_RELAXED);
+    flockfile(stdout);
+    printf("%s: %s%s\n", path, problem, fsck->is_repair ? ", fixed" : "");
+    funlockfile(stdout);
+}
@@ -0,0 +1,376 @@
+/**
+ * @file heartyfs_import.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing heartyfs's import command on the command line.
+ *
+ *  An import is a pipeline. The calling thread walks the host tree, creating
+ *  its directories right away and queueing its files, whose content is read
+ *  by a pool of workers with one large `read()` each. The calling thread is
+ *  also the only writer: it takes the files back in the order they were
+ *  queued and lays each one out in one dense run of blocks, so the image does
+ *  not depend on the number of readers. Only a window of files is read ahead,
+ *  which bounds the memory held by the pipeline.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "heartyfs.h"
+#include "heartyfs_bitmap.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_helper_structs.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_math.h"
+#include "heartyfs_pool.h"
+#include "heartyfs_string.h"
+
+#define IMPORT_WINDOW_PER_JOB 4
+
+// A host file queued for the writer.
+struct ImportFile {
+    struct Import *import;
+    struct ImportFile *next;
+    int parent_id;
+    char name[NAME_MAX_LEN];
+    uint8_t *data;
+    int size;
+    int err;      // errno of the read, 0 if it succeeded
+    bool is_read; // Set by the reader under the lock of the import
+    char path[];  // Path on the host
+};
+
+// An import in progress, shared with the readers.
+struct Import {
+    union Block *mem;
+    struct Pool *pool;
+    pthread_mutex_t lock;
+    pthread_cond_t has_read; // Signaled when a file was read
+    struct ImportFile *head; // Oldest file not written yet
+    struct ImportFile *tail;
+    int queued_count;
+    int window;
+    bool is_ok;
+    bool is_full; // The disk ran out of blocks, so nothing more is written
+};
+
+static bool _importDir(struct Import *import, char *host_path, int dir_id);
+static bool _queueFile(struct Import *import, char *host_path, char *name,
+                       int parent_id);
+static bool _readFileTask(void *arg);
+static bool _writeOldest(struct Import *import);
+static int _writeFile(union Block *mem, struct ImportFile *file);
+
+bool importCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
+{
+    if (cmd_len != 3) {
+        printf("usage: %s %s <host-dir> <dir-path>\n", exe_path, cmd[0]);
+        return false;
+    }
+    // Failing early leaves the destination untouched.
+    struct stat host_stat;
+    if (stat(cmd[1], &host_stat) == -1) {
+        perror(cmd[1]);
+        return false;
+    } else if (!S_ISDIR(host_stat.st_mode)) {
+        errno = ENOTDIR;
+        perror(cmd[1]);
+        return false;
+    }
+
+    int id = lockNodeID(mem, cmd[2], true);
+    if (id == -1)
+        return false;
+    if (mem[id].dir.type != TYPE_DIR) {
+        unlockInode(id);
+        errno = ENOTDIR;
+        perror(cmd[2]);
+        return false;
+    }
+
+    struct Import import = {.mem = mem,
+                            .window = getJobCount() * IMPORT_WINDOW_PER_JOB,
+                            .is_ok = true};
+    import.pool = startPool(getJobCount());
+    if (import.pool == NULL) {
+        unlockInode(id);
+        perror(__func__);
+        return false;
+    }
+    pthread_mutex_init(&import.lock, NULL);
+    pthread_cond_init(&import.has_read, NULL);
+
+    _importDir(&import, cmd[1], id);
+    while (import.head != NULL)
+        _writeOldest(&import);
+
+    stopPool(import.pool);
+    pthread_cond_destroy(&import.has_read);
+    pthread_mutex_destroy(&import.lock);
+    unlockInode(id);
+    return import.is_ok;
+}
+
+/**
+ * @brief
+ *  Imports the entries of a host directory into a directory of the disk,
+ *  creating subdirectories right away and queueing files for the readers.
+ *
+ * @note
+ *  Entries that cannot be imported, such as names that are too long, entries
+ *  that already exist and files that are too large, are reported and skipped.
+ *  Entries that are neither files nor directories are skipped silently.
+ *
+ * @param[in, out] import     The import in progress.
+ * @param[in]      host_path  The path of the host directory.
+ * @param[in]      dir_id     The ID of the directory to import into, locked
+ *                            or new.
+ *
+ * @return
+ *   false if the disk ran out of blocks and the import stopped, true
+ *   otherwise.
+ */
+static bool _importDir(struct Import *import, char *host_path, int dir_id)
+{
+    // Sorted, so that the same host tree always gives the same layout.
+    struct dirent **entries;
+    int entry_total = scandir(host_path, &entries, NULL, alphasort);
+    if (entry_total == -1) {
+        perror(host_path);
+        import->is_ok = false;
+        return true;
+    }
+
+    union Block *mem = import->mem;
+    int host_path_len = strlen(host_path);
+    // Queued files only get their entry once written.
+    int entry_count = mem[dir_id].dir.len;
+    bool is_ok = true;
+    for (int i = 0; is_ok && i < entry_total; i++) {
+        struct dirent *entry = entries[i];
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        char path[host_path_len + strlen(entry->d_name) + 2];
+        sprintf(path, "%s/%s", host_path, entry->d_name);
+        struct stat entry_stat;
+        if (lstat(path, &entry_stat) == -1) {
+            perror(path);
+            import->is_ok = false;
+            continue;
+        }
+        if (!S_ISDIR(entry_stat.st_mode) && !S_ISREG(entry_stat.st_mode))
+            continue;
+
+        int err = 0;
+        if (strlen(entry->d_name) >= NAME_MAX_LEN)
+            err = ENAMETOOLONG;
+        else if (entry_count == DIR_MAX_ENTRIES)
+            err = ENOMEM;
+        else if (findStr(entry->d_name, mem[dir_id].dir.entries,
+                         mem[dir_id].dir.len, sizeof(struct DirEntry),
+                         isDirEntryMatch) != -1)
+            err = EEXIST;
+        else if (S_ISREG(entry_stat.st_mode) &&
+                 entry_stat.st_size > FILE_MAX_SIZE)
+            err = EFBIG;
+        if (err != 0) {
+            errno = err;
+            perror((err == ENOMEM) ? "Directory Full" : path);
+            import->is_ok = false;
+            continue;
+        }
+
+        entry_count++;
+        if (S_ISREG(entry_stat.st_mode)) {
+            is_ok = _queueFile(import, path, entry->d_name, dir_id);
+            continue;
+        }
+        int id = initDirNode(mem, entry->d_name, dir_id);
+        if (id == -1) {
+            perror(path);
+            import->is_ok = false;
+            import->is_full = true;
+            is_ok = false;
+        } else {
+            is_ok = _importDir(import, path, id);
+        }
+    }
+    for (int i = 0; i < entry_total; i++)
+        free(entries[i]);
+    free(entries);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Queues a host file for the readers, writing the oldest queued file first if
+ *  the window is full.
+ *
+ * @param[in, out] import     The import in progress.
+ * @param[in]      host_path  The path of the host file.
+ * @param[in]      name       The name of the new file.
+ * @param[in]      parent_id  The ID of the directory it goes in.
+ *
+ * @return
+ *   false if the disk ran out of blocks, true otherwise.
+ */
+static bool _queueFile(struct Import *import, char *host_path, char *name,
+                       int parent_id)
+{
+    if (import->queued_count == import->window && !_writeOldest(import))
+        return false;
+
+    struct ImportFile *file =
+        calloc(1, sizeof(struct ImportFile) + strlen(host_path) + 1);
+    if (file == NULL) {
+        perror(host_path);
+        import->is_ok = false;
+        return true;
+    }
+    file->import = import;
+    file->parent_id = parent_id;
+    strncpy(file->name, name, NAME_MAX_LEN);
+    strcpy(file->path, host_path);
+
+    pthread_mutex_lock(&import->lock);
+    if (import->tail == NULL)
+        import->head = file;
+    else
+        import->tail->next = file;
+    import->tail = file;
+    import->queued_count++;
+    pthread_mutex_unlock(&import->lock);
+
+    if (!submitTask(import->pool, _readFileTask, file))
+        _readFileTask(file);
+    return true;
+}
+
+/**
+ * @brief
+ *  Reads a queued host file into memory on a worker.
+ *
+ * @param[in, out] arg  The `struct ImportFile` to read.
+ *
+ * @return
+ *   true, since errors are reported by the writer.
+ */
+static bool _readFileTask(void *arg)
+{
+    struct ImportFile *file = arg;
+    int fd = open(file->path, O_RDONLY);
+    struct stat file_stat;
+    if (fd == -1 || fstat(fd, &file_stat) == -1) {
+        file->err = errno;
+    } else if (file_stat.st_size > FILE_MAX_SIZE) {
+        file->err = EFBIG;
+    } else {
+        // One more byte than expected tells a file that grew in between.
+        int buf_size = file_stat.st_size + 1;
+        uint8_t *data = malloc(buf_size);
+        int size = 0;
+        ssize_t size_read = 1;
+        while (data != NULL && size_read > 0 && size < buf_size) {
+            size_read = read(fd, data + size, buf_size - size);
+            if (size_read > 0)
+                size += size_read;
+        }
+        if (data == NULL || size_read == -1)
+            file->err = errno;
+        else if (size == buf_size)
+            file->err = EFBIG;
+        file->data = data;
+        file->size = size;
+    }
+    if (fd != -1)
+        close(fd);
+
+    struct Import *import = file->import;
+    pthread_mutex_lock(&import->lock);
+    file->is_read = true;
+    pthread_cond_broadcast(&import->has_read);
+    pthread_mutex_unlock(&import->lock);
+    return true;
+}
+
+/**
+ * @brief
+ *  Waits for the oldest queued file to be read, and writes it to the disk.
+ *
+ * @param[in, out] import  The import in progress, with a file queued.
+ *
+ * @return
+ *   false if the disk ran out of blocks, true otherwise.
+ */
+static bool _writeOldest(struct Import *import)
+{
+    pthread_mutex_lock(&import->lock);
+    struct ImportFile *file = import->head;
+    while (!file->is_read)
+        pthread_cond_wait(&import->has_read, &import->lock);
+    import->head = file->next;
+    if (import->head == NULL)
+        import->tail = NULL;
+    import->queued_count--;
+    pthread_mutex_unlock(&import->lock);
+
+    if (import->is_full) {
+        // Dropped, there is no room left for it.
+    } else if (file->err != 0) {
+        errno = file->err;
+        perror(file->path);
+        import->is_ok = false;
+    } else if (_writeFile(import->mem, file) == -1) {
+        perror(file->path);
+        import->is_ok = false;
+        import->is_full = true;
+    }
+    free(file->data);
+    free(file);
+    return !import->is_full;
+}
+
+/**
+ * @brief
+ *  Creates a file from a host file that was read, with its inode and data
+ *  blocks in one dense run.
+ *
+ * @param[in, out] mem   Pointer to the memory block containing file system
+ *                       data.
+ * @param[in]      file  The host file.
+ *
+ * @return
+ *   The ID of the new file, or -1 if there are not enough free blocks (sets
+ *   errno).
+ */
+static int _writeFile(union Block *mem, struct ImportFile *file)
+{
+    int count = ceilDivInt(file->size, BLOCK_MAX_DATA) + 1;
+    struct Interval no_bounds = intArrInterval(NULL, 0);
+    struct Interval bounds;
+    if (!findFreeDensestBlocks(mem[BITMAP_ID].bitmap, count, &no_bounds,
+                               &bounds)) {
+        errno = ENOSPC;
+        return -1;
+    }
+    int id = initFileNode(mem, file->name, file->parent_id, bounds.start);
+    if (id == -1)
+        return -1;
+    if (!writeFileID(mem, id, file->data, file->size)) {
+        // Nothing else refers to it, so it goes with its entry.
+        int err = errno;
+        deleteFileNode(mem, id, file->parent_id);
+        errno = err;
+        return -1;
+    }
+    return id;
+}
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 
 #include "heartyfs.h"
+#include "heartyfs_lock.h"
 
 #define MAX_INT_DIGIT 10
 
@@ -30,22 +31,27 @@ bool lsCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
         path = curr_dir;
     }
 
-    int id = getNodeID(mem, path, GETNODEID_USE_CWD);
+    int id = lockNodeID(mem, path, false);
+    bool is_ok = false;
     if (id == -1) {
+        return false;
     } else if (mem[id].dir.type != TYPE_DIR) {
         errno = ENOTDIR;
         perror(path);
     } else {
         _printDirEntries(&mem[id].dir);
-        return true;
+        is_ok = true;
     }
-    return false;
+    unlockInode(id);
+    return is_ok;
 }
 
 static void _printDirEntries(struct DirNode *dir)
 {
+    flockfile(stdout);
     for (int i = PARENT_DIR_ENTRY_IDX + 1; i < dir->len; i++) {
         printf("%s\t", dir->entries[i].name);
     }
     printf("\n");
+    funlockfile(stdout);
 }
\ No newline at end of file
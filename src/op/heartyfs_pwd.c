@@ -12,6 +12,7 @@
 #include <stdlib.h>
 
 #include "heartyfs.h"
+#include "heartyfs_lock.h"
 
 #define MAX_INT_DIGIT 10
 
@@ -87,10 +88,15 @@ static void _printAbsPath(union Block *mem, int start_id)
             _freeAllStackNode(curr_node);
             return;
         }
+        // Each directory is only locked while it is read, since walking up
+        // goes against the lock order.
+        lockInodeRead(id);
         new_node->name = mem[id].dir.name;
         new_node->prev = curr_node;
         curr_node = new_node;
-        id = mem[id].dir.entries[PARENT_DIR_ENTRY_IDX].block_id;
+        int parent_id = mem[id].dir.entries[PARENT_DIR_ENTRY_IDX].block_id;
+        unlockInode(id);
+        id = parent_id;
     }
     while (curr_node != NULL) {
         printf("/%s", curr_node->name);
@@ -12,6 +12,8 @@
 #include <string.h>
 
 #include "heartyfs.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_lock.h"
 #include "heartyfs_math.h"
 
 #define READ_BUF_SIZE 128
@@ -22,23 +24,32 @@ bool readCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
         printf("usage: %s %s <file-path>\n", exe_path, cmd[0]);
         return false;
     }
-    int id = getNodeID(mem, cmd[1], GETNODEID_USE_CWD);
+    int id = lockNodeID(mem, cmd[1], false);
     if (id == -1) {
         return false;
     } else if (mem[id].file.type != TYPE_FILE) {
+        unlockInode(id);
         errno = EISDIR;
         perror(cmd[1]);
         return false;
     }
 
-    int offset = 0;
+    prefetchFileData(mem, id);
+
+    // Keeps the output of reads running on other threads apart.
+    flockfile(stdout);
+    struct FilePos pos;
+    setFilePos(&pos, 0);
     char buf[READ_BUF_SIZE];
     int size_read;
     do {
-        size_read = readFileID(mem, id, buf, READ_BUF_SIZE, &offset);
+        size_read = readFilePos(mem, id, buf, READ_BUF_SIZE, &pos);
         fwrite(buf, sizeof(char), size_read, stdout);
     } while (size_read == READ_BUF_SIZE);
     printf("\n");
+    funlockfile(stdout);
+    endFileRead(mem, id);
+    unlockInode(id);
 
-    return false;
+    return true;
 }
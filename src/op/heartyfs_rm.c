@@ -8,59 +8,244 @@
  * @date 2024-11-11
  */
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "heartyfs.h"
-#include "heartyfs_bitmap.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_pool.h"
 #include "heartyfs_string.h"
 
-static void _deleteFile(union Block *mem, int id, int parent_id);
+// A tree being removed by `rm -r`, shared by the workers walking it.
+struct RmTree {
+    union Block *mem;
+    struct Pool *pool;
+    pthread_mutex_t lock; // Guards `ids` and `count`
+    int ids[BLOCK_COUNT]; // Blocks of the tree, freed once it is walked
+    int count;
+};
+
+// A directory of the tree left for a worker to walk.
+struct RmTask {
+    struct RmTree *tree;
+    int id;
+};
+
+static bool _deleteTree(union Block *mem, int id, int parent_id);
+static bool _walkDirTask(void *arg);
+static void _walkDir(struct RmTree *tree, int id);
+static bool _isCwdWithin(union Block *mem, int id);
 
 bool rmCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
 {
-    if (cmd_len != 2) {
-        printf("usage: %s %s <file-path>\n", exe_path, cmd[0]);
+    bool is_recursive = cmd_len == 3 && strcmp(cmd[1], "-r") == 0;
+    if (cmd_len != 2 && !is_recursive) {
+        printf("usage: %s %s [-r] <path>\n", exe_path, cmd[0]);
         return false;
     }
+    char *path = cmd[cmd_len - 1];
 
-    int parent_id = getParentID(mem, cmd[1]);
-    if (parent_id == -1)
-        return false;
-
+    // A trailing '/' still names the directory, not its parent.
+    for (int i = strlen(path) - 1; is_recursive && i > 0 && path[i] == '/'; i--)
+        path[i] = '\0';
     char name[NAME_MAX_LEN];
-    parseBasename(cmd[1], name, NAME_MAX_LEN);
-    int id = getNodeID(mem, name, parent_id);
+    parseBasename(path, name, NAME_MAX_LEN);
+    if (name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        errno = is_recursive ? EINVAL : EISDIR;
+        perror(path);
+        return false;
+    }
+    // Checked before anything is locked, since it walks up the tree. Nothing
+    // holding the current directory can be removed in between.
+    int guess_id = is_recursive ? getNodeID(mem, path, GETNODEID_USE_CWD) : -1;
+    if (is_recursive && guess_id == -1) {
+        return false;
+    } else if (guess_id != -1 && _isCwdWithin(mem, guess_id)) {
+        errno = EPERM;
+        perror("Cannot delete current directory");
+        return false;
+    }
 
-    if (id == -1) {
-    } else if (mem[id].file.type != TYPE_FILE) {
-        errno = EISDIR;
-        perror(cmd[1]);
+    // The parent is locked before the file.
+    int parent_id = lockParentID(mem, path, true);
+    if (parent_id == -1)
+        return false;
+    struct DirNode *parent = &mem[parent_id].dir;
+    int idx = findStr(name, parent->entries, parent->len,
+                      sizeof(struct DirEntry), isDirEntryMatch);
+    bool is_ok = false;
+    if (idx == -1) {
+        errno = ENOENT;
+        perror(path);
     } else {
-        _deleteFile(mem, id, parent_id);
-        return true;
+        int id = parent->entries[idx].block_id;
+        lockInodeWrite(id);
+        if (mem[id].file.type == TYPE_FILE) {
+            deleteFileNode(mem, id, parent_id);
+            is_ok = true;
+        } else if (!is_recursive) {
+            errno = EISDIR;
+            perror(path);
+        } else if (id != guess_id) {
+            // Replaced since the current directory was checked.
+            errno = EBUSY;
+            perror(path);
+        } else {
+            is_ok = _deleteTree(mem, id, parent_id);
+        }
+        unlockInode(id);
     }
-    return false;
+    unlockInode(parent_id);
+    return is_ok;
 }
 
 /**
  * @brief 
- *  Deletes the specified file from the file system.
+ *  Deletes a directory with everything under it, walking its subdirectories
+ *  in parallel.
  * 
  * @note 
- *  This helper function performs the actual deletion of the file. It removes
- *  the file's entry from the parent directory, frees any associated file data,
- *  and updates the bitmap to mark the blocks as free.
+ *  Every inode of the tree is locked in turn, from the top down, and marked
+ *  `TYPE_DELETED` before it is unlocked, so that threads waiting to lock it
+ *  give up. The blocks of the tree are only freed once the whole tree was
+ *  walked, sorted into runs, so that the bitmap is changed in one pass and
+ *  locked last. The parent is also only changed once, for the top entry.
  * 
- * @param[in]  mem        Pointer to the memory block containing file system 
+ * @param[in]  mem        Pointer to the memory block containing file system
  *                        data.
- * @param[in]  id         The ID of the file node to be deleted.
- * @param[in]  parent_id  The ID of the parent directory of the file.
+ * @param[in]  id         The ID of the directory, locked for writing.
+ * @param[in]  parent_id  The ID of its parent, locked for writing.
+ * 
+ * @return 
+ *   true if the tree was deleted, false otherwise.
  */
-static void _deleteFile(union Block *mem, int id, int parent_id)
+static bool _deleteTree(union Block *mem, int id, int parent_id)
 {
+    struct RmTree *tree = malloc(sizeof(struct RmTree));
+    if (tree == NULL) {
+        perror(__func__);
+        return false;
+    }
+    tree->mem = mem;
+    tree->count = 0;
+    pthread_mutex_init(&tree->lock, NULL);
+    tree->pool = startPool(getJobCount());
+    if (tree->pool == NULL) {
+        perror(__func__);
+        pthread_mutex_destroy(&tree->lock);
+        free(tree);
+        return false;
+    }
+
+    _walkDir(tree, id);
+    stopPool(tree->pool);
+
     deleteParentDirEntry(&mem[parent_id].dir, id);
-    deleteFileData(mem, id);
-    setBitmapFree(mem[BITMAP_ID].bitmap, &(struct Interval){id, id + 1});
-}
\ No newline at end of file
+    markBlockDirty(parent_id);
+    freeBlockIDs(mem, tree->ids, tree->count);
+    pthread_mutex_destroy(&tree->lock);
+    free(tree);
+    return true;
+}
+
+/**
+ * @brief 
+ *  Walks a directory of a tree being deleted on a worker.
+ * 
+ * @param[in] arg   The `struct RmTask` of the directory, freed afterwards.
+ * 
+ * @return 
+ *   true.
+ */
+static bool _walkDirTask(void *arg)
+{
+    struct RmTask *task = arg;
+    lockInodeWrite(task->id);
+    _walkDir(task->tree, task->id);
+    unlockInode(task->id);
+    free(task);
+    return true;
+}
+
+/**
+ * @brief 
+ *  Collects the blocks of a directory being deleted and of the files it
+ *  holds, and hands its subdirectories to the workers.
+ * 
+ * @note 
+ *  The blocks are added to the tree once per directory, so that workers
+ *  rarely contend on the tree. A subdirectory that cannot be queued is walked
+ *  right away instead.
+ * 
+ * @param[in, out] tree  The tree being deleted.
+ * @param[in]      id    The ID of the directory, locked for writing.
+ */
+static void _walkDir(struct RmTree *tree, int id)
+{
+    union Block *mem = tree->mem;
+    struct DirNode *dir = &mem[id].dir;
+    int ids[(DIR_MAX_ENTRIES - 2) * (FILE_MAX_BLOCKS + 1) + 1];
+    int count = 0;
+    for (int i = PARENT_DIR_ENTRY_IDX + 1; i < dir->len; i++) {
+        int child_id = dir->entries[i].block_id;
+        lockInodeWrite(child_id);
+        struct FileNode *file = &mem[child_id].file;
+        if (file->type == TYPE_FILE) {
+            int owned = file->len + file->prealloc;
+            memcpy(ids + count, file->blocks, owned * sizeof(int));
+            count += owned;
+            ids[count++] = child_id;
+            file->type = TYPE_DELETED;
+            unlockInode(child_id);
+            continue;
+        }
+        unlockInode(child_id);
+
+        struct RmTask *task = malloc(sizeof(struct RmTask));
+        if (task != NULL) {
+            *task = (struct RmTask){.tree = tree, .id = child_id};
+            if (submitTask(tree->pool, _walkDirTask, task))
+                continue;
+            free(task);
+        }
+        lockInodeWrite(child_id);
+        _walkDir(tree, child_id);
+        unlockInode(child_id);
+    }
+    ids[count++] = id;
+    dir->type = TYPE_DELETED;
+
+    pthread_mutex_lock(&tree->lock);
+    memcpy(tree->ids + tree->count, ids, count * sizeof(int));
+    tree->count += count;
+    pthread_mutex_unlock(&tree->lock);
+}
+
+/**
+ * @brief 
+ *  Checks if the current directory is a directory or lies under it.
+ * 
+ * @note 
+ *  Walks up from the current directory, only locking each directory while
+ *  its parent is read.
+ * 
+ * @param[in]  mem  Pointer to the memory block containing file system data.
+ * @param[in]  id   The ID of the directory.
+ * 
+ * @return 
+ *   true if the current directory is within the directory, false otherwise.
+ */
+static bool _isCwdWithin(union Block *mem, int id)
+{
+    int curr_id = getCWD();
+    while (curr_id != -1 && curr_id != id && curr_id != ROOT_ID) {
+        lockInodeRead(curr_id);
+        int parent_id = mem[curr_id].dir.entries[PARENT_DIR_ENTRY_IDX].block_id;
+        unlockInode(curr_id);
+        curr_id = parent_id;
+    }
+    return curr_id == id;
+}
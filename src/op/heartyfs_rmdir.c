@@ -13,10 +13,13 @@
 #include <string.h>
 
 #include "heartyfs.h"
-#include "heartyfs_bitmap.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_lock.h"
 #include "heartyfs_string.h"
 
-static void _deleteDir(union Block *mem, int id);
+static bool _deleteChildDir(union Block *mem, char *path, char *name,
+                            int parent_id);
+static void _deleteDir(union Block *mem, int id, int parent_id);
 
 bool rmdirCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
 {
@@ -25,23 +28,75 @@ bool rmdirCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
         return false;
     }
 
-    int id = getNodeID(mem, cmd[1], GETNODEID_USE_CWD);
+    // A trailing '/' still names the directory, not its parent.
+    for (int i = strlen(cmd[1]) - 1; i > 0 && cmd[1][i] == '/'; i--)
+        cmd[1][i] = '\0';
+    char name[NAME_MAX_LEN];
+    parseBasename(cmd[1], name, NAME_MAX_LEN);
+    if (name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        // Would name the parent or an ancestor, which is never empty.
+        errno = EINVAL;
+        perror(cmd[1]);
+        return false;
+    }
+
+    int parent_id = lockParentID(mem, cmd[1], true);
+    if (parent_id == -1)
+        return false;
+    bool is_ok = _deleteChildDir(mem, cmd[1], name, parent_id);
+    unlockInode(parent_id);
+    return is_ok;
+}
+
+/**
+ * @brief 
+ *  Deletes a directory held by a directory locked for writing, if it is empty
+ *  and not the current directory.
+ * 
+ * @note 
+ *  The directory is locked after its parent.
+ * 
+ * @param[in]  mem        Pointer to the memory block containing file system
+ *                        data.
+ * @param[in]  path       The path given for the directory.
+ * @param[in]  name       The name of the directory.
+ * @param[in]  parent_id  The ID of the locked parent directory.
+ * 
+ * @return 
+ *   true if the directory was deleted, false otherwise.
+ */
+static bool _deleteChildDir(union Block *mem, char *path, char *name,
+                            int parent_id)
+{
+    struct DirNode *parent = &mem[parent_id].dir;
+    int idx = findStr(name, parent->entries, parent->len,
+                      sizeof(struct DirEntry), isDirEntryMatch);
+    if (idx == -1) {
+        errno = ENOENT;
+        perror(path);
+        return false;
+    }
+
+    int id = parent->entries[idx].block_id;
     int cwd_id = getCWD();
-    if (cwd_id == -1 || id == -1) {
+    lockInodeWrite(id);
+    bool is_ok = false;
+    if (cwd_id == -1) {
     } else if (id == cwd_id) {
         errno = EPERM;
         perror("Cannot delete current directory");
     } else if (mem[id].dir.type != TYPE_DIR) {
         errno = ENOTDIR;
-        perror(cmd[1]);
+        perror(path);
     } else if (mem[id].dir.len > 2) {
         errno = ENOTEMPTY;
-        perror(cmd[1]);
+        perror(path);
     } else {
-        _deleteDir(mem, id);
-        return true;
+        _deleteDir(mem, id, parent_id);
+        is_ok = true;
     }
-    return false;
+    unlockInode(id);
+    return is_ok;
 }
 
 /**
@@ -53,13 +108,14 @@ bool rmdirCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
  *  the directory's entry from its parent directory and updates the bitmap to mark 
  *  the directory's block as free.
  * 
- * @param[in]  mem  Pointer to the memory block containing file system data.
- * @param[in]  id   The ID of the directory node to be deleted.
+ * @param[in]  mem        Pointer to the memory block containing file system
+ *                        data.
+ * @param[in]  id         The ID of the directory node to be deleted.
+ * @param[in]  parent_id  The ID of the parent directory.
  */
-static void _deleteDir(union Block *mem, int id)
+static void _deleteDir(union Block *mem, int id, int parent_id)
 {
-    struct DirNode *dir = &mem[id].dir;
-    int parent_id = dir->entries[PARENT_DIR_ENTRY_IDX].block_id;
     deleteParentDirEntry(&mem[parent_id].dir, id);
-    setBitmapFree(mem[BITMAP_ID].bitmap, &(struct Interval){id, id + 1});
+    markBlockDirty(parent_id);
+    freeBlocks(mem, &(struct Interval){id, id + 1});
 }
\ No newline at end of file
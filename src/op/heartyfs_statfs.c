@@ -0,0 +1,212 @@
+/**
+ * @file heartyfs_statfs.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing heartyfs's statfs command on the command line.
+ *
+ *  The tree is walked once to count the blocks of every inode and the extents
+ *  of every file, and the bitmap is scanned once for its runs of free blocks.
+ *  Run lengths and extent counts are gathered into power-of-two histograms,
+ *  which tell whether the disk is worth a defrag and how large an image the
+ *  files need.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <stdio.h>
+
+#include "heartyfs.h"
+#include "heartyfs_bitmap.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_math.h"
+#include "heartyfs_refs.h"
+
+// Buckets of a histogram, one per power of two up to `BLOCK_COUNT`.
+#define HIST_LEN RUN_HIST_LEN
+#define HIST_RANGE_LEN 16
+
+// The usage of the disk, counted in blocks unless named otherwise.
+struct SpaceStats {
+    int dir_count;
+    int file_count;
+    int data_count;     // Data blocks of the files, shared ones per file
+    int prealloc_count; // Blocks reserved past the end of files
+    long data_size;     // Bytes of data
+    long stored_size;   // Bytes held by the data blocks, shared ones once
+    uint8_t seen_map[BITMAP_LEN]; // Data blocks counted in `stored_size`
+    int compressed_count;
+    int compressed_blocks; // Blocks holding compressed data
+    long compressed_size;  // Bytes of compressed files, decompressed
+    int extent_count;
+    int split_count;    // Files in more than one extent
+    int max_extents;
+    int extent_hist[HIST_LEN];
+    struct FreeRuns free_runs;
+    int ref_block_count; // Blocks holding reference counts
+    int shared_count;    // Data blocks shared by several files
+    int saved_count;     // Extra references to them
+};
+
+static void _countDir(union Block *mem, int id, struct SpaceStats *stats);
+static int _findBucket(int n);
+static void _printHist(char *label, int *hist);
+
+bool statfsCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
+{
+    if (cmd_len != 1) {
+        printf("usage: %s %s\n", exe_path, cmd[0]);
+        return false;
+    }
+    struct SpaceStats stats = {.dir_count = 1};
+    lockInodeRead(ROOT_ID);
+    _countDir(mem, ROOT_ID, &stats);
+    unlockInode(ROOT_ID);
+    lockDiskBlock(BITMAP_ID, false);
+    countFreeRuns(mem[BITMAP_ID].bitmap, &stats.free_runs);
+    stats.ref_block_count =
+        countBlockRefs(mem, &stats.shared_count, &stats.saved_count);
+    unlockDiskBlock(BITMAP_ID);
+
+    // The root is counted with the reserved blocks, and a shared data block
+    // once.
+    int inode_count = stats.dir_count - 1 + stats.file_count;
+    int meta_count = RESERVED_BLOCK_COUNT + inode_count + stats.ref_block_count;
+    int free_count = stats.free_runs.free_count;
+    int used_count = BLOCK_COUNT - free_count;
+    int stored_count = stats.data_count - stats.saved_count;
+    int other_count =
+        used_count - meta_count - stored_count - stats.prealloc_count;
+    printf("blocks: %d total, %d used, %d free (%d bytes each)\n", BLOCK_COUNT,
+           used_count, free_count, BLOCK_SIZE);
+    printf("metadata: %d blocks, %d reserved, %d directories, %d files\n",
+           meta_count, RESERVED_BLOCK_COUNT, stats.dir_count,
+           stats.file_count);
+    // How full the blocks are, by the bytes they hold rather than the bytes
+    // they decompress to.
+    printf("data: %d blocks, %d preallocated, %ld bytes (%d%% full)\n",
+           stored_count, stats.prealloc_count, stats.data_size,
+           (stored_count == 0)
+               ? 0
+               : (int)(stats.stored_size * 100 /
+                       ((long)stored_count * BLOCK_MAX_DATA)));
+    if (stats.compressed_count > 0)
+        printf("compressed: %d files, %ld bytes in %d blocks (%.1fx)\n",
+               stats.compressed_count, stats.compressed_size,
+               stats.compressed_blocks,
+               (stats.compressed_blocks == 0)
+                   ? 0.0
+                   : (double)stats.compressed_size /
+                         ((long)stats.compressed_blocks * BLOCK_MAX_DATA));
+    if (stats.shared_count > 0)
+        printf("shared: %d blocks, %d blocks saved of %d referenced, "
+               "%d blocks of counts\n",
+               stats.shared_count, stats.saved_count, stats.data_count,
+               stats.ref_block_count);
+    // Blocks freed by a command not committed yet, or leaked.
+    if (other_count != 0)
+        printf("unreachable: %d blocks\n", other_count);
+
+    int extent_blocks = stats.data_count + stats.prealloc_count;
+    printf("extents: %d, %d files split, at most %d per file, "
+           "%.1f blocks per extent\n",
+           stats.extent_count, stats.split_count, stats.max_extents,
+           (stats.extent_count == 0)
+               ? 0.0
+               : (double)extent_blocks / stats.extent_count);
+    printf("free runs: %d, largest %d blocks\n", stats.free_runs.run_count,
+           stats.free_runs.max_len);
+    _printHist("extents per file", stats.extent_hist);
+    _printHist("free run length", stats.free_runs.len_hist);
+    return true;
+}
+
+/**
+ * @brief
+ *  Adds the blocks and extents of everything under a directory to the usage
+ *  of the disk.
+ *
+ * @param[in]      mem    Memory block representing the file system.
+ * @param[in]      id     The ID of the directory, locked for reading.
+ * @param[in, out] stats  The usage of the disk.
+ */
+static void _countDir(union Block *mem, int id, struct SpaceStats *stats)
+{
+    struct DirNode *dir = &mem[id].dir;
+    for (int i = PARENT_DIR_ENTRY_IDX + 1; i < dir->len; i++) {
+        int child_id = dir->entries[i].block_id;
+        lockInodeRead(child_id);
+        struct FileNode *file = &mem[child_id].file;
+        if (file->type == TYPE_DIR) {
+            stats->dir_count++;
+            _countDir(mem, child_id, stats);
+        } else {
+            int extent_count = countFileExtents(mem, child_id);
+            int size = calcFileSize(mem, child_id);
+            stats->file_count++;
+            stats->data_count += file->len;
+            stats->prealloc_count += file->prealloc;
+            stats->data_size += size;
+            if (file->flags & FILE_COMPRESSED) {
+                stats->compressed_count++;
+                stats->compressed_blocks += file->len;
+                stats->compressed_size += size;
+            }
+            for (int j = 0; j < minInt(file->len, FILE_MAX_BLOCKS); j++) {
+                int block_id = file->blocks[j];
+                if (block_id < 0 || block_id >= BLOCK_COUNT)
+                    continue;
+                uint8_t mask = 0x80 >> (block_id % CHAR_BIT);
+                if (stats->seen_map[block_id / CHAR_BIT] & mask)
+                    continue;
+                stats->seen_map[block_id / CHAR_BIT] |= mask;
+                stats->stored_size += mem[block_id].data.size;
+            }
+            stats->extent_count += extent_count;
+            if (extent_count > 1)
+                stats->split_count++;
+            stats->max_extents = maxInt(stats->max_extents, extent_count);
+            if (extent_count > 0)
+                stats->extent_hist[_findBucket(extent_count)]++;
+        }
+        unlockInode(child_id);
+    }
+}
+
+/**
+ * @brief
+ *  Finds the bucket of a histogram a positive number falls into.
+ *
+ * @param[in] n  The number.
+ *
+ * @return
+ *   The bucket, `k` for numbers from `2^k` to `2^(k+1) - 1`.
+ */
+static int _findBucket(int n)
+{
+    return minInt(log2Int(n), HIST_LEN - 1);
+}
+
+/**
+ * @brief
+ *  Prints the buckets of a histogram holding anything, one per line.
+ *
+ * @param[in] label  What the histogram counts.
+ * @param[in] hist   The histogram.
+ */
+static void _printHist(char *label, int *hist)
+{
+    printf("%s:\n", label);
+    for (int i = 0; i < HIST_LEN; i++) {
+        if (hist[i] == 0)
+            continue;
+        int low = 1 << i;
+        int high = (i == HIST_LEN - 1) ? BLOCK_COUNT : (low << 1) - 1;
+        char range[HIST_RANGE_LEN];
+        if (low == high)
+            snprintf(range, sizeof(range), "%d", low);
+        else
+            snprintf(range, sizeof(range), "%d-%d", low, high);
+        printf("  %-10s %d\n", range, hist[i]);
+    }
+}
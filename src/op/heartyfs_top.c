@@ -0,0 +1,251 @@
+/**
+ * @file heartyfs_top.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing heartyfs's top command on the command line.
+ *
+ *  The shared memory segment of a process run with `--live` is mapped
+ *  read-only and sampled once a second. Rates come from the difference of the
+ *  counters between two samples, and latency percentiles from the trace
+ *  records written in between, so the watched process never waits on the
+ *  viewer and never writes anything for it but its own counters.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "heartyfs.h"
+#include "heartyfs_stats.h"
+#include "heartyfs_string.h"
+
+#define TOP_INTERVAL_US 1000000
+#define TOP_RECENT_LEN 8
+
+// The counts of a live process at one time.
+struct TopSample {
+    long ns;
+    unsigned long trace_head;
+    struct ThreadStats total;
+};
+
+static bool _parseArgs(char **args, int arg_count, int *count, int *pid);
+static void _takeSample(const struct LiveStats *live,
+                        struct TopSample *sample);
+static void _printFrame(const struct LiveStats *live, struct TopSample *prev,
+                        struct TopSample *curr);
+static void _printLatency(const struct LiveStats *live, unsigned long start,
+                          unsigned long end);
+static void _printRecent(const struct LiveStats *live, unsigned long end);
+static int _compareLong(const void *n1, const void *n2);
+
+bool topCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
+{
+    (void)mem;
+    int count = -1;
+    int pid = -1;
+    if (!_parseArgs(&cmd[1], cmd_len - 1, &count, &pid)) {
+        printf("usage: %s %s [-n count] [pid]\n", exe_path, cmd[0]);
+        return false;
+    }
+    if (pid == -1)
+        pid = findLiveProcess();
+    if (pid == -1) {
+        fprintf(stderr, "%s: No process running with --live\n", cmd[0]);
+        return false;
+    }
+    const struct LiveStats *live = attachStats(pid);
+    if (live == NULL) {
+        fprintf(stderr, "%s: %d: %s\n", cmd[0], pid, strerror(errno));
+        return false;
+    }
+
+    bool is_tty = isatty(STDOUT_FILENO);
+    struct TopSample samples[2];
+    _takeSample(live, &samples[0]);
+    for (int i = 0; count < 0 || i < count; i++) {
+        usleep(TOP_INTERVAL_US);
+        struct TopSample *prev = &samples[i % 2];
+        struct TopSample *curr = &samples[(i + 1) % 2];
+        _takeSample(live, curr);
+        if (is_tty)
+            printf("\033[H\033[J");
+        _printFrame(live, prev, curr);
+        fflush(stdout);
+        if (kill(pid, 0) != 0 && errno == ESRCH) {
+            printf("process %d exited\n", pid);
+            break;
+        }
+    }
+    detachStats(live);
+    return true;
+}
+
+/**
+ * @brief
+ *  Parses the arguments of top.
+ *
+ * @param[in]  args       The arguments after the name of the command.
+ * @param[in]  arg_count  The number of arguments.
+ * @param[out] count      Number of samples to print, left as is without `-n`.
+ * @param[out] pid        Process to watch, left as is without one.
+ *
+ * @return
+ *   true if the arguments are valid, false otherwise.
+ */
+static bool _parseArgs(char **args, int arg_count, int *count, int *pid)
+{
+    for (int i = 0; i < arg_count; i++) {
+        int n;
+        if (strcmp(args[i], "-n") == 0 && i + 1 < arg_count &&
+            parseSize(args[i + 1], &n) && n > 0) {
+            *count = n;
+            i++;
+        } else if (*pid == -1 && parseSize(args[i], &n) && n > 0) {
+            *pid = n;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief
+ *  Reads the counts of a live process.
+ *
+ * @param[in]  live    The segment of the process.
+ * @param[out] sample  The counts.
+ */
+static void _takeSample(const struct LiveStats *live,
+                        struct TopSample *sample)
+{
+    sample->ns = getStatTime();
+    sample->trace_head = __atomic_load_n(&live->trace_head, __ATOMIC_ACQUIRE);
+    sumLiveStats(live, &sample->total);
+}
+
+/**
+ * @brief
+ *  Prints the rates and latencies of a live process between two samples,
+ *  followed by its latest commands.
+ *
+ * @param[in] live  The segment of the process.
+ * @param[in] prev  The earlier sample.
+ * @param[in] curr  The later sample.
+ */
+static void _printFrame(const struct LiveStats *live, struct TopSample *prev,
+                        struct TopSample *curr)
+{
+    double secs = (curr->ns - prev->ns) / 1e9;
+    long op_count = 0;
+    long fail_count = 0;
+    for (int i = 0; i < STATS_MAX_CMDS; i++) {
+        op_count += curr->total.cmds[i].count - prev->total.cmds[i].count;
+        fail_count +=
+            curr->total.cmds[i].fail_count - prev->total.cmds[i].fail_count;
+    }
+    int thread_count = __atomic_load_n(&live->thread_count, __ATOMIC_RELAXED);
+    printf("heartyfs %d: up %.1f s, %d threads\n", live->pid,
+           (curr->ns - live->start_ns) / 1e9, thread_count);
+    printf("%.1f ops/s, %.1f failed/s\n", op_count / secs, fail_count / secs);
+    _printLatency(live, prev->trace_head, curr->trace_head);
+
+    printf("\n%-12s %10s %10s %10s\n", "command", "ops/s", "failed/s",
+           "mean us");
+    for (int i = 0; i < STATS_MAX_CMDS; i++) {
+        struct CmdStats *c = &curr->total.cmds[i];
+        struct CmdStats *p = &prev->total.cmds[i];
+        long count = c->count - p->count;
+        if (count == 0)
+            continue;
+        printf("%-12.12s %10.1f %10.1f %10.1f\n", live->cmd_names[i],
+               count / secs, (c->fail_count - p->fail_count) / secs,
+               (c->total_ns - p->total_ns) / 1e3 / count);
+    }
+
+    printf("\n%-20s %12s\n", "counter", "per second");
+    for (int i = 0; i < STAT_COUNTER_COUNT; i++)
+        printf("%-20s %12.1f\n", STAT_COUNTER_LIST[i],
+               (curr->total.counters[i] - prev->total.counters[i]) / secs);
+    _printRecent(live, curr->trace_head);
+}
+
+/**
+ * @brief
+ *  Prints the latency percentiles of the commands traced in a range, or of
+ *  the latest of them if the ring has wrapped since.
+ *
+ * @param[in] live   The segment of the process.
+ * @param[in] start  Index of the first trace record.
+ * @param[in] end    Index past the last trace record.
+ */
+static void _printLatency(const struct LiveStats *live, unsigned long start,
+                          unsigned long end)
+{
+    if (end - start > TRACE_RING_LEN)
+        start = end - TRACE_RING_LEN;
+    static long durations[TRACE_RING_LEN];
+    int count = 0;
+    for (unsigned long idx = start; idx < end; idx++) {
+        struct TraceRecord rec;
+        if (readTraceRecord(live, idx, &rec))
+            durations[count++] = rec.duration_ns;
+    }
+    if (count == 0) {
+        printf("latency: no commands\n");
+        return;
+    }
+    qsort(durations, count, sizeof(long), _compareLong);
+    printf("latency of %d commands: p50 %.1f us, p99 %.1f us, p99.9 %.1f us, "
+           "max %.1f us\n",
+           count, durations[(count - 1) * 50 / 100] / 1e3,
+           durations[(count - 1) * 99 / 100] / 1e3,
+           durations[(count - 1) * 999 / 1000] / 1e3,
+           durations[count - 1] / 1e3);
+}
+
+/**
+ * @brief
+ *  Prints the latest commands traced, newest first.
+ *
+ * @param[in] live  The segment of the process.
+ * @param[in] end   Index past the last trace record.
+ */
+static void _printRecent(const struct LiveStats *live, unsigned long end)
+{
+    printf("\n%-12s %-32s %10s %8s\n", "recent", "path", "us", "blocks");
+    for (unsigned long idx = end; idx > 0 && end - idx < TOP_RECENT_LEN;
+         idx--) {
+        struct TraceRecord rec;
+        if (!readTraceRecord(live, idx - 1, &rec) || rec.cmd_idx < 0 ||
+            rec.cmd_idx >= STATS_MAX_CMDS)
+            continue;
+        printf("%-12.12s %-32s %10.1f %8d%s\n", live->cmd_names[rec.cmd_idx],
+               rec.path, rec.duration_ns / 1e3, rec.block_count,
+               rec.is_ok ? "" : " failed");
+    }
+}
+
+/**
+ * @brief
+ *  Compares two longs, for `qsort()`.
+ *
+ * @param[in] n1  The first long.
+ * @param[in] n2  The second long.
+ *
+ * @return
+ *   A negative, zero or positive number as `n1` is below, equal to or above
+ *   `n2`.
+ */
+static int _compareLong(const void *n1, const void *n2)
+{
+    long a = *(const long *)n1;
+    long b = *(const long *)n2;
+    return (a > b) - (a < b);
+}
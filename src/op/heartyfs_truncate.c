@@ -0,0 +1,135 @@
+/**
+ * @file heartyfs_truncate.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief 
+ *  The module implementing heartyfs's truncate command on the command line.
+ * 
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "heartyfs.h"
+#include "heartyfs_chunk.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_math.h"
+#include "heartyfs_string.h"
+
+static bool _shrinkFile(union Block *mem, int id, int size);
+static bool _shrinkChunks(union Block *mem, int id, int size);
+
+bool truncateCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
+{
+    if (cmd_len != 3) {
+        printf("usage: %s %s <file-path> <size>\n", exe_path, cmd[0]);
+        return false;
+    }
+
+    int size;
+    if (!parseSize(cmd[2], &size)) {
+        perror(cmd[2]);
+        return false;
+    }
+    int id = lockNodeID(mem, cmd[1], true);
+    if (id == -1) {
+        return false;
+    } else if (mem[id].file.type != TYPE_FILE) {
+        unlockInode(id);
+        errno = EISDIR;
+        perror(cmd[1]);
+        return false;
+    } else if (!(mem[id].file.flags & FILE_COMPRESSED) &&
+               size > FILE_MAX_SIZE) {
+        unlockInode(id);
+        errno = ENOMEM;
+        perror(cmd[1]);
+        return false;
+    }
+
+    bool is_ok = true;
+    int file_size = calcFileSize(mem, id);
+    if (size < file_size && (mem[id].file.flags & FILE_COMPRESSED)) {
+        is_ok = _shrinkChunks(mem, id, size);
+    } else if (size < file_size) {
+        is_ok = _shrinkFile(mem, id, size);
+    } else if (size > file_size) {
+        is_ok = writeFileID(mem, id, NULL, size - file_size);
+    }
+    if (!is_ok)
+        perror(cmd[1]);
+    unlockInode(id);
+    return is_ok;
+}
+
+/**
+ * @brief 
+ *  Shrinks a file down to the given size.
+ * 
+ * @note 
+ *  Only the trailing data blocks that are no longer needed, and any blocks
+ *  reserved after them, are freed. The blocks that are kept are left in place
+ *  and the size of the new last block is cut down, after it is copied if it
+ *  is shared.
+ * 
+ * @param[in]  mem   Pointer to the memory block containing file system data.
+ * @param[in]  id    The ID of the file to shrink.
+ * @param[in]  size  The new size of the file, smaller than its current size.
+ *
+ * @return
+ *   true if successful, false otherwise (sets errno).
+ */
+static bool _shrinkFile(union Block *mem, int id, int size)
+{
+    struct FileNode *file = &mem[id].file;
+    int new_len = ceilDivInt(size, BLOCK_MAX_DATA);
+    if (size % BLOCK_MAX_DATA != 0 &&
+        !unshareFileBlocks(mem, id, new_len - 1, new_len))
+        return false;
+
+    freeBlockIDs(mem, file->blocks + new_len,
+                 file->len + file->prealloc - new_len);
+    if (new_len > 0) {
+        int last_id = file->blocks[new_len - 1];
+        mem[last_id].data.size = size - (new_len - 1) * BLOCK_MAX_DATA;
+        markDataDirty(last_id);
+    }
+    file->len = new_len;
+    file->prealloc = 0;
+    markBlockDirty(id);
+    return true;
+}
+
+/**
+ * @brief
+ *  Shrinks a compressed file down to the given size.
+ *
+ * @note
+ *  The chunk holding the new end of the file is encoded again with the part
+ *  of it that is kept, and the blocks after it are freed.
+ *
+ * @param[in]  mem   Pointer to the memory block containing file system data.
+ * @param[in]  id    The ID of the file to shrink.
+ * @param[in]  size  The new size of the file, smaller than its current size.
+ *
+ * @return
+ *   true if successful, false otherwise (sets errno).
+ */
+static bool _shrinkChunks(union Block *mem, int id, int size)
+{
+    struct FileNode *file = &mem[id].file;
+    struct FilePos pos;
+    setFilePos(&pos, size);
+    seekFilePos(mem, id, &pos);
+
+    uint8_t buf[CHUNK_MAX_SIZE];
+    decodeChunk(&mem[file->blocks[pos.block_idx]].data, buf, pos.block_offset);
+    if (!writeFileChunks(mem, id, pos.block_idx, buf, pos.block_offset))
+        return false;
+    freeBlockIDs(mem, file->blocks + file->len, file->prealloc);
+    file->prealloc = 0;
+    markBlockDirty(id);
+    return true;
+}
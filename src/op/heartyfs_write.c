@@ -13,14 +13,11 @@
 #include <string.h>
 
 #include "heartyfs.h"
-#include "heartyfs_bitmap.h"
-#include "heartyfs_helper_structs.h"
-#include "heartyfs_math.h"
+#include "heartyfs_lock.h"
 #include "heartyfs_string.h"
 
 #define CMD_ARG_CNT 1
 
-static bool _writeFile(union Block *mem, int id, void *data, int size);
 static bool _readStdin(char **buf, size_t *offset);
 static int _getWriteMode(char **cmd, int cmd_len, int *operand_start);
 
@@ -37,18 +34,12 @@ bool writeCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
                cmd[0]);
         return false;
     }
-    int id = getNodeID(mem, cmd[operand_start], GETNODEID_USE_CWD);
-    if (id == -1) {
-        return false;
-    } else if (mem[id].file.type != TYPE_FILE) {
-        errno = EISDIR;
-        perror(cmd[operand_start]);
-        return false;
-    }
 
+    // The input is read before the destination is locked, so that a file is
+    // never locked while another one is, which could deadlock.
     char *input = NULL;
     int size;
-    bool is_ok;
+    bool is_ok = false;
     switch (operand_count) {
     case 1: {
         size_t tmp_size;
@@ -62,11 +53,29 @@ bool writeCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
         break;
     }
     }
+    if (!is_ok) {
+        free(input);
+        return false;
+    }
+
+    int id = lockNodeID(mem, cmd[operand_start], true);
+    if (id == -1) {
+        free(input);
+        return false;
+    } else if (mem[id].file.type != TYPE_FILE) {
+        unlockInode(id);
+        free(input);
+        errno = EISDIR;
+        perror(cmd[operand_start]);
+        return false;
+    }
 
     /* Check File size & Resize */
-    if (!is_ok) {
-    } else if (mode == WRONLY) {
-        if (size > FILE_MAX_SIZE) {
+    // A compressed file holds as much as its blocks fit once compressed, so
+    // its size is only checked as it is written.
+    bool is_compressed = mem[id].file.flags & FILE_COMPRESSED;
+    if (mode == WRONLY) {
+        if (!is_compressed && size > FILE_MAX_SIZE) {
             errno = ENOMEM;
             perror(cmd[operand_start]);
             is_ok = false;
@@ -74,14 +83,18 @@ bool writeCmd(union Block *mem, char *exe_path, char **cmd, int cmd_len)
             deleteFileData(mem, id);
         }
     } else if (mode == APPEND) {
-        if (size > FILE_MAX_SIZE - calcFileSize(mem, id)) {
+        if (!is_compressed && size > FILE_MAX_SIZE - calcFileSize(mem, id)) {
             errno = ENOMEM;
             perror(cmd[operand_start]);
             is_ok = false;
         }
     }
-    if (is_ok)
-        is_ok = _writeFile(mem, id, input, size);
+    if (is_ok) {
+        is_ok = writeFileID(mem, id, input, size);
+        if (!is_ok)
+            perror(cmd[operand_start]);
+    }
+    unlockInode(id);
     free(input);
 
     if (is_ok)
@@ -142,66 +155,6 @@ loop_end:
 }
 
 
-/**
- * @brief 
- *  Writes the given data to a file in the file system.
- * 
- * @note 
- *  This function writes data to the file blocks, either overwriting existing 
- *  content or appending to it, depending on the provided write mode. If the 
- *  file needs more space, it finds free blocks in the bitmap and allocates 
- *  them for writing the data.
- * 
- * @param[in]  mem   Pointer to the memory block containing file system data.
- * @param[in]  id    The ID of the file to write to.
- * @param[in]  data  The data to write to the file.
- * @param[in]  size  The size of the data to write.
- * 
- * @return 
- *   true  : Data successfully written to the file. @n
- *   false : Failed to write data (e.g., insufficient space).
- */
-static bool _writeFile(union Block *mem, int id, void *data, int size)
-{
-    struct FileNode *file = &mem[id].file;
-
-    int file_size = calcFileSize(mem, id);
-    int new_len = ceilDivInt(file_size + size, BLOCK_MAX_DATA);
-    struct Interval curr_bounds = intArrInterval(file->blocks, file->len);
-    struct Interval block_bounds;
-    if (!findFreeDensestBlocks(mem[BITMAP_ID].bitmap, new_len - file->len,
-                               &curr_bounds, &block_bounds)) {
-        return false;
-    }
-
-    int curr_block;
-    uint8_t *data_ptr = data;
-    if (file_size > 0) {
-        curr_block = file->blocks[file->len - 1];
-
-        struct DataBlock *d_block = &mem[curr_block].data;
-        int size_wrote = writeDataBlock(d_block, d_block->size, data_ptr, size);
-
-        size -= size_wrote;
-        data_ptr += size_wrote;
-    }
-    curr_block = findNextFreeBlock(mem[BITMAP_ID].bitmap, block_bounds.start);
-    for (int i = file->len; size > 0 && curr_block < block_bounds.end; i++) {
-        file->blocks[i] = curr_block;
-
-        int size_wrote =
-            writeDataBlock(&mem[curr_block].data, 0, data_ptr, size);
-
-        size -= size_wrote;
-        data_ptr += size_wrote;
-        curr_block = findNextFreeBlock(mem[BITMAP_ID].bitmap, curr_block + 1);
-    }
-    setBitmapUsed(mem[BITMAP_ID].bitmap, &block_bounds);
-    file->len = new_len;
-
-    return true;
-}
-
 /**
  * @brief 
  *  Reads data from standard input into a buffer.
@@ -242,11 +195,12 @@ static bool _readStdin(char **buf, size_t *offset)
         *offset += size_read;
         if (*offset == size) {
             size *= 2;
-            *buf = realloc(*buf, size);
-            if (*buf == NULL) {
+            char *new_buf = realloc(*buf, size);
+            if (new_buf == NULL) {
                 perror(__func__);
                 return false;
             }
+            *buf = new_buf;
         } else {
             break;
         }
@@ -0,0 +1,387 @@
+/**
+ * @file heartyfs_backend.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing the storage backends.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// <linux/fs.h> defines its own BLOCK_SIZE, not the one of heartyfs.
+#undef BLOCK_SIZE
+
+#include "heartyfs.h"
+#include "heartyfs_backend.h"
+
+// Most operations in flight on the ring, a bigger batch is split up.
+#define URING_DEPTH 32
+
+struct Ring {
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+static bool _preadBlocks(const struct BlockIO *ios, int count);
+static bool _pwriteBlocks(const struct BlockIO *ios, int count, bool sync);
+static bool _uringReadBlocks(const struct BlockIO *ios, int count);
+static bool _uringWriteBlocks(const struct BlockIO *ios, int count, bool sync);
+static bool _setupRing();
+static void _teardownRing();
+static bool _submitRing(int opcode, const struct BlockIO *ios, int count,
+                        bool sync);
+static bool _reapRing(int count, const unsigned *lens);
+
+const struct {
+    char name[8];
+    bool (*read)(const struct BlockIO *ios, int count);
+    bool (*write)(const struct BlockIO *ios, int count, bool sync);
+} BACKEND_LIST[] = {
+    [BACKEND_MMAP] = {"mmap", _preadBlocks, _pwriteBlocks},
+    [BACKEND_PREAD] = {"pread", _preadBlocks, _pwriteBlocks},
+    [BACKEND_URING] = {"uring", _uringReadBlocks, _uringWriteBlocks}};
+#define BACKEND_LIST_LEN (int)(sizeof(BACKEND_LIST) / sizeof(BACKEND_LIST[0]))
+
+static enum BackendTypes backend = BACKEND_MMAP;
+static int disk_fd = -1;
+static struct Ring ring = {.fd = -1};
+// The block cache reads from its fault handler thread.
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+bool parseBackend(const char *name, enum BackendTypes *type)
+{
+    for (int i = 0; i < BACKEND_LIST_LEN; i++)
+        if (strcmp(name, BACKEND_LIST[i].name) == 0) {
+            *type = i;
+            return true;
+        }
+    errno = EINVAL;
+    return false;
+}
+
+bool openBackend(enum BackendTypes type, int fd)
+{
+    backend = type;
+    disk_fd = fd;
+    return type != BACKEND_URING || _setupRing();
+}
+
+void closeBackend()
+{
+    if (backend == BACKEND_URING)
+        _teardownRing();
+    backend = BACKEND_MMAP;
+    disk_fd = -1;
+}
+
+bool readBlocks(const struct BlockIO *ios, int count)
+{
+    return BACKEND_LIST[backend].read(ios, count);
+}
+
+bool writeBlocks(const struct BlockIO *ios, int count, bool sync)
+{
+    return BACKEND_LIST[backend].write(ios, count, sync);
+}
+
+/**
+ * @brief
+ *  Reads runs of blocks with one `pread()` each.
+ *
+ * @param[in] ios    The runs of blocks to read.
+ * @param[in] count  Number of runs in `ios`.
+ *
+ * @return
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _preadBlocks(const struct BlockIO *ios, int count)
+{
+    for (int i = 0; i < count; i++) {
+        ssize_t size = (ssize_t)ios[i].count * BLOCK_SIZE;
+        ssize_t ret = pread(disk_fd, ios[i].buf, size,
+                            (off_t)ios[i].id * BLOCK_SIZE);
+        if (ret != size) {
+            if (ret >= 0)
+                errno = EIO;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief
+ *  Writes runs of blocks with one `pwrite()` each, then syncs if asked to.
+ *
+ * @param[in] ios    The runs of blocks to write.
+ * @param[in] count  Number of runs in `ios`.
+ * @param[in] sync   Whether to sync the disk file after the writes.
+ *
+ * @return
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _pwriteBlocks(const struct BlockIO *ios, int count, bool sync)
+{
+    for (int i = 0; i < count; i++) {
+        ssize_t size = (ssize_t)ios[i].count * BLOCK_SIZE;
+        ssize_t ret = pwrite(disk_fd, ios[i].buf, size,
+                             (off_t)ios[i].id * BLOCK_SIZE);
+        if (ret != size) {
+            if (ret >= 0)
+                errno = EIO;
+            return false;
+        }
+    }
+    return !sync || fdatasync(disk_fd) == 0;
+}
+
+/**
+ * @brief
+ *  Reads runs of blocks through the ring, `URING_DEPTH` runs per submission.
+ *
+ * @param[in] ios    The runs of blocks to read.
+ * @param[in] count  Number of runs in `ios`.
+ *
+ * @return
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _uringReadBlocks(const struct BlockIO *ios, int count)
+{
+    bool is_ok = true;
+    pthread_mutex_lock(&ring_lock);
+    for (int i = 0; i < count && is_ok; i += URING_DEPTH)
+        is_ok = _submitRing(IORING_OP_READ, ios + i,
+                            count - i < URING_DEPTH ? count - i : URING_DEPTH,
+                            false);
+    pthread_mutex_unlock(&ring_lock);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Writes runs of blocks through the ring, `URING_DEPTH - 1` runs per
+ *  submission, with the sync queued behind the writes of the last one.
+ *
+ * @note
+ *  The buffers are touched before the ring is locked, so that the kernel never
+ *  has to fault in a page of the block cache while the ring is held.
+ *
+ * @param[in] ios    The runs of blocks to write.
+ * @param[in] count  Number of runs in `ios`.
+ * @param[in] sync   Whether to sync the disk file after the writes.
+ *
+ * @return
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _uringWriteBlocks(const struct BlockIO *ios, int count, bool sync)
+{
+    for (int j = 0; j < count; j++) {
+        const volatile char *buf = ios[j].buf;
+        for (int k = 0; k < ios[j].count; k++)
+            (void)buf[k * BLOCK_SIZE];
+    }
+
+    bool is_ok = true;
+    pthread_mutex_lock(&ring_lock);
+    int i = 0;
+    do {
+        int n = count - i < URING_DEPTH - 1 ? count - i : URING_DEPTH - 1;
+        is_ok = _submitRing(IORING_OP_WRITE, ios + i, n,
+                            sync && i + n == count);
+        i += n;
+    } while (i < count && is_ok);
+    pthread_mutex_unlock(&ring_lock);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Sets up the ring and maps its queues.
+ *
+ * @note
+ *  There is no liburing dependency, the ring is driven with the raw system
+ *  calls.
+ *
+ * @return
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _setupRing()
+{
+    struct io_uring_params params = {0};
+    ring.fd = syscall(__NR_io_uring_setup, URING_DEPTH, &params);
+    if (ring.fd < 0)
+        return false;
+
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool is_single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (is_single_mmap && ring.cq_ring_size > ring.sq_ring_size)
+        ring.sq_ring_size = ring.cq_ring_size;
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    ring.cq_ring = is_single_mmap
+                       ? ring.sq_ring
+                       : mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, ring.fd,
+                              IORING_OFF_CQ_RING);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sq_ring == MAP_FAILED || ring.cq_ring == MAP_FAILED ||
+        ring.sqes == MAP_FAILED) {
+        int err = errno;
+        _teardownRing();
+        errno = err;
+        return false;
+    }
+
+    char *sq = ring.sq_ring;
+    char *cq = ring.cq_ring;
+    ring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring.cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+/**
+ * @brief
+ *  Unmaps the queues of the ring and closes it.
+ */
+static void _teardownRing()
+{
+    if (ring.sqes != NULL && ring.sqes != MAP_FAILED)
+        munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_ring != NULL && ring.cq_ring != MAP_FAILED &&
+        ring.cq_ring != ring.sq_ring)
+        munmap(ring.cq_ring, ring.cq_ring_size);
+    if (ring.sq_ring != NULL && ring.sq_ring != MAP_FAILED)
+        munmap(ring.sq_ring, ring.sq_ring_size);
+    if (ring.fd >= 0)
+        close(ring.fd);
+    ring = (struct Ring){.fd = -1};
+}
+
+/**
+ * @brief
+ *  Queues runs of blocks on the ring, submits them with a single system call
+ *  and waits for all of them to complete.
+ *
+ * @note
+ *  The sync is drained behind the other operations, so it only starts once
+ *  all of them completed.
+ *
+ * @param[in] opcode  `IORING_OP_READ` or `IORING_OP_WRITE`.
+ * @param[in] ios     The runs of blocks, less than `URING_DEPTH`.
+ * @param[in] count   Number of runs in `ios`.
+ * @param[in] sync    Whether to queue a sync of the disk file after the runs.
+ *
+ * @return
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _submitRing(int opcode, const struct BlockIO *ios, int count,
+                        bool sync)
+{
+    unsigned lens[URING_DEPTH];
+    unsigned tail = *ring.sq_tail;
+    unsigned mask = *ring.sq_mask;
+    int total = count + (sync ? 1 : 0);
+    for (int i = 0; i < total; i++) {
+        unsigned idx = tail & mask;
+        struct io_uring_sqe *sqe = &ring.sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = disk_fd;
+        sqe->user_data = i;
+        if (i < count) {
+            lens[i] = ios[i].count * BLOCK_SIZE;
+            sqe->opcode = opcode;
+            sqe->addr = (uintptr_t)ios[i].buf;
+            sqe->len = lens[i];
+            sqe->off = (off_t)ios[i].id * BLOCK_SIZE;
+        } else {
+            lens[i] = 0;
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->flags = IOSQE_IO_DRAIN;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        }
+        ring.sq_array[idx] = idx;
+        tail++;
+    }
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+    int submitted = 0;
+    while (submitted < total) {
+        int ret = syscall(__NR_io_uring_enter, ring.fd, total - submitted, 0,
+                          0, NULL, 0);
+        if (ret < 0 && errno != EINTR)
+            return false;
+        if (ret > 0)
+            submitted += ret;
+    }
+    return _reapRing(total, lens);
+}
+
+/**
+ * @brief
+ *  Waits for the completions of submitted operations and checks their results.
+ *
+ * @param[in] count  Number of operations submitted.
+ * @param[in] lens   Expected result of each operation, by user data.
+ *
+ * @return
+ *  `true` if every operation completed in full, `false` otherwise (sets
+ *  errno).
+ */
+static bool _reapRing(int count, const unsigned *lens)
+{
+    int err = 0;
+    int reaped = 0;
+    while (reaped < count) {
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (syscall(__NR_io_uring_enter, ring.fd, 0, 1,
+                        IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+                errno != EINTR)
+                return false;
+            continue;
+        }
+        for (; head != tail; head++, reaped++) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            if (cqe->res < 0)
+                err = -cqe->res;
+            else if ((unsigned)cqe->res != lens[cqe->user_data])
+                err = EIO;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+    if (err != 0) {
+        errno = err;
+        return false;
+    }
+    return true;
+}
@@ -4,6 +4,11 @@
  * @brief 
  *  The module implementing the bitmap helper functions.
  * 
+ *  The bitmap is changed one 64-bit word at a time with atomic operations, so
+ *  that threads can claim and free blocks without a lock. Searches read it one
+ *  byte at a time and may see a stale snapshot, so a block they find is only
+ *  owned once `claimFreeBlocks()` took it.
+ * 
  * @version 0.1
  * @date 2024-11-11
  */
@@ -19,30 +24,27 @@
 #include "heartyfs_bitmap.h"
 #include "heartyfs_helper_structs.h"
 #include "heartyfs_math.h"
+#include "heartyfs_stats.h"
 #include "heartyfs_string.h"
 
 /* Private Functions */
 
+#define WORD_BITS 64
+
 static bool _findFirstFreeInterval(uint8_t *, int, struct Interval *);
+static uint64_t _wordMask(int start_id, int end_id);
+static uint64_t *_wordOf(uint8_t *map, int id);
+static uint8_t _loadByte(const uint8_t *map, int idx);
 
 void setBitmapFree(uint8_t *bitmap, struct Interval *bounds)
 {
     if (bounds == NULL)
         return;
-    int idx_start = bounds->start / CHAR_BIT;
-    int idx_end = bounds->end / CHAR_BIT;
-    int set_size = idx_end - idx_start - 1;
-    if (set_size < 0)
-        set_size = 0;
-    memset(bitmap + idx_start + 1, 0xFF, set_size);
-    uint8_t start_mask = (0xFF >> (bounds->start % CHAR_BIT));
-    uint8_t end_mask = (0xFF << (CHAR_BIT - (bounds->end % CHAR_BIT)));
-
-    if (idx_start == idx_end) {
-        bitmap[idx_end] = bitmap[idx_end] | (start_mask & end_mask);
-    } else {
-        bitmap[idx_start] = bitmap[idx_start] | start_mask;
-        bitmap[idx_end] = bitmap[idx_end] | end_mask;
+    for (int id = bounds->start; id < bounds->end;) {
+        int word_end = minInt((id / WORD_BITS + 1) * WORD_BITS, bounds->end);
+        __atomic_fetch_or(_wordOf(bitmap, id), _wordMask(id, word_end),
+                          __ATOMIC_RELEASE);
+        id = word_end;
     }
 }
 
@@ -50,24 +52,47 @@ void setBitmapUsed(uint8_t *bitmap, struct Interval *bounds)
 {
     if (bounds == NULL)
         return;
-    int idx_start = bounds->start / CHAR_BIT;
-    int idx_end = bounds->end / CHAR_BIT;
-    int set_size = idx_end - idx_start - 1;
-    if (set_size < 0)
-        set_size = 0;
-    memset(bitmap + idx_start + 1, 0x00, set_size);
-
-    uint8_t start_mask = (0xFF << (CHAR_BIT - (bounds->start % CHAR_BIT)));
-    uint8_t end_mask = (0xFF >> (bounds->end % CHAR_BIT));
-
-    if (idx_start == idx_end) {
-        bitmap[idx_end] = bitmap[idx_end] & (start_mask | end_mask);
-    } else {
-        bitmap[idx_start] = bitmap[idx_start] & start_mask;
-        bitmap[idx_end] = bitmap[idx_end] & end_mask;
+    for (int id = bounds->start; id < bounds->end;) {
+        int word_end = minInt((id / WORD_BITS + 1) * WORD_BITS, bounds->end);
+        __atomic_fetch_and(_wordOf(bitmap, id), ~_wordMask(id, word_end),
+                           __ATOMIC_ACQUIRE);
+        id = word_end;
     }
 }
 
+int claimFreeBlocks(uint8_t *map, int start_id, int *ids, int max_count)
+{
+    countStat(STAT_BITMAP_SCANS, 1);
+    for (int id = start_id; id < BLOCK_COUNT;) {
+        countStat(STAT_BITMAP_BYTES, sizeof(uint64_t));
+        uint64_t *word = _wordOf(map, id);
+        int word_end = (id / WORD_BITS + 1) * WORD_BITS;
+        uint64_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+        while ((old & _wordMask(id, word_end)) != 0) {
+            uint8_t bytes[sizeof(uint64_t)];
+            memcpy(bytes, &old, sizeof(bytes));
+            int count = 0;
+            uint64_t mask = 0;
+            for (int found = id; found < word_end && count < max_count;
+                 found++) {
+                if (bytes[found % WORD_BITS / CHAR_BIT] &
+                    (0x80 >> (found % CHAR_BIT))) {
+                    ids[count++] = found;
+                    mask |= _wordMask(found, found + 1);
+                }
+            }
+
+            // Fails and reloads `old` if another thread changed the word.
+            if (__atomic_compare_exchange_n(word, &old, old & ~mask, true,
+                                            __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED))
+                return count;
+        }
+        id = word_end;
+    }
+    return 0;
+}
+
 bool findFreeDensestBlocks(uint8_t *map, int block_count,
                            const struct Interval *existing_bounds,
                            struct Interval *min_bounds)
@@ -77,7 +102,7 @@ bool findFreeDensestBlocks(uint8_t *map, int block_count,
     struct Interval bounds = {0};
     if (!_findFirstFreeInterval(map, block_count, &bounds)) {
         errno = ENOSPC;
-        perror("Disk: " DISK_FILE_PATH);
+        reportError("Disk: " DISK_FILE_PATH);
         return false;
     }
 
@@ -92,31 +117,68 @@ bool findFreeDensestBlocks(uint8_t *map, int block_count,
             if (min_range == smallest_possible)
                 break;
         }
-        if (bounds.end >= BITMAP_LEN)
+        int next_end = findNextFreeBlock(map, bounds.end);
+        if (next_end >= BLOCK_COUNT)
             break;
-        
+
         bounds.start = findNextFreeBlock(map, bounds.start + 1);
-        bounds.end = findNextFreeBlock(map, bounds.end) + 1;
+        bounds.end = next_end + 1;
     }
     return true;
 }
 
 int findNextFreeBlock(uint8_t *map, int start_id)
 {
+    if (start_id >= BLOCK_COUNT)
+        return BLOCK_COUNT;
     int idx = start_id / CHAR_BIT;
     int offset;
     uint8_t mask = 0xFF >> (start_id % CHAR_BIT);
-    if (countSetBits(map[idx] & mask) == 0) {
+    uint8_t byte = _loadByte(map, idx);
+    if (countSetBits(byte & mask) == 0) {
         mask = 0xFF;
         idx++;
     }
-    while (countSetBits(map[idx]) == 0 && idx < BITMAP_LEN) {
+    while (idx < BITMAP_LEN && countSetBits(byte = _loadByte(map, idx)) == 0) {
         idx++;
     }
-    offset = findFirstSetBit(map[idx] & mask, 1);
+    countStat(STAT_BITMAP_SCANS, 1);
+    countStat(STAT_BITMAP_BYTES, minInt(idx, BITMAP_LEN - 1) -
+                                     start_id / CHAR_BIT + 1);
+    if (idx >= BITMAP_LEN)
+        return BLOCK_COUNT;
+    offset = findFirstSetBit(byte & mask, 1);
     return CHAR_BIT * idx + offset;
 }
 
+int findNextUsedBlock(uint8_t *map, int start_id)
+{
+    if (start_id >= BLOCK_COUNT)
+        return BLOCK_COUNT;
+    int idx = start_id / CHAR_BIT;
+    uint8_t mask = 0xFF >> (start_id % CHAR_BIT);
+    uint8_t byte = ~_loadByte(map, idx) & mask;
+    while (byte == 0 && ++idx < BITMAP_LEN)
+        byte = ~_loadByte(map, idx);
+    if (idx >= BITMAP_LEN)
+        return BLOCK_COUNT;
+    return CHAR_BIT * idx + findFirstSetBit(byte, 1);
+}
+
+void countFreeRuns(uint8_t *map, struct FreeRuns *runs)
+{
+    int start_id = findNextFreeBlock(map, 0);
+    while (start_id < BLOCK_COUNT) {
+        int end_id = findNextUsedBlock(map, start_id);
+        int len = end_id - start_id;
+        runs->free_count += len;
+        runs->run_count++;
+        runs->max_len = maxInt(runs->max_len, len);
+        runs->len_hist[minInt(log2Int(len), RUN_HIST_LEN - 1)]++;
+        start_id = findNextFreeBlock(map, end_id);
+    }
+}
+
 /**
  * @brief 
  *  Finds the first free interval in the bitmap that can fit the specified
@@ -137,21 +199,80 @@ static bool _findFirstFreeInterval(uint8_t *map, int count_to_find,
                                    struct Interval *new_bounds)
 {
     int start_id = findNextFreeBlock(map, 0);
+    if (start_id >= BLOCK_COUNT)
+        return false;
 
     int end_idx = start_id / CHAR_BIT;
     uint8_t mask = 0xFF >> (start_id % CHAR_BIT);
-    count_to_find -= countSetBits(map[end_idx] & mask);
+    uint8_t byte = _loadByte(map, end_idx) & mask;
+    count_to_find -= countSetBits(byte);
     while (count_to_find > 0) {
-        if (end_idx >= BITMAP_LEN)
+        if (end_idx + 1 >= BITMAP_LEN)
             return false;
 
         end_idx++;
-        count_to_find -= countSetBits(map[end_idx]);
+        byte = _loadByte(map, end_idx);
+        count_to_find -= countSetBits(byte);
     }
-    int remainder = count_to_find + countSetBits(map[end_idx]);
-    int end_offset = findFirstSetBit(map[end_idx], remainder);
+    int remainder = count_to_find + countSetBits(byte);
+    int end_offset = findFirstSetBit(byte, remainder);
 
     new_bounds->start = start_id;
     new_bounds->end = CHAR_BIT * end_idx + (end_offset + 1);
     return true;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief 
+ *  Builds the mask of a range of blocks within one word of the bitmap.
+ * 
+ * @note 
+ *  The bits are laid out byte by byte with the first block in the most
+ *  significant bit, so the mask is built in memory order to not depend on the
+ *  byte order of the word.
+ * 
+ * @param[in] start_id  ID of the first block of the range.
+ * @param[in] end_id    ID after the last block, in the same word.
+ * 
+ * @return 
+ *  The mask of the range.
+ */
+static uint64_t _wordMask(int start_id, int end_id)
+{
+    uint8_t bytes[sizeof(uint64_t)] = {0};
+    for (int id = start_id; id < end_id; id++)
+        bytes[id % WORD_BITS / CHAR_BIT] |= 0x80 >> (id % CHAR_BIT);
+    uint64_t mask;
+    memcpy(&mask, bytes, sizeof(mask));
+    return mask;
+}
+
+/**
+ * @brief 
+ *  Gets the word of the bitmap holding the bit of a block.
+ * 
+ * @param[in] map   The bitmap, aligned to a word.
+ * @param[in] id    ID of the block.
+ * 
+ * @return 
+ *  Pointer to the word.
+ */
+static uint64_t *_wordOf(uint8_t *map, int id)
+{
+    return (uint64_t *)(map + id / WORD_BITS * sizeof(uint64_t));
+}
+
+/**
+ * @brief 
+ *  Reads a byte of the bitmap that other threads may be changing.
+ * 
+ * @param[in] map   The bitmap.
+ * @param[in] idx   Index of the byte.
+ * 
+ * @return 
+ *  The byte.
+ */
+static uint8_t _loadByte(const uint8_t *map, int idx)
+{
+    return __atomic_load_n(&map[idx], __ATOMIC_RELAXED);
+}
@@ -0,0 +1,470 @@
+/**
+ * @file heartyfs_cache.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing the block cache.
+ *
+ *  The memory of the disk is an anonymous mapping registered with
+ *  userfaultfd, so that the rest of heartyfs can keep indexing it as
+ *  `mem[id]`. A handler thread fills the pages missing on a fault from the
+ *  backend, and write-protects them, so that the first write to a page is also
+ *  reported and the page is pinned until it is cleaned.
+ *
+ *  Handling the faults of the kernel needs privileges unless
+ *  `vm.unprivileged_userfaultfd` is set, and the disk memory is handed to the
+ *  kernel directly, e.g. by `export`. Without userfaultfd, the whole disk is
+ *  read into the memory in one batch instead and kept there, so the cache
+ *  size is not honored, but the backends still work.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "heartyfs.h"
+#include "heartyfs_backend.h"
+#include "heartyfs_cache.h"
+
+// Pages read on a fault, starting with the faulting one.
+#define CACHE_READAHEAD 4
+
+struct Page {
+    int prev; // Next more recently faulted page
+    int next; // Next less recently faulted page
+    bool is_resident;
+    bool is_written;
+};
+
+static bool _startFaults();
+static void _stopFaults();
+static bool _loadDisk();
+static void *_handleFaults(void *arg);
+static void _handleFault(const struct uffd_msg *msg);
+static bool _loadPages(int first, int count);
+static void _evictPages();
+static void _protectPages(int first, int count, bool is_protected);
+static void _pushPage(int page);
+static void _unlinkPage(int page);
+
+static int uffd = -1;
+static int stop_fd = -1;
+static pthread_t handler;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *base = NULL;
+static char *bounce = NULL;
+static long page_size;
+static int page_count;
+static int capacity_pages;
+static int resident_count = 0;
+static bool is_faulted = false; // Whether pages are filled on faults
+static struct Page *pages = NULL;
+static int lru_head = -1;
+static int lru_tail = -1;
+
+union Block *mapCache(int capacity)
+{
+    page_size = sysconf(_SC_PAGESIZE);
+    page_count = DISK_SIZE / page_size;
+    int blocks_per_page = page_size / BLOCK_SIZE;
+    capacity_pages = (capacity + blocks_per_page - 1) / blocks_per_page;
+    if (capacity_pages < CACHE_READAHEAD)
+        capacity_pages = CACHE_READAHEAD;
+    if (capacity_pages > page_count)
+        capacity_pages = page_count;
+
+    pages = calloc(page_count, sizeof(struct Page));
+    base = mmap(NULL, DISK_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pages == NULL || base == MAP_FAILED)
+        goto fail;
+    for (int i = 0; i < page_count; i++)
+        pages[i] = (struct Page){.prev = -1, .next = -1};
+
+    is_faulted = _startFaults();
+    if (!is_faulted && !_loadDisk())
+        goto fail;
+    return (union Block *)base;
+
+fail:;
+    int fail_err = errno;
+    if (base != MAP_FAILED && base != NULL)
+        munmap(base, DISK_SIZE);
+    free(pages);
+    base = NULL;
+    pages = NULL;
+    errno = fail_err;
+    return NULL;
+}
+
+void unmapCache(union Block *mem)
+{
+    if (is_faulted)
+        _stopFaults();
+    munmap(mem, DISK_SIZE);
+    free(pages);
+    base = NULL;
+    pages = NULL;
+    is_faulted = false;
+    resident_count = 0;
+    lru_head = lru_tail = -1;
+}
+
+void prefetchCache(union Block *mem, const struct Interval *ranges, int count)
+{
+    (void)mem;
+    if (!is_faulted)
+        return;
+    int blocks_per_page = page_size / BLOCK_SIZE;
+    struct BlockIO ios[count > 0 ? count : 1];
+    struct Interval runs[count > 0 ? count : 1];
+    int io_count = 0;
+    int room;
+
+    pthread_mutex_lock(&cache_lock);
+    room = capacity_pages - resident_count;
+    for (int i = 0; i < count && room > 0; i++) {
+        int first = ranges[i].start / blocks_per_page;
+        int end = (ranges[i].end + blocks_per_page - 1) / blocks_per_page;
+        while (first < end && pages[first].is_resident)
+            first++;
+        int n = 0;
+        while (first + n < end && n < room && !pages[first + n].is_resident)
+            n++;
+        if (n == 0)
+            continue;
+
+        // Runs are read next to each other in the bounce buffer.
+        int offset = capacity_pages - resident_count - room;
+        ios[io_count] = (struct BlockIO){first * blocks_per_page,
+                                         n * blocks_per_page,
+                                         bounce + (size_t)offset * page_size};
+        runs[io_count++] = (struct Interval){first, first + n};
+        room -= n;
+    }
+    if (io_count > 0 && readBlocks(ios, io_count)) {
+        for (int i = 0; i < io_count; i++) {
+            struct uffdio_copy copy = {
+                .dst = (uintptr_t)(base + (size_t)runs[i].start * page_size),
+                .src = (uintptr_t)ios[i].buf,
+                .len = (size_t)(runs[i].end - runs[i].start) * page_size,
+                .mode = UFFDIO_COPY_MODE_WP};
+            if (ioctl(uffd, UFFDIO_COPY, &copy) == -1)
+                continue;
+            for (int page = runs[i].start; page < runs[i].end; page++) {
+                pages[page].is_resident = true;
+                _pushPage(page);
+                resident_count++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void cleanCache(union Block *mem)
+{
+    (void)mem;
+    if (!is_faulted)
+        return;
+    pthread_mutex_lock(&cache_lock);
+    int first = -1;
+    for (int page = 0; page <= page_count; page++) {
+        bool is_written = page < page_count && pages[page].is_written;
+        if (is_written) {
+            pages[page].is_written = false;
+            if (first == -1)
+                first = page;
+        } else if (first != -1) {
+            _protectPages(first, page - first, true);
+            first = -1;
+        }
+    }
+    _evictPages();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * @brief
+ *  Registers the memory of the disk with userfaultfd and starts the thread
+ *  handling its faults.
+ *
+ * @return
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _startFaults()
+{
+    bounce = malloc((size_t)capacity_pages * page_size);
+    uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (bounce == NULL || uffd < 0 || stop_fd < 0)
+        goto fail;
+    madvise(base, DISK_SIZE, MADV_NOHUGEPAGE);
+
+    struct uffdio_api api = {.api = UFFD_API,
+                             .features = UFFD_FEATURE_PAGEFAULT_FLAG_WP};
+    struct uffdio_register reg = {
+        .range = {.start = (uintptr_t)base, .len = DISK_SIZE},
+        .mode = UFFDIO_REGISTER_MODE_MISSING | UFFDIO_REGISTER_MODE_WP};
+    if (ioctl(uffd, UFFDIO_API, &api) == -1 ||
+        ioctl(uffd, UFFDIO_REGISTER, &reg) == -1)
+        goto fail;
+    if (!(reg.ioctls & (1ULL << _UFFDIO_WRITEPROTECT))) {
+        errno = ENOTSUP;
+        goto fail;
+    }
+
+    int err = pthread_create(&handler, NULL, _handleFaults, NULL);
+    if (err != 0) {
+        errno = err;
+        goto fail;
+    }
+    return true;
+
+fail:;
+    int fail_err = errno;
+    if (stop_fd >= 0)
+        close(stop_fd);
+    if (uffd >= 0)
+        close(uffd);
+    free(bounce);
+    stop_fd = uffd = -1;
+    bounce = NULL;
+    errno = fail_err;
+    return false;
+}
+
+/**
+ * @brief
+ *  Stops the thread handling the faults and closes userfaultfd.
+ */
+static void _stopFaults()
+{
+    uint64_t stop = 1;
+    if (write(stop_fd, &stop, sizeof(stop)) == sizeof(stop))
+        pthread_join(handler, NULL);
+    close(stop_fd);
+    close(uffd);
+    free(bounce);
+    stop_fd = uffd = -1;
+    bounce = NULL;
+}
+
+/**
+ * @brief
+ *  Reads the whole disk into its memory, for when faults cannot be handled.
+ *
+ * @return
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _loadDisk()
+{
+    struct BlockIO io = {0, BLOCK_COUNT, base};
+    if (!readBlocks(&io, 1))
+        return false;
+    for (int i = 0; i < page_count; i++)
+        pages[i].is_resident = true;
+    resident_count = page_count;
+    return true;
+}
+
+/**
+ * @brief
+ *  Handles the faults on the memory of the disk until the cache is torn down.
+ *
+ * @param[in] arg   Unused.
+ *
+ * @return
+ *  `NULL`.
+ */
+static void *_handleFaults(void *arg)
+{
+    (void)arg;
+    struct pollfd fds[2] = {{.fd = uffd, .events = POLLIN},
+                            {.fd = stop_fd, .events = POLLIN}};
+    while (true) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            reportError("Cache");
+            exit(1);
+        }
+        if (fds[1].revents & POLLIN)
+            return NULL;
+
+        struct uffd_msg msg;
+        if (read(uffd, &msg, sizeof(msg)) != sizeof(msg))
+            continue;
+        if (msg.event != UFFD_EVENT_PAGEFAULT)
+            continue;
+        pthread_mutex_lock(&cache_lock);
+        _handleFault(&msg);
+        pthread_mutex_unlock(&cache_lock);
+    }
+}
+
+/**
+ * @brief
+ *  Resolves a fault: a missing page is read with the pages after it, and the
+ *  first write to a page pins it until the cache is cleaned.
+ *
+ * @note
+ *  The cache cannot report a failed read to the faulting access, so it exits
+ *  the program instead.
+ *
+ * @param[in] msg   The fault message.
+ */
+static void _handleFault(const struct uffd_msg *msg)
+{
+    int page = (msg->arg.pagefault.address - (uintptr_t)base) / page_size;
+    bool is_write = msg->arg.pagefault.flags &
+                    (UFFD_PAGEFAULT_FLAG_WRITE | UFFD_PAGEFAULT_FLAG_WP);
+
+    if (!pages[page].is_resident) {
+        int count = 1;
+        while (count < CACHE_READAHEAD && page + count < page_count &&
+               !pages[page + count].is_resident)
+            count++;
+        if (!_loadPages(page, count)) {
+            reportError("Cache: " DISK_FILE_PATH);
+            exit(1);
+        }
+    } else {
+        _unlinkPage(page);
+        _pushPage(page);
+    }
+
+    if (is_write) {
+        pages[page].is_written = true;
+        _protectPages(page, 1, false);
+    } else {
+        struct uffdio_range range = {
+            .start = (uintptr_t)(base + (size_t)page * page_size),
+            .len = page_size};
+        ioctl(uffd, UFFDIO_WAKE, &range);
+    }
+    _evictPages();
+}
+
+/**
+ * @brief
+ *  Reads a run of missing pages from the backend and places them
+ *  write-protected, with the first page as the most recently faulted one.
+ *
+ * @note
+ *  The faulting thread is not woken up yet.
+ *
+ * @param[in] first  Index of the first page.
+ * @param[in] count  Number of pages, at most `CACHE_READAHEAD`.
+ *
+ * @return
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _loadPages(int first, int count)
+{
+    int blocks_per_page = page_size / BLOCK_SIZE;
+    struct BlockIO io = {first * blocks_per_page, count * blocks_per_page,
+                         bounce};
+    struct uffdio_copy copy = {
+        .dst = (uintptr_t)(base + (size_t)first * page_size),
+        .src = (uintptr_t)bounce,
+        .len = (size_t)count * page_size,
+        .mode = UFFDIO_COPY_MODE_WP | UFFDIO_COPY_MODE_DONTWAKE};
+    if (!readBlocks(&io, 1) || ioctl(uffd, UFFDIO_COPY, &copy) == -1)
+        return false;
+
+    for (int page = first + count - 1; page >= first; page--) {
+        pages[page].is_resident = true;
+        _pushPage(page);
+        resident_count++;
+    }
+    return true;
+}
+
+/**
+ * @brief
+ *  Drops the least recently faulted clean pages until the cache fits in its
+ *  capacity, or only written pages are left.
+ */
+static void _evictPages()
+{
+    int page = lru_tail;
+    while (resident_count > capacity_pages && page != -1) {
+        int prev = pages[page].prev;
+        if (!pages[page].is_written &&
+            madvise(base + (size_t)page * page_size, page_size,
+                    MADV_DONTNEED) == 0) {
+            _unlinkPage(page);
+            pages[page].is_resident = false;
+            resident_count--;
+        }
+        page = prev;
+    }
+}
+
+/**
+ * @brief
+ *  Write-protects a run of pages, or removes the protection and wakes up the
+ *  threads waiting on it.
+ *
+ * @param[in] first         Index of the first page.
+ * @param[in] count         Number of pages.
+ * @param[in] is_protected  Whether to protect the pages.
+ */
+static void _protectPages(int first, int count, bool is_protected)
+{
+    struct uffdio_writeprotect wp = {
+        .range = {.start = (uintptr_t)(base + (size_t)first * page_size),
+                  .len = (size_t)count * page_size},
+        .mode = is_protected ? UFFDIO_WRITEPROTECT_MODE_WP : 0};
+    if (ioctl(uffd, UFFDIO_WRITEPROTECT, &wp) == -1) {
+        reportError("Cache: " DISK_FILE_PATH);
+        exit(1);
+    }
+}
+
+/**
+ * @brief
+ *  Links a page at the most recently faulted end of the LRU list.
+ *
+ * @param[in] page  Index of the page.
+ */
+static void _pushPage(int page)
+{
+    pages[page].prev = -1;
+    pages[page].next = lru_head;
+    if (lru_head != -1)
+        pages[lru_head].prev = page;
+    lru_head = page;
+    if (lru_tail == -1)
+        lru_tail = page;
+}
+
+/**
+ * @brief
+ *  Unlinks a page from the LRU list.
+ *
+ * @param[in] page  Index of the page.
+ */
+static void _unlinkPage(int page)
+{
+    if (pages[page].prev != -1)
+        pages[pages[page].prev].next = pages[page].next;
+    else
+        lru_head = pages[page].next;
+    if (pages[page].next != -1)
+        pages[pages[page].next].prev = pages[page].prev;
+    else
+        lru_tail = pages[page].prev;
+    pages[page].prev = pages[page].next = -1;
+}
@@ -0,0 +1,297 @@
+/**
+ * @file heartyfs_chunk.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing the codec and the chunks of compressed files.
+ *
+ *  Compressed data is a list of sequences, each a token, literals copied as
+ *  they are, then a match copying bytes already decompressed. The high four
+ *  bits of the token hold the number of literals and the low four bits the
+ *  length of the match minus `LZ_MIN_MATCH`, either followed by extra bytes
+ *  adding up to the rest when it reaches 15. A match is a 2-byte offset back
+ *  from the end of the output. The last sequence has no match.
+ *
+ *  Matches are found through a hash table of the positions of the last
+ *  4-byte sequences seen, which is all a chunk of a few kilobytes needs.
+ *  Since a chunk has to fit in a block, the compressor stops at the last
+ *  sequence that fits rather than failing.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <string.h>
+
+#include "heartyfs_chunk.h"
+#include "heartyfs_math.h"
+#include "heartyfs_stats.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET UINT16_MAX
+#define LZ_LEN_MASK 0xF
+#define LZ_LEN_EXT 255
+
+// Set in the header of a chunk stored as is.
+#define CHUNK_STORED 0x8000
+
+static const uint8_t ZERO_CHUNK[CHUNK_MAX_SIZE];
+
+static int _countLenBytes(int len);
+static int _putLen(uint8_t *dst, int len);
+static bool _getLen(const uint8_t *src, int src_len, int *idx, int *len);
+static int _putLiterals(const uint8_t *lits, int lit_len, uint8_t *dst,
+                        int dst_cap, int *lits_used);
+static uint16_t _getHeader(const struct DataBlock *d_block);
+static void _setHeader(struct DataBlock *d_block, uint16_t header);
+
+int compressLZ(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap,
+               int *src_used)
+{
+    int16_t table[1 << LZ_HASH_BITS];
+    memset(table, -1, sizeof(table));
+
+    int ip = 0;
+    int anchor = 0; // Start of the literals not written yet
+    int op = 0;
+    while (ip + LZ_MIN_MATCH <= src_len) {
+        uint32_t seq;
+        memcpy(&seq, src + ip, sizeof(seq));
+        int hash = (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+        int ref = table[hash];
+        table[hash] = ip;
+        if (ref < 0 || ip - ref > LZ_MAX_OFFSET ||
+            memcmp(src + ref, src + ip, LZ_MIN_MATCH) != 0) {
+            ip++;
+            continue;
+        }
+        int match_len = LZ_MIN_MATCH;
+        while (ip + match_len < src_len &&
+               src[ref + match_len] == src[ip + match_len])
+            match_len++;
+
+        int lit_len = ip - anchor;
+        int cost = 1 + _countLenBytes(lit_len) + lit_len + sizeof(uint16_t) +
+                   _countLenBytes(match_len - LZ_MIN_MATCH);
+        if (op + cost > dst_cap)
+            break;
+        uint8_t *token = &dst[op++];
+        *token = minInt(lit_len, LZ_LEN_MASK) << 4 |
+                 minInt(match_len - LZ_MIN_MATCH, LZ_LEN_MASK);
+        op += _putLen(dst + op, lit_len);
+        memcpy(dst + op, src + anchor, lit_len);
+        op += lit_len;
+        dst[op++] = (ip - ref) & 0xFF;
+        dst[op++] = (ip - ref) >> 8;
+        op += _putLen(dst + op, match_len - LZ_MIN_MATCH);
+
+        ip += match_len;
+        anchor = ip;
+    }
+
+    int lits_used;
+    op += _putLiterals(src + anchor, src_len - anchor, dst + op, dst_cap - op,
+                       &lits_used);
+    *src_used = anchor + lits_used;
+    return op;
+}
+
+int decompressLZ(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap)
+{
+    int ip = 0;
+    int op = 0;
+    while (ip < src_len && op < dst_cap) {
+        int token = src[ip++];
+        int lit_len = token >> 4;
+        if (!_getLen(src, src_len, &ip, &lit_len) || lit_len > src_len - ip)
+            return -1;
+        int copy_len = minInt(lit_len, dst_cap - op);
+        memcpy(dst + op, src + ip, copy_len);
+        ip += lit_len;
+        op += copy_len;
+        if (ip == src_len || op == dst_cap)
+            break;
+
+        if (src_len - ip < (int)sizeof(uint16_t))
+            return -1;
+        int offset = src[ip] | src[ip + 1] << 8;
+        ip += sizeof(uint16_t);
+        int match_len = token & LZ_LEN_MASK;
+        if (offset == 0 || offset > op ||
+            !_getLen(src, src_len, &ip, &match_len))
+            return -1;
+        match_len = minInt(match_len + LZ_MIN_MATCH, dst_cap - op);
+        // Byte by byte, since a match may overlap the bytes it produces.
+        for (int i = 0; i < match_len; i++)
+            dst[op + i] = dst[op - offset + i];
+        op += match_len;
+    }
+    return op;
+}
+
+int encodeChunk(struct DataBlock *d_block, const void *data, int size)
+{
+    const uint8_t *src = (data == NULL) ? ZERO_CHUNK : data;
+    int chunk_size;
+    int data_size = compressLZ(src, minInt(size, CHUNK_MAX_SIZE),
+                               d_block->data + CHUNK_HEADER_SIZE,
+                               CHUNK_MAX_DATA, &chunk_size);
+    if (chunk_size <= minInt(size, CHUNK_MAX_DATA)) {
+        chunk_size = minInt(size, CHUNK_MAX_DATA);
+        memcpy(d_block->data + CHUNK_HEADER_SIZE, src, chunk_size);
+        data_size = chunk_size;
+        _setHeader(d_block, chunk_size | CHUNK_STORED);
+    } else {
+        _setHeader(d_block, chunk_size);
+    }
+    d_block->size = CHUNK_HEADER_SIZE + data_size;
+    countStat(STAT_BYTES_WRITTEN, d_block->size);
+    return chunk_size;
+}
+
+int getChunkSize(const struct DataBlock *d_block)
+{
+    return _getHeader(d_block) & ~CHUNK_STORED;
+}
+
+int decodeChunk(const struct DataBlock *d_block, void *buf, int size)
+{
+    const uint8_t *data = d_block->data + CHUNK_HEADER_SIZE;
+    int data_size = d_block->size - CHUNK_HEADER_SIZE;
+    if (_getHeader(d_block) & CHUNK_STORED) {
+        size = minInt(size, data_size);
+        memcpy(buf, data, size);
+        return size;
+    }
+    return decompressLZ(data, data_size, buf, size);
+}
+
+bool isChunkValid(const struct DataBlock *d_block)
+{
+    if (d_block->size < CHUNK_HEADER_SIZE || d_block->size > BLOCK_MAX_DATA)
+        return false;
+    int chunk_size = getChunkSize(d_block);
+    if (_getHeader(d_block) & CHUNK_STORED)
+        return chunk_size == d_block->size - CHUNK_HEADER_SIZE;
+    uint8_t buf[CHUNK_MAX_SIZE];
+    return chunk_size <= CHUNK_MAX_SIZE &&
+           decodeChunk(d_block, buf, CHUNK_MAX_SIZE) == chunk_size;
+}
+
+/**
+ * @brief
+ *  Counts the extra bytes holding the rest of a length past its token.
+ *
+ * @param[in] len  The length.
+ *
+ * @return
+ *   Number of extra bytes.
+ */
+static int _countLenBytes(int len)
+{
+    return (len < LZ_LEN_MASK) ? 0 : (len - LZ_LEN_MASK) / LZ_LEN_EXT + 1;
+}
+
+/**
+ * @brief
+ *  Writes the extra bytes of a length past its token.
+ *
+ * @param[out] dst  Where to write them.
+ * @param[in]  len  The length.
+ *
+ * @return
+ *   Number of extra bytes written.
+ */
+static int _putLen(uint8_t *dst, int len)
+{
+    if (len < LZ_LEN_MASK)
+        return 0;
+    int count = 0;
+    for (len -= LZ_LEN_MASK; len >= LZ_LEN_EXT; len -= LZ_LEN_EXT)
+        dst[count++] = LZ_LEN_EXT;
+    dst[count++] = len;
+    return count;
+}
+
+/**
+ * @brief
+ *  Reads the extra bytes of a length, if its token asks for them.
+ *
+ * @param[in]      src      The compressed data.
+ * @param[in]      src_len  Size of the compressed data.
+ * @param[in, out] idx      Index of the extra bytes, moved past them.
+ * @param[in, out] len      The length from the token, with the rest added.
+ *
+ * @return
+ *   true if successful, false if the data ends first.
+ */
+static bool _getLen(const uint8_t *src, int src_len, int *idx, int *len)
+{
+    if (*len < LZ_LEN_MASK)
+        return true;
+    int byte;
+    do {
+        if (*idx == src_len)
+            return false;
+        byte = src[(*idx)++];
+        *len += byte;
+    } while (byte == LZ_LEN_EXT);
+    return true;
+}
+
+/**
+ * @brief
+ *  Writes the last sequence, holding as many of the literals left as fit.
+ *
+ * @param[in]  lits       The literals left.
+ * @param[in]  lit_len    Number of literals left.
+ * @param[out] dst        Where to write the sequence.
+ * @param[in]  dst_cap    Bytes left in `dst`.
+ * @param[out] lits_used  Number of literals written.
+ *
+ * @return
+ *   Size of the sequence, 0 if not even its token fits.
+ */
+static int _putLiterals(const uint8_t *lits, int lit_len, uint8_t *dst,
+                        int dst_cap, int *lits_used)
+{
+    *lits_used = 0;
+    if (lit_len == 0 || dst_cap < 2)
+        return 0;
+    lit_len = minInt(lit_len, dst_cap - 1);
+    while (1 + _countLenBytes(lit_len) + lit_len > dst_cap)
+        lit_len--;
+    int op = 0;
+    dst[op++] = minInt(lit_len, LZ_LEN_MASK) << 4;
+    op += _putLen(dst + op, lit_len);
+    memcpy(dst + op, lits, lit_len);
+    *lits_used = lit_len;
+    return op + lit_len;
+}
+
+/**
+ * @brief
+ *  Reads the header of the chunk in a data block.
+ *
+ * @param[in] d_block  The data block.
+ *
+ * @return
+ *   The header.
+ */
+static uint16_t _getHeader(const struct DataBlock *d_block)
+{
+    uint16_t header;
+    memcpy(&header, d_block->data, CHUNK_HEADER_SIZE);
+    return header;
+}
+
+/**
+ * @brief
+ *  Writes the header of the chunk in a data block.
+ *
+ * @param[out] d_block  The data block.
+ * @param[in]  header   The header.
+ */
+static void _setHeader(struct DataBlock *d_block, uint16_t header)
+{
+    memcpy(d_block->data, &header, CHUNK_HEADER_SIZE);
+}
@@ -0,0 +1,1091 @@
+/**
+ * @file heartyfs_disk.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief 
+ *  The module implementing the disk mapping and its transactions.
+ * 
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#define _GNU_SOURCE // sync_file_range(), F_OFD_SETLKW
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "heartyfs.h"
+#include "heartyfs_backend.h"
+#include "heartyfs_bitmap.h"
+#include "heartyfs_cache.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_journal.h"
+#include "heartyfs_math.h"
+#include "heartyfs_stats.h"
+#include "heartyfs_string.h"
+
+// Most records an operation adds, unless it runs alone and reserves more with
+// `reserveDiskOp()`: a directory, an inode, the bitmap and the blocks of
+// reference counts, e.g. for `rm` of a file sharing blocks. Data blocks are
+// written in place, so they take no record.
+#define OP_MAX_RECORDS (3 + REF_BLOCK_COUNT)
+// Blocks the block cache keeps by default, a quarter of the disk.
+#define CACHE_DEFAULT_SIZE (BLOCK_COUNT / 4)
+
+static bool _setBit(uint8_t *map, int id);
+static void _clearBit(uint8_t *map, int id);
+static bool _isBitSet(const uint8_t *map, int id);
+static bool _commitLocked(union Block *mem, bool is_releasing);
+static bool _commitJournaled(union Block *mem, const int *fresh_ids,
+                             int fresh_count, const int *journal_ids,
+                             int journal_count);
+static void _applyFrees(union Block *mem);
+static bool _writeBlocks(union Block *mem, const int *ids, int count,
+                         bool sync);
+static bool _commitInPlace(union Block *mem, const int *ids, int count);
+static bool _isJournaled();
+static bool _isCached();
+static bool _startWriteback(const int *ids, int count);
+static bool _adviseRange(union Block *mem, int start_id, int end_id,
+                         int advice);
+static void _populateRange(union Block *mem, int start_id, int end_id);
+static int _findFileExtents(struct FileNode *file, struct Interval *extents);
+static void _lockRange(int start_id, int end_id, short type);
+static void _refreshNode(int id);
+static void _refreshBlock(int id);
+static void _releaseDiskLocks();
+static union Block *_abortMount();
+static int _claimBlocks(union Block *mem, int start_id, int *ids, int count);
+static int _allocCached(union Block *mem, int start_id);
+static struct AllocCache *_getAllocCache();
+static int _stealCachedBlock();
+static void _returnCachedBlocks(union Block *mem);
+
+const char SYNC_MODE_LIST[][8] = {
+    [SYNC_NONE] = "none",
+    [SYNC_ASYNC] = "async",
+    [SYNC_ORDERED] = "ordered",
+    [SYNC_FULL] = "full"};
+#define SYNC_MODE_LIST_LEN (int)(sizeof(SYNC_MODE_LIST) / sizeof(SYNC_MODE_LIST[0]))
+
+const struct {
+    char name[12];
+    int flag;
+} MAPPING_FLAG_LIST[] = {{"meta", MAPPING_POPULATE_META},
+                         {"populate", MAPPING_POPULATE},
+                         {"huge", MAPPING_HUGE}};
+#define MAPPING_FLAG_LIST_LEN (int)(sizeof(MAPPING_FLAG_LIST) / sizeof(MAPPING_FLAG_LIST[0]))
+
+static enum SyncModes sync_mode = SYNC_ORDERED;
+static int mapping_flags = 0;
+static enum BackendTypes backend = BACKEND_MMAP;
+static int cache_size = CACHE_DEFAULT_SIZE;
+static int disk_fd = -1;
+static union Block *disk_mem = NULL;
+static enum DiskLockModes lock_mode = DISK_LOCK_BLOCKS;
+// Blocks write-locked across processes, kept until the commit. The threads
+// of a command share the locks of its process, counted under `lock_mutex`.
+static pthread_mutex_t lock_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t write_lock_map[BITMAP_LEN];
+static int read_lock_counts[BLOCK_COUNT];
+
+// Blocks claimed ahead by a thread, so that it allocates without touching
+// the shared bitmap until they run out.
+struct AllocCache {
+    _Alignas(64) pthread_mutex_t lock; // Only contended by stealing threads
+    int next;                          // Index of the next block to hand out
+    int count;                         // Blocks left from `next`
+    int ids[ALLOC_CACHE_MAX_BLOCKS];
+};
+
+#define ALLOC_CACHE_MAX 128
+
+static int alloc_cache_size = 0;
+static pthread_mutex_t alloc_caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct AllocCache alloc_caches[ALLOC_CACHE_MAX];
+static int alloc_cache_count = 0;
+static _Thread_local struct AllocCache *thread_cache = NULL;
+static _Thread_local bool has_no_cache = false;
+static uint8_t dirty_map[BITMAP_LEN];
+static uint8_t alloc_map[BITMAP_LEN];
+static uint8_t data_map[BITMAP_LEN];
+static uint8_t free_map[BITMAP_LEN];
+// The maps and counter above are changed with atomic operations, so that
+// threads record their changes without a lock.
+static int record_count = 0;
+// Held shared by every running operation and exclusively by a commit, so that
+// a commit never sees the changes of an operation halfway through.
+static pthread_rwlock_t op_lock = PTHREAD_RWLOCK_INITIALIZER;
+// Guards the count of running operations.
+static pthread_mutex_t txn_lock = PTHREAD_MUTEX_INITIALIZER;
+static int op_count = 0;
+// Set while the thread runs an operation holding `op_lock` exclusively.
+static _Thread_local bool is_isolated = false;
+// The error of a journaled commit that failed, after which the disk file no
+// longer matches the memory and nothing more is committed.
+static int commit_err = 0;
+
+bool parseSyncMode(const char *name, enum SyncModes *mode)
+{
+    for (int i = 0; i < SYNC_MODE_LIST_LEN; i++)
+        if (strcmp(name, SYNC_MODE_LIST[i]) == 0) {
+            *mode = i;
+            return true;
+        }
+    errno = EINVAL;
+    return false;
+}
+
+void setSyncMode(enum SyncModes mode) { sync_mode = mode; }
+
+bool parseMappingFlags(const char *list, int *flags)
+{
+    char buf[STR_MAX_LEN];
+    strncpy(buf, list, STR_MAX_LEN - 1);
+    buf[STR_MAX_LEN - 1] = '\0';
+
+    *flags = 0;
+    char *ptr = buf;
+    char *name;
+    while (splitStr(&name, ',', &ptr)) {
+        int i = 0;
+        while (i < MAPPING_FLAG_LIST_LEN &&
+               strcmp(name, MAPPING_FLAG_LIST[i].name) != 0)
+            i++;
+        if (i == MAPPING_FLAG_LIST_LEN) {
+            errno = EINVAL;
+            return false;
+        }
+        *flags |= MAPPING_FLAG_LIST[i].flag;
+    }
+    return true;
+}
+
+void setMappingFlags(int flags) { mapping_flags = flags; }
+
+void setBackend(enum BackendTypes type) { backend = type; }
+
+void setCacheSize(int size) { cache_size = size; }
+
+void setDiskLocking(enum DiskLockModes mode) { lock_mode = mode; }
+
+void setAllocCacheSize(int size) { alloc_cache_size = size; }
+
+union Block *mountDisk()
+{
+    commit_err = 0;
+    disk_fd = open(DISK_FILE_PATH, O_RDWR);
+    if (disk_fd < 0) {
+        reportError("Cannot open the disk file");
+        return NULL;
+    }
+    // The journal is locked so that it is not replayed over the home blocks
+    // while another process commits.
+    if (lock_mode == DISK_LOCK_WHOLE)
+        _lockRange(0, BLOCK_COUNT, F_WRLCK);
+    else
+        _lockRange(JOURNAL_ID, JOURNAL_ID + JOURNAL_LEN, F_WRLCK);
+    if (!replayJournal(disk_fd) || (!_isJournaled() && !clearJournal(disk_fd)))
+        return _abortMount();
+    if (lock_mode == DISK_LOCK_BLOCKS)
+        _lockRange(JOURNAL_ID, JOURNAL_ID + JOURNAL_LEN, F_UNLCK);
+    if (!openBackend(backend, disk_fd)) {
+        reportError("Cannot open the storage backend");
+        return _abortMount();
+    }
+
+    if (_isCached()) {
+        union Block *mem = mapCache(cache_size);
+        if (mem == NULL) {
+            reportError("Cannot set up the block cache");
+            closeBackend();
+            return _abortMount();
+        }
+        // Pages of the cache are filled one by one, so huge pages do not apply.
+        struct Interval range = {ROOT_ID, BLOCK_COUNT};
+        if (!(mapping_flags & MAPPING_POPULATE))
+            range.end = JOURNAL_ID;
+        if (mapping_flags & (MAPPING_POPULATE | MAPPING_POPULATE_META))
+            prefetchCache(mem, &range, 1);
+        disk_mem = mem;
+        return mem;
+    }
+
+    // MAP_POPULATE on a private mapping would copy every page up front, so
+    // private mappings are prefaulted read-only with madvise() instead.
+    int flags = _isJournaled() ? MAP_PRIVATE : MAP_SHARED;
+    if ((mapping_flags & MAPPING_POPULATE) && flags == MAP_SHARED)
+        flags |= MAP_POPULATE;
+    union Block *mem =
+        mmap(NULL, DISK_SIZE, PROT_READ | PROT_WRITE, flags, disk_fd, 0);
+    if (mem == MAP_FAILED) {
+        reportError("Cannot map the disk file onto memory");
+        closeBackend();
+        return _abortMount();
+    }
+
+    if (mapping_flags & MAPPING_HUGE)
+        _adviseRange(mem, 0, BLOCK_COUNT, MADV_HUGEPAGE);
+    if ((mapping_flags & MAPPING_POPULATE) && !(flags & MAP_POPULATE))
+        _populateRange(mem, 0, BLOCK_COUNT);
+    else if (mapping_flags & MAPPING_POPULATE_META)
+        _populateRange(mem, ROOT_ID, JOURNAL_ID);
+    disk_mem = mem;
+    return mem;
+}
+
+bool unmountDisk(union Block *mem)
+{
+    bool is_ok = commitDisk(mem);
+    if (_isCached())
+        unmapCache(mem);
+    else
+        munmap(mem, DISK_SIZE);
+    closeBackend();
+    // Closing the last descriptor drops every lock on the disk file.
+    close(disk_fd);
+    disk_fd = -1;
+    disk_mem = NULL;
+    memset(write_lock_map, 0, BITMAP_LEN);
+    memset(read_lock_counts, 0, sizeof(read_lock_counts));
+    return is_ok;
+}
+
+bool writeWholeDisk(union Block *mem)
+{
+    if (pwrite(disk_fd, mem, DISK_SIZE, 0) != DISK_SIZE ||
+        fdatasync(disk_fd) == -1) {
+        reportError("Disk: " DISK_FILE_PATH);
+        return false;
+    }
+    memset(dirty_map, 0, BITMAP_LEN);
+    memset(alloc_map, 0, BITMAP_LEN);
+    memset(data_map, 0, BITMAP_LEN);
+    memset(free_map, 0, BITMAP_LEN);
+    record_count = 0;
+    commit_err = 0;
+    if (_isCached())
+        cleanCache(mem);
+    return true;
+}
+
+void prefetchFileData(union Block *mem, int id)
+{
+    struct FileNode *file = &mem[id].file;
+    if (file->len <= 1)
+        return;
+
+    struct Interval extents[FILE_MAX_BLOCKS];
+    int extent_count = _findFileExtents(file, extents);
+    // The cache reads every extent in one batch.
+    if (_isCached()) {
+        prefetchCache(mem, extents, extent_count);
+        return;
+    }
+    for (int i = 0; i < extent_count; i++) {
+        _adviseRange(mem, extents[i].start, extents[i].end, MADV_SEQUENTIAL);
+        _adviseRange(mem, extents[i].start, extents[i].end, MADV_WILLNEED);
+    }
+}
+
+void endFileRead(union Block *mem, int id)
+{
+    struct FileNode *file = &mem[id].file;
+    if (file->len <= 1 || _isCached())
+        return;
+
+    struct Interval extents[FILE_MAX_BLOCKS];
+    int extent_count = _findFileExtents(file, extents);
+    for (int i = 0; i < extent_count; i++)
+        _adviseRange(mem, extents[i].start, extents[i].end, MADV_NORMAL);
+}
+
+void lockDiskBlock(int id, bool is_write)
+{
+    if (lock_mode != DISK_LOCK_BLOCKS)
+        return;
+    pthread_mutex_lock(&lock_mutex);
+    bool is_new = false;
+    if (_isBitSet(write_lock_map, id)) {
+        // Already kept until the commit.
+    } else if (is_write) {
+        _lockRange(id, id + 1, F_WRLCK);
+        _setBit(write_lock_map, id);
+        is_new = true;
+    } else if (read_lock_counts[id]++ == 0) {
+        _lockRange(id, id + 1, F_RDLCK);
+        is_new = true;
+    }
+    // Refreshed before any other thread can use the block under the lock.
+    if (is_new)
+        _refreshNode(id);
+    pthread_mutex_unlock(&lock_mutex);
+}
+
+void lockWholeDisk()
+{
+    if (lock_mode != DISK_LOCK_BLOCKS)
+        return;
+    pthread_mutex_lock(&lock_mutex);
+    // The journal keeps its own lock, taken around replays and commits.
+    _lockRange(0, JOURNAL_ID, F_WRLCK);
+    _lockRange(JOURNAL_ID + JOURNAL_LEN, BLOCK_COUNT, F_WRLCK);
+    for (int id = 0; id < BLOCK_COUNT; id++) {
+        if (id == JOURNAL_ID)
+            id += JOURNAL_LEN;
+        if (_setBit(write_lock_map, id) && read_lock_counts[id] == 0)
+            _refreshBlock(id);
+    }
+    pthread_mutex_unlock(&lock_mutex);
+}
+
+void unlockDiskBlock(int id)
+{
+    if (lock_mode != DISK_LOCK_BLOCKS)
+        return;
+    pthread_mutex_lock(&lock_mutex);
+    if (!_isBitSet(write_lock_map, id) && read_lock_counts[id] > 0 &&
+        --read_lock_counts[id] == 0)
+        _lockRange(id, id + 1, F_UNLCK);
+    pthread_mutex_unlock(&lock_mutex);
+}
+
+void markBlockDirty(int id)
+{
+    // Only the thread setting the bit counts the record.
+    if (_setBit(dirty_map, id) && !_isBitSet(alloc_map, id))
+        __atomic_fetch_add(&record_count, 1, __ATOMIC_RELAXED);
+}
+
+void markDataDirty(int id)
+{
+    _setBit(data_map, id);
+    _setBit(dirty_map, id);
+}
+
+int allocBlock(union Block *mem, int start_id)
+{
+    lockDiskBlock(BITMAP_ID, true);
+    int id;
+    if (alloc_cache_size > 0)
+        id = _allocCached(mem, start_id);
+    else if (_claimBlocks(mem, start_id, &id, 1) == 0)
+        id = -1;
+    if (id == -1) {
+        errno = ENOSPC;
+        reportError("Disk: " DISK_FILE_PATH);
+        return -1;
+    }
+    _setBit(alloc_map, id);
+    countStat(STAT_BLOCKS_ALLOCATED, 1);
+    return id;
+}
+
+void freeBlocks(union Block *mem, struct Interval *bounds)
+{
+    lockDiskBlock(BITMAP_ID, true);
+    countStat(STAT_BLOCKS_FREED, bounds->end - bounds->start);
+    for (int id = bounds->start; id < bounds->end; id++) {
+        if (_isBitSet(alloc_map, id) || !_isJournaled()) {
+            // Never reached the disk, so it can be reused right away.
+            _clearBit(alloc_map, id);
+            _clearBit(data_map, id);
+            _clearBit(dirty_map, id);
+            setBitmapFree(mem[BITMAP_ID].bitmap,
+                          &(struct Interval){id, id + 1});
+            markBlockDirty(BITMAP_ID);
+        } else {
+            _setBit(free_map, id);
+        }
+    }
+}
+
+bool beginDiskOp(union Block *mem)
+{
+    while (true) {
+        pthread_rwlock_rdlock(&op_lock);
+        pthread_mutex_lock(&txn_lock);
+        // Every running operation may still add its share of records.
+        int count = __atomic_load_n(&record_count, __ATOMIC_RELAXED);
+        bool is_full =
+            count + (op_count + 1) * OP_MAX_RECORDS > JOURNAL_MAX_RECORDS;
+        if (!is_full)
+            op_count++;
+        pthread_mutex_unlock(&txn_lock);
+        if (!is_full)
+            return true;
+        pthread_rwlock_unlock(&op_lock);
+
+        // No operation is running once the commit holds the lock, so the
+        // journal is empty again afterwards.
+        pthread_rwlock_wrlock(&op_lock);
+        bool is_ok = record_count + OP_MAX_RECORDS <= JOURNAL_MAX_RECORDS ||
+                     _commitLocked(mem, true);
+        pthread_rwlock_unlock(&op_lock);
+        if (!is_ok)
+            return false;
+    }
+}
+
+bool isolateDiskOp(union Block *mem)
+{
+    pthread_mutex_lock(&txn_lock);
+    op_count--;
+    pthread_mutex_unlock(&txn_lock);
+    pthread_rwlock_unlock(&op_lock);
+    // Holding no lock yet, the operation cannot keep the others from ending.
+    pthread_rwlock_wrlock(&op_lock);
+    is_isolated = true;
+    return _commitLocked(mem, true);
+}
+
+bool reserveDiskOp(union Block *mem, int count)
+{
+    if (count > JOURNAL_MAX_RECORDS) {
+        errno = EFBIG;
+        return false;
+    }
+    if (!_isJournaled() || record_count + count <= JOURNAL_MAX_RECORDS)
+        return true;
+    // The blocks locked so far stay locked in the disk file, since the
+    // operation goes on with them.
+    return _commitLocked(mem, false);
+}
+
+bool endDiskOp(union Block *mem)
+{
+    if (is_isolated) {
+        is_isolated = false;
+    } else {
+        pthread_mutex_lock(&txn_lock);
+        op_count--;
+        pthread_mutex_unlock(&txn_lock);
+    }
+    pthread_rwlock_unlock(&op_lock);
+    if (sync_mode == SYNC_FULL)
+        return commitDisk(mem);
+    return true;
+}
+
+bool commitDisk(union Block *mem)
+{
+    pthread_rwlock_wrlock(&op_lock);
+    bool is_ok = _commitLocked(mem, true);
+    pthread_rwlock_unlock(&op_lock);
+    return is_ok;
+}
+
+/**
+ * @brief 
+ *  Commits the open transaction to the disk file, with no operation running
+ *  but the one calling it, if it runs alone.
+ * 
+ * @note 
+ *  Once a journaled commit failed, the disk file misses its changes, which
+ *  later transactions build on, so they are not committed either.
+ * 
+ * @param[in, out] mem           Pointer to the mapped memory.
+ * @param[in]      is_releasing  Whether to release the blocks locked in the
+ *                               disk file.
+ * 
+ * @return 
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _commitLocked(union Block *mem, bool is_releasing)
+{
+    if (commit_err != 0) {
+        errno = commit_err;
+        return false;
+    }
+    _returnCachedBlocks(mem);
+    _applyFrees(mem);
+
+    int fresh_ids[BLOCK_COUNT];
+    int journal_ids[BLOCK_COUNT];
+    int fresh_count = 0;
+    int journal_count = 0;
+    for (int id = 0; id < BLOCK_COUNT; id++) {
+        if (!_isBitSet(dirty_map, id))
+            continue;
+        if (_isBitSet(alloc_map, id) || _isBitSet(data_map, id) ||
+            !_isJournaled())
+            fresh_ids[fresh_count++] = id;
+        else
+            journal_ids[journal_count++] = id;
+    }
+    memset(dirty_map, 0, BITMAP_LEN);
+    memset(alloc_map, 0, BITMAP_LEN);
+    memset(data_map, 0, BITMAP_LEN);
+    record_count = 0;
+
+    bool is_ok = _isJournaled()
+                     ? _commitJournaled(mem, fresh_ids, fresh_count,
+                                        journal_ids, journal_count)
+                     : _commitInPlace(mem, fresh_ids, fresh_count);
+    if (!is_ok && _isJournaled())
+        commit_err = errno;
+    if (is_releasing)
+        _releaseDiskLocks();
+    return is_ok;
+}
+
+/**
+ * @brief 
+ *  Writes the changed blocks of a transaction back through the journal, as one
+ *  journal transaction.
+ * 
+ * @note 
+ *  A transaction changing more blocks than the journal holds is refused with
+ *  `EFBIG` before anything is written, rather than split into journal
+ *  transactions that could each be interrupted by a crash.
+ * 
+ * @param[in] mem            Pointer to the mapped memory.
+ * @param[in] fresh_ids      IDs of the blocks written in place, ascending.
+ * @param[in] fresh_count    Number of IDs in `fresh_ids`.
+ * @param[in] journal_ids    IDs of the blocks written through the journal,
+ *                           ascending.
+ * @param[in] journal_count  Number of IDs in `journal_ids`.
+ * 
+ * @return 
+ *  `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _commitJournaled(union Block *mem, const int *fresh_ids,
+                             int fresh_count, const int *journal_ids,
+                             int journal_count)
+{
+    if (journal_count > JOURNAL_MAX_RECORDS) {
+        errno = EFBIG;
+        reportError("Disk: " DISK_FILE_PATH);
+        return false;
+    }
+    // The sync after the new and data blocks makes them durable before the
+    // journal changes.
+    if (!_writeBlocks(mem, fresh_ids, fresh_count, journal_count > 0))
+        return false;
+    // Other processes must not replay the journal, or commit through it,
+    // until the home blocks match it.
+    if (lock_mode == DISK_LOCK_BLOCKS && journal_count > 0)
+        _lockRange(JOURNAL_ID, JOURNAL_ID + JOURNAL_LEN, F_WRLCK);
+    bool is_ok = true;
+    if (journal_count == 0) {
+    } else if (!writeJournal(disk_fd, mem, journal_ids, journal_count) ||
+               fdatasync(disk_fd) == -1) {
+        reportError("Disk: " DISK_FILE_PATH);
+        is_ok = false;
+    } else {
+        is_ok = _writeBlocks(mem, journal_ids, journal_count, false);
+    }
+    if (lock_mode == DISK_LOCK_BLOCKS && journal_count > 0)
+        _lockRange(JOURNAL_ID, JOURNAL_ID + JOURNAL_LEN, F_UNLCK);
+    if (is_ok && _isCached())
+        cleanCache(mem);
+    return is_ok;
+}
+
+/**
+ * @brief 
+ *  Frees the blocks whose free was deferred until the commit.
+ * 
+ * @param[in, out] mem  Memory block representing the file system.
+ */
+static void _applyFrees(union Block *mem)
+{
+    struct Interval bounds = EMPTY_INTERVAL;
+    for (int id = 0; id <= BLOCK_COUNT; id++) {
+        if (id < BLOCK_COUNT && _isBitSet(free_map, id)) {
+            if (bounds.end != id)
+                bounds.start = id;
+            bounds.end = id + 1;
+        } else if (bounds.end == id) {
+            setBitmapFree(mem[BITMAP_ID].bitmap, &bounds);
+            markBlockDirty(BITMAP_ID);
+        }
+    }
+    memset(free_map, 0, BITMAP_LEN);
+}
+
+/**
+ * @brief 
+ *  Writes blocks to their home location in the disk file through the backend,
+ *  as one batch with one write per run of consecutive IDs.
+ * 
+ * @param[in] mem    Memory block representing the file system.
+ * @param[in] ids    IDs of the blocks to write, in ascending order.
+ * @param[in] count  Number of IDs in `ids`.
+ * @param[in] sync   Whether to sync the disk file after the writes.
+ * 
+ * @return 
+ *   `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _writeBlocks(union Block *mem, const int *ids, int count,
+                         bool sync)
+{
+    struct BlockIO ios[BLOCK_COUNT];
+    int io_count = 0;
+    int i = 0;
+    while (i < count) {
+        int run = 1;
+        while (i + run < count && ids[i + run] == ids[i] + run)
+            run++;
+        ios[io_count++] = (struct BlockIO){ids[i], run, &mem[ids[i]]};
+        i += run;
+    }
+    if ((io_count > 0 || sync) && !writeBlocks(ios, io_count, sync)) {
+        reportError("Disk: " DISK_FILE_PATH);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 
+ *  Commits the changed blocks in place, without the journal.
+ * 
+ * @note 
+ *  A shared mapping already changed the disk file, the block cache still has to
+ *  write the blocks. Neither waits for the disk.
+ * 
+ * @param[in] mem    Memory block representing the file system.
+ * @param[in] ids    IDs of the changed blocks, in ascending order.
+ * @param[in] count  Number of IDs in `ids`.
+ * 
+ * @return 
+ *   `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _commitInPlace(union Block *mem, const int *ids, int count)
+{
+    if (_isCached()) {
+        if (!_writeBlocks(mem, ids, count, false))
+            return false;
+        cleanCache(mem);
+    }
+    return sync_mode != SYNC_ASYNC || _startWriteback(ids, count);
+}
+
+/**
+ * @brief 
+ *  Starts writing back the pages of the disk file holding changed blocks,
+ *  without waiting for them.
+ * 
+ * @note 
+ *  `msync(MS_ASYNC)` does not start any I/O on Linux, so the dirty ranges are
+ *  handed to `sync_file_range()` instead.
+ * 
+ * @param[in] ids    IDs of the changed blocks, in ascending order.
+ * @param[in] count  Number of IDs in `ids`.
+ * 
+ * @return 
+ *   `true` if successful, `false` otherwise (sets errno).
+ */
+static bool _startWriteback(const int *ids, int count)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    off_t start = -1;
+    off_t end = -1;
+    for (int i = 0; i <= count; i++) {
+        off_t page_start =
+            (i < count) ? (off_t)ids[i] * BLOCK_SIZE / page_size * page_size : 0;
+        if (i < count && start != -1 && page_start <= end) {
+            end = (off_t)(ids[i] + 1) * BLOCK_SIZE;
+            continue;
+        }
+        if (start != -1 &&
+            sync_file_range(disk_fd, start, end - start,
+                            SYNC_FILE_RANGE_WRITE) == -1) {
+            reportError("Disk: " DISK_FILE_PATH);
+            return false;
+        }
+        if (i < count) {
+            start = page_start;
+            end = (off_t)(ids[i] + 1) * BLOCK_SIZE;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 
+ *  Gives advice to the kernel about a range of blocks of the mapping.
+ * 
+ * @note 
+ *  The range is widened to whole pages.
+ * 
+ * @param[in] mem       Pointer to the mapped memory.
+ * @param[in] start_id  ID of the first block of the range.
+ * @param[in] end_id    ID after the last block of the range.
+ * @param[in] advice    The advice for `madvise()`.
+ * 
+ * @return 
+ *   `true` if the advice was taken, `false` otherwise. Advice is only a hint,
+ *   so most callers ignore failures.
+ */
+static bool _adviseRange(union Block *mem, int start_id, int end_id, int advice)
+{
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)&mem[start_id] / page_size * page_size;
+    uintptr_t end = (uintptr_t)&mem[end_id];
+    return madvise((void *)start, end - start, advice) == 0;
+}
+
+/**
+ * @brief 
+ *  Prefaults a range of blocks of the mapping for reading.
+ * 
+ * @note 
+ *  Falls back to `MADV_WILLNEED`, which only reads the pages ahead, on kernels
+ *  without `MADV_POPULATE_READ`.
+ * 
+ * @param[in] mem       Pointer to the mapped memory.
+ * @param[in] start_id  ID of the first block of the range.
+ * @param[in] end_id    ID after the last block of the range.
+ */
+static void _populateRange(union Block *mem, int start_id, int end_id)
+{
+    if (!_adviseRange(mem, start_id, end_id, MADV_POPULATE_READ))
+        _adviseRange(mem, start_id, end_id, MADV_WILLNEED);
+}
+
+/**
+ * @brief 
+ *  Splits the data blocks of a file into runs of consecutive blocks.
+ * 
+ * @param[in]  file     The file.
+ * @param[out] extents  The runs, in the order of the file, at least
+ *                      `FILE_MAX_BLOCKS` of them.
+ * 
+ * @return 
+ *  Number of runs.
+ */
+static int _findFileExtents(struct FileNode *file, struct Interval *extents)
+{
+    int extent_count = 0;
+    int start = 0;
+    for (int i = 1; i <= file->len; i++) {
+        if (i < file->len && file->blocks[i] == file->blocks[i - 1] + 1)
+            continue;
+        extents[extent_count++] =
+            (struct Interval){file->blocks[start], file->blocks[i - 1] + 1};
+        start = i;
+    }
+    return extent_count;
+}
+
+/**
+ * @brief 
+ *  Locks or unlocks a range of blocks of the disk file against other
+ *  processes, waiting for conflicting locks to be released.
+ * 
+ * @note 
+ *  The locks are open file description locks, so they belong to the open disk
+ *  file and are dropped when it is closed, even if the process crashes.
+ * 
+ * @param[in] start_id  ID of the first block of the range.
+ * @param[in] end_id    ID after the last block of the range.
+ * @param[in] type      `F_RDLCK`, `F_WRLCK` or `F_UNLCK`.
+ * 
+ * Exits the program on failure.
+ */
+static void _lockRange(int start_id, int end_id, short type)
+{
+    struct flock lock = {.l_type = type,
+                         .l_whence = SEEK_SET,
+                         .l_start = (off_t)start_id * BLOCK_SIZE,
+                         .l_len = (off_t)(end_id - start_id) * BLOCK_SIZE};
+    while (fcntl(disk_fd, F_OFD_SETLKW, &lock) == -1) {
+        if (errno != EINTR) {
+            reportError("Disk: " DISK_FILE_PATH);
+            exit(1);
+        }
+    }
+}
+
+/**
+ * @brief 
+ *  Refreshes a newly locked block from the disk file, along with the data
+ *  blocks it refers to if it is the inode of a file.
+ * 
+ * @param[in] id    ID of the block.
+ */
+static void _refreshNode(int id)
+{
+    _refreshBlock(id);
+    if (id < RESERVED_BLOCK_COUNT || disk_mem[id].file.type != TYPE_FILE)
+        return;
+    struct FileNode *file = &disk_mem[id].file;
+    int count = minInt(file->len + file->prealloc, FILE_MAX_BLOCKS);
+    for (int i = 0; i < count; i++) {
+        if (file->blocks[i] >= RESERVED_BLOCK_COUNT &&
+            file->blocks[i] < BLOCK_COUNT)
+            _refreshBlock(file->blocks[i]);
+    }
+}
+
+/**
+ * @brief 
+ *  Copies a block from the disk file over its copy in memory, in case another
+ *  process committed it since it was last read.
+ * 
+ * @note 
+ *  Only a private mapping or the block cache can hold a stale copy, and only
+ *  of blocks the open transaction did not change.
+ * 
+ * @param[in] id    ID of the block.
+ * 
+ * Exits the program on failure.
+ */
+static void _refreshBlock(int id)
+{
+    if ((!_isJournaled() && !_isCached()) || _isBitSet(dirty_map, id))
+        return;
+    union Block block;
+    if (pread(disk_fd, &block, BLOCK_SIZE, (off_t)id * BLOCK_SIZE) !=
+        BLOCK_SIZE) {
+        reportError("Disk: " DISK_FILE_PATH);
+        exit(1);
+    }
+    // Copying only on a change keeps unchanged pages shared with the disk.
+    if (memcmp(&disk_mem[id], &block, BLOCK_SIZE) != 0)
+        memcpy(&disk_mem[id], &block, BLOCK_SIZE);
+}
+
+/**
+ * @brief 
+ *  Releases the blocks write-locked by the transaction that was just
+ *  committed, merging adjacent blocks into one range.
+ */
+static void _releaseDiskLocks()
+{
+    int start_id = -1;
+    for (int id = 0; id <= BLOCK_COUNT; id++) {
+        bool is_locked = id < BLOCK_COUNT && _isBitSet(write_lock_map, id);
+        if (is_locked && start_id == -1) {
+            start_id = id;
+        } else if (!is_locked && start_id != -1) {
+            _lockRange(start_id, id, F_UNLCK);
+            start_id = -1;
+        }
+    }
+    memset(write_lock_map, 0, BITMAP_LEN);
+}
+
+/**
+ * @brief
+ *  Closes the disk file after a mount failed, which drops its locks.
+ *
+ * @return
+ *  NULL, keeping errno.
+ */
+static union Block *_abortMount()
+{
+    int err = errno;
+    close(disk_fd);
+    disk_fd = -1;
+    errno = err;
+    return NULL;
+}
+
+/**
+ * @brief 
+ *  Claims free blocks from the bitmap, from a given position and wrapping
+ *  around to the start of the disk.
+ * 
+ * @param[in, out] mem       Memory block representing the file system.
+ * @param[in]      start_id  ID to start searching from.
+ * @param[out]     ids       IDs of the claimed blocks.
+ * @param[in]      count     Maximum number of blocks to claim.
+ * 
+ * @return 
+ *  Number of blocks claimed, 0 if the disk is full.
+ */
+static int _claimBlocks(union Block *mem, int start_id, int *ids, int count)
+{
+    uint8_t *bitmap = mem[BITMAP_ID].bitmap;
+    int claimed = claimFreeBlocks(bitmap, start_id, ids, count);
+    if (claimed == 0 && start_id > 0)
+        claimed = claimFreeBlocks(bitmap, 0, ids, count);
+    if (claimed > 0)
+        markBlockDirty(BITMAP_ID);
+    return claimed;
+}
+
+/**
+ * @brief 
+ *  Hands out a block from the cache of the calling thread, refilling it from
+ *  the bitmap first if it is empty.
+ * 
+ * @note 
+ *  A refill claims the next free blocks from `start_id` at once, so a thread
+ *  writing a file keeps getting nearby blocks. Once the bitmap is out of free
+ *  blocks, one is taken from the cache of another thread.
+ * 
+ * @param[in, out] mem       Memory block representing the file system.
+ * @param[in]      start_id  ID to refill the cache from.
+ * 
+ * @return 
+ *  ID of the block, -1 if the disk is full.
+ */
+static int _allocCached(union Block *mem, int start_id)
+{
+    struct AllocCache *cache = _getAllocCache();
+    int id = -1;
+    if (cache == NULL) {
+        if (_claimBlocks(mem, start_id, &id, 1) == 0)
+            return -1;
+        return id;
+    }
+    pthread_mutex_lock(&cache->lock);
+    if (cache->count == 0) {
+        cache->next = 0;
+        cache->count =
+            _claimBlocks(mem, start_id, cache->ids, alloc_cache_size);
+    }
+    if (cache->count > 0) {
+        id = cache->ids[cache->next++];
+        cache->count--;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return (id == -1) ? _stealCachedBlock() : id;
+}
+
+/**
+ * @brief 
+ *  Gets the allocation cache of the calling thread, setting one up on its
+ *  first allocation.
+ * 
+ * @return 
+ *  Pointer to the cache, `NULL` if every cache is taken.
+ */
+static struct AllocCache *_getAllocCache()
+{
+    if (thread_cache != NULL || has_no_cache)
+        return thread_cache;
+    pthread_mutex_lock(&alloc_caches_lock);
+    if (alloc_cache_count < ALLOC_CACHE_MAX) {
+        thread_cache = &alloc_caches[alloc_cache_count];
+        pthread_mutex_init(&thread_cache->lock, NULL);
+        thread_cache->next = 0;
+        thread_cache->count = 0;
+        alloc_cache_count++;
+    } else {
+        has_no_cache = true;
+    }
+    pthread_mutex_unlock(&alloc_caches_lock);
+    return thread_cache;
+}
+
+/**
+ * @brief 
+ *  Takes a block from the cache of any thread.
+ * 
+ * @return 
+ *  ID of the block, -1 if every cache is empty.
+ */
+static int _stealCachedBlock()
+{
+    pthread_mutex_lock(&alloc_caches_lock);
+    int id = -1;
+    for (int i = 0; id == -1 && i < alloc_cache_count; i++) {
+        struct AllocCache *cache = &alloc_caches[i];
+        pthread_mutex_lock(&cache->lock);
+        if (cache->count > 0)
+            id = cache->ids[cache->next + --cache->count];
+        pthread_mutex_unlock(&cache->lock);
+    }
+    pthread_mutex_unlock(&alloc_caches_lock);
+    return id;
+}
+
+/**
+ * @brief 
+ *  Frees the blocks left in the cache of every thread, so that no block is
+ *  committed as used without belonging to anything.
+ * 
+ * @param[in, out] mem  Memory block representing the file system.
+ */
+static void _returnCachedBlocks(union Block *mem)
+{
+    pthread_mutex_lock(&alloc_caches_lock);
+    for (int i = 0; i < alloc_cache_count; i++) {
+        struct AllocCache *cache = &alloc_caches[i];
+        pthread_mutex_lock(&cache->lock);
+        for (int j = cache->next; j < cache->next + cache->count; j++)
+            setBitmapFree(mem[BITMAP_ID].bitmap,
+                          &(struct Interval){cache->ids[j], cache->ids[j] + 1});
+        cache->count = 0;
+        pthread_mutex_unlock(&cache->lock);
+    }
+    pthread_mutex_unlock(&alloc_caches_lock);
+}
+
+/**
+ * @brief 
+ *  Checks if changes go through the journal in the current sync mode.
+ * 
+ * @return 
+ *   `true` if the sync mode is journaled, `false` otherwise.
+ */
+static bool _isJournaled()
+{
+    return sync_mode == SYNC_ORDERED || sync_mode == SYNC_FULL;
+}
+
+/**
+ * @brief 
+ *  Checks if the disk is served by the block cache instead of a mapping.
+ * 
+ * @return 
+ *   `true` if the backend uses the block cache, `false` otherwise.
+ */
+static bool _isCached()
+{
+    return backend != BACKEND_MMAP;
+}
+
+/**
+ * @brief 
+ *  Atomically sets the bit of a block in a transaction map.
+ * 
+ * @param[out] map  The map to modify.
+ * @param[in]  id   ID of the block.
+ * 
+ * @return 
+ *   `true` if the bit was not set before, `false` otherwise.
+ */
+static bool _setBit(uint8_t *map, int id)
+{
+    uint8_t mask = 0x80 >> (id % CHAR_BIT);
+    return !(__atomic_fetch_or(&map[id / CHAR_BIT], mask, __ATOMIC_RELAXED) &
+             mask);
+}
+
+/**
+ * @brief 
+ *  Atomically clears the bit of a block in a transaction map.
+ * 
+ * @param[out] map  The map to modify.
+ * @param[in]  id   ID of the block.
+ */
+static void _clearBit(uint8_t *map, int id)
+{
+    __atomic_fetch_and(&map[id / CHAR_BIT], ~(0x80 >> (id % CHAR_BIT)),
+                       __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 
+ *  Checks the bit of a block in a transaction map.
+ * 
+ * @param[in] map  The map to check.
+ * @param[in] id   ID of the block.
+ * 
+ * @return 
+ *   `true` if the bit is set, `false` otherwise.
+ */
+static bool _isBitSet(const uint8_t *map, int id)
+{
+    uint8_t byte = __atomic_load_n(&map[id / CHAR_BIT], __ATOMIC_RELAXED);
+    return (byte & (0x80 >> (id % CHAR_BIT))) != 0;
+}
@@ -0,0 +1,135 @@
+/**
+ * @file heartyfs_journal.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief 
+ *  The module implementing the metadata journal.
+ * 
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "heartyfs.h"
+#include "heartyfs_journal.h"
+#include "heartyfs_math.h"
+
+static uint32_t _checksum(const struct JournalHeader *header,
+                          const union Block *records);
+
+static uint32_t last_seq = 0;
+
+bool replayJournal(int fd)
+{
+    union Block header;
+    if (pread(fd, &header, BLOCK_SIZE, JOURNAL_ID * BLOCK_SIZE) != BLOCK_SIZE) {
+        reportError("Journal");
+        return false;
+    }
+    struct JournalHeader *jh = &header.journal;
+    if (jh->magic != JOURNAL_MAGIC)
+        return true;
+    last_seq = jh->seq;
+    if (jh->state != JOURNAL_COMMITTED || jh->count <= 0 ||
+        jh->count > JOURNAL_MAX_RECORDS)
+        return true;
+
+    union Block *records = malloc(jh->count * BLOCK_SIZE);
+    if (records == NULL) {
+        reportError(__func__);
+        return false;
+    }
+    bool is_ok = true;
+    ssize_t size = jh->count * BLOCK_SIZE;
+    if (pread(fd, records, size, (JOURNAL_ID + 1) * BLOCK_SIZE) != size) {
+        reportError("Journal");
+        is_ok = false;
+    } else if (_checksum(jh, records) == jh->checksum) {
+        for (int i = 0; i < jh->count && is_ok; i++) {
+            union Block home;
+            off_t offset = (off_t)jh->targets[i] * BLOCK_SIZE;
+            if (pread(fd, &home, BLOCK_SIZE, offset) != BLOCK_SIZE ||
+                (memcmp(&home, &records[i], BLOCK_SIZE) != 0 &&
+                 pwrite(fd, &records[i], BLOCK_SIZE, offset) != BLOCK_SIZE)) {
+                reportError("Journal replay");
+                is_ok = false;
+            }
+        }
+    }
+    free(records);
+    return is_ok;
+}
+
+bool writeJournal(int fd, union Block *mem, const int *ids, int count)
+{
+    union Block header = {0};
+    struct JournalHeader *jh = &header.journal;
+    jh->magic = JOURNAL_MAGIC;
+    jh->state = JOURNAL_COMMITTED;
+    jh->seq = ++last_seq;
+    jh->count = count;
+
+    struct iovec iov[JOURNAL_LEN];
+    iov[0] = (struct iovec){.iov_base = &header, .iov_len = BLOCK_SIZE};
+    uint32_t hash = hashBytes(FNV_OFFSET_BASIS, &jh->count, sizeof(int));
+    for (int i = 0; i < count; i++) {
+        jh->targets[i] = ids[i];
+        iov[i + 1] = (struct iovec){.iov_base = &mem[ids[i]],
+                                    .iov_len = BLOCK_SIZE};
+    }
+    hash = hashBytes(hash, jh->targets, count * sizeof(int));
+    for (int i = 0; i < count; i++)
+        hash = hashBytes(hash, &mem[ids[i]], BLOCK_SIZE);
+    jh->checksum = hash;
+
+    ssize_t size = (count + 1) * BLOCK_SIZE;
+    if (pwritev(fd, iov, count + 1, JOURNAL_ID * BLOCK_SIZE) != size) {
+        reportError("Journal");
+        return false;
+    }
+    return true;
+}
+
+bool clearJournal(int fd)
+{
+    union Block header;
+    if (pread(fd, &header, BLOCK_SIZE, JOURNAL_ID * BLOCK_SIZE) != BLOCK_SIZE) {
+        reportError("Journal");
+        return false;
+    }
+    if (header.journal.magic != JOURNAL_MAGIC ||
+        header.journal.state != JOURNAL_COMMITTED)
+        return true;
+
+    header.journal.state = JOURNAL_CLEAN;
+    if (pwrite(fd, &header, BLOCK_SIZE, JOURNAL_ID * BLOCK_SIZE) != BLOCK_SIZE ||
+        fdatasync(fd) == -1) {
+        reportError("Journal");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 
+ *  Computes the checksum of a journal transaction.
+ * 
+ * @param[in] header   The header of the transaction.
+ * @param[in] records  The after-images of the transaction, `header->count`
+ *                     blocks long.
+ * 
+ * @return 
+ *   The checksum covering the block count, the targets, and the records.
+ */
+static uint32_t _checksum(const struct JournalHeader *header,
+                          const union Block *records)
+{
+    uint32_t hash = hashBytes(FNV_OFFSET_BASIS, &header->count, sizeof(int));
+    hash = hashBytes(hash, header->targets, header->count * sizeof(int));
+    return hashBytes(hash, records, header->count * BLOCK_SIZE);
+}
+
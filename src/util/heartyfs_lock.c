@@ -0,0 +1,52 @@
+/**
+ * @file heartyfs_lock.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing the inode locks.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <pthread.h>
+
+#include "heartyfs.h"
+#include "heartyfs_disk.h"
+#include "heartyfs_lock.h"
+#include "heartyfs_stats.h"
+
+static void _initLocks();
+
+static pthread_once_t locks_once = PTHREAD_ONCE_INIT;
+static pthread_rwlock_t inode_locks[BLOCK_COUNT];
+
+void lockInodeRead(int id)
+{
+    pthread_once(&locks_once, _initLocks);
+    pthread_rwlock_rdlock(&inode_locks[id]);
+    lockDiskBlock(id, false);
+    countStat(STAT_INODES_LOCKED, 1);
+}
+
+void lockInodeWrite(int id)
+{
+    pthread_once(&locks_once, _initLocks);
+    pthread_rwlock_wrlock(&inode_locks[id]);
+    lockDiskBlock(id, true);
+    countStat(STAT_INODES_LOCKED, 1);
+}
+
+void unlockInode(int id)
+{
+    unlockDiskBlock(id);
+    pthread_rwlock_unlock(&inode_locks[id]);
+}
+
+/**
+ * @brief
+ *  Initializes the lock of every inode, once.
+ */
+static void _initLocks()
+{
+    for (int id = 0; id < BLOCK_COUNT; id++)
+        pthread_rwlock_init(&inode_locks[id], NULL);
+}
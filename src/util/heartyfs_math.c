@@ -30,4 +30,24 @@ int countDigits(int x)
         i++;
     }
     return i;
-}
\ No newline at end of file
+}
+
+int log2Int(int x)
+{
+    int k = 0;
+    while (x > 1) {
+        x >>= 1;
+        k++;
+    }
+    return k;
+}
+
+uint32_t hashBytes(uint32_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
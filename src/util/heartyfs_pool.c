@@ -0,0 +1,288 @@
+/**
+ * @file heartyfs_pool.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing the pool of worker threads.
+ *
+ *  Every worker has its own deque of tasks, and the pool has a shared queue
+ *  for the tasks submitted from other threads. A worker pushes the tasks it
+ *  submits to the back of its deque and takes its next task from there, so it
+ *  goes depth first through the work it spawns. Once its deque is empty, it
+ *  takes the oldest task of the shared queue, then steals the oldest task of
+ *  another worker, which is usually the largest one left. Each queue has its
+ *  own mutex, so workers only contend when they steal.
+ *
+ *  Workers sleep on a condition variable of the pool while no task is queued
+ *  anywhere, and the last task to finish wakes up the threads waiting for the
+ *  pool to drain.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "heartyfs_pool.h"
+
+struct Task {
+    bool (*call)(void *);
+    void *arg;
+    struct Task *prev;
+    struct Task *next;
+};
+
+struct Deque {
+    pthread_mutex_t lock;
+    struct Task *head; // Oldest task, taken by thieves
+    struct Task *tail; // Newest task, taken by the owner
+};
+
+struct Worker {
+    struct Pool *pool;
+    pthread_t thread;
+    struct Deque deque;
+};
+
+struct Pool {
+    pthread_mutex_t lock;
+    pthread_cond_t has_task; // Signaled when a task is queued or on stop
+    pthread_cond_t is_idle;  // Signaled when the pool drained
+    struct Deque shared;     // Tasks submitted from outside the pool
+    int queued_count;        // Tasks queued and not taken yet
+    int busy_count;          // Tasks queued or running
+    bool is_ok;              // No task failed since the last wait
+    bool is_stopping;
+    int worker_count;
+    int thread_count;        // Workers started, only used by the owner
+    struct Worker workers[];
+};
+
+static void *_runWorker(void *arg);
+static struct Task *_takeTask(struct Worker *self);
+static void _initDeque(struct Deque *deque);
+static void _pushTask(struct Deque *deque, struct Task *task);
+static struct Task *_popTask(struct Deque *deque, bool is_newest);
+
+static int job_count = 1;
+static _Thread_local struct Worker *curr_worker = NULL;
+
+void setJobCount(int jobs) { job_count = jobs; }
+
+int getJobCount() { return job_count; }
+
+struct Pool *startPool(int jobs)
+{
+    struct Pool *pool =
+        malloc(sizeof(struct Pool) + jobs * sizeof(struct Worker));
+    if (pool == NULL)
+        return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->has_task, NULL);
+    pthread_cond_init(&pool->is_idle, NULL);
+    _initDeque(&pool->shared);
+    pool->queued_count = 0;
+    pool->busy_count = 0;
+    pool->is_ok = true;
+    pool->is_stopping = false;
+    // Every deque exists before any worker may steal from it.
+    pool->worker_count = jobs;
+    for (int i = 0; i < jobs; i++) {
+        pool->workers[i].pool = pool;
+        _initDeque(&pool->workers[i].deque);
+    }
+    pool->thread_count = 0;
+    for (; pool->thread_count < jobs; pool->thread_count++) {
+        struct Worker *worker = &pool->workers[pool->thread_count];
+        int err = pthread_create(&worker->thread, NULL, _runWorker, worker);
+        if (err != 0) {
+            stopPool(pool);
+            errno = err;
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+bool submitTask(struct Pool *pool, bool (*call)(void *), void *arg)
+{
+    struct Task *task = malloc(sizeof(struct Task));
+    if (task == NULL)
+        return false;
+    *task = (struct Task){.call = call, .arg = arg};
+
+    bool is_worker = curr_worker != NULL && curr_worker->pool == pool;
+    // Pushed and counted under the lock of the pool, so that a worker going to
+    // sleep never misses it, and a worker taking it at once only uncounts it
+    // after it was counted.
+    pthread_mutex_lock(&pool->lock);
+    _pushTask(is_worker ? &curr_worker->deque : &pool->shared, task);
+    pool->queued_count++;
+    pool->busy_count++;
+    pthread_cond_signal(&pool->has_task);
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+bool waitPool(struct Pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy_count > 0)
+        pthread_cond_wait(&pool->is_idle, &pool->lock);
+    bool is_ok = pool->is_ok;
+    pool->is_ok = true;
+    pthread_mutex_unlock(&pool->lock);
+    return is_ok;
+}
+
+bool stopPool(struct Pool *pool)
+{
+    bool is_ok = waitPool(pool);
+    pthread_mutex_lock(&pool->lock);
+    pool->is_stopping = true;
+    pthread_cond_broadcast(&pool->has_task);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+    for (int i = 0; i < pool->worker_count; i++)
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+    pthread_mutex_destroy(&pool->shared.lock);
+    pthread_cond_destroy(&pool->is_idle);
+    pthread_cond_destroy(&pool->has_task);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Runs queued tasks until the pool is stopped.
+ *
+ * @param[in, out] arg  The worker.
+ *
+ * @return
+ *  `NULL`.
+ */
+static void *_runWorker(void *arg)
+{
+    struct Worker *self = arg;
+    struct Pool *pool = self->pool;
+    curr_worker = self;
+    while (true) {
+        struct Task *task = _takeTask(self);
+        if (task == NULL) {
+            pthread_mutex_lock(&pool->lock);
+            while (pool->queued_count == 0 && !pool->is_stopping)
+                pthread_cond_wait(&pool->has_task, &pool->lock);
+            bool is_stopped = pool->queued_count == 0;
+            pthread_mutex_unlock(&pool->lock);
+            if (is_stopped)
+                break;
+            continue;
+        }
+
+        bool is_ok = task->call(task->arg);
+        free(task);
+
+        pthread_mutex_lock(&pool->lock);
+        if (!is_ok)
+            pool->is_ok = false;
+        if (--pool->busy_count == 0)
+            pthread_cond_broadcast(&pool->is_idle);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    curr_worker = NULL;
+    return NULL;
+}
+
+/**
+ * @brief
+ *  Takes the next task for a worker: its newest own task, else the oldest
+ *  task of the shared queue, else the oldest task of another worker.
+ *
+ * @param[in, out] self The worker.
+ *
+ * @return
+ *  The task, `NULL` if every queue is empty.
+ */
+static struct Task *_takeTask(struct Worker *self)
+{
+    struct Pool *pool = self->pool;
+    struct Task *task = _popTask(&self->deque, true);
+    if (task == NULL)
+        task = _popTask(&pool->shared, false);
+    // Victims are scanned from the next worker on, so that thieves spread out.
+    int self_idx = self - pool->workers;
+    for (int i = 1; task == NULL && i < pool->worker_count; i++)
+        task = _popTask(&pool->workers[(self_idx + i) % pool->worker_count]
+                             .deque, false);
+    if (task != NULL) {
+        pthread_mutex_lock(&pool->lock);
+        pool->queued_count--;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return task;
+}
+
+/**
+ * @brief
+ *  Initializes an empty deque.
+ *
+ * @param[out] deque    The deque.
+ */
+static void _initDeque(struct Deque *deque)
+{
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->head = NULL;
+    deque->tail = NULL;
+}
+
+/**
+ * @brief
+ *  Pushes a task to the back of a deque.
+ *
+ * @param[in, out] deque    The deque.
+ * @param[in]      task     The task.
+ */
+static void _pushTask(struct Deque *deque, struct Task *task)
+{
+    pthread_mutex_lock(&deque->lock);
+    task->prev = deque->tail;
+    task->next = NULL;
+    if (deque->tail == NULL)
+        deque->head = task;
+    else
+        deque->tail->next = task;
+    deque->tail = task;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+/**
+ * @brief
+ *  Pops a task from either end of a deque.
+ *
+ * @param[in, out] deque      The deque.
+ * @param[in]      is_newest  `true` to pop the newest task, `false` for the
+ *                            oldest.
+ *
+ * @return
+ *  The task, `NULL` if the deque is empty.
+ */
+static struct Task *_popTask(struct Deque *deque, bool is_newest)
+{
+    pthread_mutex_lock(&deque->lock);
+    struct Task *task = is_newest ? deque->tail : deque->head;
+    if (task != NULL) {
+        if (task->prev == NULL)
+            deque->head = task->next;
+        else
+            task->prev->next = task->next;
+        if (task->next == NULL)
+            deque->tail = task->prev;
+        else
+            task->next->prev = task->prev;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
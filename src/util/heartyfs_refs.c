@@ -0,0 +1,158 @@
+/**
+ * @file heartyfs_refs.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing the reference counts of shared data blocks.
+ *
+ *  The ID of a block of counts is published in the bitmap block only once the
+ *  block is zeroed, so a thread reading it without the allocation lock sees
+ *  either no counts or valid ones.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "heartyfs_disk.h"
+#include "heartyfs_refs.h"
+
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int _loadRefBlock(union Block *mem, int id, bool is_alloc);
+static int _allocRefBlock(union Block *mem, int idx);
+
+int getBlockRefs(union Block *mem, int id)
+{
+    lockDiskBlock(BITMAP_ID, false);
+    int ref_id = __atomic_load_n(
+        &mem[BITMAP_ID].bitmap_block.ref_ids[id / BLOCK_SIZE],
+        __ATOMIC_ACQUIRE);
+    int refs = 0;
+    if (ref_id != 0) {
+        lockDiskBlock(ref_id, false);
+        refs = __atomic_load_n(&mem[ref_id].refs[id % BLOCK_SIZE],
+                               __ATOMIC_RELAXED);
+        unlockDiskBlock(ref_id);
+    }
+    unlockDiskBlock(BITMAP_ID);
+    return refs;
+}
+
+bool addBlockRef(union Block *mem, int id)
+{
+    int ref_id = _loadRefBlock(mem, id, true);
+    if (ref_id == -1)
+        return false;
+    uint8_t *ref = &mem[ref_id].refs[id % BLOCK_SIZE];
+    uint8_t refs = __atomic_load_n(ref, __ATOMIC_RELAXED);
+    do {
+        if (refs == REF_MAX) {
+            errno = EMLINK;
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(ref, &refs, refs + 1, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    markBlockDirty(ref_id);
+    return true;
+}
+
+bool dropBlockRef(union Block *mem, int id)
+{
+    int ref_id = _loadRefBlock(mem, id, false);
+    if (ref_id == 0)
+        return false;
+    uint8_t *ref = &mem[ref_id].refs[id % BLOCK_SIZE];
+    uint8_t refs = __atomic_load_n(ref, __ATOMIC_RELAXED);
+    do {
+        if (refs == 0)
+            return false;
+    } while (!__atomic_compare_exchange_n(ref, &refs, refs - 1, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    markBlockDirty(ref_id);
+    return true;
+}
+
+int countBlockRefs(union Block *mem, int *shared_count, int *ref_count)
+{
+    *shared_count = 0;
+    *ref_count = 0;
+    int block_count = 0;
+    lockDiskBlock(BITMAP_ID, false);
+    for (int i = 0; i < REF_BLOCK_COUNT; i++) {
+        int ref_id = __atomic_load_n(&mem[BITMAP_ID].bitmap_block.ref_ids[i],
+                                     __ATOMIC_ACQUIRE);
+        if (ref_id == 0)
+            continue;
+        block_count++;
+        lockDiskBlock(ref_id, false);
+        for (int j = 0; j < BLOCK_SIZE; j++) {
+            int refs = __atomic_load_n(&mem[ref_id].refs[j], __ATOMIC_RELAXED);
+            if (refs > 0)
+                (*shared_count)++;
+            *ref_count += refs;
+        }
+        unlockDiskBlock(ref_id);
+    }
+    unlockDiskBlock(BITMAP_ID);
+    return block_count;
+}
+
+/**
+ * @brief
+ *  Write-locks the block holding the reference count of a block, along with
+ *  the bitmap block listing it.
+ *
+ * @param[in, out] mem       Memory block representing the file system.
+ * @param[in]      id        ID of the block.
+ * @param[in]      is_alloc  Whether to allocate the block of counts if the
+ *                           disk has none for the block yet.
+ *
+ * @return
+ *   ID of the block of counts, 0 if there is none, or -1 if it could not be
+ *   allocated (sets errno).
+ */
+static int _loadRefBlock(union Block *mem, int id, bool is_alloc)
+{
+    lockDiskBlock(BITMAP_ID, true);
+    int idx = id / BLOCK_SIZE;
+    int ref_id = __atomic_load_n(&mem[BITMAP_ID].bitmap_block.ref_ids[idx],
+                                 __ATOMIC_ACQUIRE);
+    if (ref_id == 0 && is_alloc)
+        ref_id = _allocRefBlock(mem, idx);
+    if (ref_id > 0)
+        lockDiskBlock(ref_id, true);
+    return ref_id;
+}
+
+/**
+ * @brief
+ *  Allocates a zeroed block of reference counts and lists it in the bitmap
+ *  block, unless another thread did first.
+ *
+ * @param[in, out] mem  Memory block representing the file system, with the
+ *                      bitmap block write-locked.
+ * @param[in]      idx  Index of the block of counts in the list.
+ *
+ * @return
+ *   ID of the block of counts, or -1 if the disk is full (sets errno).
+ */
+static int _allocRefBlock(union Block *mem, int idx)
+{
+    int *ref_ids = mem[BITMAP_ID].bitmap_block.ref_ids;
+    pthread_mutex_lock(&alloc_lock);
+    int ref_id = __atomic_load_n(&ref_ids[idx], __ATOMIC_ACQUIRE);
+    if (ref_id == 0) {
+        ref_id = allocBlock(mem, RESERVED_BLOCK_COUNT);
+        if (ref_id != -1) {
+            lockDiskBlock(ref_id, true);
+            memset(mem[ref_id].refs, 0, BLOCK_SIZE);
+            markBlockDirty(ref_id);
+            __atomic_store_n(&ref_ids[idx], ref_id, __ATOMIC_RELEASE);
+            markBlockDirty(BITMAP_ID);
+        }
+    }
+    pthread_mutex_unlock(&alloc_lock);
+    return ref_id;
+}
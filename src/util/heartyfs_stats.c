@@ -0,0 +1,424 @@
+/**
+ * @file heartyfs_stats.c
+ * @author Sarutch Supaibulpipat (Pokpong) {ssupaibu@cmkl.ac.th}
+ * @brief
+ *  The module implementing the counters and timers of `--stats` and `--live`.
+ *
+ *  A thread gets its block of counters the first time it counts anything,
+ *  and the block is linked into a list that outlives the thread, so the
+ *  counts of the workers of a pool are still there once it is stopped.
+ *
+ *  A live process takes the blocks from its shared memory segment, and each
+ *  thread stores its counts with relaxed atomic stores so that a watcher never
+ *  reads half a count. Trace records are claimed with one atomic add on the
+ *  head of the ring and guarded by a sequence number, so writers never wait on
+ *  each other or on a watcher, and a watcher retries nothing but skips the
+ *  records it caught half written.
+ *
+ * @version 0.1
+ * @date 2024-11-11
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "heartyfs_stats.h"
+
+#define LIVE_STATS_MAGIC 0x48465354
+#define LIVE_STATS_DIR "/dev/shm"
+#define LIVE_STATS_PREFIX "heartyfs."
+#define LIVE_NAME_LEN 32
+
+const char STAT_COUNTER_LIST[STAT_COUNTER_COUNT][24] = {
+    [STAT_BITMAP_SCANS] = "bitmap_scans",
+    [STAT_BITMAP_BYTES] = "bitmap_bytes",
+    [STAT_BLOCKS_ALLOCATED] = "blocks_allocated",
+    [STAT_BLOCKS_FREED] = "blocks_freed",
+    [STAT_INODES_LOCKED] = "inodes_locked",
+    [STAT_PATH_LOOKUPS] = "path_lookups",
+    [STAT_PATH_COMPONENTS] = "path_components",
+    [STAT_BYTES_READ] = "bytes_read",
+    [STAT_BYTES_WRITTEN] = "bytes_written"};
+
+bool is_stats_enabled = false;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ThreadStats *stats_list = NULL;
+static const char *cmd_names[STATS_MAX_CMDS];
+static _Thread_local struct ThreadStats *thread_stats = NULL;
+static struct LiveStats *live_stats = NULL;
+static char live_name[LIVE_NAME_LEN];
+
+static struct ThreadStats *_getThreadStats();
+static void _addThreadStats(struct ThreadStats *total,
+                            const struct ThreadStats *stats);
+static long _countBlocks(const struct ThreadStats *stats);
+static void _traceCmd(int idx, const char *path, long end_ns, long ns,
+                      int block_count, bool is_ok);
+static void _unlinkLiveStats();
+static bool _isProcessAlive(int pid);
+
+void enableStats() { is_stats_enabled = true; }
+
+bool publishStats()
+{
+    snprintf(live_name, sizeof(live_name), "/" LIVE_STATS_PREFIX "%d",
+             (int)getpid());
+    int fd = shm_open(live_name, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, sizeof(struct LiveStats)) != 0) {
+        int err = errno;
+        close(fd);
+        shm_unlink(live_name);
+        errno = err;
+        return false;
+    }
+    struct LiveStats *live = mmap(NULL, sizeof(struct LiveStats),
+                                  PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (live == MAP_FAILED) {
+        int err = errno;
+        shm_unlink(live_name);
+        errno = err;
+        return false;
+    }
+    live->pid = getpid();
+    live->start_ns = getStatTime();
+    for (int i = 0; i < STATS_MAX_CMDS; i++)
+        if (cmd_names[i] != NULL)
+            snprintf(live->cmd_names[i], STATS_NAME_LEN, "%s", cmd_names[i]);
+    __atomic_store_n(&live->magic, LIVE_STATS_MAGIC, __ATOMIC_RELEASE);
+    live_stats = live;
+    atexit(_unlinkLiveStats);
+    enableStats();
+    return true;
+}
+
+void addStat(enum StatCounters counter, long n)
+{
+    struct ThreadStats *stats = _getThreadStats();
+    if (stats != NULL)
+        __atomic_store_n(&stats->counters[counter],
+                         stats->counters[counter] + n, __ATOMIC_RELAXED);
+}
+
+long getStatTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+void nameCmdStat(int idx, const char *name)
+{
+    if (idx >= STATS_MAX_CMDS)
+        return;
+    cmd_names[idx] = name;
+    if (live_stats != NULL)
+        snprintf(live_stats->cmd_names[idx], STATS_NAME_LEN, "%s", name);
+}
+
+long startCmdStat()
+{
+    struct ThreadStats *stats = _getThreadStats();
+    if (stats != NULL)
+        stats->cmd_blocks = _countBlocks(stats);
+    return getStatTime();
+}
+
+void addCmdStat(int idx, const char *path, long start_ns, bool is_ok)
+{
+    long end_ns = getStatTime();
+    long ns = end_ns - start_ns;
+    struct ThreadStats *stats = _getThreadStats();
+    if (stats == NULL || idx >= STATS_MAX_CMDS)
+        return;
+    struct CmdStats *cmd = &stats->cmds[idx];
+    __atomic_store_n(&cmd->count, cmd->count + 1, __ATOMIC_RELAXED);
+    if (!is_ok)
+        __atomic_store_n(&cmd->fail_count, cmd->fail_count + 1,
+                         __ATOMIC_RELAXED);
+    __atomic_store_n(&cmd->total_ns, cmd->total_ns + ns, __ATOMIC_RELAXED);
+    if (ns > cmd->max_ns)
+        __atomic_store_n(&cmd->max_ns, ns, __ATOMIC_RELAXED);
+    if (live_stats != NULL)
+        _traceCmd(idx, path, end_ns, ns,
+                  (int)(_countBlocks(stats) - stats->cmd_blocks), is_ok);
+}
+
+void printStats(bool is_json)
+{
+    struct ThreadStats total = {0};
+    pthread_mutex_lock(&stats_lock);
+    for (struct ThreadStats *stats = stats_list; stats != NULL;
+         stats = stats->next)
+        _addThreadStats(&total, stats);
+    pthread_mutex_unlock(&stats_lock);
+
+    if (is_json) {
+        fprintf(stderr, "{\"commands\": {");
+        bool is_first = true;
+        for (int i = 0; i < STATS_MAX_CMDS; i++) {
+            struct CmdStats *cmd = &total.cmds[i];
+            if (cmd->count == 0)
+                continue;
+            fprintf(stderr,
+                    "%s\"%s\": {\"count\": %ld, \"failed\": %ld, "
+                    "\"total_ns\": %ld, \"max_ns\": %ld}",
+                    is_first ? "" : ", ", cmd_names[i], cmd->count,
+                    cmd->fail_count, cmd->total_ns, cmd->max_ns);
+            is_first = false;
+        }
+        fprintf(stderr, "}, \"counters\": {");
+        for (int i = 0; i < STAT_COUNTER_COUNT; i++)
+            fprintf(stderr, "%s\"%s\": %ld", (i == 0) ? "" : ", ",
+                    STAT_COUNTER_LIST[i], total.counters[i]);
+        fprintf(stderr, "}}\n");
+        return;
+    }
+
+    fprintf(stderr, "\n---Stats---\n");
+    fprintf(stderr, "%-12s %8s %8s %12s %12s %12s\n", "command", "count",
+            "failed", "total us", "mean us", "max us");
+    for (int i = 0; i < STATS_MAX_CMDS; i++) {
+        struct CmdStats *cmd = &total.cmds[i];
+        if (cmd->count == 0)
+            continue;
+        fprintf(stderr, "%-12s %8ld %8ld %12.1f %12.1f %12.1f\n",
+                cmd_names[i], cmd->count, cmd->fail_count,
+                cmd->total_ns / 1e3, cmd->total_ns / 1e3 / cmd->count,
+                cmd->max_ns / 1e3);
+    }
+    for (int i = 0; i < STAT_COUNTER_COUNT; i++)
+        fprintf(stderr, "%-20s %12ld\n", STAT_COUNTER_LIST[i],
+                total.counters[i]);
+}
+
+int findLiveProcess()
+{
+    DIR *dir = opendir(LIVE_STATS_DIR);
+    if (dir == NULL)
+        return -1;
+    int latest_pid = -1;
+    long latest_ns = 0;
+    size_t prefix_len = strlen(LIVE_STATS_PREFIX);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, LIVE_STATS_PREFIX, prefix_len) != 0)
+            continue;
+        char *end;
+        long pid = strtol(entry->d_name + prefix_len, &end, 10);
+        if (*end != '\0' || pid <= 0 || !_isProcessAlive((int)pid))
+            continue;
+        const struct LiveStats *live = attachStats((int)pid);
+        if (live == NULL)
+            continue;
+        if (latest_pid == -1 || live->start_ns > latest_ns) {
+            latest_pid = (int)pid;
+            latest_ns = live->start_ns;
+        }
+        detachStats(live);
+    }
+    closedir(dir);
+    return latest_pid;
+}
+
+const struct LiveStats *attachStats(int pid)
+{
+    char name[LIVE_NAME_LEN];
+    snprintf(name, sizeof(name), "/" LIVE_STATS_PREFIX "%d", pid);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size != sizeof(struct LiveStats)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    const struct LiveStats *live =
+        mmap(NULL, sizeof(struct LiveStats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (live == MAP_FAILED)
+        return NULL;
+    // Not set up yet, or left by another program.
+    if (__atomic_load_n(&live->magic, __ATOMIC_ACQUIRE) != LIVE_STATS_MAGIC) {
+        detachStats(live);
+        errno = EAGAIN;
+        return NULL;
+    }
+    return live;
+}
+
+void detachStats(const struct LiveStats *live)
+{
+    munmap((void *)live, sizeof(struct LiveStats));
+}
+
+void sumLiveStats(const struct LiveStats *live, struct ThreadStats *total)
+{
+    *total = (struct ThreadStats){0};
+    int count = __atomic_load_n(&live->thread_count, __ATOMIC_RELAXED);
+    if (count > LIVE_MAX_THREADS)
+        count = LIVE_MAX_THREADS;
+    for (int i = 0; i < count; i++)
+        _addThreadStats(total, &live->threads[i]);
+}
+
+bool readTraceRecord(const struct LiveStats *live, unsigned long idx,
+                     struct TraceRecord *rec)
+{
+    const struct TraceRecord *slot = &live->trace[idx % TRACE_RING_LEN];
+    unsigned long seq = 2 * (idx + 1);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq)
+        return false;
+    memcpy(rec, slot, sizeof(struct TraceRecord));
+    // A writer that started meanwhile has moved the sequence number on.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+        return false;
+    rec->path[TRACE_PATH_LEN - 1] = '\0';
+    return true;
+}
+
+/**
+ * @brief
+ *  Finds the block of counters of the calling thread, creating it the first
+ *  time.
+ *
+ * @note
+ *  A live process hands out the blocks of its segment, and falls back to the
+ *  heap for threads past `LIVE_MAX_THREADS`, which are then only printed.
+ *
+ * @return
+ *   The block of counters, or NULL if it cannot be allocated.
+ */
+static struct ThreadStats *_getThreadStats()
+{
+    if (thread_stats != NULL)
+        return thread_stats;
+    struct ThreadStats *stats = NULL;
+    if (live_stats != NULL) {
+        int idx = __atomic_fetch_add(&live_stats->thread_count, 1,
+                                     __ATOMIC_RELAXED);
+        if (idx < LIVE_MAX_THREADS)
+            stats = &live_stats->threads[idx];
+    }
+    if (stats == NULL)
+        stats = calloc(1, sizeof(struct ThreadStats));
+    if (stats == NULL)
+        return NULL;
+    pthread_mutex_lock(&stats_lock);
+    stats->next = stats_list;
+    stats_list = stats;
+    pthread_mutex_unlock(&stats_lock);
+    thread_stats = stats;
+    return stats;
+}
+
+/**
+ * @brief
+ *  Adds the counts of a thread to a total.
+ *
+ * @param[in, out] total  The total.
+ * @param[in]      stats  The counts of the thread, maybe still counting.
+ */
+static void _addThreadStats(struct ThreadStats *total,
+                            const struct ThreadStats *stats)
+{
+    for (int i = 0; i < STAT_COUNTER_COUNT; i++)
+        total->counters[i] +=
+            __atomic_load_n(&stats->counters[i], __ATOMIC_RELAXED);
+    for (int i = 0; i < STATS_MAX_CMDS; i++) {
+        const struct CmdStats *cmd = &stats->cmds[i];
+        struct CmdStats *sum = &total->cmds[i];
+        sum->count += __atomic_load_n(&cmd->count, __ATOMIC_RELAXED);
+        sum->fail_count += __atomic_load_n(&cmd->fail_count, __ATOMIC_RELAXED);
+        sum->total_ns += __atomic_load_n(&cmd->total_ns, __ATOMIC_RELAXED);
+        long max_ns = __atomic_load_n(&cmd->max_ns, __ATOMIC_RELAXED);
+        if (max_ns > sum->max_ns)
+            sum->max_ns = max_ns;
+    }
+}
+
+/**
+ * @brief
+ *  Counts the blocks a thread has touched so far.
+ *
+ * @param[in] stats  The counts of the thread.
+ *
+ * @return
+ *   The inodes locked and the blocks allocated or freed.
+ */
+static long _countBlocks(const struct ThreadStats *stats)
+{
+    return stats->counters[STAT_INODES_LOCKED] +
+           stats->counters[STAT_BLOCKS_ALLOCATED] +
+           stats->counters[STAT_BLOCKS_FREED];
+}
+
+/**
+ * @brief
+ *  Appends a trace record of a command to the ring of the live process,
+ *  overwriting the oldest one.
+ *
+ * @param[in] idx          Index of the command.
+ * @param[in] path         Path the command ran on, or NULL.
+ * @param[in] end_ns       Time the command ended.
+ * @param[in] ns           Time the command took.
+ * @param[in] block_count  Blocks the command touched.
+ * @param[in] is_ok        Whether the command succeeded.
+ */
+static void _traceCmd(int idx, const char *path, long end_ns, long ns,
+                      int block_count, bool is_ok)
+{
+    unsigned long head =
+        __atomic_fetch_add(&live_stats->trace_head, 1, __ATOMIC_RELAXED);
+    struct TraceRecord *rec = &live_stats->trace[head % TRACE_RING_LEN];
+    // The record is dropped rather than waited for if the writer of the lap
+    // before is still on the slot.
+    unsigned long prev_seq =
+        (head < TRACE_RING_LEN) ? 0 : 2 * (head - TRACE_RING_LEN + 1);
+    if (!__atomic_compare_exchange_n(&rec->seq, &prev_seq, 2 * head + 1,
+                                     false, __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED))
+        return;
+    rec->end_ns = end_ns;
+    rec->duration_ns = ns;
+    rec->cmd_idx = idx;
+    rec->block_count = block_count;
+    rec->is_ok = is_ok;
+    snprintf(rec->path, TRACE_PATH_LEN, "%s", (path == NULL) ? "" : path);
+    __atomic_store_n(&rec->seq, 2 * (head + 1), __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief
+ *  Removes the shared memory segment of the process at exit. Watchers keep
+ *  their mapping until they detach.
+ */
+static void _unlinkLiveStats() { shm_unlink(live_name); }
+
+/**
+ * @brief
+ *  Checks whether a process is still running.
+ *
+ * @param[in] pid  The ID of the process.
+ *
+ * @return
+ *   true if the process exists, false otherwise.
+ */
+static bool _isProcessAlive(int pid)
+{
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
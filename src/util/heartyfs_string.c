@@ -7,9 +7,12 @@
  * @version 0.1
  * @date 2024-11-11
  */
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "heartyfs_string.h"
 #include "heartyfs_math.h"
@@ -108,4 +111,17 @@ char parseOpt(char **start_arg, int len, int *idx)
         (*idx)++;
     }
     return opt;
+}
+
+bool parseSize(const char *str, int *size)
+{
+    char *end;
+    errno = 0;
+    long val = strtol(str, &end, 10);
+    if (errno != 0 || end == str || *end != '\0' || val < 0 || val > INT_MAX) {
+        errno = EINVAL;
+        return false;
+    }
+    *size = (int)val;
+    return true;
 }
\ No newline at end of file
@@ -16,13 +16,27 @@
 
 #include "heartyfs.h"
 #include "heartyfs_bitmap.h"
+#include "heartyfs_chunk.h"
+#include "heartyfs_disk.h"
 #include "heartyfs_helper_structs.h"
+#include "heartyfs_lock.h"
 #include "heartyfs_math.h"
+#include "heartyfs_refs.h"
+#include "heartyfs_stats.h"
 #include "heartyfs_string.h"
 
+static int _lockPath(union Block *mem, char path[], int start_id,
+                     bool is_write);
+static int _lockChild(union Block *mem, int dir_id, char *name, bool is_write);
+static void _lockInode(int id, bool is_write);
+static bool _appendChunks(union Block *mem, int id, void *data, int size);
+static int _readChunks(union Block *mem, int id, uint8_t *buf, int size,
+                       struct FilePos *pos);
 static int _compareInt(const void *n1, const void *n2);
 static void _printBin(uint8_t byte);
 
+static bool is_muted = false;
+
 void printBitmap(uint8_t *bitmap)
 {
     const int col_n = 10;
@@ -47,69 +61,36 @@ void printBitmap(uint8_t *bitmap)
 
 int getNodeID(union Block *mem, char path[], int start_id)
 {
-    if (start_id == GETNODEID_USE_CWD) {
-        start_id = getCWD();
-        if (start_id == -1) {
-            return -1;
-        }
-    }
-
-    int id;
-    char *buf = malloc(strlen(path) + 1);
-    if (buf == NULL) {
-        perror(__func__);
-        return -1;
-    }
-    if (path[0] == '/') {
-        strcpy(buf, path + 1);
-        id = 0;
-    } else {
-        strcpy(buf, path);
-        id = start_id;
-    }
-    char *ptr = buf;
-    char *substr = NULL;
-    while (splitStr(&substr, '/', &ptr)) {
-        if (mem[id].dir.type != TYPE_DIR)
-            break;
-
-        struct DirNode *dir = &mem[id].dir;
-        int idx = findStr(substr, dir->entries, dir->len,
-                          sizeof(struct DirEntry), isDirEntryMatch);
-        if (idx != -1) {
-            id = mem[id].dir.entries[idx].block_id;
-        } else {
-            errno = ENOENT;
-            perror(path);
-            id = -1;
-            break;
-        }
-    }
-    free(buf);
+    int id = _lockPath(mem, path, start_id, false);
+    if (id != -1)
+        unlockInode(id);
     return id;
 }
 
-int getParentID(union Block *mem, char path[])
+int lockParentID(union Block *mem, char path[], bool is_write)
 {
     int dir_len = strlen(path) + 1;
     char *dir = malloc(dir_len);
     if (dir == NULL) {
-        perror(__func__);
+        reportError(__func__);
         return -1;
     }
 
     parseDir(path, dir, dir_len);
-    int id = getNodeID(mem, dir, GETNODEID_USE_CWD);
-    if (id == -1) {
-    } else if (mem[id].dir.type != TYPE_DIR) {
+    int id = _lockPath(mem, dir, GETNODEID_USE_CWD, is_write);
+    if (id != -1 && mem[id].dir.type != TYPE_DIR) {
+        unlockInode(id);
         errno = ENOTDIR;
-        perror(dir);
-    } else {
-        free(dir);
-        return id;
+        reportError(dir);
+        id = -1;
     }
     free(dir);
-    return -1;
+    return id;
+}
+
+int lockNodeID(union Block *mem, char path[], bool is_write)
+{
+    return _lockPath(mem, path, GETNODEID_USE_CWD, is_write);
 }
 
 bool setCWD(int cwd_id)
@@ -119,7 +100,7 @@ bool setCWD(int cwd_id)
     char buf[STR_MAX_LEN];
     sprintf(buf, "%d", cwd_id);
     if (write(fd, buf, strlen(buf)) == -1) {
-        perror(CWD_STORE_PATH);
+        reportError(CWD_STORE_PATH);
         is_set = false;
     }
     close(fd);
@@ -131,9 +112,11 @@ int getCWD()
     int cwd_id = -1;
     int fd = open(CWD_STORE_PATH, O_RDONLY);
     char buf[STR_MAX_LEN];
-    if (read(fd, buf, STR_MAX_LEN) == -1) {
-        perror(CWD_STORE_PATH);
+    ssize_t len = read(fd, buf, STR_MAX_LEN - 1);
+    if (len == -1) {
+        reportError(CWD_STORE_PATH);
     } else {
+        buf[len] = '\0';
         sscanf(buf, "%d", &cwd_id);
     }
     close(fd);
@@ -152,14 +135,17 @@ void initDirEntry(union Block *mem, char *name, int id, int parent_id)
     strncpy(parent_dir->entries[parent_dir->len].name, name, NAME_MAX_LEN);
     parent_dir->entries[parent_dir->len].block_id = id;
     parent_dir->len++;
+    markBlockDirty(parent_id);
 }
 
 void deleteParentDirEntry(struct DirNode *parent_dir, int id)
 {
-    int idx_to_delete;
+    int idx_to_delete = -1;
     for (int i = 0; i < parent_dir->len; i++)
         if (parent_dir->entries[i].block_id == id)
             idx_to_delete = i;
+    if (idx_to_delete == -1)
+        return;
 
     int i = idx_to_delete;
     for (; i < parent_dir->len - 1; i++)
@@ -171,6 +157,13 @@ void deleteParentDirEntry(struct DirNode *parent_dir, int id)
 
 int calcFileSize(union Block *mem, int id)
 {
+    struct FileNode *file = &mem[id].file;
+    if (file->flags & FILE_COMPRESSED) {
+        int size = 0;
+        for (int i = 0; i < file->len; i++)
+            size += getChunkSize(&mem[file->blocks[i]].data);
+        return size;
+    }
     if (mem[id].file.len == 0) {
         return 0;
     } else {
@@ -180,67 +173,317 @@ int calcFileSize(union Block *mem, int id)
     }
 }
 
+int countFileExtents(union Block *mem, int id)
+{
+    struct FileNode *file = &mem[id].file;
+    int count = minInt(file->len + file->prealloc, FILE_MAX_BLOCKS);
+    int extent_count = (count > 0) ? 1 : 0;
+    for (int i = 1; i < count; i++)
+        if (file->blocks[i] != file->blocks[i - 1] + 1)
+            extent_count++;
+    return extent_count;
+}
+
 void deleteFileData(union Block *mem, int id)
 {
     struct FileNode *file = &mem[id].file;
-    if (file->len == 0)
+    freeBlockIDs(mem, file->blocks, file->len + file->prealloc);
+    file->len = 0;
+    file->prealloc = 0;
+    markBlockDirty(id);
+}
+
+void freeBlockIDs(union Block *mem, const int *ids, int count)
+{
+    if (count <= 0)
         return;
 
-    int blocks[FILE_MAX_BLOCKS];
-    memcpy(blocks, file->blocks, file->len * sizeof(int));
-    qsort(blocks, file->len, sizeof(int), _compareInt);
+    // Shared blocks only lose a reference.
+    int blocks[BLOCK_COUNT];
+    int free_count = 0;
+    for (int i = 0; i < count; i++)
+        if (!dropBlockRef(mem, ids[i]))
+            blocks[free_count++] = ids[i];
+    if (free_count == 0)
+        return;
+    count = free_count;
+    qsort(blocks, count, sizeof(int), _compareInt);
 
     struct Interval free_bounds = {.start = blocks[0], .end = blocks[0] + 1};
-    for (int i = 1; i < file->len; i++) {
+    for (int i = 1; i < count; i++) {
         if (blocks[i - 1] + 1 != blocks[i]) {
-            setBitmapFree(mem[BITMAP_ID].bitmap, &free_bounds);
+            freeBlocks(mem, &free_bounds);
             free_bounds.start = blocks[i];
             free_bounds.end = blocks[i];
         }
         free_bounds.end++;
     }
-    setBitmapFree(mem[BITMAP_ID].bitmap, &free_bounds);
+    freeBlocks(mem, &free_bounds);
+}
+
+bool unshareFileBlocks(union Block *mem, int id, int start, int end)
+{
+    struct FileNode *file = &mem[id].file;
+    for (int i = start; i < end; i++) {
+        int block_id = file->blocks[i];
+        if (getBlockRefs(mem, block_id) == 0)
+            continue;
+        int new_id = allocBlock(mem, block_id);
+        if (new_id == -1)
+            return false;
+        // The other files may have let go of the block in the meantime.
+        if (!dropBlockRef(mem, block_id)) {
+            freeBlockIDs(mem, &new_id, 1);
+            continue;
+        }
+        mem[new_id].data = mem[block_id].data;
+        markDataDirty(new_id);
+        file->blocks[i] = new_id;
+        markBlockDirty(id);
+    }
+    return true;
+}
+
+bool reserveFileBlocks(union Block *mem, int id, int count)
+{
+    struct FileNode *file = &mem[id].file;
+    int owned = file->len + file->prealloc;
+    if (count <= 0)
+        return true;
+    if (owned + count > FILE_MAX_BLOCKS) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    struct Interval curr_bounds = intArrInterval(file->blocks, owned);
+    struct Interval block_bounds = {0};
+    if (!findFreeDensestBlocks(mem[BITMAP_ID].bitmap, count, &curr_bounds,
+                               &block_bounds)) {
+        return false;
+    }
+
+    // Only the free blocks taken are marked used, the rest of the span may
+    // belong to other files or stay free. Blocks of the span taken by other
+    // threads in the meantime are skipped.
+    int curr_block = block_bounds.start;
+    for (int i = 0; i < count; i++) {
+        curr_block = allocBlock(mem, curr_block);
+        if (curr_block == -1) {
+            freeBlockIDs(mem, file->blocks + owned, i);
+            return false;
+        }
+        file->blocks[owned + i] = curr_block++;
+    }
+    file->prealloc += count;
+    markBlockDirty(id);
+    return true;
+}
+
+bool writeFileID(union Block *mem, int id, void *data, int size)
+{
+    struct FileNode *file = &mem[id].file;
+    if (file->flags & FILE_COMPRESSED)
+        return _appendChunks(mem, id, data, size);
+
+    int file_size = calcFileSize(mem, id);
+    int new_len = ceilDivInt(file_size + size, BLOCK_MAX_DATA);
+    if (!reserveFileBlocks(mem, id, new_len - file->len - file->prealloc))
+        return false;
+
+    uint8_t *data_ptr = data;
+    if (file_size > 0) {
+        int last_block = file->blocks[file->len - 1];
+        struct DataBlock *d_block = &mem[last_block].data;
+        int size_wrote = writeDataBlock(d_block, d_block->size, data_ptr, size);
+        if (size_wrote > 0)
+            markDataDirty(last_block);
+
+        size -= size_wrote;
+        if (data_ptr != NULL)
+            data_ptr += size_wrote;
+    }
+    for (int i = file->len; size > 0; i++) {
+        int size_wrote =
+            writeDataBlock(&mem[file->blocks[i]].data, 0, data_ptr, size);
+        markDataDirty(file->blocks[i]);
+
+        size -= size_wrote;
+        if (data_ptr != NULL)
+            data_ptr += size_wrote;
+    }
+    if (new_len > file->len) {
+        file->prealloc -= new_len - file->len;
+        file->len = new_len;
+        markBlockDirty(id);
+    }
+    return true;
+}
+
+bool writeFileChunks(union Block *mem, int id, int chunk_idx, const void *data,
+                     int size)
+{
+    struct FileNode *file = &mem[id].file;
+    int max_count = FILE_MAX_BLOCKS - chunk_idx;
+    struct DataBlock *chunks = malloc(max_count * sizeof(struct DataBlock));
+    if (chunks == NULL && max_count > 0)
+        return false;
+
+    const uint8_t *data_ptr = data;
+    int count = 0;
+    while (size > 0) {
+        if (count == max_count) {
+            free(chunks);
+            errno = ENOMEM;
+            return false;
+        }
+        int chunk_size = encodeChunk(&chunks[count++], data_ptr, size);
+        size -= chunk_size;
+        if (data_ptr != NULL)
+            data_ptr += chunk_size;
+    }
+    int new_len = chunk_idx + count;
+    if (!unshareFileBlocks(mem, id, chunk_idx, file->len) ||
+        !reserveFileBlocks(mem, id, new_len - file->len - file->prealloc)) {
+        free(chunks);
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int block_id = file->blocks[chunk_idx + i];
+        mem[block_id].data = chunks[i];
+        markDataDirty(block_id);
+    }
+    free(chunks);
+    file->prealloc = file->len + file->prealloc - new_len;
+    file->len = new_len;
+    markBlockDirty(id);
+    return true;
+}
+
+bool setFileCompressed(union Block *mem, int id, bool is_compressed)
+{
+    struct FileNode *file = &mem[id].file;
+    if (((file->flags & FILE_COMPRESSED) != 0) == is_compressed)
+        return true;
+    int size = calcFileSize(mem, id);
+    uint8_t *data = malloc(size);
+    if (data == NULL && size > 0)
+        return false;
+    int offset = 0;
+    readFileID(mem, id, data, size, &offset);
+
+    struct FileNode old_file = *file;
     file->len = 0;
+    file->prealloc = 0;
+    file->flags ^= FILE_COMPRESSED;
+    bool is_ok = writeFileID(mem, id, data, size);
+    free(data);
+    if (!is_ok) {
+        int err = errno;
+        freeBlockIDs(mem, file->blocks, file->len + file->prealloc);
+        *file = old_file;
+        errno = err;
+        return false;
+    }
+    freeBlockIDs(mem, old_file.blocks, old_file.len + old_file.prealloc);
+    markBlockDirty(id);
+    return true;
 }
 
 int writeDataBlock(struct DataBlock *d_block, int size_used, void *data,
                    int size)
 {
     int write_size = minInt(size, BLOCK_MAX_DATA - size_used);
-    memcpy(d_block->data + size_used, data, write_size);
+    if (data == NULL)
+        memset(d_block->data + size_used, 0, write_size);
+    else
+        memcpy(d_block->data + size_used, data, write_size);
     d_block->size = size_used + write_size;
+    countStat(STAT_BYTES_WRITTEN, write_size);
     return write_size;
 }
 
 int readFileID(union Block *mem, int id, void *buf, int size, int *offset)
+{
+    struct FilePos pos;
+    setFilePos(&pos, *offset);
+    int total_read = readFilePos(mem, id, buf, size, &pos);
+    *offset = pos.offset;
+    return total_read;
+}
+
+void setFilePos(struct FilePos *pos, int offset)
+{
+    pos->offset = offset;
+    pos->block_idx = -1;
+    pos->block_offset = 0;
+}
+
+void seekFilePos(union Block *mem, int id, struct FilePos *pos)
+{
+    struct FileNode *file = &mem[id].file;
+    if (!(file->flags & FILE_COMPRESSED)) {
+        pos->block_idx = pos->offset / BLOCK_MAX_DATA;
+        pos->block_offset = pos->offset % BLOCK_MAX_DATA;
+        return;
+    }
+    // The end of the file is held at the end of the last chunk, which stays
+    // valid when more data is appended to the chunk.
+    int start = 0;
+    int i = 0;
+    for (; i < file->len; i++) {
+        int chunk_size = getChunkSize(&mem[file->blocks[i]].data);
+        if (pos->offset < start + chunk_size || i == file->len - 1)
+            break;
+        start += chunk_size;
+    }
+    pos->block_idx = i;
+    pos->block_offset = pos->offset - start;
+}
+
+int readFilePos(union Block *mem, int id, void *buf, int size,
+                struct FilePos *pos)
 {
     struct FileNode *file = &mem[id].file;
+    if (pos->block_idx == -1)
+        seekFilePos(mem, id, pos);
+    if (file->flags & FILE_COMPRESSED)
+        return _readChunks(mem, id, buf, size, pos);
+
     uint8_t *buf_ptr = buf;
     int total_read = 0;
-    for (int i = *offset / BLOCK_MAX_DATA; i < file->len && size > 0; i++) {
-        struct DataBlock *data_block = &mem[file->blocks[i]].data;
-        int block_offset = *offset % BLOCK_MAX_DATA;
-
-        uint8_t *block_ptr = data_block->data + block_offset;
-        int size_read = minInt(size, data_block->size - block_offset);
-        memcpy(buf_ptr, block_ptr, size_read);
+    while (pos->block_idx < file->len && size > 0) {
+        struct DataBlock *data_block = &mem[file->blocks[pos->block_idx]].data;
+        int size_read = minInt(size, data_block->size - pos->block_offset);
+        if (size_read <= 0)
+            break;
+        memcpy(buf_ptr, data_block->data + pos->block_offset, size_read);
 
         total_read += size_read;
-        *offset += size_read;
+        pos->offset += size_read;
+        pos->block_offset += size_read;
         buf_ptr += size_read;
         size -= size_read;
+        // Only the last block is partly filled, so the position stays in it
+        // until the file grows.
+        if (pos->block_offset == BLOCK_MAX_DATA) {
+            pos->block_idx++;
+            pos->block_offset = 0;
+        }
     }
+    countStat(STAT_BYTES_READ, total_read);
     return total_read;
 }
 
 bool readFilePath(union Block *mem, char *path, char **buf, int *size)
 {
-    int id = getNodeID(mem, path, GETNODEID_USE_CWD);
+    int id = lockNodeID(mem, path, false);
     if (id == -1) {
         return false;
     } else if (mem[id].file.type != TYPE_FILE) {
+        unlockInode(id);
         errno = EISDIR;
-        perror(path);
+        reportError(path);
         return false;
     }
 
@@ -248,9 +491,144 @@ bool readFilePath(union Block *mem, char *path, char **buf, int *size)
     *buf = malloc(*size);
     int offset = 0;
     readFileID(mem, id, *buf, *size, &offset);
+    unlockInode(id);
     return true;
 }
 
+int initFileNode(union Block *mem, char *name, int parent_id, int start_id)
+{
+    int id = allocBlock(mem, start_id);
+    if (id == -1)
+        return -1;
+    initDirEntry(mem, name, id, parent_id);
+
+    mem[id].file = (struct FileNode){0};
+    strncpy(mem[id].file.name, name, NAME_MAX_LEN);
+    mem[id].file.type = TYPE_FILE;
+    markBlockDirty(id);
+    return id;
+}
+
+int initDirNode(union Block *mem, char *name, int parent_id)
+{
+    int id = allocBlock(mem, ROOT_ID);
+    if (id == -1)
+        return -1;
+    initDirEntry(mem, name, id, parent_id);
+
+    mem[id].dir = (struct DirNode){0};
+    strncpy(mem[id].dir.name, name, NAME_MAX_LEN);
+    mem[id].dir.type = TYPE_DIR;
+    initDirEntry(mem, ".", id, id);
+    initDirEntry(mem, "..", parent_id, id);
+    return id;
+}
+
+void deleteFileNode(union Block *mem, int id, int parent_id)
+{
+    deleteParentDirEntry(&mem[parent_id].dir, id);
+    markBlockDirty(parent_id);
+    deleteFileData(mem, id);
+    freeBlocks(mem, &(struct Interval){id, id + 1});
+}
+
+void reportError(const char *what)
+{
+    // perror() may change errno, which callers still return or report.
+    int err = errno;
+    if (!is_muted)
+        perror(what);
+    errno = err;
+}
+
+void muteErrors() { is_muted = true; }
+
+/**
+ * @brief
+ *  Appends data to the end of a compressed file. The last chunk is encoded
+ *  again along with the data, unless it is full.
+ *
+ * @param[in, out] mem   Memory block representing the file system.
+ * @param[in]      id    ID of the file to write to.
+ * @param[in]      data  Data to append, or NULL to append zeroes.
+ * @param[in]      size  Size of the data to append.
+ *
+ * @return
+ *   true if successful, false otherwise (sets errno).
+ */
+static bool _appendChunks(union Block *mem, int id, void *data, int size)
+{
+    struct FileNode *file = &mem[id].file;
+    struct DataBlock *last_block = NULL;
+    int last_size = 0;
+    if (file->len > 0) {
+        last_block = &mem[file->blocks[file->len - 1]].data;
+        last_size = getChunkSize(last_block);
+    }
+    if (last_block == NULL || last_size == CHUNK_MAX_SIZE ||
+        last_block->size == BLOCK_MAX_DATA)
+        return writeFileChunks(mem, id, file->len, data, size);
+
+    uint8_t *buf = malloc(last_size + size);
+    if (buf == NULL)
+        return false;
+    decodeChunk(last_block, buf, last_size);
+    if (data == NULL)
+        memset(buf + last_size, 0, size);
+    else
+        memcpy(buf + last_size, data, size);
+    bool is_ok = writeFileChunks(mem, id, file->len - 1, buf, last_size + size);
+    free(buf);
+    return is_ok;
+}
+
+/**
+ * @brief
+ *  Reads data from a compressed file into a buffer, decoding the chunks from
+ *  a position.
+ *
+ * @param[in]      mem   Memory block representing the file system.
+ * @param[in]      id    ID of the file to read.
+ * @param[out]     buf   Buffer to store the read data.
+ * @param[in]      size  Size of the buffer.
+ * @param[in, out] pos   Position to start reading from, looked up, and moved
+ *                       past the data read.
+ *
+ * @return
+ *   Number of bytes read.
+ */
+static int _readChunks(union Block *mem, int id, uint8_t *buf, int size,
+                       struct FilePos *pos)
+{
+    struct FileNode *file = &mem[id].file;
+    uint8_t chunk[CHUNK_MAX_SIZE];
+    int total_read = 0;
+    while (pos->block_idx < file->len && size > 0) {
+        struct DataBlock *d_block = &mem[file->blocks[pos->block_idx]].data;
+        int chunk_size = getChunkSize(d_block);
+        int size_read = minInt(size, chunk_size - pos->block_offset);
+        if (size_read > 0) {
+            // Only the part of the chunk up to the data read is decoded.
+            int end = pos->block_offset + size_read;
+            if (decodeChunk(d_block, chunk, end) != end)
+                break;
+            memcpy(buf + total_read, chunk + pos->block_offset, size_read);
+            total_read += size_read;
+            pos->offset += size_read;
+            pos->block_offset += size_read;
+            size -= size_read;
+        }
+        // The position stays at the end of the last chunk until it grows.
+        if (pos->block_offset < chunk_size ||
+            pos->block_idx == file->len - 1)
+            break;
+        pos->block_idx++;
+        pos->block_offset = 0;
+    }
+    countStat(STAT_BYTES_READ, total_read);
+    return total_read;
+}
+
 /**
  * @brief 
  *  Prints the binary representation of a byte.
@@ -278,4 +656,125 @@ static void _printBin(uint8_t byte)
 static int _compareInt(const void *n1, const void *n2)
 {
     return (*(int *)n1) - (*(int *)n2);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief
+ *  Walks a path hand over hand, keeping each directory locked until the next
+ *  node on the path is, so that none of them can be removed and its block
+ *  reused in between.
+ *
+ * @param[in] mem       Memory block representing the file system.
+ * @param[in] path      Path to the node.
+ * @param[in] start_id  Starting ID; use GETNODEID_USE_CWD to start from the
+ *                      current directory.
+ * @param[in] is_write  Whether to lock the node for writing. The directories
+ *                      on the way are locked for reading.
+ *
+ * @return
+ *   ID of the node, locked, or -1 if it does not exist (sets errno).
+ */
+static int _lockPath(union Block *mem, char path[], int start_id,
+                     bool is_write)
+{
+    // The current directory is only read for relative paths.
+    if (start_id == GETNODEID_USE_CWD && path[0] != '/') {
+        start_id = getCWD();
+        if (start_id == -1)
+            return -1;
+    }
+
+    char *buf = malloc(strlen(path) + 1);
+    if (buf == NULL) {
+        reportError(__func__);
+        return -1;
+    }
+    strcpy(buf, (path[0] == '/') ? path + 1 : path);
+    int id = (path[0] == '/') ? 0 : start_id;
+    char *ptr = buf;
+    char *name = NULL;
+    countStat(STAT_PATH_LOOKUPS, 1);
+    bool has_next = splitStr(&name, '/', &ptr);
+    _lockInode(id, is_write && !has_next);
+    while (has_next) {
+        countStat(STAT_PATH_COMPONENTS, 1);
+        char *next_name = NULL;
+        has_next = splitStr(&next_name, '/', &ptr);
+        id = _lockChild(mem, id, name, is_write && !has_next);
+        if (id == -1) {
+            reportError(path);
+            break;
+        }
+        name = next_name;
+    }
+    free(buf);
+    return id;
+}
+
+/**
+ * @brief
+ *  Takes one step of a path, from a locked directory to the node it holds
+ *  under a name, and unlocks the directory once the node is locked.
+ *
+ * @note
+ *  The parent of a directory cannot be locked after it, so a `..` step
+ *  unlocks the directory first, then checks that the parent still holds it.
+ *
+ * @param[in] mem       Memory block representing the file system.
+ * @param[in] dir_id    ID of the directory, locked. It is unlocked before
+ *                      returning.
+ * @param[in] name      Name of the node.
+ * @param[in] is_write  Whether to lock the node for writing.
+ *
+ * @return
+ *   ID of the node, locked, or -1 if it does not exist (sets errno).
+ */
+static int _lockChild(union Block *mem, int dir_id, char *name, bool is_write)
+{
+    struct DirNode *dir = &mem[dir_id].dir;
+    int idx = -1;
+    if (dir->type != TYPE_DIR)
+        errno = ENOTDIR;
+    else if ((idx = findStr(name, dir->entries, dir->len,
+                            sizeof(struct DirEntry), isDirEntryMatch)) == -1)
+        errno = ENOENT;
+    if (idx == -1) {
+        unlockInode(dir_id);
+        return -1;
+    }
+
+    int id = dir->entries[idx].block_id;
+    if (idx > PARENT_DIR_ENTRY_IDX) {
+        _lockInode(id, is_write);
+        unlockInode(dir_id);
+        return id;
+    }
+    unlockInode(dir_id);
+    _lockInode(id, is_write);
+    if (id == dir_id)
+        return id;
+    struct DirNode *parent = &mem[id].dir;
+    for (int i = PARENT_DIR_ENTRY_IDX + 1;
+         parent->type == TYPE_DIR && i < parent->len; i++) {
+        if (parent->entries[i].block_id == dir_id)
+            return id;
+    }
+    unlockInode(id);
+    errno = ENOENT;
+    return -1;
+}
+
+/**
+ * @brief
+ *  Locks an inode for reading or writing.
+ *
+ * @param[in] id        ID of the inode.
+ * @param[in] is_write  Whether to lock it for writing.
+ */
+static void _lockInode(int id, bool is_write)
+{
+    if (is_write)
+        lockInodeWrite(id);
+    else
+        lockInodeRead(id);
+}